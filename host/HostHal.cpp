@@ -0,0 +1,157 @@
+#include "HostHal.h"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+bool HostStore::erase() {
+	memset(image, 0, sizeof(image));
+	return true;
+}
+
+bool HostStore::readData(size_t addr, uint8_t *data, size_t len) {
+	if (addr > SIZE || len > SIZE - addr) return false;
+	memcpy(data, &image[addr], len);
+	return true;
+}
+
+bool HostStore::writeData(size_t addr, const uint8_t *data, size_t len) {
+	if (addr > SIZE || len > SIZE - addr) return false;
+	memcpy(&image[addr], data, len);
+	writes++;
+	writtenBytes += len;
+	return true;
+}
+
+static const size_t blockSize = 32;								// PUBLISH_QUEUE_BLOCK_SIZE
+
+HostCloud::HostCloud(HostClock &clock, size_t queueBytes) : clock(clock), queueBytes(queueBytes) {
+	blocks = (queueBytes - 48) / (blockSize + 2);					// Less the PublishQueueRingHeader, and a link for each block
+}
+
+size_t HostCloud::usedBlocks() const {
+	size_t used = 0;
+	for (int lane = PRIORITY_LOW; lane <= PRIORITY_URGENT; lane++) {
+		if (laneBytes[lane]) used += (laneOffset[lane] + laneBytes[lane] + blockSize - 1) / blockSize;
+	}
+	return used;
+}
+
+bool HostCloud::connected() {
+	if (!networkUp || !modemOn) {
+		session = false;
+		sessionWaiting = false;
+		connectStart = clock.getElapsed();							// A new session takes connectDelay from when there is a network
+	}
+	else if (!session && clock.getElapsed() - connectStart >= connectDelay) {
+		if (gateSessions && !sessionAdmitted) {						// The cloud hasn't got round to this handshake yet
+			sessionWaiting = true;
+			return false;
+		}
+		sessionWaiting = false;
+		sessionAdmitted = false;
+		session = true;
+		connects++;
+		clock.synchronize();										// The cloud sends the time with every new session
+	}
+	return session;
+}
+
+void HostCloud::connect() {
+	if (modemOn) return;
+	modemOn = true;
+	connectStart = clock.getElapsed();
+	connectAttempts++;
+}
+
+void HostCloud::waitConnected(uint32_t timeout) {
+	uint64_t start = clock.getElapsed();
+	while (!HostCloud::connected() && clock.getElapsed() - start < timeout) clock.advance(100);
+}
+
+void HostCloud::disconnect() {
+	modemOn = false;
+	session = false;
+	sessionWaiting = false;
+}
+
+bool HostCloud::publish(const char *name, const char *data, Priority priority) {
+	Event event;
+	event.name = name;
+	event.data = data;
+	event.size = (8 + event.name.size() + event.data.size() + 2 + 3) & ~(size_t)3;	// PublishQueueEventData, both strings and the padding
+	event.priority = priority;
+	if ((event.size + blockSize - 1) / blockSize > blocks) return false;
+	while (true) {
+		size_t fill = (laneBytes[priority]) ? (laneOffset[priority] + laneBytes[priority] - 1) % blockSize + 1 : blockSize;
+		size_t need = (event.size > blockSize - fill) ? (event.size - (blockSize - fill) + blockSize - 1) / blockSize : 0;
+		if (usedBlocks() + need <= blocks) break;
+		auto victim = events.end();									// The oldest of the lowest priority, up to the new event's own
+		for (int lane = PRIORITY_LOW; lane <= priority && victim == events.end(); lane++) {
+			victim = std::find_if(events.begin(), events.end(), [lane](const Event &e) { return e.priority == lane; });
+		}
+		dropped++;
+		if (victim == events.end()) return false;
+		remove(victim);
+	}
+	laneBytes[priority] += event.size;
+	events.push_back(event);
+	return true;
+}
+
+void HostCloud::loop() {
+	if (events.empty() || paused || !HostCloud::connected() || clock.getElapsed() - lastPublish < 1010) return;
+	lastPublish = clock.getElapsed();
+	auto next = std::max_element(events.begin(), events.end(), [](const Event &a, const Event &b) { return a.priority < b.priority; });
+	Event event = *next;											// The first of the highest priority
+	next = remove(next);
+	if (std::find(coalesced.begin(), coalesced.end(), event.name) != coalesced.end()) {
+		while (true) {												// The next ones of the same priority
+			next = std::find_if(next, events.end(), [&event](const Event &e) { return e.priority == event.priority; });
+			if (next == events.end() || next->name != event.name || event.data.size() + 1 + next->data.size() > 622) break;
+			event.data += "\n" + next->data;
+			next = remove(next);
+		}
+	}
+	sent += event.name.size() + event.data.size();
+	published++;
+	if (onPublish) onPublish(event.name.c_str(), event.data.c_str(), context);
+}
+
+std::deque<HostCloud::Event>::iterator HostCloud::remove(std::deque<Event>::iterator event) {
+	// It was the oldest of its priority, so the next starts where it ended
+	Priority lane = event->priority;
+	laneBytes[lane] -= event->size;
+	laneOffset[lane] = (laneBytes[lane]) ? (laneOffset[lane] + event->size) % blockSize : 0;
+	return events.erase(event);
+}
+
+void HostCloud::signal(float &strength, float &dBm) {
+	strength = signalStrength;
+	dBm = signalDBm;
+}
+
+void HostCloud::simId(char *iccid, size_t size) {
+	if (size) snprintf(iccid, size, "%s", this->iccid);
+}
+
+void HostSystem::heapInfo(uint32_t &freeHeap, uint32_t &largestBlock) {
+	freeHeap = 80000;												// The host heap tells us nothing about the device's - these never move
+	largestBlock = 60000;
+}
+
+void HostSystem::writeConsole(const char *prefix, const char *text) {
+	printf("%s%s\n", prefix, text);
+}
+
+size_t HostSystem::consoleRead(uint8_t *buf, size_t len) {
+	if (consoleFd < 0) return 0;
+	ssize_t got = read(consoleFd, buf, len);
+	return (got > 0) ? (size_t)got : 0;
+}
+
+size_t HostSystem::consoleWrite(const uint8_t *buf, size_t len) {
+	if (consoleFd < 0) return 0;
+	ssize_t sent = write(consoleFd, buf, len);
+	return (sent > 0) ? (size_t)sent : 0;
+}
@@ -0,0 +1,234 @@
+#ifndef __HOSTHAL_H
+#define __HOSTHAL_H
+
+#include "Hal.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The interfaces in Hal.h on a Linux host
+ *
+ * Nothing here waits on the wall clock - time only moves when the caller advances the HostClock, so a
+ * run is the same every time and goes as fast as the CPU allows. The caller plays the part of the
+ * hardware and the cloud by setting the public members between loop passes.
+ */
+
+/**
+ * @brief A virtual clock - millis() and now() only move when advance() or delay() is called
+ *
+ * millis() starts at bootMillis, as Device OS has been running for a while by the time setup() is
+ * called - the firmware takes a millis() of 0 to mean "not set". The time of day can drift like the
+ * RTC does until the cloud sets it again.
+ */
+class HostClock : public HalClock {
+public:
+	/**
+	 * @brief Construct the clock
+	 *
+	 * @param startTime Unix time at boot
+	 *
+	 * @param valid False for a device that has lost the time - isValid() is false until synchronize()
+	 */
+	HostClock(uint32_t startTime, bool valid = true) : startTime(startTime), valid(valid) {};
+
+	virtual uint32_t millis() { return (uint32_t)(elapsed - bootAt); };
+	virtual uint32_t now() { return trueTime() + getError(); };
+	virtual bool isValid() { return valid; };
+	virtual void delay(uint32_t ms) { advance(ms); };
+	virtual void begin() {};
+	virtual void loop() {};
+
+	void advance(uint32_t ms) { elapsed += ms; };
+	void synchronize() { valid = true; syncedAt = elapsed; };		//!< As the cloud does once connected
+	void reboot() { bootAt = elapsed - bootMillis; };				//!< millis() starts again - the time of day carries on, as the RTC keeps it
+	uint64_t getElapsed() const { return elapsed; };				//!< Since the clock was made, through reboots and without the wrap
+	uint32_t trueTime() const { return startTime + (uint32_t)((elapsed - bootMillis) / 1000); };
+	int32_t getError() const { return (int32_t)((double)(elapsed - syncedAt) * driftPpm / 1e9); };	//!< now() less trueTime() (sec)
+
+	static const uint32_t bootMillis = 500;
+	double driftPpm = 0;											//!< How fast the time of day runs - a few ppm for the MCP79410's crystal
+
+protected:
+	uint32_t startTime;
+	uint64_t elapsed = bootMillis;
+	uint64_t bootAt = 0;
+	uint64_t syncedAt = bootMillis;
+	bool valid;
+};
+
+/**
+ * @brief Readings the caller sets
+ */
+class HostSensor : public HalSensor {
+public:
+	virtual bool begin() { return present; };
+	virtual float readTemperature() { return temperature; };
+	virtual float readHumidity() { return humidity; };
+	virtual float batteryCharge() { return charge; };
+	virtual int batteryState() { return state; };
+
+	bool present = true;
+	float temperature = 5.0;
+	float humidity = 50.0;
+	float charge = 90.0;
+	int state = 4;													//!< Discharging
+};
+
+/**
+ * @brief The FRAM as a RAM image - starts as zeros, as the FRAM is after erase()
+ */
+class HostStore : public HalStore {
+public:
+	static const size_t SIZE = 8192;								//!< MB85RC64
+
+	virtual void begin() {};
+	virtual size_t length() { return SIZE; };
+	virtual bool erase();
+	virtual bool readData(size_t addr, uint8_t *data, size_t len);
+	virtual bool writeData(size_t addr, const uint8_t *data, size_t len);
+
+	uint8_t image[SIZE] = {0};
+	uint32_t writes = 0;											//!< writeData() calls
+	uint32_t writtenBytes = 0;
+};
+
+/**
+ * @brief A cloud session that comes up after a delay, and a publish queue that behaves like PublishQueueAsync
+ *
+ * Events take the same blocks as in the retained buffer and, as in PublishQueueRing, the oldest of the
+ * lowest priority is dropped when a new one doesn't fit, but never one of a higher priority than the
+ * new one. While connected and not paused, loop() sends the oldest event of the highest priority every
+ * 1010 ms and hands it to onPublish, with the events after it merged in as
+ * PublishQueueAsync::withCoalescing() does for the names given to withCoalescing().
+ * With gateSessions set, a session only comes up once the caller admits it - for a cloud that can
+ * only take so many handshakes at a time.
+ */
+class HostCloud : public HalCloud {
+public:
+	/**
+	 * @brief Construct the cloud
+	 *
+	 * @param clock For the connect delay and the publish rate
+	 *
+	 * @param queueBytes Size of the retained buffer the queue stands for
+	 */
+	HostCloud(HostClock &clock, size_t queueBytes = 2048);
+
+	virtual bool connected();
+	virtual bool registered() { return networkUp && modemOn; };
+	virtual void connect();
+	virtual void waitConnected(uint32_t timeout);
+	virtual void disconnect();
+	virtual void keepAlive(int seconds) { keepAliveSeconds = seconds; };
+	virtual void syncTime() { if (HostCloud::connected()) clock.synchronize(); };
+
+	virtual bool publish(const char *name, const char *data, Priority priority = PRIORITY_NORMAL);
+	virtual uint16_t queuedEvents() { return (uint16_t)events.size(); };
+	virtual uint32_t sentBytes() { return sent; };
+	virtual void pausePublishing(bool pause) { paused = pause; };
+	virtual size_t publishStackHeadroom() { return publishHeadroom; };
+
+	virtual void signal(float &strength, float &dBm);
+	virtual void simId(char *iccid, size_t size);
+
+	/**
+	 * @brief Send the next event if it is time to - call every loop pass
+	 */
+	void loop();
+
+	/**
+	 * @brief Events of this name waiting together go out as one, their data a line each
+	 */
+	void withCoalescing(const char *name) { coalesced.push_back(name); };
+
+	bool isModemOn() const { return modemOn; };
+	bool inSession() const { return session; };					//!< As connected() last found it
+
+	// What the network is doing - set by the caller
+	bool networkUp = true;											//!< A session can be had
+	uint32_t connectDelay = 5000;									//!< From connect() to connected (ms)
+	bool gateSessions = false;										//!< Wait for sessionAdmitted after connectDelay
+	bool sessionAdmitted = false;									//!< Set by the caller to let a waiting session come up
+	bool sessionWaiting = false;									//!< Ready for a handshake the caller hasn't admitted yet
+	float signalStrength = 60.0;									//!< %
+	float signalDBm = -90.0;
+	char iccid[21] = "89000000000000000000";
+	size_t publishHeadroom = 1024;									//!< The host's threads say nothing about the device's - what a device might report
+
+	/**
+	 * @brief Called with each event as it is sent
+	 */
+	void (*onPublish)(const char *name, const char *data, void *context) = nullptr;
+	void *context = nullptr;
+
+	// What happened - for the caller to report
+	uint32_t published = 0;
+	uint32_t dropped = 0;											//!< Discarded to make room, or turned away for want of it
+	uint32_t connects = 0;											//!< Sessions started
+	uint32_t connectAttempts = 0;									//!< Times the modem was turned on
+	int keepAliveSeconds = 0;
+
+protected:
+	struct Event {
+		std::string name;
+		std::string data;
+		size_t size;												//!< Room it takes in the retained buffer
+		Priority priority;
+	};
+
+	HostClock &clock;
+	size_t queueBytes;
+	std::deque<Event> events;
+	std::vector<std::string> coalesced;
+	size_t blocks;													//!< In the pool PublishQueueRing makes of the buffer
+	size_t laneBytes[PRIORITY_URGENT + 1] = {};						//!< Queued, for each priority
+	size_t laneOffset[PRIORITY_URGENT + 1] = {};					//!< Of the oldest event of each priority in its first block
+
+	size_t usedBlocks() const;
+	std::deque<Event>::iterator remove(std::deque<Event>::iterator event);	//!< The oldest event of its priority
+	uint32_t sent = 0;
+	uint64_t lastPublish = 0;
+	uint64_t connectStart = 0;
+	bool modemOn = false;
+	bool session = false;
+	bool paused = false;
+};
+
+/**
+ * @brief Pins that hold what was written to them
+ */
+class HostGpio : public HalGpio {
+public:
+	virtual void pinMode(Pin pin, bool output) {};
+	virtual void digitalWrite(Pin pin, bool high) { levels[pin] = high; };
+	virtual bool digitalRead(Pin pin) { return levels[pin]; };
+	virtual void attachWakeInterrupt() { wakeAttached = true; };
+
+	bool levels[3] = {false, false, false};
+	bool wakeAttached = false;										//!< The caller can call FacilityMonitor::watchdogInterrupt() from now on
+};
+
+/**
+ * @brief Resets are noted for the caller, and the console goes to stdout
+ */
+class HostSystem : public HalSystem {
+public:
+	virtual int resetReason() { return reason; };
+	virtual void reset() { resetRequested = true; };
+	virtual void heapInfo(uint32_t &freeHeap, uint32_t &largestBlock);
+	virtual size_t loopStackHeadroom() { return loopHeadroom; };
+	virtual bool consoleAvailable() { return console; };
+	virtual void writeConsole(const char *prefix, const char *text);
+	virtual size_t consoleRead(uint8_t *buf, size_t len);
+	virtual size_t consoleWrite(const uint8_t *buf, size_t len);
+
+	int reason = 40;												//!< RESET_REASON_POWER_DOWN - a first boot
+	bool resetRequested = false;									//!< The firmware called reset() - the caller decides what that means
+	bool console = true;
+	int consoleFd = -1;												//!< Non-blocking - the USB serial port for the bulk dump, -1 for none
+	size_t loopHeadroom = 2048;										//!< As HostCloud::publishHeadroom
+};
+
+#endif /* __HOSTHAL_H */
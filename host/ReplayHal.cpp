@@ -0,0 +1,78 @@
+#include "ReplayHal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+const InputLogReader::Record *ReplayLog::next() {
+	recordOffset = reader.getOffset();
+	return (reader.next(record)) ? &record : NULL;
+}
+
+const InputLogReader::Record &ReplayLog::expect(uint8_t type, uint8_t kind) {
+	bool timeless = (type == InputLog::MILLIS || type == InputLog::TIME);
+	while (true) {
+		if (!next()) finished("the log ends part way through a pass");
+		if (record.type == InputLog::MARK && (record.kind == InputLog::MARK_END || record.kind == InputLog::MARK_OVERFLOW)) {
+			finished((record.kind == InputLog::MARK_END) ? "recording was stopped" : "the device's ring overflowed");
+		}
+		if (record.type == InputLog::TEXT && (record.kind == InputLog::TEXT_FUNCTION || record.kind == InputLog::TEXT_WEBHOOK) &&
+			!(type == InputLog::TEXT && kind == record.kind) && onCall) {
+			onCall(record, context);
+			continue;
+		}
+		if (record.type != type || (!timeless && record.kind != kind)) {
+			char wanted[48];
+			snprintf(wanted, sizeof(wanted), "%s %s", InputLog::typeName(type), (timeless) ? "" : InputLog::kindName(type, kind));
+			diverged(wanted);
+		}
+		return record;
+	}
+}
+
+void ReplayLog::diverged(const char *wanted) {
+	fflush(stdout);
+	fprintf(stderr, "Diverged at byte %zu, in loop pass %u: the firmware read %s but the device read %s %s\n", recordOffset, passes, wanted,
+		InputLog::typeName(record.type), (record.type == InputLog::MILLIS || record.type == InputLog::TIME) ? "" : InputLog::kindName(record.type, record.kind));
+	exit(2);
+}
+
+void ReplayLog::finished(const char *why) {
+	printf("\nReplayed %u loop passes and %u calls - %s at byte %zu\n", passes, calls, why, recordOffset);
+	exit(0);
+}
+
+bool ReplayCloud::publish(const char *name, const char *data, Priority priority) {
+	printf("publish %-30s %s\n", name, data);
+	return true;
+}
+
+void ReplayCloud::signal(float &strength, float &dBm) {
+	strength = log.expect(InputLog::REAL, InputLog::REAL_SIGNAL_STRENGTH).real;
+	dBm = log.expect(InputLog::REAL, InputLog::REAL_SIGNAL_DBM).real;
+}
+
+void ReplayCloud::simId(char *iccid, size_t size) {
+	const InputLogReader::Record &record = log.expect(InputLog::TEXT, InputLog::TEXT_ICCID);
+	if (size) snprintf(iccid, size, "%.*s", (int)record.textLen, record.text);
+}
+
+void ReplaySystem::reset() {
+	log.finished("the firmware reset the device");
+}
+
+void ReplaySystem::heapInfo(uint32_t &freeHeap, uint32_t &largestBlock) {
+	freeHeap = (uint32_t)log.expect(InputLog::NUMBER, InputLog::NUMBER_FREE_HEAP).number;
+	largestBlock = (uint32_t)log.expect(InputLog::NUMBER, InputLog::NUMBER_LARGEST_BLOCK).number;
+}
+
+void ReplaySystem::writeConsole(const char *prefix, const char *text) {
+	printf("%s%s\n", prefix, text);
+}
+
+bool ReplaySystem::stallRecovered(bool recovered, uint32_t &duration, uint8_t &state, uint8_t &operation) {
+	duration = (uint32_t)log.expect(InputLog::NUMBER, InputLog::NUMBER_STALL).number;
+	if (!duration) return false;
+	state = (uint8_t)log.expect(InputLog::NUMBER, InputLog::NUMBER_STALL_STATE).number;
+	operation = (uint8_t)log.expect(InputLog::NUMBER, InputLog::NUMBER_STALL_OPERATION).number;
+	return true;
+}
@@ -0,0 +1,147 @@
+#ifndef __REPLAYHAL_H
+#define __REPLAYHAL_H
+
+#include "Hal.h"
+#include "HostHal.h"
+#include "InputLog.h"
+
+/**
+ * @brief The interfaces in Hal.h played back from a log recorded by the Input-Record function
+ *
+ * Each call takes the next record from the log, which has to be the input the device read at the
+ * same point - the firmware is the same code, so it asks for the same inputs in the same order until
+ * something differs. When it does, the replay has diverged: the offset of the record and what was
+ * asked for are printed and the process exits with 2. Nothing the firmware does is checked against
+ * the log - it only holds inputs - but publishes are printed so a run can be compared with the device's.
+ *
+ * The FRAM and the pins are not inputs - the replay uses HostStore, loaded from the log's header, and HostGpio.
+ */
+
+/**
+ * @brief The log, shared by all of the Replay interfaces
+ */
+class ReplayLog {
+public:
+	ReplayLog(const uint8_t *data, size_t len) : reader(data, len) {};
+
+	/**
+	 * @brief The next record, whatever it is
+	 *
+	 * @return NULL at the end of the log, or where it is cut short
+	 */
+	const InputLogReader::Record *next();
+
+	/**
+	 * @brief The next input, which has to be this type and kind
+	 *
+	 * A cloud function call or a webhook response can come in while the firmware waits - Device OS runs
+	 * them during delay() and waitFor() - so those are handed to onCall and skipped. The end of the log,
+	 * an END or an OVERFLOW mark ends the replay with finished().
+	 */
+	const InputLogReader::Record &expect(uint8_t type, uint8_t kind = 0);
+
+	/**
+	 * @brief Report a divergence at the record just read and exit with 2
+	 */
+	[[noreturn]] void diverged(const char *wanted);
+
+	/**
+	 * @brief Print how far the replay got and exit with 0
+	 */
+	[[noreturn]] void finished(const char *why);
+
+	/**
+	 * @brief Called with a TEXT_FUNCTION or TEXT_WEBHOOK record - it makes the call, reading the
+	 * TEXT_ARGUMENT that follows a TEXT_FUNCTION with expect()
+	 */
+	void (*onCall)(const InputLogReader::Record &record, void *context) = nullptr;
+	void *context = nullptr;
+
+	InputLogReader reader;
+	unsigned passes = 0;											//!< Loop passes started - for finished()
+	unsigned calls = 0;												//!< Function calls and webhook responses made
+
+protected:
+	InputLogReader::Record record;
+	size_t recordOffset = 0;										//!< Where the record just read starts
+};
+
+class ReplayClock : public HalClock {
+public:
+	ReplayClock(ReplayLog &log) : log(log) {};
+
+	virtual uint32_t millis() { return log.expect(InputLog::MILLIS).value; };
+	virtual uint32_t now() { return log.expect(InputLog::TIME).value; };
+	virtual bool isValid() { return log.expect(InputLog::FLAG, InputLog::FLAG_TIME_VALID).value; };
+	virtual void delay(uint32_t ms) {};
+	virtual void begin() {};
+	virtual void loop() {};
+
+protected:
+	ReplayLog &log;
+};
+
+class ReplaySensor : public HalSensor {
+public:
+	ReplaySensor(ReplayLog &log) : log(log) {};
+
+	virtual bool begin() { return log.expect(InputLog::FLAG, InputLog::FLAG_SENSOR_BEGIN).value; };
+	virtual float readTemperature() { return log.expect(InputLog::REAL, InputLog::REAL_TEMPERATURE).real; };
+	virtual float readHumidity() { return log.expect(InputLog::REAL, InputLog::REAL_HUMIDITY).real; };
+	virtual float batteryCharge() { return log.expect(InputLog::REAL, InputLog::REAL_BATTERY).real; };
+	virtual int batteryState() { return log.expect(InputLog::NUMBER, InputLog::NUMBER_BATTERY_STATE).number; };
+
+protected:
+	ReplayLog &log;
+};
+
+/**
+ * @brief The cloud - publishes are printed, everything the device read back comes from the log
+ */
+class ReplayCloud : public HalCloud {
+public:
+	ReplayCloud(ReplayLog &log) : log(log) {};
+
+	virtual bool connected() { return log.expect(InputLog::FLAG, InputLog::FLAG_CONNECTED).value; };
+	virtual bool registered() { return log.expect(InputLog::FLAG, InputLog::FLAG_REGISTERED).value; };
+	virtual void connect() {};
+	virtual void waitConnected(uint32_t timeout) {};
+	virtual void disconnect() {};
+	virtual void keepAlive(int seconds) {};
+	virtual void syncTime() {};
+
+	virtual bool publish(const char *name, const char *data, Priority priority = PRIORITY_NORMAL);
+	virtual uint16_t queuedEvents() { return (uint16_t)log.expect(InputLog::NUMBER, InputLog::NUMBER_QUEUED).number; };
+	virtual uint32_t sentBytes() { return (uint32_t)log.expect(InputLog::NUMBER, InputLog::NUMBER_SENT_BYTES).number; };
+	virtual void pausePublishing(bool pause) {};
+	virtual size_t publishStackHeadroom() { return log.expect(InputLog::NUMBER, InputLog::NUMBER_PUBLISH_HEADROOM).number; };
+
+	virtual void signal(float &strength, float &dBm);
+	virtual void simId(char *iccid, size_t size);
+
+protected:
+	ReplayLog &log;
+};
+
+/**
+ * @brief The console is printed and a reset ends the replay, the rest comes from the log
+ */
+class ReplaySystem : public HalSystem {
+public:
+	ReplaySystem(ReplayLog &log) : log(log) {};
+
+	virtual int resetReason() { return log.expect(InputLog::NUMBER, InputLog::NUMBER_RESET_REASON).number; };
+	virtual void reset();
+	virtual void heapInfo(uint32_t &freeHeap, uint32_t &largestBlock);
+	virtual size_t loopStackHeadroom() { return log.expect(InputLog::NUMBER, InputLog::NUMBER_LOOP_HEADROOM).number; };
+	virtual bool consoleAvailable() { return false; };				//!< The device's serial port was carrying the log
+	virtual void writeConsole(const char *prefix, const char *text);
+
+	virtual bool watchdogRequested(bool requested) { return log.expect(InputLog::FLAG, InputLog::FLAG_WATCHDOG).value; };
+	virtual bool stallRecovered(bool recovered, uint32_t &duration, uint8_t &state, uint8_t &operation);
+
+protected:
+	ReplayLog &log;
+};
+
+#endif /* __REPLAYHAL_H */
@@ -0,0 +1,177 @@
+#include "Scenario.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool parseTime(const std::string &text, uint64_t &ms) {	// 2d6h, 90m, 45s or plain seconds
+	const char *p = text.c_str();
+	ms = 0;
+	if (!*p) return false;
+	while (*p) {
+		char *end;
+		double value = strtod(p, &end);
+		if (end == p || value < 0) return false;
+		p = end;
+		double unit = 1000;
+		if (!strncmp(p, "ms", 2)) { unit = 1; p += 2; }
+		else if (*p == 'd') { unit = 86400000; p++; }
+		else if (*p == 'h') { unit = 3600000; p++; }
+		else if (*p == 'm') { unit = 60000; p++; }
+		else if (*p == 's') p++;
+		else if (*p) return false;
+		ms += (uint64_t)llround(value * unit);
+	}
+	return true;
+}
+
+static bool parseNumber(const std::string &text, double &value) {
+	char *end;
+	value = strtod(text.c_str(), &end);
+	return !text.empty() && !*end;
+}
+
+static std::vector<std::string> split(const char *line) {		// Whitespace separated, "quoted" for a function name with spaces
+	std::vector<std::string> tokens;
+	const char *p = line;
+	while (*p) {
+		while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+		if (!*p || *p == '#') break;
+		std::string token;
+		if (*p == '"') {
+			for (p++; *p && *p != '"'; p++) token += *p;
+			if (*p) p++;
+		}
+		else {
+			for (; *p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n'; p++) token += *p;
+		}
+		tokens.push_back(token);
+	}
+	return tokens;
+}
+
+bool Scenario::load(const char *path) {
+	FILE *fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		return false;
+	}
+	char line[256];
+	int lineNumber = 0;
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), fp)) {
+		lineNumber++;
+		std::vector<std::string> t = split(line);
+		if (t.empty()) continue;
+		const std::string &what = t[0];
+		uint64_t at = 0, length = 0, every = 0;
+		double a = 0, b = 0;
+		if (what == "duration" && t.size() == 2) ok = parseTime(t[1], duration) && duration > 0;
+		else if (what == "step" && t.size() == 2) {
+			ok = parseNumber(t[1], a) && a >= 1 && a <= 1000;			// IDLE_STATE reports on a whole second - a pass has to land in each one
+			if (ok) step = (uint32_t)a;
+		}
+		else if (what == "temperature" && t.size() == 3) ok = parseTime(t[1], at) && parseNumber(t[2], a) && (temperature.push_back({at, 0, (float)a}), true);
+		else if (what == "ramp" && t.size() == 4) ok = parseTime(t[1], at) && parseTime(t[2], length) && parseNumber(t[3], a) && (temperature.push_back({at, length, (float)a}), true);
+		else if (what == "daily" && t.size() == 2) {
+			ok = parseNumber(t[1], a);
+			if (ok) dailyAmplitude = (float)a;
+		}
+		else if (what == "humidity" && t.size() == 3) ok = parseTime(t[1], at) && parseNumber(t[2], a) && (humidity.push_back({at, 0, (float)a}), true);
+		else if (what == "outage" && (t.size() == 3 || (t.size() == 5 && t[3] == "every"))) {
+			ok = parseTime(t[1], at) && parseTime(t[2], length) && (t.size() == 3 || (parseTime(t[4], every) && every > length));
+			if (ok) outages.push_back({at, length, every});
+		}
+		else if (what == "signal" && t.size() == 4) ok = parseTime(t[1], at) && parseNumber(t[2], a) && parseNumber(t[3], b) && (signals.push_back({at, (float)a, (float)b}), true);
+		else if (what == "call" && (t.size() == 3 || t.size() == 4)) ok = parseTime(t[1], at) && (calls.push_back({at, t[2], (t.size() == 4) ? t[3] : ""}), true);
+		else if (what == "drift" && t.size() == 2) ok = parseNumber(t[1], driftPpm);
+		else if (what == "current" && t.size() == 3 && parseNumber(t[2], a)) {
+			if (t[1] == "idle") idlemA = (float)a;
+			else if (t[1] == "connecting") connectingmA = (float)a;
+			else if (t[1] == "connected") connectedmA = (float)a;
+			else if (t[1] == "transmit") transmitmA = (float)a;
+			else ok = false;
+		}
+		else if (what == "overhead" && t.size() == 3 && parseNumber(t[2], a) && a >= 0) {
+			if (t[1] == "publish") publishOverhead = (uint32_t)a;
+			else if (t[1] == "keepalive") keepAliveBytes = (uint32_t)a;
+			else if (t[1] == "session") sessionBytes = (uint32_t)a;
+			else ok = false;
+		}
+		else if (what == "battery" && (t.size() == 2 || t.size() == 3)) {
+			ok = parseNumber(t[1], a) && a > 0 && (t.size() == 2 || parseNumber(t[2], b));
+			if (ok) batterymAh = (float)a;
+			onBattery = ok;
+			if (ok && t.size() == 3) batteryStart = (float)b;
+		}
+		else if (what == "devices" && t.size() == 2) {
+			ok = parseNumber(t[1], a) && a >= 1 && a <= 1000000;
+			if (ok) devices = (uint32_t)a;
+		}
+		else if (what == "stagger" && t.size() == 2) ok = parseTime(t[1], stagger);
+		else if (what == "backend" && (t.size() == 3 || t.size() == 4)) {
+			ok = parseNumber(t[1], a) && a >= 1 && parseNumber(t[2], b) && b >= 0;
+			if (ok) {
+				backendRate = (uint32_t)a;
+				backendLatency = (uint32_t)b;
+			}
+			if (ok && t.size() == 4) ok = parseNumber(t[3], a) && a >= 0;
+			if (ok && t.size() == 4) backendBacklog = (uint32_t)a;
+		}
+		else if (what == "handshakes" && t.size() == 2) {
+			ok = parseNumber(t[1], a) && a >= 0;
+			if (ok) handshakeRate = (uint32_t)a;
+		}
+		else ok = false;
+		if (!ok) fprintf(stderr, "%s:%d: can't make sense of \"%s\"\n", path, lineNumber, what.c_str());
+	}
+	fclose(fp);
+
+	auto byTime = [](const Point &a, const Point &b) { return a.at < b.at; };
+	std::stable_sort(temperature.begin(), temperature.end(), byTime);
+	std::stable_sort(humidity.begin(), humidity.end(), byTime);
+	std::stable_sort(signals.begin(), signals.end(), [](const Signal &a, const Signal &b) { return a.at < b.at; });
+	std::stable_sort(calls.begin(), calls.end(), [](const Call &a, const Call &b) { return a.at < b.at; });
+	return ok;
+}
+
+float Scenario::profileAt(const std::vector<Point> &points, float initial, uint64_t ms) {
+	float value = initial;
+	for (const Point &point : points) {
+		if (point.at > ms) break;
+		if (!point.over || ms >= point.at + point.over) value = point.value;
+		else value += (point.value - value) * (float)(ms - point.at) / point.over;	// Part way along a ramp from where it started
+	}
+	return value;
+}
+
+float Scenario::temperatureAt(uint64_t ms) const {
+	float swing = dailyAmplitude * sinf(2 * (float)M_PI * (float)(ms % 86400000) / 86400000);
+	return profileAt(temperature, 5.0, ms) + swing;
+}
+
+float Scenario::humidityAt(uint64_t ms) const {
+	return profileAt(humidity, 50.0, ms);
+}
+
+bool Scenario::networkUpAt(uint64_t ms) const {
+	for (const Outage &outage : outages) {
+		if (ms < outage.at) continue;
+		uint64_t into = ms - outage.at;
+		if (outage.every) into %= outage.every;
+		if (into < outage.length) return false;
+	}
+	return true;
+}
+
+void Scenario::signalAt(uint64_t ms, float &strength, float &dBm) const {
+	strength = 60.0;
+	dBm = -90.0;
+	for (const Signal &signal : signals) {
+		if (signal.at > ms) break;
+		strength = signal.strength;
+		dBm = signal.dBm;
+	}
+}
@@ -0,0 +1,112 @@
+#ifndef __SCENARIO_H
+#define __SCENARIO_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * @brief What the world does to a simulated device - read from a script by host/simulate
+ *
+ * One directive per line, # starts a comment. Times are offsets from the start of the run, written as
+ * 30d, 4h, 90m, 45s or a mix like 2d6h - a plain number is seconds.
+ *
+ *   duration 30d                          How long to run
+ *   step 100                              Virtual ms between loop passes (at most 1000)
+ *   temperature <at> <C>                  The temperature steps to this value
+ *   ramp <at> <over> <C>                  The temperature moves to this value over a time
+ *   daily <C>                             A day/night swing of this amplitude on top of the profile
+ *   humidity <at> <%>                     The humidity steps to this value
+ *   outage <at> <for> [every <period>]    No network - repeats if a period is given
+ *   signal <at> <strength %> <dBm>        What the modem reports from then on
+ *   call <at> <function> [argument]       A cloud function call, by its Particle name
+ *   drift <ppm>                           How fast the RTC runs - it is set again with each session
+ *   current <idle|connecting|connected|transmit> <mA>
+ *   overhead <publish|keepalive|session> <bytes>
+ *   battery <mAh> [start %]               Run on a battery - the charge reported falls with the energy used
+ *
+ * host/fleet runs the same script on every device, and also takes:
+ *
+ *   devices <n>                           How many
+ *   stagger <time>                        Devices power up spread over this time, not all at once
+ *   backend <requests/s> <ms> [backlog]   Webhook requests the backend handles a second, how long each
+ *                                         takes, and how many it holds before answering 429
+ *   handshakes <per s>                    Sessions the cloud sets up a second - 0 for no limit
+ *
+ * The currents and overheads are rough figures for a Boron on LTE M1 - change them to match a
+ * measurement. Transmit is drawn for a second with each event and keep-alive.
+ */
+class Scenario {
+public:
+	/**
+	 * @brief Read a script
+	 *
+	 * @return false with the problem written to stderr
+	 */
+	bool load(const char *path);
+
+	float temperatureAt(uint64_t ms) const;						//!< Offset from the start of the run (ms)
+	float humidityAt(uint64_t ms) const;
+	bool networkUpAt(uint64_t ms) const;
+	void signalAt(uint64_t ms, float &strength, float &dBm) const;
+
+	struct Call {
+		uint64_t at;
+		std::string name;
+		std::string argument;
+	};
+	std::vector<Call> calls;										//!< In time order
+
+	uint64_t duration = 30ULL * 86400000;
+	uint32_t step = 100;
+	double driftPpm = 0;
+
+	float idlemA = 5.0;												//!< MCU running, modem off
+	float connectingmA = 100.0;										//!< Same figures as the firmware's Connection-Stats estimate
+	float connectedmA = 20.0;
+	float transmitmA = 250.0;
+
+	uint32_t publishOverhead = 60;									//!< CoAP and DTLS framing and the ack, per event (bytes)
+	uint32_t keepAliveBytes = 122;									//!< One ping and its reply
+	uint32_t sessionBytes = 5000;									//!< A full DTLS handshake and the describe messages
+
+	uint32_t devices = 100;
+	uint64_t stagger = 0;
+	uint32_t backendRate = 100;										//!< Requests a second
+	uint32_t backendLatency = 2000;									//!< ms
+	uint32_t backendBacklog = 10000;								//!< Requests waiting before the rest get a 429
+	uint32_t handshakeRate = 0;
+
+	float batterymAh = 2000.0;										//!< Also what the battery life is worked out for when on mains power
+	float batteryStart = 90.0;										//!< % at the start
+	bool onBattery = false;											//!< Otherwise the charge stays at batteryStart
+
+protected:
+	struct Point {
+		uint64_t at;
+		uint64_t over;												//!< 0 for a step
+		float value;
+	};
+
+	struct Outage {
+		uint64_t at;
+		uint64_t length;
+		uint64_t every;												//!< 0 for once
+	};
+
+	struct Signal {
+		uint64_t at;
+		float strength;
+		float dBm;
+	};
+
+	static float profileAt(const std::vector<Point> &points, float initial, uint64_t ms);
+
+	std::vector<Point> temperature;
+	std::vector<Point> humidity;
+	float dailyAmplitude = 0;
+	std::vector<Outage> outages;
+	std::vector<Signal> signals;
+};
+
+#endif /* __SCENARIO_H */
@@ -0,0 +1,85 @@
+#include "WorkStealingPool.h"
+
+WorkStealingPool::WorkStealingPool(unsigned threads) {
+	if (!threads) threads = std::thread::hardware_concurrency();
+	if (!threads) threads = 1;
+	for (unsigned ii = 0; ii < threads; ii++) queues.emplace_back(new Queue);
+	for (unsigned ii = 1; ii < threads; ii++) this->threads.emplace_back(&WorkStealingPool::worker, this, ii);
+}
+
+WorkStealingPool::~WorkStealingPool() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	started.notify_all();
+	for (std::thread &thread : threads) thread.join();
+}
+
+void WorkStealingPool::run(size_t count, size_t chunk, const std::function<void(size_t first, size_t last)> &fn) {
+	if (!count) return;
+	if (!chunk) chunk = 1;
+	size_t chunks = (count + chunk - 1) / chunk;
+	size_t workers = queues.size();
+	for (size_t ii = 0; ii < workers; ii++) {						// A contiguous run for each - the last chunk can be short
+		std::lock_guard<std::mutex> guard(queues[ii]->lock);
+		for (size_t jj = chunks * ii / workers; jj < chunks * (ii + 1) / workers; jj++) {
+			size_t first = jj * chunk;
+			queues[ii]->chunks.push_back({first, (first + chunk < count) ? first + chunk : count});
+		}
+	}
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		job = &fn;
+		busy = (unsigned)threads.size();
+		generation++;
+	}
+	started.notify_all();
+	work(0);
+	std::unique_lock<std::mutex> wait(lock);						// The others may still be running their last chunk
+	finished.wait(wait, [this] { return busy == 0; });
+	job = nullptr;
+}
+
+void WorkStealingPool::worker(unsigned index) {
+	uint64_t seen = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> wait(lock);
+			started.wait(wait, [this, seen] { return stopping || generation != seen; });
+			if (stopping) return;
+			seen = generation;
+		}
+		work(index);
+		std::lock_guard<std::mutex> guard(lock);
+		if (--busy == 0) finished.notify_all();
+	}
+}
+
+void WorkStealingPool::work(unsigned index) {
+	Chunk chunk;
+	while (take(index, chunk)) (*job)(chunk.first, chunk.last);
+}
+
+bool WorkStealingPool::take(unsigned index, Chunk &chunk) {
+	{
+		Queue &own = *queues[index];
+		std::lock_guard<std::mutex> guard(own.lock);
+		if (!own.chunks.empty()) {
+			chunk = own.chunks.back();
+			own.chunks.pop_back();
+			return true;
+		}
+	}
+	for (size_t ii = 1; ii < queues.size(); ii++) {					// Steal the chunk its owner would have got to last
+		Queue &victim = *queues[(index + ii) % queues.size()];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.chunks.empty()) {
+			chunk = victim.chunks.front();
+			victim.chunks.pop_front();
+			steals++;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,70 @@
+#ifndef __WORKSTEALINGPOOL_H
+#define __WORKSTEALINGPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Threads that share out a range of work, each taking from its own end and stealing from the others'
+ *
+ * run() splits [0, count) into chunks and deals each thread a contiguous run of them, so a thread
+ * mostly works through neighbouring items. A thread takes its next chunk from the back of its own
+ * queue; once that is empty it steals from the front of another's, so a thread whose items cost more
+ * (devices connecting, resetting, sending a backlog) doesn't hold the rest up. The calling thread is
+ * one of the workers, and run() returns once every chunk is done.
+ */
+class WorkStealingPool {
+public:
+	/**
+	 * @brief Start the threads
+	 *
+	 * @param threads Workers including the caller - 0 for one per core
+	 */
+	WorkStealingPool(unsigned threads = 0);
+	~WorkStealingPool();
+
+	/**
+	 * @brief Call fn(first, last) over [0, count) in chunks, in any order and on any thread
+	 *
+	 * @param chunk Items per call - big enough that taking a chunk costs little next to running it
+	 */
+	void run(size_t count, size_t chunk, const std::function<void(size_t first, size_t last)> &fn);
+
+	unsigned size() const { return (unsigned)queues.size(); };
+	uint64_t getSteals() const { return steals; };					//!< Chunks run by a thread they weren't dealt to
+
+protected:
+	struct Chunk {
+		size_t first;
+		size_t last;
+	};
+
+	struct Queue {
+		std::mutex lock;
+		std::deque<Chunk> chunks;
+	};
+
+	void worker(unsigned index);
+	void work(unsigned index);										//!< Until every queue is empty - no chunks are added during a run()
+	bool take(unsigned index, Chunk &chunk);
+
+	std::vector<std::unique_ptr<Queue>> queues;						//!< One per worker - the caller's is 0
+	std::vector<std::thread> threads;
+	const std::function<void(size_t, size_t)> *job = nullptr;
+	std::atomic<uint64_t> steals{0};
+
+	std::mutex lock;												//!< For the rest
+	std::condition_variable started;
+	std::condition_variable finished;
+	uint64_t generation = 0;										//!< Counts run() calls - a worker wakes when it moves
+	unsigned busy = 0;												//!< Workers still in this run()
+	bool stopping = false;
+};
+
+#endif /* __WORKSTEALINGPOOL_H */
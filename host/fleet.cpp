@@ -0,0 +1,444 @@
+// Runs a fleet of independent devices against one simulated cloud and webhook backend, to see what a regional outage does
+//
+// Build and run from the top of the repository (see host/Makefile):
+//   make -C host
+//   ./host/fleet host/scenarios/fleet.sim
+//   ./host/fleet -j 8 -t series.csv host/scenarios/fleet.sim
+//
+// Every device is a whole firmware instance - FacilityMonitor with its own FRAM, retained RAM, publish
+// queue, RTC and cloud session - running the scenario (Scenario.h) in virtual time. They only meet in
+// the cloud, which sets up so many sessions a second, and in the backend, which answers so many
+// webhook requests a second after a delay and turns requests away with a 429 once its backlog is full.
+//
+// Time moves a second at a time. Within a second the devices run on their own, spread over the
+// threads by a work-stealing pool (WorkStealingPool.h); between seconds the cloud and the backend take
+// what the devices sent, in device order, so a run gives the same answer on any number of threads.
+//
+// At the end: reports due, made and acked - for the fleet and the worst device - backend request rates, backlog and response times, sessions
+// and resets, and for each outage in the scenario how long the fleet took to reconnect and to drain
+// the queues it built up. -t writes the same a second at a time as CSV.
+
+#include "FacilityMonitor.h"
+#include "HostHal.h"
+#include "Scenario.h"
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <new>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+static const uint32_t startTime = 1696118400;					// 1 October 2023, 00:00 UTC
+static const uint32_t tickMillis = 1000;						// The cloud and the backend catch up this often
+static const uint32_t wakeMillis = 60000;						// Watchdog pet requests
+static const uint32_t rebootMillis = 3000;						// From System.reset() to setup()
+static const int resetReasonUser = 140;							// RESET_REASON_USER - what System.reset() leaves
+static const size_t devicesPerChunk = 16;						// Work the pool hands out at a time
+
+static Scenario scenario;
+
+/**
+ * @brief HostCloud noting the sequence number of each report as it is queued
+ */
+class FleetCloud : public HostCloud {
+public:
+	FleetCloud(HostClock &clock) : HostCloud(clock) {
+		for (int ii = 0; ii < FacilityMonitor::coalescedEventCount; ii++) withCoalescing(FacilityMonitor::coalescedEvents[ii]);
+	};
+
+	virtual bool publish(const char *name, const char *data, Priority priority = PRIORITY_NORMAL);
+
+	std::set<uint32_t> made;										//!< Reports queued
+};
+
+static bool reportSeq(const char *name, const char *data, uint32_t &seq) {
+	if (strcmp(name, FacilityMonitor::reportEventName)) return false;
+	const char *p = strstr(data, "\"Seq\":");
+	if (!p) return false;
+	seq = strtoul(p + 6, NULL, 10);
+	return true;
+}
+
+bool FleetCloud::publish(const char *name, const char *data, Priority priority) {
+	uint32_t seq;
+	if (reportSeq(name, data, seq)) made.insert(seq);
+	return HostCloud::publish(name, data, priority);
+}
+
+/**
+ * @brief One device - only its own run() touches it while the devices run, only the backend between
+ */
+struct Device {
+	Device(uint64_t bootAt) : clock(startTime), cloud(clock), bootAt(bootAt) {
+		cloud.onPublish = onPublish;
+		cloud.context = this;
+		cloud.gateSessions = scenario.handshakeRate > 0;
+		system.console = false;
+	};
+
+	void run(uint64_t until);										//!< Until the clock reaches this getElapsed()
+	void boot();
+	void reboot();
+	static void onPublish(const char *name, const char *data, void *context);
+
+	HostClock clock;
+	HostSensor sensor;
+	HostStore store;
+	FleetCloud cloud;
+	HostGpio gpio;
+	HostSystem system;
+	StallMonitor::Record stallRecord;
+	TraceBuffer::Ring traceRing;
+	alignas(FacilityMonitor) uint8_t monitorMemory[sizeof(FacilityMonitor)];
+	FacilityMonitor *monitor = NULL;								//!< NULL until the device powers up
+
+	uint64_t bootAt;												//!< Since the start of the run (ms)
+	uint64_t nextWake = 0;
+	size_t nextCall = 0;
+
+	struct Response {
+		uint64_t at;												//!< getElapsed() it gets to the device
+		std::string data;
+	};
+	std::vector<uint32_t> sent;										//!< Reports the cloud took this second - for the backend
+	uint32_t eventsSent = 0;										//!< This second
+	std::vector<Response> inbox;									//!< Webhook responses on their way back
+	std::set<uint32_t> acked;										//!< Reports the backend answered 200
+	uint32_t resets = 0;
+	uint32_t due = 0;												//!< Report boundaries passed since power up, at the interval the firmware was using
+	uint32_t dueTime = 0;
+	int boundary = 0;
+
+	uint32_t dueAtEnd() const;										//!< Less one too close to the end for its report to be made
+
+	uint32_t stormConnects = 0;										//!< cloud.connects when the last outage ended
+	int32_t reconnectedAfter = -1;									//!< Seconds from the end of the last outage - -1 until it happens
+	int32_t drainedAfter = -1;										//!< Seconds until the queue was empty again
+};
+
+void Device::onPublish(const char *name, const char *data, void *context) {
+	Device *device = (Device *)context;
+	uint32_t seq;
+	device->eventsSent++;
+	if (reportSeq(name, data, seq)) device->sent.push_back(seq);
+}
+
+uint32_t Device::dueAtEnd() const {
+	return (due && dueTime % boundary < 60) ? due - 1 : due;
+}
+
+void Device::boot() {												// A global on the device - it starts from zeroed memory each boot, as there
+	if (monitor) monitor->~FacilityMonitor();
+	memset(monitorMemory, 0, sizeof(monitorMemory));
+	clock.reboot();
+	monitor = new (monitorMemory) FacilityMonitor({clock, sensor, store, cloud, gpio, system}, stallRecord, traceRing, "fleet");
+	monitor->setup();
+	nextWake = clock.getElapsed() + wakeMillis;
+}
+
+void Device::reboot() {
+	resets++;
+	clock.advance(rebootMillis);
+	cloud.disconnect();
+	cloud.pausePublishing(false);
+	gpio = HostGpio();
+	system.resetRequested = false;
+	system.reason = resetReasonUser;
+	inbox.clear();													// The subscription goes with the session
+	boot();
+}
+
+void Device::run(uint64_t until) {
+	while (clock.getElapsed() < until) {
+		uint64_t left = until - clock.getElapsed();
+		clock.advance((left < scenario.step) ? (uint32_t)left : scenario.step);
+		uint64_t now = clock.getElapsed() - HostClock::bootMillis;
+		if (!monitor) {
+			if (now >= bootAt) {
+				boot();
+				dueTime = startTime + (uint32_t)(now / 1000);
+			}
+			continue;
+		}
+
+		sensor.temperature = scenario.temperatureAt(now);
+		sensor.humidity = scenario.humidityAt(now);
+		scenario.signalAt(now, cloud.signalStrength, cloud.signalDBm);
+		cloud.networkUp = scenario.networkUpAt(now);
+
+		if (gpio.wakeAttached && clock.getElapsed() >= nextWake) {
+			monitor->watchdogInterrupt(clock.millis());
+			nextWake = clock.getElapsed() + wakeMillis;
+		}
+		monitor->checkStall(clock.millis());
+		cloud.loop();
+		for (size_t ii = 0; ii < inbox.size();) {
+			if (inbox[ii].at > clock.getElapsed()) {
+				ii++;
+				continue;
+			}
+			std::string data = inbox[ii].data;
+			inbox.erase(inbox.begin() + ii);
+			if (cloud.networkUp && cloud.connected()) monitor->UbidotsHandler(NULL, data.c_str());	// Lost with the network otherwise
+		}
+		while (nextCall < scenario.calls.size() && scenario.calls[nextCall].at <= now && cloud.connected()) {	// Held until the device can be called
+			const Scenario::Call &call = scenario.calls[nextCall++];
+			monitor->callFunction(call.name.c_str(), call.argument.c_str());
+		}
+		boundary = monitor->reportBoundary();						// The one IDLE_STATE is about to check
+		uint32_t trueTime = startTime + (uint32_t)(now / 1000);
+		due += trueTime / boundary - dueTime / boundary;
+		dueTime = trueTime;
+		monitor->loop();
+		if (system.resetRequested) reboot();
+	}
+}
+
+/**
+ * @brief The webhook backend - a queue served at a fixed rate
+ */
+struct Backend {
+	struct Request {
+		uint64_t arrivedAt;											//!< getElapsed()
+		uint32_t device;
+		uint32_t seq;
+	};
+
+	void arrive(Device &device, uint32_t index, uint64_t at);
+	void serve(std::vector<std::unique_ptr<Device>> &devices, uint64_t at);
+
+	std::deque<Request> backlog;
+	uint64_t requests = 0;
+	uint64_t rejected = 0;											//!< Answered 429
+	std::vector<uint32_t> responseTimes;							//!< From the request to the answer getting back (ms)
+};
+
+void Backend::arrive(Device &device, uint32_t index, uint64_t at) {
+	for (uint32_t seq : device.sent) {
+		requests++;
+		if (backlog.size() >= scenario.backendBacklog) {
+			rejected++;
+			device.inbox.push_back({at + scenario.backendLatency, "429"});
+		}
+		else backlog.push_back({at, index, seq});
+	}
+	device.sent.clear();
+}
+
+void Backend::serve(std::vector<std::unique_ptr<Device>> &devices, uint64_t at) {
+	for (uint32_t ii = 0; ii < scenario.backendRate && !backlog.empty(); ii++) {
+		Request request = backlog.front();
+		backlog.pop_front();
+		Device &device = *devices[request.device];
+		char data[16];
+		snprintf(data, sizeof(data), "200:%lu", (unsigned long)request.seq);
+		device.inbox.push_back({at + scenario.backendLatency, data});
+		device.acked.insert(request.seq);
+		responseTimes.push_back((uint32_t)(at + scenario.backendLatency - request.arrivedAt));
+	}
+}
+
+/**
+ * @brief What happened after an outage ended
+ */
+struct Storm {
+	uint64_t start;													//!< Since the start of the run (ms)
+	uint64_t end;
+	uint32_t devices = 0;											//!< Powered up when it ended
+	uint32_t peakWaiting = 0;										//!< Sessions waiting for a handshake
+	uint32_t peakRequests = 0;										//!< A second
+	uint32_t peakBacklog = 0;
+	std::vector<uint32_t> reconnects;								//!< Seconds from the end of the outage for each device
+	std::vector<uint32_t> drains;
+};
+
+static uint32_t percentile(std::vector<uint32_t> values, double fraction) {
+	if (values.empty()) return 0;
+	size_t index = (size_t)(fraction * (values.size() - 1) + 0.5);
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return values[index];
+}
+
+static std::string duration(uint64_t ms) {							// 1d06h00m, 2h00m, 45s
+	char buf[32];
+	unsigned long seconds = (unsigned long)(ms / 1000);
+	if (seconds >= 86400) snprintf(buf, sizeof(buf), "%lud%02luh%02lum", seconds / 86400, seconds / 3600 % 24, seconds / 60 % 60);
+	else if (seconds >= 3600) snprintf(buf, sizeof(buf), "%luh%02lum", seconds / 3600, seconds / 60 % 60);
+	else if (seconds >= 60) snprintf(buf, sizeof(buf), "%lum%02lus", seconds / 60, seconds % 60);
+	else snprintf(buf, sizeof(buf), "%lus", seconds);
+	return buf;
+}
+
+static void printSpread(const char *what, const std::vector<uint32_t> &seconds, uint32_t devices) {
+	if (seconds.empty()) {
+		printf("  %-16s none of %u devices\n", what, devices);
+		return;
+	}
+	printf("  %-16s half in %u sec, 90%% in %u sec, the last in %u sec (%u of %u devices)\n", what, percentile(seconds, 0.5),
+		percentile(seconds, 0.9), *std::max_element(seconds.begin(), seconds.end()), (unsigned)seconds.size(), devices);
+}
+
+int main(int argc, char *argv[]) {
+	unsigned threads = 0;
+	const char *path = NULL;
+	const char *seriesPath = NULL;
+	for (int ii = 1; ii < argc; ii++) {
+		if (!strcmp(argv[ii], "-j") && ii + 1 < argc) threads = atoi(argv[++ii]);
+		else if (!strcmp(argv[ii], "-t") && ii + 1 < argc) seriesPath = argv[++ii];
+		else path = argv[ii];
+	}
+	if (!path) {
+		fprintf(stderr, "usage: %s [-j threads] [-t series.csv] fleet.sim\n", argv[0]);
+		return 1;
+	}
+	if (!scenario.load(path)) return 1;
+	FILE *series = NULL;
+	if (seriesPath) {
+		series = fopen(seriesPath, "w");
+		if (!series) {
+			perror(seriesPath);
+			return 1;
+		}
+		fprintf(series, "second,powered,connected,waiting,handshakes,events,requests,backlog,rejected,queued\n");
+	}
+
+	std::vector<std::unique_ptr<Device>> devices;
+	for (uint32_t ii = 0; ii < scenario.devices; ii++) {			// Powered up evenly over the stagger, the first at once
+		devices.emplace_back(new Device((scenario.devices > 1) ? scenario.stagger * ii / (scenario.devices - 1) : 0));
+	}
+	WorkStealingPool pool(threads);
+	Backend backend;
+	std::vector<Storm> storms;
+	uint64_t outageStart = 0;
+	bool networkWasUp = true;
+	uint32_t admitFrom = 0;											// Handshakes go round the fleet, so none waits forever
+	uint64_t sessions = 0, events = 0;
+	uint32_t peakWaiting = 0, peakEvents = 0, peakRequests = 0, peakBacklog = 0;
+	uint64_t peakRequestsAt = 0;
+	auto wallStart = std::chrono::steady_clock::now();
+
+	for (uint64_t tick = tickMillis; tick <= scenario.duration; tick += tickMillis) {
+		uint64_t until = tick + HostClock::bootMillis;
+		pool.run(devices.size(), devicesPerChunk, [&devices, until](size_t first, size_t last) {
+			for (size_t ii = first; ii < last; ii++) devices[ii]->run(until);
+		});
+
+		uint64_t requestsBefore = backend.requests, rejectedBefore = backend.rejected;
+		uint32_t tickEvents = 0, powered = 0, connected = 0, handshakes = 0, queued = 0;
+		std::vector<uint32_t> waiting;
+		for (uint32_t ii = 0; ii < devices.size(); ii++) {
+			Device &device = *devices[ii];
+			tickEvents += device.eventsSent;
+			device.eventsSent = 0;
+			backend.arrive(device, ii, until);
+			if (!device.monitor) continue;
+			powered++;
+			if (device.cloud.inSession()) connected++;
+			if (device.cloud.sessionWaiting) waiting.push_back(ii);
+			queued += device.cloud.queuedEvents();
+		}
+		backend.serve(devices, until);
+		if (scenario.handshakeRate) {
+			std::stable_partition(waiting.begin(), waiting.end(), [admitFrom](uint32_t ii) { return ii >= admitFrom; });
+			for (uint32_t ii = 0; ii < waiting.size() && ii < scenario.handshakeRate; ii++) {
+				devices[waiting[ii]]->cloud.sessionAdmitted = true;
+				admitFrom = waiting[ii] + 1;
+				handshakes++;
+			}
+		}
+		uint32_t requests = (uint32_t)(backend.requests - requestsBefore);
+		events += tickEvents;
+		peakWaiting = std::max(peakWaiting, (uint32_t)waiting.size());
+		peakEvents = std::max(peakEvents, tickEvents);
+		peakBacklog = std::max(peakBacklog, (uint32_t)backend.backlog.size());
+		if (requests > peakRequests) {
+			peakRequests = requests;
+			peakRequestsAt = tick;
+		}
+
+		bool networkUp = scenario.networkUpAt(tick);
+		if (!networkUp && networkWasUp) outageStart = tick;
+		if (networkUp && !networkWasUp) {								// The outage is over - watch every device come back
+			storms.push_back(Storm());
+			storms.back().start = outageStart;
+			storms.back().end = tick;
+			for (auto &device : devices) {
+				device->reconnectedAfter = device->drainedAfter = -1;
+				device->stormConnects = device->cloud.connects;
+				if (device->monitor) storms.back().devices++;
+			}
+		}
+		networkWasUp = networkUp;
+		if (!storms.empty() && networkUp) {
+			Storm &storm = storms.back();
+			uint32_t since = (uint32_t)((tick - storm.end) / 1000);
+			for (auto &device : devices) {
+				if (!device->monitor) continue;
+				if (device->reconnectedAfter < 0 && device->cloud.connects != device->stormConnects) {
+					device->reconnectedAfter = since;
+					storm.reconnects.push_back(since);
+				}
+				if (device->reconnectedAfter >= 0 && device->drainedAfter < 0 && !device->cloud.queuedEvents()) {
+					device->drainedAfter = since;
+					storm.drains.push_back(since);
+				}
+			}
+			if (storm.drains.size() < storm.devices) {					// Still coming back
+				storm.peakWaiting = std::max(storm.peakWaiting, (uint32_t)waiting.size());
+				storm.peakRequests = std::max(storm.peakRequests, requests);
+				storm.peakBacklog = std::max(storm.peakBacklog, (uint32_t)backend.backlog.size());
+			}
+		}
+
+		if (series) fprintf(series, "%lu,%u,%u,%u,%u,%u,%u,%u,%u,%u\n", (unsigned long)(tick / 1000), powered, connected, (unsigned)waiting.size(), handshakes,
+			tickEvents, requests, (unsigned)backend.backlog.size(), (unsigned)(backend.rejected - rejectedBefore), queued);
+	}
+	if (series) fclose(series);
+	double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+	uint64_t due = 0, made = 0, acked = 0, pending = 0, resets = 0;
+	uint32_t complete = 0, worstShort = 0, worstDue = 0;			// Devices that made every report due, and the one that made fewest of them
+	for (auto &device : devices) {
+		uint32_t deviceDue = device->dueAtEnd(), deviceMade = (uint32_t)device->cloud.made.size();
+		uint32_t missing = (deviceDue > deviceMade) ? deviceDue - deviceMade : 0;
+		if (!missing) complete++;
+		else if (missing > worstShort) {
+			worstShort = missing;
+			worstDue = deviceDue;
+		}
+		due += deviceDue;
+		made += deviceMade;
+		acked += device->acked.size();
+		pending += device->cloud.queuedEvents();
+		resets += device->resets;
+		sessions += device->cloud.connects;
+	}
+	double days = scenario.duration / 86400000.0;
+	printf("Fleet of %u devices for %.1f days in %.1f sec on %u threads (%lu chunks stolen)\n", scenario.devices, days, wallSeconds, pool.size(),
+		(unsigned long)pool.getSteals());
+	printf("Reports:   %lu due, %lu made, %lu acked by the backend (%.2f%% of those due), %lu events still queued on the devices\n", (unsigned long)due,
+		(unsigned long)made, (unsigned long)acked, (due) ? acked * 100.0 / due : 0, (unsigned long)pending);
+	if (worstShort) printf("           every report due made on %u of %u devices; the worst made %u of %u\n", complete, scenario.devices, worstDue - worstShort, worstDue);
+	else printf("           every report due made on all %u devices\n", scenario.devices);
+	printf("Backend:   %lu requests, %.1f a second on average, peak %u a second at %s; backlog peak %u, %lu answered 429\n",
+		(unsigned long)backend.requests, backend.requests / (scenario.duration / 1000.0), peakRequests, duration(peakRequestsAt).c_str(), peakBacklog,
+		(unsigned long)backend.rejected);
+	if (!backend.responseTimes.empty()) {
+		printf("           response time %.1f sec median, %.1f sec 99th percentile, %.1f sec worst\n", percentile(backend.responseTimes, 0.5) / 1000.0,
+			percentile(backend.responseTimes, 0.99) / 1000.0, *std::max_element(backend.responseTimes.begin(), backend.responseTimes.end()) / 1000.0);
+	}
+	printf("Cloud:     %lu events, peak %u a second; %lu sessions, peak %u waiting for a handshake; %lu resets\n", (unsigned long)events, peakEvents,
+		(unsigned long)sessions, peakWaiting, (unsigned long)resets);
+	for (const Storm &storm : storms) {
+		printf("Outage at %s for %s:\n", duration(storm.start).c_str(), duration(storm.end - storm.start).c_str());
+		printSpread("reconnected", storm.reconnects, storm.devices);
+		printSpread("queues drained", storm.drains, storm.devices);
+		printf("  %-16s %u waiting for a handshake, %u requests a second, backlog %u\n", "peak", storm.peakWaiting, storm.peakRequests, storm.peakBacklog);
+	}
+	return 0;
+}
@@ -0,0 +1,138 @@
+// The firmware on a Linux host, against HostHal.h - for running it under a debugger, perf or the sanitizers
+//
+// Build and run from the top of the repository (see host/Makefile):
+//   make -C host
+//   ./host/host-firmware 48
+//   ./host/host-firmware -p 48
+//
+// Runs setup() and then loop() every 100 ms of virtual time for the hours given (24 if none), as fast
+// as the host allows. The cloud is always there: each report is answered "200:<seq>" two seconds after
+// it is sent and the watchdog asks for a pet every minute. Every event the firmware publishes is printed
+// with the time it went out, then the totals.
+//
+// With -p the USB serial port is a pseudo terminal. Once the hours have run, its path is printed and
+// the firmware carries on at 100 times real time until interrupted, so tools/dump-reader.cpp can pull
+// the bulk dump (src/BulkDump.h) from it as it would from the device.
+
+#include "FacilityMonitor.h"
+#include "HostHal.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+static const uint32_t startTime = 1696118400;					// 1 October 2023, 00:00 UTC
+static const uint32_t passMillis = 100;							// Virtual time between loop passes
+static const uint32_t responseMillis = 2000;					// Webhook round trip
+static const uint32_t wakeMillis = 60000;						// Watchdog pet requests
+static const useconds_t pacedMicros = 1000;						// Real time per loop pass once the pseudo terminal is up
+
+static HostClock hostClock(startTime);
+static HostSensor hostSensor;
+static HostStore hostStore;
+static HostCloud hostCloud(hostClock);
+static HostGpio hostGpio;
+static HostSystem hostSystem;
+static StallMonitor::Record stallRecord;
+static TraceBuffer::Ring traceRing;
+static FacilityMonitor monitor({hostClock, hostSensor, hostStore, hostCloud, hostGpio, hostSystem}, stallRecord, traceRing, "host");
+
+static char response[16];										// The webhook response on its way back - empty if none
+static uint64_t responseAt;
+static volatile sig_atomic_t interrupted = 0;
+
+static void onPublish(const char *name, const char *data, void *context) {
+	printf("%10.1f %-30s %s\n", hostClock.getElapsed() / 1000.0, name, data);
+	if (strcmp(name, FacilityMonitor::reportEventName)) return;
+	const char *seq = strstr(data, "\"Seq\":");
+	snprintf(response, sizeof(response), "200:%lu", (seq) ? strtoul(seq + 6, NULL, 10) : 0UL);
+	responseAt = hostClock.getElapsed() + responseMillis;
+}
+
+static void onInterrupt(int signal) {
+	interrupted = 1;
+}
+
+// The master end becomes the console, and the slave end is held open so the master doesn't fail while no reader has it open
+static bool openPseudoTerminal(int &slave) {
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) || unlockpt(master)) return false;
+	slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+	if (slave < 0) return false;
+	struct termios raw;
+	tcgetattr(slave, &raw);
+	cfmakeraw(&raw);
+	tcsetattr(slave, TCSANOW, &raw);
+	fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+	hostSystem.consoleFd = master;
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	bool pseudoTerminal = (argc > 1 && !strcmp(argv[1], "-p"));
+	if (pseudoTerminal) {
+		argc--;
+		argv++;
+	}
+	double hours = (argc > 1) ? atof(argv[1]) : 24;
+	if (hours <= 0) {
+		fprintf(stderr, "usage: %s [-p] [hours]\n", argv[0]);
+		return 1;
+	}
+	hostCloud.onPublish = onPublish;
+	for (int ii = 0; ii < FacilityMonitor::coalescedEventCount; ii++) hostCloud.withCoalescing(FacilityMonitor::coalescedEvents[ii]);
+
+	int slave = -1;
+	if (pseudoTerminal && !openPseudoTerminal(slave)) {
+		perror("pseudo terminal");
+		return 1;
+	}
+
+	monitor.setup();
+	uint64_t end = hostClock.getElapsed() + (uint64_t)(hours * 3600000);
+	uint64_t nextWake = hostClock.getElapsed() + wakeMillis;
+	unsigned long passes = 0;
+	bool paced = false;
+	while (!hostSystem.resetRequested && !interrupted) {
+		if (hostClock.getElapsed() >= end) {
+			if (!pseudoTerminal) break;
+			if (!paced) {
+				paced = true;
+				signal(SIGINT, onInterrupt);
+				signal(SIGTERM, onInterrupt);
+				printf("Bulk dump on %s - ^C to stop\n", ptsname(hostSystem.consoleFd));
+				fflush(stdout);
+			}
+			usleep(pacedMicros);
+		}
+		hostClock.advance(passMillis);
+		if (hostGpio.wakeAttached && hostClock.getElapsed() >= nextWake) {
+			monitor.watchdogInterrupt(hostClock.millis());
+			nextWake += wakeMillis;
+		}
+		monitor.checkStall(hostClock.millis());
+		hostCloud.loop();
+		if (response[0] && hostClock.getElapsed() >= responseAt) {
+			char data[sizeof(response)];
+			strcpy(data, response);
+			response[0] = 0;
+			monitor.UbidotsHandler(NULL, data);
+		}
+		monitor.loop();
+		passes++;
+	}
+
+	printf("\n%lu loop passes in %.1f hours%s\n", passes, hostClock.getElapsed() / 3600000.0, (hostSystem.resetRequested) ? " - ended by a reset" : "");
+	printf("%u events published (%u bytes), %u dropped, %u still queued, %u sessions\n", (unsigned)hostCloud.published, (unsigned)hostCloud.sentBytes(),
+		(unsigned)hostCloud.dropped, (unsigned)hostCloud.queuedEvents(), (unsigned)hostCloud.connects);
+	printf("%u FRAM writes (%u bytes), final state %s\n", (unsigned)hostStore.writes, (unsigned)hostStore.writtenBytes, FacilityMonitor::stateNames[monitor.getState()]);
+	if (pseudoTerminal) {
+		close(slave);
+		close(hostSystem.consoleFd);
+	}
+	return 0;
+}
@@ -0,0 +1,134 @@
+// Replays a log recorded by the firmware's Input-Record function through the same firmware on a Linux host
+//
+// Build and run from the top of the repository (see host/Makefile):
+//   make -C host
+//   ./host/replay run.vfr
+//
+// The FRAM, the stall record and the trace ring start as the log's header has them, then setup(),
+// each loop() pass, each cloud function call and each webhook response happen where the device's did,
+// with every input taken from the log (ReplayHal.h). What the firmware publishes and writes to the
+// console is printed. Exits with 0 once the log runs out, or with 2 and the byte offset where the
+// firmware first asked for an input the device didn't read - a build that doesn't match the device's,
+// or a bug that depends on something the log doesn't hold. Set a breakpoint and step through a field
+// problem as many times as it takes.
+
+#include "FacilityMonitor.h"
+#include "ReplayHal.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+struct Replay {
+	HostStore store;
+	StallMonitor::Record stallRecord;
+	TraceBuffer::Ring traceRing;
+	FacilityMonitor *monitor;
+	ReplayLog *log;
+};
+
+static void loadSection(uint8_t id, const uint8_t *data, size_t len, void *context) {
+	Replay *replay = (Replay *)context;
+	switch (id) {
+	case InputLog::SECTION_FRAM:
+		memcpy(replay->store.image, data, (len < sizeof(replay->store.image)) ? len : sizeof(replay->store.image));
+		break;
+	case InputLog::SECTION_STALL_RECORD:
+		if (len == sizeof(replay->stallRecord)) memcpy(&replay->stallRecord, data, len);
+		else fprintf(stderr, "Stall record is %zu bytes, not %zu - starting without it\n", len, sizeof(replay->stallRecord));
+		break;
+	case InputLog::SECTION_TRACE_RING:
+		if (len == sizeof(replay->traceRing)) memcpy(&replay->traceRing, data, len);
+		else fprintf(stderr, "Trace ring is %zu bytes, not %zu - starting without it\n", len, sizeof(replay->traceRing));
+		break;
+	default:														// The publish queue - what it reports back is in the log
+		break;
+	}
+}
+
+static void makeCall(const InputLogReader::Record &record, void *context) {
+	Replay *replay = (Replay *)context;
+	replay->log->calls++;
+	if (record.kind == InputLog::TEXT_WEBHOOK) {
+		std::string data(record.text, record.textLen);
+		printf("webhook \"%s\"\n", data.c_str());
+		replay->monitor->UbidotsHandler(NULL, (record.textLen) ? data.c_str() : NULL);	// The device logs no data as empty
+		return;
+	}
+	std::string name(record.text, record.textLen);
+	const InputLogReader::Record &argument = replay->log->expect(InputLog::TEXT, InputLog::TEXT_ARGUMENT);
+	std::string command(argument.text, argument.textLen);
+	printf("call    %s(\"%s\")\n", name.c_str(), command.c_str());
+	if (replay->monitor->callFunction(name.c_str(), command.c_str()) < 0) fprintf(stderr, "No function called %s\n", name.c_str());
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s run.vfr\n", argv[0]);
+		return 1;
+	}
+	FILE *fp = fopen(argv[1], "rb");
+	if (!fp) {
+		perror(argv[1]);
+		return 1;
+	}
+	std::vector<uint8_t> data;
+	uint8_t buf[4096];
+	size_t got;
+	while ((got = fread(buf, 1, sizeof(buf), fp)) > 0) data.insert(data.end(), buf, buf + got);
+	fclose(fp);
+
+	size_t start = 0;												// Skip a terminal's leftovers, as tools/input-dump.cpp does
+	for (; start + 4 <= data.size(); start++) {
+		uint32_t magic = data[start] | (data[start + 1] << 8) | (data[start + 2] << 16) | ((uint32_t)data[start + 3] << 24);
+		if (magic == InputLog::MAGIC) break;
+	}
+	if (start + 4 > data.size()) {
+		fprintf(stderr, "No input log found\n");
+		return 1;
+	}
+
+	static Replay replay;
+	ReplayLog log(&data[start], data.size() - start);
+	if (!log.reader.readHeader(loadSection, &replay)) {
+		fprintf(stderr, "Header is cut short\n");
+		return 1;
+	}
+
+	ReplayClock clock(log);
+	ReplaySensor sensor(log);
+	ReplayCloud cloud(log);
+	HostGpio gpio;
+	ReplaySystem system(log);
+	static FacilityMonitor monitor({clock, sensor, replay.store, cloud, gpio, system}, replay.stallRecord, replay.traceRing, "replay");
+	replay.monitor = &monitor;
+	replay.log = &log;
+	log.onCall = makeCall;
+	log.context = &replay;
+
+	const InputLogReader::Record *record;
+	while ((record = log.next())) {
+		if (record->type == InputLog::MARK) {
+			switch (record->kind) {
+			case InputLog::MARK_SETUP:
+				monitor.setup();
+				continue;
+			case InputLog::MARK_LOOP:
+				log.passes++;
+				monitor.loop();
+				continue;
+			case InputLog::MARK_END:
+				log.finished("recording was stopped");
+			case InputLog::MARK_OVERFLOW:
+				log.finished("the device's ring overflowed");
+			}
+		}
+		else if (record->type == InputLog::TEXT && (record->kind == InputLog::TEXT_FUNCTION || record->kind == InputLog::TEXT_WEBHOOK)) {
+			makeCall(*record, &replay);
+			continue;
+		}
+		log.diverged("nothing more in this pass");				// The device read an input the firmware didn't ask for
+	}
+	log.finished("the log ends");
+}
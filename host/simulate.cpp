@@ -0,0 +1,328 @@
+// Runs the firmware through weeks or months of a scripted world in virtual time, and totals what it cost
+//
+// Build and run from the top of the repository (see host/Makefile):
+//   make -C host
+//   ./host/simulate host/scenarios/month.sim
+//   ./host/simulate -v host/scenarios/month.sim      every publish and call as it happens
+//   ./host/simulate -c host/scenarios/month.sim      the totals as CSV, for comparing runs
+//
+// The scenario (Scenario.h) sets the temperature, the humidity, the network and the signal over time,
+// and makes cloud function calls - a policy change is a call. The firmware runs as it does on a device:
+// IDLE_STATE schedules the reports off the RTC, the publish queue holds and drops events as
+// PublishQueueAsync does, sessions take time to come up and set the RTC, which drifts in between, and a
+// reset starts setup() again with the FRAM, the retained RAM and the queue as they were. The backend
+// answers a report two seconds after it gets it, if the network is still up by then.
+//
+// At the end: reports due, made, delivered and lost, events and bytes, connections, how long each
+// excursion past the thresholds took to reach the backend, and the energy the radio and MCU used.
+// The data and energy figures come from the per-state currents and overheads in the scenario - good
+// for comparing one policy with another, not for a battery life promise.
+
+#include "FacilityMonitor.h"
+#include "HostHal.h"
+#include "Scenario.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+static const uint32_t startTime = 1696118400;					// 1 October 2023, 00:00 UTC
+static const uint32_t responseMillis = 2000;					// Webhook round trip
+static const uint32_t wakeMillis = 60000;						// Watchdog pet requests
+static const uint32_t rebootMillis = 3000;						// From System.reset() to setup()
+static const uint32_t transmitMillis = 1000;					// Time at the transmit current for each event and keep-alive
+static const int defaultKeepAlive = 23 * 60;					// Device OS's cellular keep-alive when the firmware sets none (sec)
+static const int resetReasonUser = 140;							// RESET_REASON_USER - what System.reset() leaves
+
+/**
+ * @brief HostCloud noting the sequence number of each report as it is queued
+ */
+class SimCloud : public HostCloud {
+public:
+	SimCloud(HostClock &clock) : HostCloud(clock) {
+		for (int ii = 0; ii < FacilityMonitor::coalescedEventCount; ii++) withCoalescing(FacilityMonitor::coalescedEvents[ii]);
+	};
+
+	virtual bool publish(const char *name, const char *data, Priority priority = PRIORITY_NORMAL);
+
+	/**
+	 * @brief Sequence numbers of the reports still in the queue
+	 */
+	void queuedReports(std::vector<uint32_t> &seqs) const;
+
+	void (*onQueue)(uint32_t seq) = nullptr;
+};
+
+struct Report {
+	uint64_t madeAt;												//!< When it was first queued
+	uint64_t deliveredAt;											//!< When the backend first got it - 0 if it never did
+};
+
+struct Excursion {													//!< The temperature past a threshold
+	uint64_t start;
+	uint64_t end;													//!< 0 while it lasts
+	uint32_t startTime;												//!< The device's time - what a report's Timestamp is compared with
+	uint32_t endTime;
+	uint64_t alertedAt;												//!< When the first report showing it reached the backend - 0 if none did
+};
+
+static Scenario scenario;
+static HostClock hostClock(startTime);
+static HostSensor hostSensor;
+static HostStore hostStore;
+static SimCloud hostCloud(hostClock);
+static HostGpio hostGpio;
+static HostSystem hostSystem;
+static StallMonitor::Record stallRecord;
+static TraceBuffer::Ring traceRing;
+alignas(FacilityMonitor) static uint8_t monitorMemory[sizeof(FacilityMonitor)];
+static FacilityMonitor *monitor = NULL;
+
+static bool verbose = false;
+static std::map<uint32_t, Report> reports;
+static std::vector<Excursion> excursions;
+static std::deque<std::pair<uint64_t, std::string>> responses;	// Webhook responses on their way back
+static uint32_t duplicates = 0;									// Reports the backend got again
+static uint64_t lastTraffic = 0;									// For the keep-alive pings
+static uint32_t keepAlives = 0;
+static uint32_t transmits = 0;
+static uint32_t resets = 0;
+
+static uint64_t simMillis() {										// Since the start of the run, for the scenario
+	return hostClock.getElapsed() - HostClock::bootMillis;
+}
+
+static bool parseField(const char *data, const char *field, double &value) {
+	const char *p = strstr(data, field);
+	if (!p) return false;
+	value = atof(p + strlen(field));
+	return true;
+}
+
+bool SimCloud::publish(const char *name, const char *data, Priority priority) {
+	double seq;
+	if (onQueue && !strcmp(name, FacilityMonitor::reportEventName) && parseField(data, "\"Seq\":", seq)) onQueue((uint32_t)seq);
+	return HostCloud::publish(name, data, priority);
+}
+
+void SimCloud::queuedReports(std::vector<uint32_t> &seqs) const {
+	for (const Event &event : events) {
+		double seq;
+		if (event.name == FacilityMonitor::reportEventName && parseField(event.data.c_str(), "\"Seq\":", seq)) seqs.push_back((uint32_t)seq);
+	}
+}
+
+static void onQueue(uint32_t seq) {
+	if (!reports.count(seq)) reports[seq] = {simMillis(), 0};
+}
+
+static void alertReached(uint32_t timeStamp) {						// The backend has seen a temperature past a threshold from this time - 0 if it doesn't say
+	for (Excursion &excursion : excursions) {						// The first excursion it belongs to that hasn't reached the backend yet
+		if (excursion.alertedAt) continue;
+		if (timeStamp && (timeStamp < excursion.startTime || (excursion.end && timeStamp > excursion.endTime))) continue;
+		excursion.alertedAt = simMillis();
+		return;
+	}
+}
+
+static void onPublish(const char *name, const char *data, void *context) {
+	lastTraffic = hostClock.getElapsed();
+	transmits++;
+	if (verbose) printf("%10.1f %-30s %s\n", simMillis() / 1000.0, name, data);
+	if (!strcmp(name, "Alerts") && strstr(data, "Temp Alert")) alertReached(0);
+	if (strcmp(name, FacilityMonitor::reportEventName)) return;
+
+	double seq = 0, temperature, timeStamp;
+	parseField(data, "\"Seq\":", seq);
+	char response[16];
+	snprintf(response, sizeof(response), "200:%lu", (unsigned long)seq);
+	responses.push_back({hostClock.getElapsed() + responseMillis, response});
+
+	Report &report = reports[(uint32_t)seq];
+	if (report.deliveredAt) {
+		duplicates++;
+		return;
+	}
+	report.deliveredAt = simMillis();
+	if (!parseField(data, "\"Temperature\":", temperature) || !parseField(data, "\"Timestamp\":", timeStamp)) return;
+	if (temperature > monitor->alertsStatus.upperTemperatureThreshold || temperature < monitor->alertsStatus.lowerTemperatureThreshold) alertReached((uint32_t)timeStamp);
+}
+
+static void startMonitor() {										// A global on the device - it starts from zeroed memory each boot, as there
+	if (monitor) monitor->~FacilityMonitor();
+	memset(monitorMemory, 0, sizeof(monitorMemory));
+	monitor = new (monitorMemory) FacilityMonitor({hostClock, hostSensor, hostStore, hostCloud, hostGpio, hostSystem}, stallRecord, traceRing, "sim");
+	monitor->setup();
+}
+
+static void reboot() {												// What the device goes through after System.reset()
+	resets++;
+	if (verbose) printf("%10.1f reset\n", simMillis() / 1000.0);
+	hostClock.advance(rebootMillis);
+	hostClock.reboot();
+	hostCloud.disconnect();
+	hostCloud.pausePublishing(false);
+	hostGpio = HostGpio();
+	hostSystem.resetRequested = false;
+	hostSystem.reason = resetReasonUser;
+	responses.clear();												// The subscription goes with the session
+	startMonitor();
+}
+
+int main(int argc, char *argv[]) {
+	bool csv = false;
+	const char *path = NULL;
+	for (int ii = 1; ii < argc; ii++) {
+		if (!strcmp(argv[ii], "-v")) verbose = true;
+		else if (!strcmp(argv[ii], "-c")) csv = true;
+		else path = argv[ii];
+	}
+	if (!path) {
+		fprintf(stderr, "usage: %s [-v] [-c] scenario.sim\n", argv[0]);
+		return 1;
+	}
+	if (!scenario.load(path)) return 1;
+
+	hostClock.driftPpm = scenario.driftPpm;
+	hostCloud.onPublish = onPublish;
+	hostCloud.onQueue = onQueue;
+	hostSystem.console = verbose;
+	hostSensor.charge = scenario.batteryStart;
+	hostSensor.temperature = scenario.temperatureAt(0);
+	hostSensor.humidity = scenario.humidityAt(0);
+	auto wallStart = std::chrono::steady_clock::now();
+
+	startMonitor();
+
+	size_t nextCall = 0;
+	uint64_t nextWake = hostClock.getElapsed() + wakeMillis;
+	uint32_t sessions = hostCloud.connects;
+	uint64_t connectedMillis = 0;
+	uint32_t due = 0;												// Report boundaries passed, at the interval the firmware was using
+	uint32_t dueTime = startTime;
+	int boundary = 0;
+	double mAh = 0;
+	int32_t worstClockError = 0;
+	unsigned long passes = 0;
+	while (simMillis() < scenario.duration) {
+		uint64_t before = hostClock.getElapsed();
+		hostClock.advance(scenario.step);
+		uint64_t now = simMillis();
+
+		hostSensor.temperature = scenario.temperatureAt(now);
+		hostSensor.humidity = scenario.humidityAt(now);
+		scenario.signalAt(now, hostCloud.signalStrength, hostCloud.signalDBm);
+		hostCloud.networkUp = scenario.networkUpAt(now);
+
+		bool outside = hostSensor.temperature > monitor->alertsStatus.upperTemperatureThreshold || hostSensor.temperature < monitor->alertsStatus.lowerTemperatureThreshold;
+		bool inExcursion = !excursions.empty() && !excursions.back().end;
+		if (outside && !inExcursion) excursions.push_back({now, 0, hostClock.now(), 0, 0});
+		else if (!outside && inExcursion) {
+			excursions.back().end = now;
+			excursions.back().endTime = hostClock.now();
+		}
+
+		if (hostGpio.wakeAttached && hostClock.getElapsed() >= nextWake) {
+			monitor->watchdogInterrupt(hostClock.millis());
+			nextWake = hostClock.getElapsed() + wakeMillis;
+		}
+		monitor->checkStall(hostClock.millis());
+		hostCloud.loop();
+		while (!responses.empty() && hostClock.getElapsed() >= responses.front().first) {
+			std::string data = responses.front().second;
+			responses.pop_front();
+			if (hostCloud.networkUp && hostCloud.connected()) monitor->UbidotsHandler(NULL, data.c_str());	// Lost with the network otherwise
+		}
+		while (nextCall < scenario.calls.size() && scenario.calls[nextCall].at <= now && hostCloud.connected()) {	// Held until the device can be called
+			const Scenario::Call &call = scenario.calls[nextCall++];
+			if (verbose) printf("%10.1f call %s(\"%s\")\n", now / 1000.0, call.name.c_str(), call.argument.c_str());
+			if (monitor->callFunction(call.name.c_str(), call.argument.c_str()) < 0) fprintf(stderr, "No function called %s\n", call.name.c_str());
+		}
+		boundary = monitor->reportBoundary();						// The one IDLE_STATE is about to check
+		uint32_t trueTime = startTime + (uint32_t)(now / 1000);
+		due += trueTime / boundary - dueTime / boundary;
+		dueTime = trueTime;
+		monitor->loop();
+		passes++;
+		if (hostSystem.resetRequested) reboot();
+
+		uint64_t elapsed = hostClock.getElapsed() - before;			// The firmware's delay()s move the clock too
+		bool connected = hostCloud.connected();
+		if (hostCloud.connects != sessions) {
+			sessions = hostCloud.connects;
+			lastTraffic = hostClock.getElapsed();
+		}
+		int keepAlive = (hostCloud.keepAliveSeconds > 0) ? hostCloud.keepAliveSeconds : defaultKeepAlive;
+		if (connected && hostClock.getElapsed() - lastTraffic >= (uint64_t)keepAlive * 1000) {
+			keepAlives++;
+			transmits++;
+			lastTraffic = hostClock.getElapsed();
+		}
+		if (connected) connectedMillis += elapsed;
+		float current = (connected) ? scenario.connectedmA : (hostCloud.isModemOn()) ? scenario.connectingmA : 0;
+		mAh += (current + scenario.idlemA) * elapsed / 3600000.0;
+		if (scenario.onBattery) {
+			hostSensor.charge = scenario.batteryStart - (float)((mAh + transmits * (scenario.transmitmA - scenario.connectedmA) * transmitMillis / 3600000.0) / scenario.batterymAh * 100);
+			if (hostSensor.charge < 0) hostSensor.charge = 0;
+		}
+		int32_t clockError = abs(hostClock.getError());
+		if (clockError > worstClockError) worstClockError = clockError;
+	}
+	double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+	double days = simMillis() / 86400000.0;
+	if (due && dueTime % boundary < 60) due--;						// Too close to the end for its report to be made
+	mAh += transmits * (scenario.transmitmA - scenario.connectedmA) * transmitMillis / 3600000.0;
+
+	std::vector<uint32_t> queued;
+	hostCloud.queuedReports(queued);
+	uint32_t delivered = 0, pending = 0, lost = 0;
+	for (auto &entry : reports) {
+		if (entry.second.deliveredAt) delivered++;
+		else if (std::find(queued.begin(), queued.end(), entry.first) != queued.end()) pending++;
+		else lost++;												// Dropped from the queue to make room
+	}
+	uint32_t neverMade = (due > reports.size()) ? due - (uint32_t)reports.size() : 0;	// Boundaries passed without a report
+	lost += neverMade;
+	uint32_t alerted = 0;											// By an Alerts event or a report showing the temperature
+	double latencySum = 0, latencyMax = 0;
+	for (const Excursion &excursion : excursions) {
+		if (!excursion.alertedAt) continue;
+		double latency = (excursion.alertedAt - excursion.start) / 1000.0;
+		alerted++;
+		latencySum += latency;
+		if (latency > latencyMax) latencyMax = latency;
+	}
+	double latencyMean = (alerted) ? latencySum / alerted : 0;
+	uint32_t sessionBytes = hostCloud.connects * scenario.sessionBytes;
+	uint32_t dataBytes = hostCloud.sentBytes() + hostCloud.published * scenario.publishOverhead + keepAlives * scenario.keepAliveBytes + sessionBytes;
+	double averagemA = mAh / (simMillis() / 3600000.0);
+	double batteryDays = scenario.batterymAh / averagemA / 24;
+
+	if (csv) {
+		printf("scenario,days,due,reports,delivered,lost,pending,duplicates,events,dropped,event_bytes,data_bytes,sessions,connected_pct,resets,"
+			"excursions,alerted,latency_mean_s,latency_max_s,mAh,average_mA,battery_days,clock_error_s\n");
+		printf("%s,%.2f,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%.1f,%u,%u,%u,%.0f,%.0f,%.1f,%.2f,%.1f,%d\n", path, days, due, (unsigned)reports.size(), delivered, lost,
+			pending, duplicates, (unsigned)hostCloud.published, (unsigned)hostCloud.dropped, (unsigned)hostCloud.sentBytes(), dataBytes,
+			(unsigned)hostCloud.connects, connectedMillis * 100.0 / simMillis(), resets, (unsigned)excursions.size(), alerted, latencyMean, latencyMax,
+			mAh, averagemA, batteryDays, worstClockError);
+		return 0;
+	}
+	if (verbose) printf("\n");
+	printf("Simulated %.1f days in %.1f sec (%lu loop passes), final state %s\n", days, wallSeconds, passes, FacilityMonitor::stateNames[monitor->getState()]);
+	printf("Reports:     %u due, %u made, %u delivered, %u lost (%u never made), %u still queued, %u sent again\n", due, (unsigned)reports.size(), delivered, lost,
+		neverMade, pending, duplicates);
+	printf("Events:      %u published (%u bytes), %u dropped from the queue\n", (unsigned)hostCloud.published, (unsigned)hostCloud.sentBytes(), (unsigned)hostCloud.dropped);
+	printf("Data:        %.1f kB with %u keep-alives and %u sessions (%.1f kB of handshakes)\n", dataBytes / 1024.0, keepAlives, (unsigned)hostCloud.connects, sessionBytes / 1024.0);
+	printf("Connection:  connected %.1f%% of the time, %u connect attempts, %u resets\n", connectedMillis * 100.0 / simMillis(), (unsigned)hostCloud.connectAttempts, resets);
+	printf("Alerts:      %u excursions, %u reached the backend - %.0f sec mean, %.0f sec worst\n", (unsigned)excursions.size(), alerted, latencyMean, latencyMax);
+	printf("Energy:      %.0f mAh, %.2f mA average - %.0f days on a %.0f mAh battery\n", mAh, averagemA, batteryDays, scenario.batterymAh);
+	printf("RTC:         %d sec worst error\n", worstClockError);
+	printf("FRAM:        %u writes (%u bytes)\n", (unsigned)hostStore.writes, (unsigned)hostStore.writtenBytes);
+	return 0;
+}
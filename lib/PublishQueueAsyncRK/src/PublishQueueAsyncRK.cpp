@@ -1,6 +1,8 @@
 
 #include "PublishQueueAsyncRK.h"
 
+#include <new>
+
 
 Logger pubqLogger("app.pubq");
 
@@ -15,9 +17,11 @@ PublishQueueAsyncBase::~PublishQueueAsyncBase() {
 void PublishQueueAsyncBase::setup() {
 	haveSetup = true;
 
-	os_mutex_create(&mutex);
+	if (!mutex) {
+		os_mutex_create(&mutex);
+	}
 
-	thread = new Thread("PublishQueueAsync", threadFunctionStatic, this, OS_THREAD_PRIORITY_DEFAULT, 2048);
+	thread = new(threadStorage) Thread("PublishQueueAsync", threadFunctionStatic, this, OS_THREAD_PRIORITY_DEFAULT, threadStackSize);
 }
 
 void PublishQueueAsyncBase::mutexLock() const {
@@ -29,13 +33,34 @@ void PublishQueueAsyncBase::mutexUnlock() const {
 }
 
 void PublishQueueAsyncBase::threadFunction() {
+	// Paint the stack while almost none of it is in use. The stack grows down, so everything from a little below
+	// this frame down to the bottom of the stack (less what was used before we got here) is free.
+	uint32_t marker = 0;
+	uintptr_t top = ((uintptr_t)&marker - STACK_PAINT_GUARD) & ~(uintptr_t)3;
+	uintptr_t bottom = ((uintptr_t)&marker - (threadStackSize - STACK_ENTRY_RESERVE) + 3) & ~(uintptr_t)3;
+	for(volatile uint32_t *p = (volatile uint32_t *)bottom; p < (volatile uint32_t *)top; p++) {
+		*p = STACK_PAINT;
+	}
+	stackPaintTop = (volatile uint32_t *)top;
+	stackPaintBottom = (volatile uint32_t *)bottom;
+
 	// Call the stateHandler forever
 	while(true) {
-		stateHandler(*this);
+		(this->*stateHandler)();
 		os_thread_yield();
 	}
 }
 
+size_t PublishQueueAsyncBase::getThreadStackHeadroom() const {
+	size_t headroom = 0;
+	if (stackPaintBottom) {
+		for(volatile uint32_t *p = stackPaintBottom; p < stackPaintTop && *p == STACK_PAINT; p++) {
+			headroom += sizeof(uint32_t);
+		}
+	}
+	return headroom;
+}
+
 void PublishQueueAsyncBase::startState() {
 	// If we had other initialization to do, this would be a good place to do it.
 
@@ -47,10 +72,12 @@ void PublishQueueAsyncBase::startState() {
 void PublishQueueAsyncBase::checkQueueState() {
 	if (!pausePublishing && Particle.connected() && millis() - lastPublish >= 1010) {
 
+		// Set first, so an event queued while the oldest is copied out can't drop it
+		isSending = true;
 		PublishQueueEventData *data = getOldestEvent();
 		if (data) {
 			// We have an event and can probably publish
-			isSending = true;
+			uint16_t numEvents = coalesce(data);
 
 			const char *buf = reinterpret_cast<const char *>(data);
 			const char *eventName = &buf[sizeof(PublishQueueEventData)];
@@ -72,7 +99,13 @@ void PublishQueueAsyncBase::checkQueueState() {
 			if (bResult) {
 				// Successfully published
 				pubqLogger.info("published successfully");
-				discardOldEvent(false);
+				sentBytes += strlen(eventName) + strlen(eventData);
+				while(numEvents-- > 0) {
+					// One at a time, so a publish making room still can't drop the ones left
+					discardOldEvent(false);
+					StMutexLock lock(this);
+					sendingEvents = (numEvents > 0) ? numEvents : 1;
+				}
 			}
 			else {
 				// Did not successfully transmit, try again after retry time
@@ -84,6 +117,7 @@ void PublishQueueAsyncBase::checkQueueState() {
 		}
 		else {
 			// No event
+			isSending = false;
 		}
 	}
 	else {
@@ -92,6 +126,66 @@ void PublishQueueAsyncBase::checkQueueState() {
 
 }
 
+uint16_t PublishQueueAsyncBase::coalesce(PublishQueueEventData *data) {
+	StMutexLock lock(this);
+
+	sendingEvents = 1;
+
+	char *eventName = reinterpret_cast<char *>(data) + sizeof(PublishQueueEventData);
+	const CoalesceRule *rule = NULL;
+	for(size_t ii = 0; ii < numCoalesceRules; ii++) {
+		if (strcmp(eventName, coalesceRules[ii].eventName) == 0) {
+			rule = &coalesceRules[ii];
+			break;
+		}
+	}
+	if (rule == NULL) {
+		return sendingEvents;
+	}
+
+	char *eventData = eventName + strlen(eventName) + 1;
+	char *end = eventData + strlen(eventData);
+	uint8_t *bufEnd = reinterpret_cast<uint8_t *>(data) + EVENT_BUF_SIZE;
+
+	for(uint16_t ii = 1; ; ii++) {
+		// Each event is copied in just after the data so far, then its data is moved down over its
+		// header and name. If it can't be added, the data so far is still terminated.
+		uint8_t *next = reinterpret_cast<uint8_t *>(end) + 1;
+		if (!peekEvent(ii, next, bufEnd - next)) {
+			break;
+		}
+
+		PublishQueueEventData nextHeader;
+		memcpy(&nextHeader, next, sizeof(PublishQueueEventData));
+		const char *nextName = reinterpret_cast<const char *>(next) + sizeof(PublishQueueEventData);
+		const char *nextData = nextName + strlen(nextName) + 1;
+		size_t nextLen = strlen(nextData);
+		if (nextHeader.flags != data->flags || nextHeader.reserved1 != data->reserved1 || strcmp(nextName, eventName) != 0 ||
+				(size_t)(end - eventData) + 1 + nextLen > MAX_COALESCED_DATA) {
+			break;
+		}
+
+		*end++ = rule->separator;
+		memmove(end, nextData, nextLen + 1);
+		end += nextLen;
+		sendingEvents = ii + 1;
+	}
+
+	if (sendingEvents > 1) {
+		pubqLogger.info("coalesced %u %s events", sendingEvents, eventName);
+	}
+	return sendingEvents;
+}
+
+PublishQueueAsyncBase &PublishQueueAsyncBase::withCoalescing(const char *eventName, char separator) {
+	if (numCoalesceRules < MAX_COALESCED) {
+		coalesceRules[numCoalesceRules].eventName = eventName;
+		coalesceRules[numCoalesceRules].separator = separator;
+		numCoalesceRules++;
+	}
+	return *this;
+}
+
 void PublishQueueAsyncBase::waitRetryState() {
 	if (millis() - lastPublish >= failureRetryMs) {
 		stateHandler = &PublishQueueAsyncBase::checkQueueState;
@@ -106,39 +200,8 @@ void PublishQueueAsyncBase::threadFunctionStatic(void *param) {
 
 
 PublishQueueAsyncRetained::PublishQueueAsyncRetained(uint8_t *retainedBuffer, uint16_t retainedBufferSize) :
-		retainedBuffer(retainedBuffer), retainedBufferSize(retainedBufferSize) {
-
-	// Initialize the retained buffer
-	bool initBuffer = false;
-
-	volatile PublishQueueHeader *hdr = reinterpret_cast<PublishQueueHeader *>(retainedBuffer);
-	if (hdr->magic == PUBLISH_QUEUE_HEADER_MAGIC && hdr->size == retainedBufferSize) {
-		// Calculate the next write offset
-		uint8_t *end = &retainedBuffer[retainedBufferSize];
-
-		nextFree = &retainedBuffer[sizeof(PublishQueueHeader)];
-		for(uint16_t ii = 0; ii < hdr->numEvents; ii++) {
-			nextFree = skipEvent(nextFree);
-			if (nextFree > end) {
-				// Overflowed buffer, must be corrupted
-				initBuffer = true;
-				break;
-			}
-		}
-	}
-	else {
-		// Not valid
-		initBuffer = true;
-	}
-
-	//initBuffer = true; // Uncomment to discard old data
-
-	if (initBuffer) {
-		hdr->magic = PUBLISH_QUEUE_HEADER_MAGIC;
-		hdr->size = retainedBufferSize;
-		hdr->numEvents = 0;
-		nextFree = &retainedBuffer[sizeof(PublishQueueHeader)];
-	}
+		ring(retainedBuffer, retainedBufferSize) {
+	// The ring keeps the events in the buffer if they check out, otherwise it starts it again
 }
 
 PublishQueueAsyncRetained::~PublishQueueAsyncRetained() {
@@ -146,7 +209,8 @@ PublishQueueAsyncRetained::~PublishQueueAsyncRetained() {
 }
 
 
-bool PublishQueueAsyncRetained::publishCommon(const char *eventName, const char *data, int ttl, PublishFlags flags1, PublishFlags flags2) {
+bool PublishQueueAsyncRetained::publishCommon(const char *eventName, const char *data, int ttl, PublishFlags flags1, PublishFlags flags2,
+		PublishQueuePriority priority) {
 
 	if (!haveSetup) {
 		setup();
@@ -156,79 +220,25 @@ bool PublishQueueAsyncRetained::publishCommon(const char *eventName, const char
 		data = "";
 	}
 
-	// Size is the size of the header, the two c-strings (with null terminators), rounded up to a multiple of 4
-	size_t size = sizeof(PublishQueueEventData) + strlen(eventName) + strlen(data) + 2;
-	if ((size % 4) != 0) {
-		size += 4 - (size % 4);
-	}
-
-	pubqLogger.info("queueing eventName=%s data=%s ttl=%d flags1=%d flags2=%d size=%d", eventName, data, ttl, flags1.value(), flags2.value(), size);
-
-	if  (size > (retainedBufferSize - sizeof(PublishQueueHeader))) {
-		// Special case: event is larger than the retained buffer. Rather than throw out all events
-		// before discovering this, check that case first
-		return false;
-	}
-
-	while(true) {
-		{
-			StMutexLock lock(this);
-
-			uint8_t *end = &retainedBuffer[retainedBufferSize];
-			if ((size_t)(end - nextFree) >= size) {
-				// There is room to fit this
-				PublishQueueEventData *eventData = reinterpret_cast<PublishQueueEventData *>(nextFree);
-				eventData->ttl = ttl;
-				eventData->flags = flags1.value() | flags2.value();
-
-				char *cp = reinterpret_cast<char *>(nextFree);
-				cp += sizeof(PublishQueueEventData);
-
-				strcpy(cp, eventName);
-				cp += strlen(cp) + 1;
-
-				strcpy(cp, data);
-
-				nextFree += size;
+	pubqLogger.info("queueing eventName=%s data=%s ttl=%d flags1=%d flags2=%d priority=%d size=%d", eventName, data, ttl, flags1.value(), flags2.value(),
+		priority, PublishQueueRing::eventSize(eventName, data));
 
-				PublishQueueHeader *hdr = reinterpret_cast<PublishQueueHeader *>(retainedBuffer);
-				hdr->numEvents++;
-				return true;
-			}
-
-			// If there's only one event, there's nothing left to discard, this event is too large
-			// to fit with the existing first event (which we can't delete because it might be
-			// in the process of being sent)
-			PublishQueueHeader *hdr = reinterpret_cast<PublishQueueHeader *>(retainedBuffer);
-			if (hdr->numEvents == 1) {
-				return false;
-			}
-		}
-
-		// Discard the oldest event (false) if we're not currently sending.
-		// If we are sending (isSending=true), discard the second oldest event
-		if (!discardOldEvent(isSending)) {
-			// There isn't an event to discard, so we don't have enough room
-			return false;
-		}
-	}
+	StMutexLock lock(this);
 
-	// Not reached
-	return false;
+	// Discards the oldest event of the lowest priority to make room. If we are sending (isSending=true),
+	// the events being sent are kept.
+	return ring.push(eventName, data, ttl, flags1.value() | flags2.value(), priority, (isSending) ? sendingEvents : 0);
 }
 
 
 PublishQueueEventData *PublishQueueAsyncRetained::getOldestEvent() {
 	// This entire function holds a mutex lock that's released when returning
 	StMutexLock lock(this);
-	PublishQueueEventData *eventData = NULL;
 
-	volatile PublishQueueHeader *hdr = reinterpret_cast<PublishQueueHeader *>(retainedBuffer);
-	if (hdr->numEvents > 0) {
-		eventData = reinterpret_cast<PublishQueueEventData *>(&retainedBuffer[sizeof(PublishQueueHeader)]);
+	if (!ring.front(reinterpret_cast<uint8_t *>(publishBuf))) {
+		return NULL;
 	}
-
-	return eventData;
+	return reinterpret_cast<PublishQueueEventData *>(publishBuf);
 }
 
 bool PublishQueueAsyncRetained::clearEvents() {
@@ -239,66 +249,24 @@ bool PublishQueueAsyncRetained::clearEvents() {
 
 	StMutexLock lock(this);
 
-	PublishQueueHeader *hdr = reinterpret_cast<PublishQueueHeader *>(retainedBuffer);
 	if (!isSending) {
-		hdr->numEvents = 0;
+		ring.clear();
 		result = true;
 	}
 
 	return result;
 }
 
-uint8_t *PublishQueueAsyncRetained::skipEvent(uint8_t *start) {
-	start += sizeof(PublishQueueEventData);
-	start += strlen(reinterpret_cast<char *>(start)) + 1;
-	start += strlen(reinterpret_cast<char *>(start)) + 1;
-
-	// Align
-	size_t offset = start - retainedBuffer;
-	if ((offset % 4) != 0) {
-		start += 4 - (offset % 4);
-	}
-
-
-	return start;
-}
-
-
 bool PublishQueueAsyncRetained::discardOldEvent(bool secondEvent) {
 	// This entire function holds a mutex lock that's released when returning
 	StMutexLock lock(this);
 
-	PublishQueueHeader *hdr = reinterpret_cast<PublishQueueHeader *>(retainedBuffer);
-	uint8_t *start = &retainedBuffer[sizeof(PublishQueueHeader)];
-	uint8_t *end = &retainedBuffer[retainedBufferSize];
-
-	if (secondEvent) {
-		if (hdr->numEvents < 2) {
-			return false;
-		}
-		start = skipEvent(start);
-	}
-	else {
-		if (hdr->numEvents < 1) {
-			return false;
-		}
-	}
-
-	// Remove the event at start
-	uint8_t *next = skipEvent(start);
-	size_t len = next - start;
-
-	size_t after = end - next;
-	if (after > 0) {
-		// Move events down
-		memmove(start, next, after);
-	}
-
-	nextFree -= len;
-	hdr->numEvents--;
-
+	return ring.discard(secondEvent);
+}
 
-	return true;
+bool PublishQueueAsyncRetained::peekEvent(uint16_t n, uint8_t *buf, size_t bufSize) {
+	// Called with the mutex held
+	return ring.peek(n, buf, bufSize);
 }
 
 uint16_t PublishQueueAsyncRetained::getNumEvents() const {
@@ -307,8 +275,7 @@ uint16_t PublishQueueAsyncRetained::getNumEvents() const {
 	{
 		StMutexLock lock(this);
 
-		PublishQueueHeader *hdr = reinterpret_cast<PublishQueueHeader *>(retainedBuffer);
-		numEvents = hdr->numEvents;
+		numEvents = ring.getNumEvents();
 	}
 
 	return numEvents;
@@ -2,6 +2,7 @@
 #define __PUBLISHQUEUEASYNCRK_H
 
 #include "Particle.h"
+#include "PublishQueueRing.h"
 
 /**
  * @brief Library for asynchronous Particle.publish on the Particle Photon, Electron, and other devices.
@@ -21,38 +22,6 @@
  * License: MIT
  */
 
-/**
- * @brief Magic bytes used in retained memory and FRAM to detect if the data structures look valid-ish
- */
-static const uint32_t PUBLISH_QUEUE_HEADER_MAGIC = 0xd19cab61;
-
-/**
- * @brief Structure stored at the beginning of retained memory.
- *
- * It's followed by a packed event PublishQueueEventData structures.
- *
- * It's also what's stored in FRAM, or in the event file on SPIFFS or SdFat file system.
- */
-typedef struct { // 8 bytes
-	uint32_t	magic;			//!< PUBLISH_QUEUE_HEADER_MAGIC
-	uint16_t	size;			//!< retainedBufferSize, in case it changed, or for file systems, this is the number of events that have been sent already
-	uint16_t	numEvents;		//!< number of events, see the PublishQueueEventData structure
-} PublishQueueHeader;
-
-/**
- * @brief Event data structure.
- *
- */
-typedef struct { // 8 bytes
-	int ttl;					//!< Event TTL (not actually used by the cloud, but we can send it up if sent)
-	uint8_t flags;				//!< Event flags (like PRIVATE or WITH_ACK)
-	uint8_t reserved1;			//!< Not currently used (compiler will pad structure out to 8 bytes anyway)
-	uint16_t reserved2;			//!< Not currently used
-	// eventName (c-string, packed)
-	// eventData (c-string, packed)
-	// padded to 4-byte alignment
-} PublishQueueEventData;
-
 /**
  * @brief Logger class that logs to app.pubq
  */
@@ -151,6 +120,30 @@ public:
 		return publishCommon(eventName, data, ttl, flags1, flags2);
 	}
 
+	/**
+	 * @brief Overload for publishing an event with a priority
+	 *
+	 * @param eventName The name of the event (63 character maximum).
+	 *
+	 * @param data The event data (255 bytes maximum, 622 bytes in system firmware 0.8.0-rc.4 and later).
+	 *
+	 * @param priority The lane the event waits in. The oldest event of the highest priority queued is
+	 * sent first, and when the queue is full the oldest event of the lowest priority is discarded, never
+	 * one of a higher priority than this event. The other overloads use PUBLISH_PRIORITY_NORMAL.
+	 *
+	 * @param flags1 Normally PRIVATE. You can also use PUBLIC, but one or the other must be specified.
+	 *
+	 * @param flags2 (optional) You can use NO_ACK or WITH_ACK if desired.
+	 *
+	 * @return true if the event was queued or false if it was not.
+	 *
+	 * Returns false if the queue is full of events of a higher priority that can't make room for it,
+	 * or if priority isn't one of the PublishQueuePriority values.
+	 */
+	inline  bool publish(const char *eventName, const char *data, PublishQueuePriority priority, PublishFlags flags1, PublishFlags flags2 = PublishFlags()) {
+		return publishCommon(eventName, data, 60, flags1, flags2, priority);
+	}
+
 	/**
 	 * @brief Common publish function. All other overloads lead here. This is a pure virtual function, implemented in subclasses.
 	 *
@@ -166,12 +159,15 @@ public:
 	 *
 	 * @param flags2 (optional) You can use NO_ACK or WITH_ACK if desired.
 	 *
+	 * @param priority (optional) The lane the event waits in (default: PUBLISH_PRIORITY_NORMAL)
+	 *
 	 * @return true if the event was queued or false if it was not.
 	 *
 	 * This function almost always returns true. If you queue more events than fit in the buffer the
-	 * oldest (sometimes second oldest) is discarded.
+	 * oldest (sometimes second oldest) of the lowest priority is discarded.
 	 */
-	virtual bool publishCommon(const char *eventName, const char *data, int ttl, PublishFlags flags1, PublishFlags flags2 = PublishFlags()) = 0;
+	virtual bool publishCommon(const char *eventName, const char *data, int ttl, PublishFlags flags1, PublishFlags flags2 = PublishFlags(),
+		PublishQueuePriority priority = PUBLISH_PRIORITY_NORMAL) = 0;
 
 	/**
 	 * @brief Sets the retry after publish failure time
@@ -182,6 +178,48 @@ public:
 	 */
 	inline PublishQueueAsyncBase &withFailureRetryMs(unsigned long value) { failureRetryMs = value; return *this; };
 
+	/**
+	 * @brief Sets the stack size of the worker thread
+	 *
+	 * @param value The size in bytes (default: 2048)
+	 *
+	 * Must be called before setup() (or the first publish if you don't call setup()). Use getThreadStackHeadroom()
+	 * on a device that has been running for a while to see how much could safely be given back.
+	 */
+	inline PublishQueueAsyncBase &withThreadStackSize(size_t value) { threadStackSize = value; return *this; };
+
+	/**
+	 * @brief Sends events of this name that are waiting together as one event
+	 *
+	 * @param eventName The event name. The string is not copied, so it must stay valid - normally a literal.
+	 *
+	 * @param separator Goes between the data of the events merged (default: newline)
+	 *
+	 * When the oldest event has this name, the events straight after it with the same name, flags and
+	 * priority are added to its data, each after the separator, while the data stays within
+	 * MAX_COALESCED_DATA bytes. They go out in one publish, so they take one slot of the publish rate
+	 * limit, and are removed together once it succeeds. The receiver splits the data at the separators,
+	 * so it should not appear in the data.
+	 *
+	 * Up to MAX_COALESCED names. Must be called before setup(). Queues that can't look past the oldest event
+	 * (see peekEvent()) send each event on its own.
+	 */
+	PublishQueueAsyncBase &withCoalescing(const char *eventName, char separator = '\n');
+
+	/**
+	 * @brief Gets the stack size of the worker thread
+	 */
+	size_t getThreadStackSize() const { return threadStackSize; };
+
+	/**
+	 * @brief Gets the part of the worker thread stack that has never been used
+	 *
+	 * The thread paints its stack with a known pattern when it starts, and this counts how much of the
+	 * pattern is still there at the bottom of the stack. It is a lower bound, as the top of the stack
+	 * (used before the thread function runs) is not painted. Returns 0 before the thread has started.
+	 */
+	size_t getThreadStackHeadroom() const;
+
 	/**
 	 * @brief Remove any saved events
 	 *
@@ -194,10 +232,27 @@ public:
 	 * @brief Get the oldest event that hasn't been published yet
 	 *
 	 * Returns a pointer to a PublishQueueEventData structure. This will remain valid until getOldestEvent()
-	 * is called again.
+	 * is called again. It is a copy in a buffer of EVENT_BUF_SIZE bytes, which the publish thread adds
+	 * the events coalesced with it to.
 	 */
 	virtual PublishQueueEventData *getOldestEvent() = 0;
 
+	/**
+	 * @brief Copy an event waiting to be sent into buf without removing it
+	 *
+	 * @param n 0 for the event getOldestEvent() returned, 1 for the next of the same priority and so on
+	 *
+	 * @param buf Where to copy the PublishQueueEventData and its strings - not aligned
+	 *
+	 * @param bufSize Bytes in buf
+	 *
+	 * @return false if there is no such event, it doesn't fit in buf, or the storage can't find it
+	 * without a search. The default never finds one, which turns off withCoalescing().
+	 *
+	 * Called from the publish thread with the mutex held.
+	 */
+	virtual bool peekEvent(uint16_t n, uint8_t *buf, size_t bufSize) { return false; };
+
 	/**
 	 * @brief Discards the oldest event or second oldest event
 	 *
@@ -235,6 +290,13 @@ public:
 	 */
 	bool getPausePublishing() const { return pausePublishing; };
 
+	/**
+	 * @brief Returns the number of event bytes (name and data) successfully published since setup
+	 *
+	 * This does not include the protocol overhead, but it's useful for estimating data usage.
+	 */
+	uint32_t getSentBytes() const { return sentBytes; };
+
 	/**
 	 * @brief Obtain a mutex lock
 	 *
@@ -266,6 +328,9 @@ public:
 	 */
 	static const size_t EVENT_BUF_SIZE = sizeof(PublishQueueEventData) + 65 + 623;
 
+	static const size_t MAX_COALESCED = 8;				//!< Event names for withCoalescing()
+	static const size_t MAX_COALESCED_DATA = 622;		//!< Longest data made by coalescing events
+
 protected:
 	/**
 	 * @brief The thread function for the publish thread
@@ -292,15 +357,32 @@ protected:
 	 */
 	void waitRetryState();
 
+	/**
+	 * @brief Add the events that can go out with the oldest one to its data, see withCoalescing()
+	 *
+	 * @param data From getOldestEvent()
+	 *
+	 * @return The events in the publish, 1 if none were added - also set in sendingEvents
+	 */
+	uint16_t coalesce(PublishQueueEventData *data);
+
 	/**
 	 * @brief Thread object, created in setup()
+	 *
+	 * Constructed in threadStorage rather than on the heap, so the queue object owns it. (The thread's stack
+	 * is still allocated by the RTOS when the thread starts.)
 	 */
 	Thread *thread = NULL;
 
 	/**
-	 * @brief Mutex to protect against concurrent access, created in setup()
+	 * @brief Storage for the thread object
+	 */
+	alignas(Thread) uint8_t threadStorage[sizeof(Thread)];
+
+	/**
+	 * @brief Mutex to protect against concurrent access, created in setup() unless a subclass needed it sooner
 	 */
-	os_mutex_t mutex;
+	os_mutex_t mutex = 0;
 
 	/**
 	 * @brief Default time to wait before trying to publish again after failure
@@ -312,9 +394,10 @@ protected:
 	/**
 	 * @brief State handler function pointer
 	 *
-	 * Set to startState, checkQueueState, or waitRetryState
+	 * Set to startState, checkQueueState, or waitRetryState. A plain member function pointer, as a std::function
+	 * can allocate when it is assigned.
 	 */
-	std::function<void(PublishQueueAsyncBase&)> stateHandler = &PublishQueueAsyncBase::startState;
+	void (PublishQueueAsyncBase::*stateHandler)() = &PublishQueueAsyncBase::startState;
 
 	/**
 	 * @brief Last millis value for certain state changes like waitRetryState
@@ -326,6 +409,11 @@ protected:
 	 */
 	unsigned long lastPublish = 0;
 
+	/**
+	 * @brief Number of event name and data bytes successfully published, see getSentBytes()
+	 */
+	uint32_t sentBytes = 0;
+
 	/**
 	 * @brief true if we're currently publishing
 	 *
@@ -334,6 +422,24 @@ protected:
 	 */
 	bool isSending = false;
 
+	/**
+	 * @brief The oldest events that are in the publish going out, while isSending
+	 *
+	 * Normally 1, more when events have been coalesced. A full queue drops the event after these to make room.
+	 */
+	uint16_t sendingEvents = 1;
+
+	/**
+	 * @brief An event name from withCoalescing()
+	 */
+	struct CoalesceRule {
+		const char *eventName;
+		char separator;
+	};
+
+	CoalesceRule coalesceRules[MAX_COALESCED];		//!< See withCoalescing()
+	size_t numCoalesceRules = 0;
+
 	/**
 	 * @brief True if setup() has been called.
 	 *
@@ -345,12 +451,33 @@ protected:
 	 * @brief True if publishing has been manually paused
 	 */
 	bool pausePublishing = false;
+
+	/**
+	 * @brief Stack size for the worker thread, see withThreadStackSize()
+	 */
+	size_t threadStackSize = 2048;
+
+	/**
+	 * @brief Lowest painted word of the worker thread stack, NULL until the thread starts
+	 */
+	volatile uint32_t *stackPaintBottom = NULL;
+
+	/**
+	 * @brief Word after the highest painted word of the worker thread stack
+	 */
+	volatile uint32_t *stackPaintTop = NULL;
+
+	static const uint32_t STACK_PAINT = 0xa5a5a5a5;		//!< Pattern painted on the unused stack
+	static const size_t STACK_ENTRY_RESERVE = 256;		//!< Top of the stack that may be in use when the thread function starts
+	static const size_t STACK_PAINT_GUARD = 64;			//!< Left unpainted below the painting function's own frame
 };
 
 /**
  * @brief Class to store the publish queue in retained memory.
  *
- * Also works for regular RAM, though it won't survive a reset or SLEEP_MODE_DEEP.
+ * Also works for regular RAM, though it won't survive a reset or SLEEP_MODE_DEEP. The buffer is a
+ * pool of blocks shared by the priorities (PublishQueueRing), so queueing, sending and dropping an
+ * event take the same time however large the buffer is.
  */
 class PublishQueueAsyncRetained : public PublishQueueAsyncBase {
 public:
@@ -362,7 +489,7 @@ public:
 	 *
 	 * @param retainedBuffer Pointer to the buffer in retained or regular memory
 	 *
-	 * @param retainedBufferSize Buffer size. Must be at least 704 bytes, but it's best for it to be
+	 * @param retainedBufferSize Buffer size. Must be at least 796 bytes, but it's best for it to be
 	 * at least 1024 bytes, and ideally larger than that.
 	 */
 	PublishQueueAsyncRetained(uint8_t *retainedBuffer, uint16_t retainedBufferSize);
@@ -387,17 +514,20 @@ public:
 	 *
 	 * @param flags2 (optional) You can use NO_ACK or WITH_ACK if desired.
 	 *
+	 * @param priority (optional) The lane the event waits in (default: PUBLISH_PRIORITY_NORMAL)
+	 *
 	 * @return true if the event was queued or false if it was not.
 	 *
 	 * This function almost always returns true. If you queue more events than fit in the buffer the
-	 * oldest (sometimes second oldest) is discarded.
+	 * oldest (sometimes second oldest) of the lowest priority is discarded.
 	 */
-	virtual bool publishCommon(const char *eventName, const char *data, int ttl, PublishFlags flags1, PublishFlags flags2 = PublishFlags());
+	virtual bool publishCommon(const char *eventName, const char *data, int ttl, PublishFlags flags1, PublishFlags flags2 = PublishFlags(),
+		PublishQueuePriority priority = PUBLISH_PRIORITY_NORMAL);
 
 	/**
 	 * @brief Get the oldest event that hasn't been published yet
 	 *
-	 * Returns a pointer to a PublishQueueEventData structure. This will remain valid until getOldestEvent()
+	 * Returns a pointer to a copy of it in publishBuf. This will remain valid until getOldestEvent()
 	 * is called again.
 	 */
 	virtual PublishQueueEventData *getOldestEvent();
@@ -415,33 +545,30 @@ public:
 	 *
 	 * @param secondEvent True to discard the second oldest event
 	 *
-	 * When using retained memory, the getOldestEvent() function returns a pointer to retained memory. This
-	 * pointer must remain valid while in the process of publishing. If the retained buffer is full, we
-	 * want to discard and old event to make room for a newer event, but we can't dispose of the oldest
-	 * event, because it may be in use, so we pass true for secondEvent.
+	 * If the retained buffer is full, we want to discard an old event to make room for a newer event,
+	 * but we can't dispose of the oldest event while it is being sent (it would be sent again), so we
+	 * pass true for secondEvent.
 	 */
 	bool discardOldEvent(bool secondEvent);
 
 	/**
-	 * @brief Given a pointer into the retained buffer, finds the offset of the next event
-	 *
-	 * @param start Where to start (pointer to RAM, not an offset)
-	 *
-	 * @returns A pointer to the beginning of the next event
+	 * @brief Get the number of events in the queue (0 = empty)
 	 */
-	uint8_t *skipEvent(uint8_t *start);
+	uint16_t getNumEvents() const;
 
 	/**
-	 * @brief Get the number of events in the queue (0 = empty)
+	 * @brief Copy an event waiting to be sent into buf, for coalescing
 	 */
-	uint16_t getNumEvents() const;
+	virtual bool peekEvent(uint16_t n, uint8_t *buf, size_t bufSize);
 
 
 protected:
-	uint8_t *retainedBuffer;		//!< Pointer to the beginning of the retained (or regular) RAM buffer
-	uint16_t retainedBufferSize;	//!< Size of the buffer in bytes. Must be at least 704 bytes!
-	uint8_t *nextFree = NULL;		//!< Pointer into the retained buffer for the next free space (where the next queued publish will be stored)
+	PublishQueueRing ring;			//!< The events, in the retained (or regular) RAM buffer
 
+	/**
+	 * @brief The event being published, copied out of the ring whole as it may wrap round the end
+	 */
+	uint32_t publishBuf[(EVENT_BUF_SIZE + 3) / 4];
 };
 
 /**
@@ -497,10 +624,61 @@ public:
 
 #if defined(__MB85RC256V_FRAM_RK) || defined(DOXYGEN_BUILD)
 
+/**
+ * @brief A PublishQueueRing in FRAM, for PublishQueueAsyncFRAM
+ *
+ * The header is kept in RAM and written to the FRAM after each change. Sending an event reads it
+ * once and drops it with a header write, and a link or two for the blocks it leaves, so the bus time
+ * per event doesn't grow with the queue.
+ */
+class PublishQueueFRAMRing : public PublishQueueRing {
+public:
+	/**
+	 * @brief The ring in len bytes of the FRAM from start - call load() once the FRAM is begun
+	 */
+	PublishQueueFRAMRing(MB85RC &fram, size_t start, uint16_t len) :
+		PublishQueueRing(&framHeader, len - sizeof(PublishQueueRingHeader)), fram(fram), start(start), len(len) {
+	}
+
+	/**
+	 * @brief Read the header, keeping the events if they check out
+	 *
+	 * @return true if the events were kept, false if the ring was started again
+	 */
+	bool load() {
+		if (!fram.readData(start, (uint8_t *)&framHeader, sizeof(PublishQueueRingHeader))) {
+			framHeader.magic = 0;
+		}
+		return begin(len);
+	}
+
+protected:
+	virtual void write(uint16_t offset, const void *src, size_t count) {
+		fram.writeData(start + sizeof(PublishQueueRingHeader) + offset, (const uint8_t *)src, count);
+	}
+
+	virtual void read(uint16_t offset, void *dst, size_t count) const {
+		fram.readData(start + sizeof(PublishQueueRingHeader) + offset, (uint8_t *)dst, count);
+	}
+
+	virtual void saveHeader() {
+		fram.writeData(start, (const uint8_t *)&framHeader, sizeof(PublishQueueRingHeader));
+	}
+
+	MB85RC &fram;
+	size_t start;
+	uint16_t len;
+	PublishQueueRingHeader framHeader;		//!< Copy of the header at start
+};
+
 /**
  * @brief Support for MB85RC256V-FRAM-RK library.
  *
  * If you include "MB85RC256V-FRAM-RK.h" before PublishQueueAsyncRK.h, this code will be enabled
+ *
+ * The events are in a pool of blocks in the FRAM (PublishQueueFRAMRing), so sending one reads it, the
+ * links of the blocks it leaves and then writes the 48 byte header, rather than moving the rest of the
+ * queue down over I2C.
  */
 class PublishQueueAsyncFRAM : public PublishQueueAsyncBase {
 public:
@@ -512,11 +690,10 @@ public:
 	 * @param start Optional start address, default is 0 (beginning of FRAM)
 	 *
 	 * @param len Optional length, default is size of FRAM. Note that this is a length relative to start, not an ending address.
+	 * At most 65532 bytes are used.
 	 */
-	PublishQueueAsyncFRAM(MB85RC &fram, size_t start = 0, size_t len = 0) : fram(fram), start(start), len(len) {
-		if (len == 0) {
-			len = fram.length() - start;
-		}
+	PublishQueueAsyncFRAM(MB85RC &fram, size_t start = 0, size_t len = 0) :
+		ring(fram, start, ringLength((len != 0) ? len : fram.length() - start)) {
 	}
 
 	/**
@@ -527,59 +704,25 @@ public:
 	}
 
 	virtual void setup() {
-		// Do superclass setup (starting the thread)
-		PublishQueueAsyncBase::setup();
-
-		// Initialize the retained buffer
-		bool initBuffer = false;
-
-		if (!fram.readData(start, (uint8_t *)&header, sizeof(PublishQueueHeader))) {
-			pubqLogger.error("failed to read FRAM");
-			return;
-		}
-
-		if (header.magic == PUBLISH_QUEUE_HEADER_MAGIC && header.size == len) {
-			// Calculate the next write offset
+		// Load the ring under the mutex before the thread that sends from it is started
+		os_mutex_create(&mutex);
+		{
+			StMutexLock lock(this);
 
-			nextFree = start + sizeof(PublishQueueHeader);
-			for(uint16_t ii = 0; ii < header.numEvents; ii++) {
-				nextFree = skipEvent(nextFree, eventBuf);
-				if (nextFree > (start + len)) {
-					// Overflowed buffer, must be corrupted
-					// pubqLogger.info("FRAM contents invalid, reinitializing");
-					initBuffer = true;
-					break;
-				}
+			if (ring.load()) {
+				pubqLogger.info("FRAM numEvents=%u", ring.getNumEvents());
 			}
-		}
-		else {
-			// Not valid
-			initBuffer = true;
-			// pubqLogger.info("No magic bytes or invalid length");
-		}
-
-		// initBuffer = true; // Uncomment to discard old data
-
-		if (initBuffer) {
-			header.magic = PUBLISH_QUEUE_HEADER_MAGIC;
-			header.size = len;
-			header.numEvents = 0;
-			if (!fram.writeData(start, (uint8_t *)&header, sizeof(PublishQueueHeader))) {
-				pubqLogger.error("failed to write FRAM");
-				return;
+			else {
+				pubqLogger.info("FRAM reinitialized");
 			}
-
-			nextFree = start + sizeof(PublishQueueHeader);
-			pubqLogger.info("FRAM reinitialized start=%u len=%u", start, len);
-		}
-		else {
-			pubqLogger.info("FRAM numEvents=%u nextFree=%u", header.numEvents, nextFree);
 		}
 
-		haveSetup = true;
+		// Do superclass setup (starting the thread)
+		PublishQueueAsyncBase::setup();
 	}
 
-	virtual bool publishCommon(const char *eventName, const char *data, int ttl, PublishFlags flags1, PublishFlags flags2 = PublishFlags()) {
+	virtual bool publishCommon(const char *eventName, const char *data, int ttl, PublishFlags flags1, PublishFlags flags2 = PublishFlags(),
+			PublishQueuePriority priority = PUBLISH_PRIORITY_NORMAL) {
 		if (!haveSetup) {
 			return false;
 		}
@@ -588,71 +731,12 @@ public:
 			data = "";
 		}
 
-		// Size is the size of the header, the two c-strings (with null terminators), rounded up to a multiple of 4
-		size_t size = sizeof(PublishQueueEventData) + strlen(eventName) + strlen(data) + 2;
-		if ((size % 4) != 0) {
-			size += 4 - (size % 4);
-		}
-
-		// pubqLogger.info("queueing eventName=%s data=%s ttl=%d flags1=%d flags2=%d size=%d", eventName, data, ttl, flags1.value(), flags2.value(), size);
-
-		if  (size > (len - sizeof(PublishQueueHeader))) {
-			// Special case: event is larger than the FRAM. Rather than throw out all events
-			// before discovering this, check that case first
-			return false;
-		}
-
-		while(true) {
-			{
-				StMutexLock lock(this);
-
-				if ((start + len - nextFree) >= size) {
-					// There is room to fit this
-					// pubqLogger.info("writing event nextFree=%u size=%u", nextFree, size);
-
-					PublishQueueEventData *eventData = (PublishQueueEventData *)eventBuf;
-					eventData->ttl = ttl;
-					eventData->flags = flags1.value() | flags2.value();
-
-					char *cp = (char *) eventBuf;
-					cp += sizeof(PublishQueueEventData);
-
-					strcpy(cp, eventName);
-					cp += strlen(cp) + 1;
-
-					strcpy(cp, data);
-
-					fram.writeData(nextFree, (uint8_t *)&eventBuf, size);
-
-					nextFree += size;
-					header.numEvents++;
-					fram.writeData(start, (uint8_t *)&header, sizeof(PublishQueueHeader));
-
-					// pubqLogger.info("after writing nextFree=%u numEvents=%u", nextFree, header.numEvents);
-
-					return true;
-				}
-
-				pubqLogger.info("need to discard event, FRAM is full");
-
-				// If there's only one event, there's nothing left to discard, this event is too large
-				// to fit with the existing first event (which we can't delete because it might be
-				// in the process of being sent)
-				if (header.numEvents == 1) {
-					return false;
-				}
-			}
+		// pubqLogger.info("queueing eventName=%s data=%s ttl=%d flags1=%d flags2=%d", eventName, data, ttl, flags1.value(), flags2.value());
 
-			// Discard the oldest event (false) if we're not currently sending.
-			// If we are sending (isSending=true), discard the second oldest event
-			if (!discardOldEvent(isSending)) {
-				// There isn't an event to discard, so we don't have enough room
-				return false;
-			}
-		}
+		StMutexLock lock(this);
 
-		// Not reached
-		return false;
+		// If the ring is full, discard the oldest event of the lowest priority, not one of those being sent
+		return ring.push(eventName, data, ttl, flags1.value() | flags2.value(), priority, (isSending) ? sendingEvents : 0);
 	}
 
 	/**
@@ -664,16 +748,9 @@ public:
 	virtual PublishQueueEventData *getOldestEvent() {
 		StMutexLock lock(this);
 
-		if (header.numEvents == 0) {
+		if (!ring.front((uint8_t *)publishBuf)) {
 			return NULL;
 		}
-
-		size_t addr = start + sizeof(PublishQueueHeader);
-		skipEvent(addr, publishBuf);
-
-		// skipEvent will leave the event in publishBuf, which we then return
-		// pubqLogger.trace("getOldestEvent found an event");
-
 		return (PublishQueueEventData *)publishBuf;
 	}
 
@@ -686,8 +763,7 @@ public:
 	 */
 	virtual bool clearEvents() {
 		StMutexLock lock(this);
-		header.numEvents = 0;
-		fram.writeData(start, (uint8_t *)&header, sizeof(PublishQueueHeader));
+		ring.clear();
 		return true;
 	}
 
@@ -696,89 +772,19 @@ public:
 	 *
 	 * @param secondEvent True to discard the second oldest event
 	 *
-	 * When using retained memory, the getOldestEvent() function returns a pointer to retained memory. This
-	 * pointer must remain valid while in the process of publishing. If the retained buffer is full, we
-	 * want to discard and old event to make room for a newer event, but we can't dispose of the oldest
-	 * event, because it may be in use, so we pass true for secondEvent.
+	 * The oldest event may be in the process of being sent, so when the FRAM is full and isSending is
+	 * set the second oldest is discarded instead.
 	 */
 	virtual bool discardOldEvent(bool secondEvent) {
-
 		StMutexLock lock(this);
-
-		if (header.numEvents == 0) {
-			return false;
-		}
-
-		size_t addr = start + sizeof(PublishQueueHeader);
-		size_t prevAddr = addr;
-
-
-		uint16_t ii = 1;
-
-		// Skip the first event
-		addr = skipEvent(addr, eventBuf);
-
-		// If we're currently publishing, delete the second event instead
-		if (secondEvent) {
-			if (header.numEvents == 1) {
-				// Only have one event so we can't delete the second event
-				return false;
-			}
-			prevAddr = addr;
-			addr = skipEvent(addr, eventBuf);
-			ii++;
-		}
-
-		// pubqLogger.info("discardOldEvent secondEvent=%d prevAddr=%u addr=%u nextFree=%u", secondEvent, prevAddr, addr, nextFree); // TEMPORARY
-
-		if (nextFree > addr) {
-			// pubqLogger.info("moveData from %u to %u len=%u", addr, prevAddr, nextFree - addr);
-			fram.moveData(addr, prevAddr, nextFree - addr);
-		}
-		nextFree -= (addr - prevAddr);
-
-		header.numEvents--;
-		fram.writeData(start, (uint8_t *)&header, sizeof(PublishQueueHeader));
-
-		// pubqLogger.info("after numEvents=%u nextFree=%u", header.numEvents, nextFree); // TEMPORARY
-
-		return true;
+		return ring.discard(secondEvent);
 	}
 
 	/**
-	 * @brief Given an address in FRAM, finds the offset of the next event
-	 *
-	 * @param addr Where to start (address in FRAM, not relative to start!)
-	 *
-	 * @param buf Buffer to store the event in. Typically either eventBuf or publishBuf.
-	 *
-	 * @returns Address of the the next event
+	 * @brief Copy an event waiting to be sent into buf, for coalescing
 	 */
-	size_t skipEvent(size_t addr, uint8_t *buf) {
-		// Read event at start
-		size_t count = (start + len) - addr;
-		if (count > EVENT_BUF_SIZE) {
-			count = EVENT_BUF_SIZE;
-		}
-
-		fram.readData(addr, buf, count);
-
-		// pubqLogger.info("skipEvent addr=%u ttl=%d flags=%02x", addr, ((PublishQueueEventData *)buf)->ttl, ((PublishQueueEventData *)buf)->flags);
-
-		size_t next = addr;
-
-		next += sizeof(PublishQueueEventData);
-		next += strlen((const char *)&buf[next - addr]) + 1;
-		next += strlen((const char *)&buf[next - addr]) + 1;
-
-		// Align
-		if ((next % 4) != 0) {
-			next += 4 - (next % 4);
-		}
-
-		// pubqLogger.trace("skipEvent addr=%u next=%u", addr, next);
-
-		return next;
+	virtual bool peekEvent(uint16_t n, uint8_t *buf, size_t bufSize) {
+		return ring.peek(n, buf, bufSize);
 	}
 
 	/**
@@ -790,7 +796,7 @@ public:
 		{
 			StMutexLock lock(this);
 
-			numEvents = header.numEvents;
+			numEvents = ring.getNumEvents();
 		}
 
 		return numEvents;
@@ -798,36 +804,22 @@ public:
 
 
 protected:
-	MB85RC &fram;		//!< Object for the FRAM
-	size_t start;		//!< Start offset (0 = beginning of FRAM)
-	size_t len;			//!< Length to use (relative to start!)
-
 	/**
-	 * @brief The header, copied from FRAM
+	 * @brief Header and event offsets are 16 bits, and the ring is a whole number of 4 byte words
 	 */
-	PublishQueueHeader header;
+	static uint16_t ringLength(size_t len) {
+		return (uint16_t)(((len < 0xffff) ? len : 0xffff) & ~(size_t)3);
+	}
 
-	/**
-	 * @brief This holds a single event during scanning and writing.
-	 *
-	 * Because the data needs to be in RAM to be written to FRAM, this buffer is required.
-	 */
-	uint8_t eventBuf[EVENT_BUF_SIZE];
+	PublishQueueFRAMRing ring;		//!< The events, in the FRAM
 
 	/**
 	 * @brief This holds a single event during publish.
 	 *
 	 * Because the publish code does not copy the data, we need to keep the data around
 	 * even after getOldestEvent() returns. This is the buffer that holds the data.
-	 *
-	 * It's separate from eventBuf because eventBuf is used to publish new data to the queue.
 	 */
-	uint8_t publishBuf[EVENT_BUF_SIZE];
-
-	/**
-	 * @brief Offset of the next free entry in FRAM. This includes "start" so don't add it again!
-	 */
-	size_t nextFree = 0;
+	uint32_t publishBuf[(EVENT_BUF_SIZE + 3) / 4];
 };
 
 #endif /* __MB85RC256V_FRAM_RK */
@@ -941,6 +933,94 @@ public:
 	PublishQueueAsyncFileSystemBase *fs;
 };
 
+/**
+ * @brief Magic bytes for an events file where each event is marked once it has been sent
+ *
+ * A file with PUBLISH_QUEUE_HEADER_MAGIC sent its events in order and only counted them, so setup()
+ * marks the ones it counted and rewrites the header with this.
+ */
+static const uint32_t PUBLISH_QUEUE_FILE_MAGIC = 0xd19cab64;
+
+/**
+ * @brief File offsets of the oldest events of one priority waiting to be sent
+ *
+ * The events of a priority are spread through the events file among the others, so each lane lists
+ * the offsets of its oldest PUBLISH_QUEUE_INDEX_SIZE events. Events added while the list is full are
+ * only counted; the queue finds them as the list drains by reading event headers on from
+ * getScanFrom(), passing over those of other priorities and those already sent.
+ */
+class PublishQueueFileLane {
+public:
+	void clear() {
+		first = count = unlisted = 0;
+		scanFrom = 0;
+	}
+
+	/**
+	 * @brief A new event at offset, after all the others - next is the offset after it
+	 */
+	void add(size_t offset, size_t next) {
+		if (count < PUBLISH_QUEUE_INDEX_SIZE && unlisted == 0) {
+			offsets[(first + count++) % PUBLISH_QUEUE_INDEX_SIZE] = offset;
+			scanFrom = next;
+		}
+		else {
+			unlisted++;
+		}
+	}
+
+	/**
+	 * @brief Offset of a listed event, 0 for the oldest - n must be less than getCount()
+	 */
+	size_t offsetOf(uint16_t n) const { return offsets[(first + n) % PUBLISH_QUEUE_INDEX_SIZE]; };
+
+	/**
+	 * @brief The oldest event has been sent
+	 */
+	void removeFirst() {
+		first = (first + 1) % PUBLISH_QUEUE_INDEX_SIZE;
+		count--;
+	}
+
+	/**
+	 * @brief true if fewer than events are listed, but there are more events and room for them
+	 */
+	bool needsRefill(uint16_t events) const { return count < events && count < PUBLISH_QUEUE_INDEX_SIZE && unlisted > 0; };
+
+	/**
+	 * @brief Where to read on from for the oldest event that isn't listed
+	 */
+	size_t getScanFrom() const { return scanFrom; };
+
+	/**
+	 * @brief List the event found at offset
+	 */
+	void refill(size_t offset, size_t next) {
+		unlisted--;
+		offsets[(first + count++) % PUBLISH_QUEUE_INDEX_SIZE] = offset;
+		scanFrom = next;
+	}
+
+	/**
+	 * @brief Pass over an event of another priority, or one already sent
+	 */
+	void skip(size_t next) { scanFrom = next; };
+
+	uint16_t getCount() const { return count; };
+
+	/**
+	 * @brief Events waiting, listed or not
+	 */
+	uint16_t getNumEvents() const { return count + unlisted; };
+
+protected:
+	uint32_t offsets[PUBLISH_QUEUE_INDEX_SIZE];
+	uint16_t first = 0;					//!< Entry for the oldest event
+	uint16_t count = 0;					//!< Events listed
+	uint16_t unlisted = 0;				//!< Events after those, not listed
+	size_t scanFrom = 0;				//!< After the last event listed or passed over
+};
+
 /**
  * @brief Abstract class for file system-based events storage (SPIFFS, SdCard, etc.)
  *
@@ -966,9 +1046,16 @@ public:
  * When a publish is queued, the event is appeneded to the file and the numEvents in the
  * header updated.
  *
- * When a publish is completed, the size in the header (actually, the number of events sent)
- * is incremented. If size == numEvents, then both are set to 0 and the file truncated
- * to the size of the file header.
+ * Events are sent highest priority first, so they don't leave the file in the order they went in.
+ * When a publish is completed, the event is marked as sent where it is (reserved2 in its header)
+ * and the size in the header (actually, the number of events sent) is incremented. Nothing is
+ * moved. If size == numEvents, then both are set to 0 and the file truncated to the size of the
+ * file header. setup() counts the marks again, so a reset between the mark and the header write
+ * loses nothing.
+ *
+ * The offsets of the events waiting to be sent are kept for each priority in a PublishQueueFileLane,
+ * built by the check in setup(), so getOldestEvent() reads just the event it sends. The file only
+ * grows, so nothing is ever discarded to make room.
  *
  * The reason for this is that unlike RAM or FRAM, it's really inefficient to remove
  * data from the beginning of the file. Since the most common situation is that a
@@ -1012,9 +1099,11 @@ public:
 				pubqLogger.info("no data in events file, will generate new");
 			}
 
-			if (!initBuffer && header.magic == PUBLISH_QUEUE_HEADER_MAGIC) {
+			if (!initBuffer && (header.magic == PUBLISH_QUEUE_FILE_MAGIC || header.magic == PUBLISH_QUEUE_HEADER_MAGIC)) {
 				pubqLogger.trace("numEvents=%u numSent=%u", header.numEvents, header.size);
-				oldestPos = sizeof(PublishQueueHeader);
+
+				// A file from before the marks - its events were sent in order and counted in size
+				bool marking = (header.magic == PUBLISH_QUEUE_HEADER_MAGIC);
 
 				if (header.numEvents == header.size) {
 					pubqLogger.info("all events have been sent, reinitializing");
@@ -1022,23 +1111,43 @@ public:
 				}
 				else
 				if (header.numEvents > 0) {
-					// Calculate the offset of the oldest event and validate the file structure
+					// Validate the file structure, count the events sent and list the others by priority
 					size_t addr = sizeof(PublishQueueHeader);
+					uint16_t numSent = 0;
+					clearLanes();
 					for(uint16_t ii = 0; ii < header.numEvents; ii++) {
 						size_t next = skipEvent(addr, eventBuf);
-						if (addr == 0) {
+						if (next == 0) {
 							// Overflowed buffer, must be corrupted
 							pubqLogger.info("Overflowed buffer on initial read, reinitializing");
 							initBuffer = true;
 							break;
 						}
-						if (ii == header.size) {
-							oldestPos = addr;
+						PublishQueueEventData *event = (PublishQueueEventData *)eventBuf;
+						if (marking) {
+							event->reserved2 = (ii < header.size) ? SENT_MARK : 0;
+							writeBytes(addr + offsetof(PublishQueueEventData, reserved2), (const uint8_t *)&event->reserved2, sizeof(uint16_t));
+						}
+						if (event->reserved2 != 0) {
+							numSent++;
+						}
+						else {
+							lanes[eventPriority(eventBuf)].add(addr, next);
 						}
 						addr = next;
 					}
+					if (!initBuffer && numSent == header.numEvents) {
+						pubqLogger.info("all events have been sent, reinitializing");
+						initBuffer = true;
+					}
+					if (!initBuffer && (marking || numSent != header.size)) {
+						// Marked but not counted before a reset, or marked just now
+						header.magic = PUBLISH_QUEUE_FILE_MAGIC;
+						header.size = numSent;
+						writeBytes(0, (uint8_t *)&header, sizeof(PublishQueueHeader));
+					}
 					if (!initBuffer) {
-						pubqLogger.info("file data looks valid oldestPos=%u", oldestPos);
+						pubqLogger.info("file data looks valid");
 					}
 				}
 			}
@@ -1055,7 +1164,7 @@ public:
 				truncate(0);
 
 				// For file system queues, size is not the size in bytes, but the number of events that have already been sent!
-				header.magic = PUBLISH_QUEUE_HEADER_MAGIC;
+				header.magic = PUBLISH_QUEUE_FILE_MAGIC;
 				header.size = 0;
 				header.numEvents = 0;
 				if (!writeBytes(0, (uint8_t *)&header, sizeof(PublishQueueHeader))) {
@@ -1063,11 +1172,11 @@ public:
 					return;
 				}
 
-				oldestPos = sizeof(PublishQueueHeader);
+				clearLanes();
 				pubqLogger.info("initialized events file");
 			}
 			else {
-				pubqLogger.info("using events file with size=%u numEvents=%u oldestPos=%u", header.size, header.numEvents, oldestPos);
+				pubqLogger.info("using events file with size=%u numEvents=%u", header.size, header.numEvents);
 			}
 		}
 
@@ -1077,8 +1186,9 @@ public:
 	/**
 	 * @brief Append the publish data to the events file
 	 */
-	virtual bool publishCommon(const char *eventName, const char *data, int ttl, PublishFlags flags1, PublishFlags flags2 = PublishFlags()) {
-		if (!haveSetup) {
+	virtual bool publishCommon(const char *eventName, const char *data, int ttl, PublishFlags flags1, PublishFlags flags2 = PublishFlags(),
+			PublishQueuePriority priority = PUBLISH_PRIORITY_NORMAL) {
+		if (!haveSetup || priority >= PUBLISH_QUEUE_PRIORITIES) {
 			return false;
 		}
 
@@ -1102,6 +1212,8 @@ public:
 		PublishQueueEventData *eventData = (PublishQueueEventData *)eventBuf;
 		eventData->ttl = ttl;
 		eventData->flags = flags1.value() | flags2.value();
+		eventData->reserved1 = priority;
+		eventData->reserved2 = 0;
 
 		char *cp = (char *) eventBuf;
 		cp += sizeof(PublishQueueEventData);
@@ -1112,11 +1224,13 @@ public:
 		strcpy(cp, data);
 
 		// Append to file (-1)
+		size_t addr = (size_t) getLength();
 		writeBytes(-1, (uint8_t *)&eventBuf, size);
 
 		// Update the file header
 		header.numEvents++;
 		writeBytes(0, (uint8_t *)&header, sizeof(PublishQueueHeader));
+		lanes[priority].add(addr, addr + size);
 
 		pubqLogger.trace("after writing numEvents=%u fileLength=%d", header.numEvents, getLength());
 
@@ -1125,10 +1239,12 @@ public:
 	}
 
 	/**
-	 * @brief Get the oldest event that hasn't been published yet
+	 * @brief Get the oldest event of the highest priority that hasn't been published yet
 	 *
 	 * Returns a pointer to a PublishQueueEventData structure in the publishBuf member variable.
-	 * This will remain valid until getOldestEvent() is called again.
+	 * This will remain valid until getOldestEvent() is called again. The same event is returned
+	 * until discardOldEvent() is called, so a failed publish is tried again, unless an event of a
+	 * higher priority is queued in the meantime.
 	 */
 	virtual PublishQueueEventData *getOldestEvent() {
 		StMutexLock lock(this);
@@ -1140,17 +1256,16 @@ public:
 		{
 			StFileOpenClose openClose(this);
 
-			size_t next = skipEvent(oldestPos, publishBuf);
-			if (next == 0) {
-				// pubqLogger.trace("getOldestEvent failed, oldestPos=%u, clearing events", oldestPos);
+			sendLane = PUBLISH_QUEUE_PRIORITIES - 1;
+			while(sendLane > 0 && lanes[sendLane].getNumEvents() == 0) {
+				sendLane--;
+			}
+			refillLane(sendLane, 1);
+			if (lanes[sendLane].getCount() == 0 || skipEvent(lanes[sendLane].offsetOf(0), publishBuf) == 0) {
+				// pubqLogger.trace("getOldestEvent failed, sendLane=%u", sendLane);
 				return NULL;
 			}
 
-			// skipEvent will leave the event in publishBuf, which we then return
-			// pubqLogger.trace("getOldestEvent found an event at oldestPos=%u, next=%u", oldestPos, next);
-
-			oldestPos = next;
-
 			return (PublishQueueEventData *)publishBuf;
 		}
 	}
@@ -1168,13 +1283,14 @@ public:
 			StFileOpenClose openClose(this);
 
 			header.numEvents = header.size = 0;
+			clearLanes();
 			writeBytes(0, (uint8_t *)&header, sizeof(PublishQueueHeader));
 			return truncate(sizeof(PublishQueueHeader));
 		}
 	}
 
 	/**
-	 * @brief Discard an event
+	 * @brief Discard the event getOldestEvent() returned, marking it as sent
 	 *
 	 * Note: secondEvent will never be true for file systems, which always append an event
 	 */
@@ -1182,26 +1298,101 @@ public:
 
 		StMutexLock lock(this);
 
-		if (header.numEvents == 0) {
+		if (header.size >= header.numEvents) {
 			return false;
 		}
 
 		{
 			StFileOpenClose openClose(this);
 
+			refillLane(sendLane, 1);
+			PublishQueueFileLane &lane = lanes[sendLane];
+			if (lane.getCount() == 0) {
+				return false;
+			}
+			// Marked where it is - the header is written after, so a reset in between only leaves the count behind
+			uint16_t sent = SENT_MARK;
+			writeBytes(lane.offsetOf(0) + offsetof(PublishQueueEventData, reserved2), (const uint8_t *)&sent, sizeof(sent));
+			lane.removeFirst();
+
 			header.size++;
 			if (header.size == header.numEvents) {
 				// pubqLogger.trace("sent all events, truncating file");
 				header.size = header.numEvents = 0;
-				oldestPos = sizeof(PublishQueueHeader);
-				truncate(oldestPos);
+				clearLanes();
+				truncate(sizeof(PublishQueueHeader));
 			}
 			writeBytes(0, (uint8_t *)&header, sizeof(PublishQueueHeader));
 
 			//pubqLogger.trace("discardOldestEvent numEvents=%u numSent=%u fileLength=%d", header.numEvents, header.size, getLength());
 
+			return true;
+		}
+	}
+
+	/**
+	 * @brief Copy an event of the priority being sent into buf, for coalescing
+	 *
+	 * Only events whose offsets are listed are copied. Called with the mutex held.
+	 */
+	virtual bool peekEvent(uint16_t n, uint8_t *buf, size_t bufSize) {
+		if (n >= lanes[sendLane].getNumEvents()) {
+			return false;
+		}
+
+		StFileOpenClose openClose(this);
+
+		refillLane(sendLane, n + 1);
+		if (n >= lanes[sendLane].getCount()) {
+			return false;
+		}
+		size_t addr = lanes[sendLane].offsetOf(n);
+		size_t next = skipEvent(addr, eventBuf);
+		if (next == 0 || next - addr > bufSize) {
 			return false;
 		}
+		memcpy(buf, eventBuf, next - addr);
+		return true;
+	}
+
+	/**
+	 * @brief Find the offsets of events queued while a lane's list was full, as it drains
+	 *
+	 * Note: You must obtain a mutex lock and open the events file before calling this!
+	 */
+	void refillLane(uint8_t priority, uint16_t events) {
+		PublishQueueFileLane &lane = lanes[priority];
+		while(lane.needsRefill(events)) {
+			size_t addr = lane.getScanFrom();
+			size_t next = skipEvent(addr, eventBuf);
+			if (next == 0) {
+				// Past the end - the file doesn't hold what the header says
+				break;
+			}
+			if (((const PublishQueueEventData *)eventBuf)->reserved2 == 0 && eventPriority(eventBuf) == priority) {
+				lane.refill(addr, next);
+			}
+			else {
+				lane.skip(next);
+			}
+		}
+	}
+
+	/**
+	 * @brief Forget the events in every lane
+	 */
+	void clearLanes() {
+		for(uint8_t priority = 0; priority < PUBLISH_QUEUE_PRIORITIES; priority++) {
+			lanes[priority].clear();
+		}
+	}
+
+	/**
+	 * @brief Priority of an event read into buf - files written before priorities may have anything there
+	 */
+	static uint8_t eventPriority(const uint8_t *buf) {
+		uint8_t priority = ((const PublishQueueEventData *)buf)->reserved1;
+		return (priority < PUBLISH_QUEUE_PRIORITIES) ? priority : (uint8_t)PUBLISH_PRIORITY_LOW;
 	}
 
 	/**
@@ -1288,11 +1479,18 @@ protected:
 	uint8_t publishBuf[EVENT_BUF_SIZE];
 
 	/**
-	 * @brief Offset in the file for the oldest event. We begin publishing at this offset.
+	 * @brief Offsets of the events waiting to be sent, for each priority
 	 *
-	 * This is set in setup() and updated in discardOldEvent().
+	 * These are set in setup() and updated in publishCommon() and discardOldEvent().
 	 */
-	size_t oldestPos = 0;
+	PublishQueueFileLane lanes[PUBLISH_QUEUE_PRIORITIES];
+
+	/**
+	 * @brief Priority of the event getOldestEvent() last returned
+	 */
+	uint8_t sendLane = PUBLISH_QUEUE_PRIORITIES - 1;
+
+	static const uint16_t SENT_MARK = 1;		//!< In reserved2 of an event in the file once it has been sent
 };
 
 #endif /* PUBLISH_QUEUE_USE_FS */
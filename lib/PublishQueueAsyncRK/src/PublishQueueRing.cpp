@@ -0,0 +1,459 @@
+#include "PublishQueueRing.h"
+
+#include <string.h>
+
+void PublishQueueIndex::clear() {
+	first = count = unindexed = 0;
+	indexedBytes = 0;
+}
+
+void PublishQueueIndex::add(uint16_t size) {
+	if (count < PUBLISH_QUEUE_INDEX_SIZE && unindexed == 0) {
+		entries[(first + count++) % PUBLISH_QUEUE_INDEX_SIZE] = size;
+		indexedBytes += size;
+	}
+	else {
+		unindexed++;
+	}
+}
+
+size_t PublishQueueIndex::offsetOf(uint16_t index) const {
+	size_t offset = 0;
+	for(uint16_t ii = 0; ii < index; ii++) {
+		offset += sizeOf(ii);
+	}
+	return offset;
+}
+
+void PublishQueueIndex::remove(uint16_t index) {
+	indexedBytes -= sizeOf(index);
+	// The sizes of the events before it move up one entry
+	for(uint16_t ii = index; ii > 0; ii--) {
+		entries[(first + ii) % PUBLISH_QUEUE_INDEX_SIZE] = sizeOf(ii - 1);
+	}
+	first = (first + 1) % PUBLISH_QUEUE_INDEX_SIZE;
+	count--;
+}
+
+void PublishQueueIndex::refill(uint16_t size) {
+	unindexed--;
+	entries[(first + count++) % PUBLISH_QUEUE_INDEX_SIZE] = size;
+	indexedBytes += size;
+}
+
+PublishQueueRing::PublishQueueRing(uint8_t *buffer, uint16_t bufferSize) :
+		PublishQueueRing(reinterpret_cast<PublishQueueRingHeader *>(buffer), bufferSize - sizeof(PublishQueueRingHeader)) {
+	data = &buffer[sizeof(PublishQueueRingHeader)];
+	begin(bufferSize);
+}
+
+PublishQueueRing::PublishQueueRing(PublishQueueRingHeader *header, uint16_t capacity) : header(header), data(NULL), capacity(capacity) {
+	numBlocks = capacity / (BLOCK_SIZE + sizeof(uint16_t));
+	blocksStart = numBlocks * sizeof(uint16_t);
+}
+
+bool PublishQueueRing::begin(uint16_t size) {
+	if (header->magic == PUBLISH_QUEUE_RING_MAGIC && header->size == size && header->blockSize == BLOCK_SIZE && check()) {
+		return true;
+	}
+	// Not valid, or an old layout, or corrupted
+	header->magic = PUBLISH_QUEUE_RING_MAGIC;
+	header->size = size;
+	header->blockSize = BLOCK_SIZE;
+	clear();
+	return false;
+}
+
+size_t PublishQueueRing::eventSize(const char *eventName, const char *data) {
+	// Size is the size of the header, the two c-strings (with null terminators), rounded up to a multiple of 4
+	size_t size = sizeof(PublishQueueEventData) + strlen(eventName) + strlen(data) + 2;
+	if ((size % 4) != 0) {
+		size += 4 - (size % 4);
+	}
+	return size;
+}
+
+bool PublishQueueRing::push(const char *eventName, const char *eventData, int ttl, uint8_t flags, uint8_t priority, uint16_t keep) {
+	size_t size = eventSize(eventName, eventData);
+	if (priority >= PUBLISH_QUEUE_PRIORITIES || size > EVENT_BUF_SIZE || (size + BLOCK_SIZE - 1) / BLOCK_SIZE > numBlocks) {
+		return false;
+	}
+
+	while(header->freeBlocks < blocksNeeded(priority, size)) {
+		// The oldest event of the lowest priority, up to the new event's own - but not the events being sent
+		uint8_t lane = 0;
+		while(lane <= priority && header->lanes[lane].numEvents <= ((lane == sendLane) ? keep : 0)) {
+			lane++;
+		}
+		if (lane > priority || !discardFrom(lane, (lane == sendLane) ? keep : 0)) {
+			return false;
+		}
+	}
+
+	PublishQueueRingLane &lane = header->lanes[priority];
+	uint16_t need = blocksNeeded(priority, size);
+	uint16_t block, offset;
+	if (lane.numEvents == 0) {
+		block = header->freeHead;
+		offset = 0;
+		lane.head = block * BLOCK_SIZE;
+	}
+	else {
+		block = (lane.tail - 1) / BLOCK_SIZE;
+		offset = lane.tail - block * BLOCK_SIZE;
+		if (need > 0) {
+			// Past the end of the chain until the header is saved
+			setLink(block, header->freeHead);
+		}
+	}
+
+	PublishQueueEventData event;
+	event.ttl = ttl;
+	event.flags = flags;
+	event.reserved1 = priority;
+	event.reserved2 = (uint16_t)size;
+	streamWrite(block, offset, &event, sizeof(event));
+	streamWrite(block, offset, eventName, strlen(eventName) + 1);
+	streamWrite(block, offset, eventData, strlen(eventData) + 1);
+	static const uint8_t padding[3] = {0, 0, 0};
+	streamWrite(block, offset, padding, size - sizeof(event) - strlen(eventName) - strlen(eventData) - 2);
+
+	if (need > 0) {
+		header->freeBlocks -= need;
+		if (header->freeBlocks > 0) {
+			header->freeHead = link(block);
+		}
+	}
+	lane.tail = block * BLOCK_SIZE + offset;
+	lane.bytes += size;
+	lane.numEvents++;
+	header->numEvents++;
+	saveHeader();
+
+	index[priority].add((uint16_t)size);
+	if (index[priority].getIndexedBytes() == lane.bytes) {
+		// Every event is indexed, so the next one to be refilled will start here
+		refillBlock[priority] = block;
+		refillOffset[priority] = offset;
+		refillValid[priority] = true;
+	}
+	return true;
+}
+
+bool PublishQueueRing::front(uint8_t *buf) {
+	if (header->numEvents == 0) {
+		return false;
+	}
+	sendLane = PUBLISH_QUEUE_PRIORITIES - 1;
+	while(header->lanes[sendLane].numEvents == 0) {
+		sendLane--;
+	}
+	refillIndex(sendLane);
+	laneRead(sendLane, 0, buf, index[sendLane].sizeOf(0));
+	return true;
+}
+
+bool PublishQueueRing::peek(uint16_t n, uint8_t *buf, size_t bufSize) {
+	refillIndex(sendLane, n + 1);
+	const PublishQueueIndex &laneIndex = index[sendLane];
+	if (n >= laneIndex.getCount() || laneIndex.sizeOf(n) > bufSize) {
+		return false;
+	}
+	laneRead(sendLane, laneIndex.offsetOf(n), buf, laneIndex.sizeOf(n));
+	return true;
+}
+
+bool PublishQueueRing::discard(uint16_t keep) {
+	return discardFrom(sendLane, keep);
+}
+
+bool PublishQueueRing::discardFrom(uint8_t priority, uint16_t keep) {
+	PublishQueueRingLane &lane = header->lanes[priority];
+	if (lane.numEvents <= keep) {
+		return false;
+	}
+	refillIndex(priority, keep + 1);
+	PublishQueueIndex &laneIndex = index[priority];
+	if (keep >= laneIndex.getCount()) {
+		// Only events whose sizes are indexed are kept - more than PUBLISH_QUEUE_INDEX_SIZE are never sent at once
+		return false;
+	}
+
+	uint16_t size = laneIndex.sizeOf(keep);
+	if (keep > 0) {
+		// Move the kept events up so they end where the dropped one did
+		moveUp(priority, laneIndex.offsetOf(keep), size);
+	}
+	laneIndex.remove(keep);
+
+	uint16_t block = lane.head / BLOCK_SIZE;
+	uint16_t offset = lane.head % BLOCK_SIZE;
+	header->numEvents--;
+	lane.numEvents--;
+	lane.bytes -= size;
+	if (lane.numEvents == 0) {
+		// All of its blocks go
+		freeBlocks(block, (offset + size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+		lane.head = lane.tail = 0;
+		refillValid[priority] = false;
+	}
+	else {
+		// The blocks it leaves behind go - the block the next event starts in stays
+		uint16_t passed = (offset + size) / BLOCK_SIZE;
+		uint16_t next = block;
+		for(uint16_t ii = 0; ii < passed; ii++) {
+			next = link(next);
+		}
+		if (passed > 0) {
+			freeBlocks(block, passed);
+		}
+		lane.head = next * BLOCK_SIZE + (offset + size) % BLOCK_SIZE;
+	}
+	saveHeader();
+	return true;
+}
+
+void PublishQueueRing::freeBlocks(uint16_t first, uint16_t count) {
+	// The blocks are already linked to each other in the chain they leave, and the link of the last
+	// free block isn't in use until the header says there are more after it
+	if (header->freeBlocks == 0) {
+		header->freeHead = first;
+	}
+	else {
+		setLink(header->freeTail, first);
+	}
+	uint16_t last = first;
+	for(uint16_t ii = 1; ii < count; ii++) {
+		last = link(last);
+	}
+	header->freeTail = last;
+	header->freeBlocks += count;
+}
+
+uint16_t PublishQueueRing::blocksNeeded(uint8_t priority, size_t size) const {
+	const PublishQueueRingLane &lane = header->lanes[priority];
+	size_t room = 0;
+	if (lane.numEvents > 0) {
+		// What's left of the block the newest event ends in
+		room = BLOCK_SIZE - (lane.tail - (lane.tail - 1) / BLOCK_SIZE * BLOCK_SIZE);
+	}
+	return (size > room) ? (uint16_t)((size - room + BLOCK_SIZE - 1) / BLOCK_SIZE) : 0;
+}
+
+void PublishQueueRing::moveUp(uint8_t lane, size_t bytes, size_t by) {
+	// Small chunks, as this runs on the publish thread's stack
+	uint32_t buf[32];
+	while(bytes > 0) {
+		size_t count = (bytes < sizeof(buf)) ? bytes : sizeof(buf);
+		bytes -= count;
+		laneRead(lane, bytes, buf, count);
+		laneWrite(lane, bytes + by, buf, count);
+	}
+}
+
+void PublishQueueRing::clear() {
+	header->numEvents = 0;
+	for(uint8_t lane = 0; lane < PUBLISH_QUEUE_PRIORITIES; lane++) {
+		header->lanes[lane].head = 0;
+		header->lanes[lane].tail = 0;
+		header->lanes[lane].bytes = 0;
+		header->lanes[lane].numEvents = 0;
+		index[lane].clear();
+		refillValid[lane] = false;
+	}
+
+	// Every block free, in order
+	uint16_t links[32];
+	for(uint16_t block = 0; block < numBlocks; block += 32) {
+		uint16_t count = (numBlocks - block < 32) ? numBlocks - block : 32;
+		for(uint16_t ii = 0; ii < count; ii++) {
+			links[ii] = block + ii + 1;
+		}
+		write(block * sizeof(uint16_t), links, count * sizeof(uint16_t));
+	}
+	header->freeBlocks = numBlocks;
+	header->freeHead = 0;
+	header->freeTail = numBlocks - 1;
+	saveHeader();
+}
+
+uint16_t PublishQueueRing::link(uint16_t block) const {
+	uint16_t next;
+	read(block * sizeof(uint16_t), &next, sizeof(next));
+	return next;
+}
+
+void PublishQueueRing::setLink(uint16_t block, uint16_t next) {
+	write(block * sizeof(uint16_t), &next, sizeof(next));
+}
+
+void PublishQueueRing::streamWrite(uint16_t &block, uint16_t &offset, const void *src, size_t len) {
+	const uint8_t *cp = static_cast<const uint8_t *>(src);
+	while(len > 0) {
+		if (offset == BLOCK_SIZE) {
+			block = link(block);
+			offset = 0;
+		}
+		size_t count = (len < (size_t)(BLOCK_SIZE - offset)) ? len : BLOCK_SIZE - offset;
+		write(blocksStart + block * BLOCK_SIZE + offset, cp, count);
+		cp += count;
+		len -= count;
+		offset += count;
+	}
+}
+
+void PublishQueueRing::streamRead(uint16_t &block, uint16_t &offset, void *dst, size_t len) const {
+	uint8_t *cp = static_cast<uint8_t *>(dst);
+	while(len > 0) {
+		if (offset == BLOCK_SIZE) {
+			block = link(block);
+			offset = 0;
+		}
+		size_t count = (len < (size_t)(BLOCK_SIZE - offset)) ? len : BLOCK_SIZE - offset;
+		read(blocksStart + block * BLOCK_SIZE + offset, cp, count);
+		cp += count;
+		len -= count;
+		offset += count;
+	}
+}
+
+void PublishQueueRing::streamSkip(uint16_t &block, uint16_t &offset, size_t len) const {
+	while(len > 0) {
+		if (offset == BLOCK_SIZE) {
+			block = link(block);
+			offset = 0;
+		}
+		size_t count = (len < (size_t)(BLOCK_SIZE - offset)) ? len : BLOCK_SIZE - offset;
+		len -= count;
+		offset += count;
+	}
+}
+
+void PublishQueueRing::laneRead(uint8_t lane, size_t offset, void *dst, size_t len) const {
+	uint16_t block = header->lanes[lane].head / BLOCK_SIZE;
+	uint16_t blockOffset = header->lanes[lane].head % BLOCK_SIZE;
+	streamSkip(block, blockOffset, offset);
+	streamRead(block, blockOffset, dst, len);
+}
+
+void PublishQueueRing::laneWrite(uint8_t lane, size_t offset, const void *src, size_t len) {
+	uint16_t block = header->lanes[lane].head / BLOCK_SIZE;
+	uint16_t blockOffset = header->lanes[lane].head % BLOCK_SIZE;
+	streamSkip(block, blockOffset, offset);
+	streamWrite(block, blockOffset, src, len);
+}
+
+void PublishQueueRing::write(uint16_t offset, const void *src, size_t len) {
+	memcpy(&data[offset], src, len);
+}
+
+void PublishQueueRing::read(uint16_t offset, void *dst, size_t len) const {
+	memcpy(dst, &data[offset], len);
+}
+
+void PublishQueueRing::refillIndex(uint8_t lane, uint16_t events) {
+	PublishQueueIndex &laneIndex = index[lane];
+	while(laneIndex.needsRefill(events)) {
+		if (!refillValid[lane] || laneIndex.getIndexedBytes() == 0) {
+			// Find it from the oldest event - only needed once, not for each event
+			refillBlock[lane] = header->lanes[lane].head / BLOCK_SIZE;
+			refillOffset[lane] = header->lanes[lane].head % BLOCK_SIZE;
+			streamSkip(refillBlock[lane], refillOffset[lane], laneIndex.getIndexedBytes());
+			refillValid[lane] = true;
+		}
+		PublishQueueEventData event;
+		uint16_t block = refillBlock[lane], offset = refillOffset[lane];
+		streamRead(block, offset, &event, sizeof(event));
+		streamSkip(refillBlock[lane], refillOffset[lane], event.reserved2);
+		laneIndex.refill(event.reserved2);
+	}
+}
+
+bool PublishQueueRing::check() {
+	if (numBlocks == 0 || header->freeBlocks > numBlocks) {
+		return false;
+	}
+
+	// Every block must be in exactly one chain
+	uint8_t seen[(MAX_BLOCKS + 7) / 8] = {};
+	uint16_t seenBlocks = 0;
+	auto mark = [&](uint16_t block) {
+		if (block >= numBlocks || (seen[block / 8] & (1 << (block % 8)))) {
+			return false;
+		}
+		seen[block / 8] |= 1 << (block % 8);
+		seenBlocks++;
+		return true;
+	};
+
+	uint16_t block = header->freeHead;
+	for(uint16_t ii = 0; ii < header->freeBlocks; ii++) {
+		if (ii > 0) {
+			block = link(block);
+		}
+		if (!mark(block)) {
+			return false;
+		}
+	}
+	if (header->freeBlocks > 0 && block != header->freeTail) {
+		return false;
+	}
+
+	uint32_t numEvents = 0;
+	for(uint8_t lane = 0; lane < PUBLISH_QUEUE_PRIORITIES; lane++) {
+		const PublishQueueRingLane &l = header->lanes[lane];
+		index[lane].clear();
+		refillValid[lane] = false;
+		if (l.numEvents == 0) {
+			if (l.bytes != 0 || l.head != 0 || l.tail != 0) {
+				return false;
+			}
+			continue;
+		}
+		if (l.bytes == 0 || l.tail == 0) {
+			return false;
+		}
+
+		// The chain, from the block of the oldest event to the block the newest ends in
+		uint16_t offset = l.head % BLOCK_SIZE;
+		uint16_t blocks = (offset + l.bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		block = l.head / BLOCK_SIZE;
+		for(uint16_t ii = 0; ii < blocks; ii++) {
+			if (ii > 0) {
+				block = link(block);
+			}
+			if (!mark(block)) {
+				return false;
+			}
+		}
+		if (l.tail != block * BLOCK_SIZE + (offset + l.bytes - 1) % BLOCK_SIZE + 1) {
+			return false;
+		}
+
+		size_t used = 0;
+		block = l.head / BLOCK_SIZE;
+		for(uint16_t ii = 0; ii < l.numEvents; ii++) {
+			PublishQueueEventData event;
+			streamRead(block, offset, &event, sizeof(event));
+			uint16_t size = event.reserved2;
+			if (size < sizeof(PublishQueueEventData) + 4 || size > EVENT_BUF_SIZE || (size % 4) != 0 || used + size > l.bytes ||
+					event.reserved1 != lane) {
+				return false;
+			}
+			uint8_t last;
+			streamSkip(block, offset, size - sizeof(event) - 1);
+			streamRead(block, offset, &last, 1);
+			if (last != 0) {
+				// The data string isn't terminated
+				return false;
+			}
+			index[lane].add(size);
+			used += size;
+		}
+		if (used != l.bytes) {
+			return false;
+		}
+		numEvents += l.numEvents;
+	}
+	return seenBlocks == numBlocks && numEvents == header->numEvents;
+}
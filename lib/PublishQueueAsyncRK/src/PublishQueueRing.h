@@ -0,0 +1,312 @@
+#ifndef __PUBLISHQUEUERING_H
+#define __PUBLISHQUEUERING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Magic bytes used in retained memory and FRAM to detect if the data structures look valid-ish
+ */
+static const uint32_t PUBLISH_QUEUE_HEADER_MAGIC = 0xd19cab61;
+
+/**
+ * @brief Structure stored at the beginning of FRAM, or in the event file on SPIFFS or SdFat file system.
+ *
+ * It's followed by a packed event PublishQueueEventData structures.
+ */
+typedef struct { // 8 bytes
+	uint32_t	magic;			//!< PUBLISH_QUEUE_HEADER_MAGIC
+	uint16_t	size;			//!< Size of the storage, in case it changed, or for file systems, this is the number of events that have been sent already
+	uint16_t	numEvents;		//!< number of events, see the PublishQueueEventData structure
+} PublishQueueHeader;
+
+/**
+ * @brief Event data structure.
+ *
+ */
+typedef struct { // 8 bytes
+	int ttl;					//!< Event TTL (not actually used by the cloud, but we can send it up if sent)
+	uint8_t flags;				//!< Event flags (like PRIVATE or WITH_ACK)
+	uint8_t reserved1;			//!< PublishQueuePriority of the event - 0 (low) in events queued before priorities
+	uint16_t reserved2;			//!< In a PublishQueueRing, the size of the event with its strings and padding - in a file, not 0 once it has been sent
+	// eventName (c-string, packed)
+	// eventData (c-string, packed)
+	// padded to 4-byte alignment
+} PublishQueueEventData;
+
+/**
+ * @brief Priority lane of an event - higher lanes are sent first, and lower lanes are dropped first
+ * when the queue is full
+ */
+typedef enum : uint8_t {
+	PUBLISH_PRIORITY_LOW = 0,		//!< Diagnostics and other chatter
+	PUBLISH_PRIORITY_NORMAL,		//!< The default
+	PUBLISH_PRIORITY_HIGH,
+	PUBLISH_PRIORITY_URGENT
+} PublishQueuePriority;
+
+/**
+ * @brief Number of priority lanes
+ */
+#define PUBLISH_QUEUE_PRIORITIES 4
+
+#ifndef PUBLISH_QUEUE_INDEX_SIZE
+/**
+ * @brief Entries in a PublishQueueIndex - define before including to change it, 2 bytes each
+ */
+#define PUBLISH_QUEUE_INDEX_SIZE 32
+#endif
+
+/**
+ * @brief Sizes of the oldest events in a queue, so they can be found without reading the storage
+ *
+ * A ring of PUBLISH_QUEUE_INDEX_SIZE sizes, built when the queue is checked in setup and kept up to
+ * date as events are added and removed. The oldest event is at the queue's own oldest offset and
+ * each of the others follows the one before. Events added while the index is full are only counted;
+ * the queue reads their sizes back one at a time as the index drains (needsRefill()), so it costs
+ * one small read per event sent only while more than PUBLISH_QUEUE_INDEX_SIZE are queued.
+ */
+class PublishQueueIndex {
+public:
+	void clear();
+
+	/**
+	 * @brief A new event, after all the others
+	 */
+	void add(uint16_t size);
+
+	/**
+	 * @brief Size of an indexed event, 0 for the oldest - index must be less than getCount()
+	 */
+	uint16_t sizeOf(uint16_t index) const { return entries[(first + index) % PUBLISH_QUEUE_INDEX_SIZE]; };
+
+	/**
+	 * @brief Bytes from the oldest event to an indexed event - index must be at most getCount()
+	 */
+	size_t offsetOf(uint16_t index) const;
+
+	/**
+	 * @brief Remove an indexed event, 0 for the oldest - the ones before it move up
+	 */
+	void remove(uint16_t index);
+
+	/**
+	 * @brief true if fewer than events are indexed, but there are more events and room for them
+	 */
+	bool needsRefill(uint16_t events = 2) const { return count < events && count < PUBLISH_QUEUE_INDEX_SIZE && unindexed > 0; };
+
+	/**
+	 * @brief Bytes from the oldest event to the oldest one that isn't indexed
+	 */
+	size_t getIndexedBytes() const { return indexedBytes; };
+
+	/**
+	 * @brief Index the oldest event that isn't, with its size read back from the storage
+	 */
+	void refill(uint16_t size);
+
+	uint16_t getCount() const { return count; };
+
+protected:
+	uint16_t entries[PUBLISH_QUEUE_INDEX_SIZE];
+	uint16_t first = 0;					//!< Entry for the oldest event
+	uint16_t count = 0;					//!< Events indexed
+	uint16_t unindexed = 0;				//!< Events after those, not indexed
+	size_t indexedBytes = 0;
+};
+
+#ifndef PUBLISH_QUEUE_BLOCK_SIZE
+/**
+ * @brief Bytes in a block of a PublishQueueRing - define before including to change it
+ *
+ * Each block costs 2 more bytes for its link, and each priority with events in it leaves up to a
+ * block unused at each end.
+ */
+#define PUBLISH_QUEUE_BLOCK_SIZE 32
+#endif
+
+/**
+ * @brief Magic bytes for a PublishQueueRing - different from PUBLISH_QUEUE_HEADER_MAGIC, and from the
+ * layouts before it, so a buffer in an older layout is started again rather than misread
+ */
+static const uint32_t PUBLISH_QUEUE_RING_MAGIC = 0xd19cab65;
+
+/**
+ * @brief The events of one priority in a PublishQueueRing, in its header (8 bytes)
+ *
+ * Offsets are in the blocks: block number * PUBLISH_QUEUE_BLOCK_SIZE + offset in the block.
+ */
+typedef struct {
+	uint16_t	head;			//!< Offset of the oldest event - 0 when empty
+	uint16_t	tail;			//!< Offset just after the last byte of the newest event, in the block of that byte - 0 when empty
+	uint16_t	bytes;			//!< Of the events, with their padding
+	uint16_t	numEvents;		//!< Events of this priority
+} PublishQueueRingLane;
+
+/**
+ * @brief Structure stored at the beginning of the retained buffer or FRAM by PublishQueueRing (48 bytes)
+ */
+typedef struct {
+	uint32_t	magic;			//!< PUBLISH_QUEUE_RING_MAGIC
+	uint16_t	size;			//!< Size of the buffer, in case it changed
+	uint16_t	numEvents;		//!< Events of every priority
+	uint16_t	blockSize;		//!< PUBLISH_QUEUE_BLOCK_SIZE, in case it changed
+	uint16_t	freeBlocks;		//!< Blocks with no events in them
+	uint16_t	freeHead;		//!< First free block, if there are any
+	uint16_t	freeTail;		//!< Last free block
+	PublishQueueRingLane lanes[PUBLISH_QUEUE_PRIORITIES];	//!< Lowest priority first
+} PublishQueueRingHeader;
+
+/**
+ * @brief Events in retained (or regular) RAM, in a pool of blocks shared by the priorities
+ *
+ * After the header, the buffer holds a 2 byte link for each block, then the blocks. The events of a
+ * priority are written one after another into a chain of blocks, each as a PublishQueueEventData with
+ * its size in reserved2, then the two strings, padded to 4 bytes, carrying on into the next block of
+ * the chain where a block ends. The header holds the head, tail and size of each chain, and the
+ * blocks not in any chain are kept in a list of their own. A new event takes blocks from the front of
+ * that list and a block is put back on the end of it as soon as its last event has gone, so each
+ * priority takes as much of the buffer as it needs, and nothing is moved to send one priority before
+ * another: adding, sending and dropping an event cost the same whatever the size of the buffer or the
+ * number of events in it. The oldest event is copied out whole for the publish, so a split event is
+ * never seen.
+ *
+ * front() takes the oldest event of the highest priority, and the send that follows peeks at and
+ * discards events of that priority. When there are too few free blocks for a new event, the oldest
+ * event of the lowest priority is dropped, but never one of a higher priority than the new event -
+ * if that still leaves too few, the new event isn't queued. Events being sent (keep) are never
+ * dropped; dropping the one after them moves them up into its place, which costs their size, and is
+ * the only time an event is moved. There is no locking here - the queue classes hold their mutex around
+ * each call.
+ *
+ * Every change writes only bytes that aren't in use yet, or have just stopped being used, then the
+ * header, so a reset part way through leaves the events as they were before it. The events are in RAM
+ * unless a subclass overrides read(), write() and saveHeader() to keep them somewhere else, as
+ * PublishQueueFRAMRing does. The sizes of the oldest events of each priority are kept in a
+ * PublishQueueIndex, so sending or dropping an event doesn't read its size back first.
+ */
+class PublishQueueRing {
+public:
+	/**
+	 * @brief Maximum size of an event with its strings - the same as PublishQueueAsyncBase::EVENT_BUF_SIZE
+	 */
+	static const size_t EVENT_BUF_SIZE = sizeof(PublishQueueEventData) + 65 + 623;
+
+	/**
+	 * @brief Use a buffer - the events already in it are kept if the header and every event check out
+	 *
+	 * @param buffer The buffer, 4-byte aligned
+	 *
+	 * @param bufferSize Buffer size - an event of EVENT_BUF_SIZE bytes fits in one of 796 bytes
+	 */
+	PublishQueueRing(uint8_t *buffer, uint16_t bufferSize);
+
+	virtual ~PublishQueueRing() {};
+
+	/**
+	 * @brief Add an event, dropping old events of its priority or lower to make room
+	 *
+	 * @param keep Oldest events of the priority being sent not to drop - 1 to drop the second oldest
+	 * rather than the oldest. 0 when nothing is being sent.
+	 *
+	 * @return false if the event could not fit
+	 */
+	bool push(const char *eventName, const char *data, int ttl, uint8_t flags, uint8_t priority, uint16_t keep);
+
+	/**
+	 * @brief Add a normal priority event
+	 */
+	bool push(const char *eventName, const char *data, int ttl, uint8_t flags, uint16_t keep) {
+		return push(eventName, data, ttl, flags, PUBLISH_PRIORITY_NORMAL, keep);
+	};
+
+	/**
+	 * @brief Copy the oldest event of the highest priority into buf, and send from that priority
+	 *
+	 * @param buf EVENT_BUF_SIZE bytes, 4-byte aligned
+	 *
+	 * @return false if there are no events
+	 */
+	bool front(uint8_t *buf);
+
+	/**
+	 * @brief Copy an event of the priority being sent into buf without removing it, if its size is indexed
+	 *
+	 * @param n 0 for the oldest event of the priority
+	 *
+	 * @return false if there is no such event, its size isn't in the index or it is larger than bufSize
+	 */
+	bool peek(uint16_t n, uint8_t *buf, size_t bufSize);
+
+	/**
+	 * @brief Drop the oldest event of the priority being sent, or the one after the keep oldest
+	 *
+	 * @param keep 0 to drop the oldest event, 1 for the second oldest and so on. The events kept are
+	 * moved up into the room, which costs their size.
+	 *
+	 * @return false if there was no such event, or its size isn't in the index
+	 */
+	bool discard(uint16_t keep);
+
+	void clear();
+
+	uint16_t getNumEvents() const { return header->numEvents; };
+
+	/**
+	 * @brief Size of an event with its strings and padding
+	 */
+	static size_t eventSize(const char *eventName, const char *data);
+
+protected:
+	/**
+	 * @brief For a subclass that keeps the events elsewhere - call begin() once they can be read
+	 *
+	 * @param header Where the subclass keeps its copy of the header
+	 *
+	 * @param capacity Bytes for the links and blocks, after the header
+	 */
+	PublishQueueRing(PublishQueueRingHeader *header, uint16_t capacity);
+
+	/**
+	 * @brief Keep the events already there if the header and every event check out, or start empty
+	 *
+	 * @param size Of the header, links and blocks, checked against the header
+	 *
+	 * @return true if the events were kept
+	 */
+	bool begin(uint16_t size);
+
+	virtual void write(uint16_t offset, const void *src, size_t len);	//!< Bytes from offset in the links and blocks
+	virtual void read(uint16_t offset, void *dst, size_t len) const;
+	virtual void saveHeader() {};										//!< After header changes - it is already in place in RAM
+
+	uint16_t link(uint16_t block) const;								//!< The block after this one in its chain
+	void setLink(uint16_t block, uint16_t next);
+	void streamWrite(uint16_t &block, uint16_t &offset, const void *src, size_t len);	//!< From offset in block along its chain, leaving them after the bytes
+	void streamRead(uint16_t &block, uint16_t &offset, void *dst, size_t len) const;
+	void streamSkip(uint16_t &block, uint16_t &offset, size_t len) const;
+	void laneRead(uint8_t lane, size_t offset, void *dst, size_t len) const;	//!< Offset from the oldest event of a priority
+	void laneWrite(uint8_t lane, size_t offset, const void *src, size_t len);
+	uint16_t blocksNeeded(uint8_t lane, size_t size) const;				//!< Free blocks a new event of this priority takes
+	void freeBlocks(uint16_t first, uint16_t count);					//!< A chain of blocks onto the end of the free list
+	bool check();														//!< Walk the chains and events, building the indexes - false if they don't add up
+	void refillIndex(uint8_t lane, uint16_t events = 2);
+	bool discardFrom(uint8_t lane, uint16_t keep);						//!< The oldest event of a priority, or the one after the keep oldest
+	void moveUp(uint8_t lane, size_t bytes, size_t by);				//!< The first bytes from the oldest event of a priority, by bytes - last bytes first, as they can overlap
+
+	static const uint16_t BLOCK_SIZE = PUBLISH_QUEUE_BLOCK_SIZE;
+	static const uint16_t MAX_BLOCKS = 65535 / (PUBLISH_QUEUE_BLOCK_SIZE + 2);
+
+	PublishQueueRingHeader *header;
+	uint8_t *data;														//!< After the header, NULL in a subclass
+	uint16_t capacity;													//!< Bytes in data
+	uint16_t numBlocks;
+	uint16_t blocksStart;												//!< Offset in data of block 0, after the links
+	uint8_t sendLane = PUBLISH_QUEUE_PRIORITIES - 1;					//!< Priority front() last took an event from
+	PublishQueueIndex index[PUBLISH_QUEUE_PRIORITIES];					//!< One for each priority
+	uint16_t refillBlock[PUBLISH_QUEUE_PRIORITIES];					//!< Where the oldest event not in the index starts, while refillValid
+	uint16_t refillOffset[PUBLISH_QUEUE_PRIORITIES];
+	bool refillValid[PUBLISH_QUEUE_PRIORITIES] = {};
+};
+
+#endif /* __PUBLISHQUEUERING_H */
@@ -0,0 +1,245 @@
+#include "BulkDump.h"
+
+#include <string.h>
+
+static const uint32_t crcTable[16] = {								// CRC-32 four bits at a time - 64 bytes of table instead of 1kB
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+const char *BulkDump::sectionName(uint8_t section) {
+	static const char *names[SECTION_COUNT] = {"?", "status", "history", "hourly", "daily", "reports", "trace", "stall"};
+	return (section < SECTION_COUNT) ? names[section] : "?";
+}
+
+uint32_t BulkDump::crc32(const uint8_t *data, size_t len, uint32_t crc) {
+	crc = ~crc;
+	for (size_t ii = 0; ii < len; ii++) {
+		crc = crcTable[(crc ^ data[ii]) & 0x0F] ^ (crc >> 4);
+		crc = crcTable[(crc ^ (data[ii] >> 4)) & 0x0F] ^ (crc >> 4);
+	}
+	return ~crc;
+}
+
+void BulkDump::putLittle32(uint8_t *buf, uint32_t value) {
+	buf[0] = (uint8_t)value;
+	buf[1] = (uint8_t)(value >> 8);
+	buf[2] = (uint8_t)(value >> 16);
+	buf[3] = (uint8_t)(value >> 24);
+}
+
+uint32_t BulkDump::getLittle32(const uint8_t *buf) {
+	return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+size_t BulkDump::putHeader(uint8_t *buf, uint8_t type, uint8_t section, uint32_t offset, uint16_t length) {
+	buf[0] = SYNC0;
+	buf[1] = SYNC1;
+	buf[2] = type;
+	buf[3] = section;
+	putLittle32(&buf[4], offset);
+	buf[8] = (uint8_t)length;
+	buf[9] = (uint8_t)(length >> 8);
+	return HEADER_SIZE;
+}
+
+size_t BulkDump::putFrame(uint8_t *buf, uint8_t type, uint8_t section, uint32_t offset, const uint8_t *payload, uint16_t length) {
+	putHeader(buf, type, section, offset, length);
+	if (length) memcpy(&buf[HEADER_SIZE], payload, length);
+	putLittle32(&buf[HEADER_SIZE + length], crc32(&buf[2], HEADER_SIZE - 2 + length));
+	return HEADER_SIZE + length + CRC_SIZE;
+}
+
+bool BulkDumpParser::put(uint8_t byte, Frame &frame) {
+	if (consumed) {													// The frame returned last time - anything after it came out of a resync
+		skip(consumed);
+		consumed = 0;
+	}
+	if (len == 0 && byte != BulkDump::SYNC0) return false;			// Between frames
+	if (len == 1 && byte != BulkDump::SYNC1) {
+		len = (byte == BulkDump::SYNC0) ? 1 : 0;
+		return false;
+	}
+	buf[len++] = byte;
+
+	while (len >= BulkDump::HEADER_SIZE) {
+		size_t length = buf[8] | (buf[9] << 8);
+		size_t total = BulkDump::HEADER_SIZE + length + BulkDump::CRC_SIZE;
+		if (total > size) {											// Too long for us, or a sync that wasn't one
+			badFrames++;
+			skip(1);
+			continue;
+		}
+		if (len < total) return false;
+		if (BulkDump::crc32(&buf[2], BulkDump::HEADER_SIZE - 2 + length) != BulkDump::getLittle32(&buf[BulkDump::HEADER_SIZE + length])) {
+			badFrames++;
+			skip(1);
+			continue;
+		}
+		frame.type = buf[2];
+		frame.section = buf[3];
+		frame.offset = BulkDump::getLittle32(&buf[4]);
+		frame.length = (uint16_t)length;
+		frame.payload = &buf[BulkDump::HEADER_SIZE];
+		consumed = total;
+		return true;
+	}
+	return false;
+}
+
+void BulkDumpParser::skip(size_t count) {
+	size_t ii = count;
+	while (ii < len && !(buf[ii] == BulkDump::SYNC0 && (ii + 1 == len || buf[ii + 1] == BulkDump::SYNC1))) ii++;
+	len -= ii;
+	memmove(buf, &buf[ii], len);
+}
+
+BulkDumpServer::BulkDumpServer(HalStore &store, HalSystem &system, HalClock &clock) :
+	store(store), system(system), clock(clock), parser(requestBuf, sizeof(requestBuf)) {
+}
+
+void BulkDumpServer::addStore(uint8_t id, size_t addr, size_t length) {
+	if (sourceCount < MAX_SECTIONS) sources[sourceCount++] = {id, NULL, addr, length};
+}
+
+void BulkDumpServer::addMemory(uint8_t id, const void *data, size_t length) {
+	if (sourceCount < MAX_SECTIONS) sources[sourceCount++] = {id, (const uint8_t *)data, 0, length};
+}
+
+int BulkDumpServer::find(uint8_t id) const {
+	for (int ii = 0; ii < sourceCount; ii++) {
+		if (sources[ii].id == id) return ii;
+	}
+	return -1;
+}
+
+uint8_t BulkDumpServer::poll(const char *release, uint32_t budget) {
+	uint8_t in[16];
+	size_t got;
+	BulkDumpParser::Frame request;
+	while ((got = system.consoleRead(in, sizeof(in))) > 0) {
+		for (size_t ii = 0; ii < got; ii++) {
+			if (parser.put(in[ii], request)) this->request(request);
+		}
+	}
+
+	uint8_t finished = 0;
+	uint32_t start = clock.millis();
+	while (write()) {												// Each pass starts with the last frame all sent
+		if (clock.millis() - start >= budget) break;
+		if (errorWanted) {
+			sendSmall(BulkDump::ERROR, errorSection, 0, errorWanted);
+			errorWanted = NULL;
+		}
+		else if (manifestWanted) {
+			sendManifest(release);
+			manifestWanted = false;
+		}
+		else if (streaming >= 0 && streamOffset < sources[streaming].length) sendData();
+		else if (streaming >= 0) {
+			finished = sources[streaming].id;
+			sendSmall(BulkDump::SECTION_END, finished, (uint32_t)sources[streaming].length, NULL);
+			streaming = -1;
+		}
+		else break;
+	}
+	return finished;
+}
+
+void BulkDumpServer::request(const BulkDumpParser::Frame &frame) {
+	if (frame.type == BulkDump::REQ_MANIFEST) manifestWanted = true;
+	else if (frame.type == BulkDump::REQ_READ) {
+		int index = find(frame.section);
+		errorSection = frame.section;
+		if (index < 0) errorWanted = "no such section";
+		else if (frame.offset > sources[index].length) errorWanted = "offset past the end";
+		else {
+			streaming = index;										// Replaces any stream going on - the reader has moved on
+			streamOffset = frame.offset;
+		}
+	}
+}
+
+void BulkDumpServer::sendManifest(const char *release) {
+	uint32_t crcs[MAX_SECTIONS];
+	uint8_t *scratch = &frame[BulkDump::HEADER_SIZE];
+	for (int ii = 0; ii < sourceCount; ii++) {						// The CRC of each section as it is now
+		const Source &source = sources[ii];
+		if (source.memory) crcs[ii] = BulkDump::crc32(source.memory, source.length);
+		else {
+			crcs[ii] = 0;
+			for (size_t pos = 0; pos < source.length; pos += BulkDump::MAX_PAYLOAD) {
+				size_t len = (source.length - pos < BulkDump::MAX_PAYLOAD) ? source.length - pos : BulkDump::MAX_PAYLOAD;
+				store.readData(source.addr + pos, scratch, len);
+				crcs[ii] = BulkDump::crc32(scratch, len, crcs[ii]);
+			}
+		}
+	}
+
+	uint8_t *payload = scratch;
+	payload[0] = BulkDump::VERSION;
+	payload[1] = (uint8_t)sourceCount;
+	BulkDump::putLittle32(&payload[2], (clock.isValid()) ? clock.now() : 0);
+	BulkDump::putLittle32(&payload[6], clock.millis());
+	memset(&payload[10], 0, 8);
+	strncpy((char *)&payload[10], release, 8);
+	size_t len = BulkDump::MANIFEST_HEADER_SIZE;
+	for (int ii = 0; ii < sourceCount; ii++) {
+		payload[len] = sources[ii].id;
+		payload[len + 1] = (sources[ii].memory) ? BulkDump::FLAG_LIVE : 0;
+		BulkDump::putLittle32(&payload[len + 2], (uint32_t)sources[ii].length);
+		BulkDump::putLittle32(&payload[len + 6], crcs[ii]);
+		len += BulkDump::MANIFEST_ENTRY_SIZE;
+	}
+	BulkDump::putHeader(frame, BulkDump::MANIFEST, 0, 0, (uint16_t)len);
+	sendParts(payload, (uint16_t)len);
+}
+
+void BulkDumpServer::sendData() {
+	const Source &source = sources[streaming];
+	size_t left = source.length - streamOffset;
+	uint16_t len = (uint16_t)((left < BulkDump::MAX_PAYLOAD) ? left : BulkDump::MAX_PAYLOAD);
+	BulkDump::putHeader(frame, BulkDump::DATA, source.id, streamOffset, len);
+	const uint8_t *payload = &frame[BulkDump::HEADER_SIZE];
+	if (source.memory) payload = source.memory + streamOffset;		// Sent from where it lives - a change before it is all out fails the CRC and the reader asks again
+	else store.readData(source.addr + streamOffset, &frame[BulkDump::HEADER_SIZE], len);	// Straight into the frame
+	streamOffset += len;
+	sendParts(payload, len);
+}
+
+void BulkDumpServer::sendSmall(uint8_t type, uint8_t section, uint32_t offset, const char *text) {
+	size_t len = (text) ? strlen(text) : 0;
+	if (len > BulkDump::MAX_PAYLOAD) len = BulkDump::MAX_PAYLOAD;
+	if (len) memcpy(&frame[BulkDump::HEADER_SIZE], text, len);
+	BulkDump::putHeader(frame, type, section, offset, (uint16_t)len);
+	sendParts(&frame[BulkDump::HEADER_SIZE], (uint16_t)len);
+}
+
+void BulkDumpServer::sendParts(const uint8_t *payload, uint16_t length) {
+	uint32_t crc = BulkDump::crc32(&frame[2], BulkDump::HEADER_SIZE - 2);
+	BulkDump::putLittle32(trailer, BulkDump::crc32(payload, length, crc));
+	parts[0] = frame;
+	partLength[0] = BulkDump::HEADER_SIZE;
+	parts[1] = payload;
+	partLength[1] = length;
+	parts[2] = trailer;
+	partLength[2] = BulkDump::CRC_SIZE;
+	part = 0;
+	partPos = 0;
+}
+
+bool BulkDumpServer::write() {
+	while (part < 3) {
+		size_t left = partLength[part] - partPos;
+		if (!left) {
+			part++;
+			partPos = 0;
+			continue;
+		}
+		size_t sent = system.consoleWrite(parts[part] + partPos, left);
+		bytesSent += sent;
+		partPos += sent;
+		if (sent < left) return false;
+	}
+	return true;
+}
@@ -0,0 +1,226 @@
+#ifndef __BULKDUMP_H
+#define __BULKDUMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Hal.h"
+
+/**
+ * @brief Framed, CRC checked dump of the history, reports and trace over the USB serial port
+ *
+ * For a site with no coverage: a laptop on the USB port pulls everything the device holds with
+ * tools/dump-reader.cpp. Both directions use the same frame:
+ *
+ * - sync (2 bytes, 0xA5 0x5A)
+ * - type (1), section (1), offset (4, little endian), payload length (2, little endian)
+ * - the payload
+ * - CRC-32 (4, little endian) of everything from the type to the end of the payload
+ *
+ * Anything between frames is skipped, so the dump shares the port with the console text, and a frame
+ * with a bad CRC is dropped and the reader asks again. The reader sends REQ_MANIFEST and gets back a
+ * MANIFEST with each section's length and CRC-32 as it is now. It then sends REQ_READ with a section
+ * and an offset, and gets DATA frames from there to the end of the section, then SECTION_END. After
+ * a dropped frame, a timeout or a cable pulled and put back, it sends REQ_READ again from the last
+ * byte it has. If the whole section doesn't match the CRC in the manifest, the section changed while
+ * it was being read, so the reader gets a new manifest and reads that section again. A LIVE section
+ * changes with every loop pass (the stall record) or with the dump itself (the trace), so it is
+ * taken as it was read.
+ *
+ * Sections are regions of the FRAM or of RAM, sent as they are. DATA frames are built where the
+ * bytes are: a FRAM section is read straight into the frame being sent, and a RAM section (the
+ * retained trace ring) is written from where it lives, with no copy.
+ */
+class BulkDump {
+public:
+	static const uint8_t SYNC0 = 0xA5;
+	static const uint8_t SYNC1 = 0x5A;
+	static const uint8_t VERSION = 1;					//!< In the MANIFEST
+	static const size_t HEADER_SIZE = 10;				//!< Sync to the payload length
+	static const size_t CRC_SIZE = 4;
+	static const size_t MAX_PAYLOAD = 512;				//!< Bytes in a DATA frame - one FRAM read, about 50 ms on the 100kHz I2C bus
+
+	enum Type : uint8_t {
+		REQ_MANIFEST = 0x01,		//!< Reader to device - no payload
+		REQ_READ = 0x02,			//!< Reader to device - section and offset, no payload
+		MANIFEST = 0x81,			//!< Device to reader - see MANIFEST_HEADER_SIZE
+		DATA = 0x82,				//!< Device to reader - section bytes from offset
+		SECTION_END = 0x83,			//!< Device to reader - offset is the section's length
+		ERROR = 0x84				//!< Device to reader - payload is a reason, in text
+	};
+
+	/**
+	 * @brief What each section holds - only ever add to the end, the reader has to read older firmware
+	 */
+	enum Section : uint8_t {
+		SECTION_STATUS = 1,			//!< FRAM from 0 up to the history - settings, thresholds, ring heads
+		SECTION_HISTORY,			//!< FRAM - compressed blocks of one minute readings (HistoryCodec.h)
+		SECTION_HOURLY,				//!< FRAM - hourly RollupRecords
+		SECTION_DAILY,				//!< FRAM - daily RollupRecords
+		SECTION_REPORTS,			//!< FRAM - the reports waiting for an ack, and the ones since acked
+		SECTION_TRACE,				//!< RAM - the TraceBuffer::Ring
+		SECTION_STALL,				//!< RAM - the StallMonitor::Record
+		SECTION_COUNT
+	};
+
+	enum Flags : uint8_t {
+		FLAG_LIVE = 0x01			//!< In the MANIFEST - RAM the firmware keeps changing, never the same as its CRC for long
+	};
+
+	/**
+	 * @brief Printable names, indexed by Section
+	 */
+	static const char *sectionName(uint8_t section);
+
+	/**
+	 * @brief CRC-32 (IEEE 802.3), carried on from crc for data in pieces
+	 */
+	static uint32_t crc32(const uint8_t *data, size_t len, uint32_t crc = 0);
+
+	/**
+	 * @brief Write a frame header - the CRC starts at buf + 2
+	 *
+	 * @return HEADER_SIZE
+	 */
+	static size_t putHeader(uint8_t *buf, uint8_t type, uint8_t section, uint32_t offset, uint16_t length);
+
+	/**
+	 * @brief Write a whole frame
+	 *
+	 * @param buf HEADER_SIZE + length + CRC_SIZE bytes
+	 *
+	 * @return Bytes written
+	 */
+	static size_t putFrame(uint8_t *buf, uint8_t type, uint8_t section, uint32_t offset, const uint8_t *payload, uint16_t length);
+
+	static void putLittle32(uint8_t *buf, uint32_t value);
+	static uint32_t getLittle32(const uint8_t *buf);
+
+	/**
+	 * @brief MANIFEST payload: version (1), sections (1), Unix time (4, 0 if not known), millis() (4),
+	 * release (8, null padded), then for each section its id (1), Flags (1), length (4) and CRC-32 (4)
+	 */
+	static const size_t MANIFEST_HEADER_SIZE = 18;
+	static const size_t MANIFEST_ENTRY_SIZE = 10;
+};
+
+/**
+ * @brief Finds frames in a stream of bytes
+ *
+ * Bytes outside a frame are skipped. A frame whose CRC doesn't match is dropped and the search
+ * starts again from the byte after its sync, so a frame that started inside a bad one isn't lost -
+ * though it only comes out with the byte after its last.
+ */
+class BulkDumpParser {
+public:
+	/**
+	 * @brief A frame found - payload points into the parser's buffer, valid until the next put()
+	 */
+	struct Frame {
+		uint8_t type;
+		uint8_t section;
+		uint32_t offset;
+		uint16_t length;
+		const uint8_t *payload;
+	};
+
+	/**
+	 * @brief Construct a parser
+	 *
+	 * @param buf For the frame being put together - HEADER_SIZE + CRC_SIZE and the longest payload
+	 * wanted. Frames with a longer payload are dropped.
+	 */
+	BulkDumpParser(uint8_t *buf, size_t size) : buf(buf), size(size) {};
+
+	/**
+	 * @brief Add a byte
+	 *
+	 * @return true if it completed a good frame, which is in frame
+	 */
+	bool put(uint8_t byte, Frame &frame);
+
+	uint32_t getBadFrames() const { return badFrames; };			//!< Dropped for their CRC or length
+
+protected:
+	void skip(size_t count);										//!< Drop count bytes and then up to the next sync in what is left
+
+	uint8_t *buf;
+	size_t size;
+	size_t len = 0;													//!< Bytes in buf
+	size_t consumed = 0;											//!< Bytes of the frame last returned - dropped on the next put()
+	uint32_t badFrames = 0;
+};
+
+/**
+ * @brief The device end - answers requests on the USB serial port from FacilityMonitor::loop()
+ */
+class BulkDumpServer {
+public:
+	static const int MAX_SECTIONS = BulkDump::SECTION_COUNT - 1;
+
+	BulkDumpServer(HalStore &store, HalSystem &system, HalClock &clock);
+
+	/**
+	 * @brief A section read from the FRAM
+	 */
+	void addStore(uint8_t id, size_t addr, size_t length);
+
+	/**
+	 * @brief A section sent from RAM - it has to stay where it is, and is FLAG_LIVE
+	 */
+	void addMemory(uint8_t id, const void *data, size_t length);
+
+	/**
+	 * @brief Answer any requests and send what the port will take
+	 *
+	 * Returns once the port is full, there is nothing left to send or budget ms have gone.
+	 *
+	 * @param release Goes in the MANIFEST
+	 *
+	 * @return The section that finished streaming, or 0
+	 */
+	uint8_t poll(const char *release, uint32_t budget = 20);
+
+	bool isStreaming() const { return streaming >= 0 || part < 3; };
+	uint32_t getBytesSent() const { return bytesSent; };
+
+protected:
+	struct Source {
+		uint8_t id;
+		const uint8_t *memory;										//!< NULL for a FRAM section
+		size_t addr;
+		size_t length;
+	};
+
+	void request(const BulkDumpParser::Frame &frame);
+	void sendManifest(const char *release);
+	void sendData();
+	void sendSmall(uint8_t type, uint8_t section, uint32_t offset, const char *text);
+	void sendParts(const uint8_t *payload, uint16_t length);		//!< frame[] holds the header - adds the payload and the CRC
+	bool write();													//!< false once the port won't take any more of the frame
+	int find(uint8_t id) const;
+
+	HalStore &store;
+	HalSystem &system;
+	HalClock &clock;
+	Source sources[MAX_SECTIONS];
+	int sourceCount = 0;
+
+	uint8_t requestBuf[BulkDump::HEADER_SIZE + BulkDump::CRC_SIZE];	//!< Requests have no payload
+	BulkDumpParser parser;
+	bool manifestWanted = false;
+	const char *errorWanted = NULL;
+	uint8_t errorSection = 0;
+	int streaming = -1;												//!< Index of the section being streamed
+	uint32_t streamOffset = 0;
+
+	uint8_t frame[BulkDump::HEADER_SIZE + BulkDump::MAX_PAYLOAD];	//!< Header, and the payload unless it is sent from RAM
+	uint8_t trailer[BulkDump::CRC_SIZE];
+	const uint8_t *parts[3];										//!< The frame going out - header, payload, CRC
+	size_t partLength[3];
+	int part = 3;													//!< Part being written - 3 when none
+	size_t partPos = 0;
+	uint32_t bytesSent = 0;
+};
+
+#endif /* __BULKDUMP_H */
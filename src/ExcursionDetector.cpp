@@ -0,0 +1,99 @@
+#include "ExcursionDetector.h"
+
+#include <math.h>
+
+// Keeps a scaled value inside an int16_t
+static int16_t clamp16(int32_t value) {
+	if (value > INT16_MAX) return INT16_MAX;
+	if (value < INT16_MIN) return INT16_MIN;
+	return (int16_t)value;
+}
+
+ExcursionDetector::ExcursionDetector(uint16_t sampleSeconds) : sampleSeconds(sampleSeconds) {
+	reset();
+}
+
+void ExcursionDetector::reset() {
+	next = count = 0;
+	longSlope = 0;
+	risingSeconds = 0;
+	event = NONE;
+	changed = false;
+}
+
+ExcursionDetector::Event ExcursionDetector::addSample(float temperatureC, float humidityRH) {
+	int16_t temp = clamp16(lroundf(temperatureC * 100));
+	int16_t humidity = clamp16(lroundf(humidityRH * 100));
+
+	if (count == 0) {
+		humidityBaseline = humidity;
+	}
+
+	uint8_t newest = next;
+	temperature[newest] = temp;
+	next = (next + 1) % WINDOW;
+	if (count < WINDOW) {
+		count++;
+	}
+
+	// Short slope is over the last two intervals, which is what catches a door opening
+	int16_t shortSlope = 0;
+	if (count >= 3) {
+		int16_t twoBack = temperature[(newest + WINDOW - 2) % WINDOW];
+		shortSlope = clamp16((int32_t)(temp - twoBack) * 60 / (2 * sampleSeconds));
+	}
+
+	// Long slope is over the whole window (the oldest sample is where the next one will go once it's full)
+	if (count >= 2) {
+		int16_t oldest = temperature[(count == WINDOW) ? next : 0];
+		longSlope = clamp16((int32_t)(temp - oldest) * 60 / ((count - 1) * sampleSeconds));
+	}
+
+	int16_t spike = humidity - humidityBaseline;
+	humidityBaseline += (humidity - humidityBaseline) / 8;
+
+	if (longSlope >= RISING_SLOPE) {
+		risingSeconds = (risingSeconds > UINT16_MAX - sampleSeconds) ? UINT16_MAX : risingSeconds + sampleSeconds;
+	}
+	else {
+		risingSeconds = 0;
+	}
+
+	Event newEvent;
+	if (shortSlope >= DOOR_SLOPE && spike >= HUMIDITY_SPIKE) {
+		newEvent = DOOR_OPEN;
+	}
+	else if (risingSeconds == 0) {
+		// Not warming any more, whatever it was is over
+		newEvent = NONE;
+	}
+	else if (risingSeconds >= MAX_DEFROST_MINUTES * 60) {
+		// Too long for a defrost cycle (or a door left open)
+		newEvent = COMPRESSOR_FAILURE;
+	}
+	else if (event == DOOR_OPEN || event == COMPRESSOR_FAILURE) {
+		// Still recovering from whatever started this rise
+		newEvent = event;
+	}
+	else {
+		newEvent = DEFROST;
+	}
+
+	changed = (newEvent != event);
+	event = newEvent;
+	return event;
+}
+
+// [static]
+const char *ExcursionDetector::eventName(Event event) {
+	switch(event) {
+	case DOOR_OPEN:
+		return "Door Open";
+	case DEFROST:
+		return "Defrost";
+	case COMPRESSOR_FAILURE:
+		return "Compressor Failure";
+	default:
+		return "None";
+	}
+}
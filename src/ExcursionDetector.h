@@ -0,0 +1,92 @@
+#ifndef __EXCURSIONDETECTOR_H
+#define __EXCURSIONDETECTOR_H
+
+#include <stdint.h>
+
+/**
+ * @brief Streaming classifier for temperature events in a cold room
+ *
+ * Threshold alerts only fire once the product is already out of range. This looks at the rate of change
+ * instead, so we can warn (and sample faster) before the alertsStatus limits are crossed:
+ *
+ * - Door open: a fast rise together with a humidity spike above the recent baseline
+ * - Defrost cycle: a rise without a humidity spike that stops on its own
+ * - Compressor failure: a steady rise that goes on for longer than any defrost cycle
+ *
+ * Values are kept as hundredths (of a degree or a percent RH) in 16 bit integers, so the whole state
+ * is a few dozen bytes and each sample costs a handful of integer operations.
+ */
+class ExcursionDetector {
+public:
+	/**
+	 * @brief What the detector thinks is going on
+	 */
+	enum Event : uint8_t {
+		NONE = 0,				//!< Temperature is steady or falling
+		DOOR_OPEN,				//!< Fast rise with a humidity spike
+		DEFROST,				//!< Rise without a humidity spike, not yet long enough to be a failure
+		COMPRESSOR_FAILURE		//!< Sustained rise
+	};
+
+	/**
+	 * @brief Construct a detector
+	 *
+	 * @param sampleSeconds Time between samples passed to addSample(). The slopes assume samples are evenly spaced.
+	 */
+	ExcursionDetector(uint16_t sampleSeconds);
+
+	/**
+	 * @brief Add a sample and classify
+	 *
+	 * @param temperatureC Temperature in degrees C
+	 *
+	 * @param humidityRH Relative humidity in %
+	 *
+	 * @return The current classification. Use eventChanged() to see if it differs from the last sample.
+	 */
+	Event addSample(float temperatureC, float humidityRH);
+
+	/**
+	 * @brief Forget all samples, for example after a long gap
+	 */
+	void reset();
+
+	/**
+	 * @brief The current classification
+	 */
+	Event getEvent() const { return event; };
+
+	/**
+	 * @brief True if the last addSample() changed the classification
+	 */
+	bool eventChanged() const { return changed; };
+
+	/**
+	 * @brief Slope over the full window in hundredths of a degree per minute
+	 */
+	int16_t getSlope() const { return longSlope; };
+
+	/**
+	 * @brief Printable name for an event
+	 */
+	static const char *eventName(Event event);
+
+	static const uint8_t WINDOW = 8;					//!< Samples kept for the slope
+	static const int16_t DOOR_SLOPE = 50;				//!< Short term rise for a door opening (0.5 C/min)
+	static const int16_t HUMIDITY_SPIKE = 500;			//!< Humidity above baseline for a door opening (5 %RH)
+	static const int16_t RISING_SLOPE = 5;				//!< Long term rise that counts as warming (0.05 C/min)
+	static const uint16_t MAX_DEFROST_MINUTES = 45;		//!< A rise without a spike that lasts longer than this is a failure
+
+protected:
+	int16_t temperature[WINDOW];	//!< Ring of recent temperatures (hundredths of a degree)
+	int16_t humidityBaseline = 0;	//!< Slow moving average of humidity (hundredths of a %)
+	int16_t longSlope = 0;			//!< Slope over the window (hundredths of a degree per minute)
+	uint16_t sampleSeconds;			//!< Time between samples
+	uint16_t risingSeconds = 0;		//!< How long the temperature has been rising without a break
+	uint8_t next = 0;				//!< Where the next sample goes in the ring
+	uint8_t count = 0;				//!< Samples in the ring, up to WINDOW
+	Event event = NONE;				//!< Current classification
+	bool changed = false;			//!< Classification changed on the last sample
+};
+
+#endif /* __EXCURSIONDETECTOR_H */
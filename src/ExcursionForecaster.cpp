@@ -0,0 +1,73 @@
+#include "ExcursionForecaster.h"
+
+#include <math.h>
+
+// Hundredths x 256
+static int32_t toFixed(float value) {
+	return (int32_t)lroundf(value * 100 * 256);
+}
+
+ExcursionForecaster::ExcursionForecaster(uint16_t sampleSeconds, uint8_t alpha, uint8_t beta) :
+		sampleSeconds(sampleSeconds), alpha(alpha), beta(beta) {
+}
+
+void ExcursionForecaster::reset() {
+	level = trend = 0;
+	count = 0;
+}
+
+void ExcursionForecaster::addSample(float value) {
+	int32_t x = toFixed(value);
+
+	if (count == 0) {
+		level = x;
+		trend = 0;
+	}
+	else {
+		// 64 bit intermediates - hundredths x 256 x 256 does not fit in 32 bits for large readings
+		int32_t prevLevel = level;
+		level = (int32_t)(((int64_t)alpha * x + (int64_t)(256 - alpha) * (prevLevel + trend)) >> 8);
+		trend = (int32_t)(((int64_t)beta * (level - prevLevel) + (int64_t)(256 - beta) * trend) >> 8);
+	}
+
+	if (count < WARMUP_SAMPLES) {
+		count++;
+	}
+}
+
+int32_t ExcursionForecaster::secondsToCross(float lower, float upper) const {
+	if (!isReady()) {
+		return -1;
+	}
+
+	int32_t lowerFixed = toFixed(lower);
+	int32_t upperFixed = toFixed(upper);
+
+	if (level >= upperFixed || level <= lowerFixed) {
+		return 0;
+	}
+
+	int32_t distance;
+	if (trend > 0) {
+		distance = upperFixed - level;
+	}
+	else if (trend < 0) {
+		distance = lowerFixed - level;
+	}
+	else {
+		return -1;
+	}
+
+	// distance and trend have the same sign here
+	int64_t samples = ((int64_t)distance + trend - (trend > 0 ? 1 : -1)) / trend;
+	int64_t seconds = samples * sampleSeconds;
+	return (seconds > INT32_MAX) ? INT32_MAX : (int32_t)seconds;
+}
+
+float ExcursionForecaster::getLevel() const {
+	return level / 25600.0;
+}
+
+float ExcursionForecaster::getTrendPerHour() const {
+	return trend / 25600.0 * 3600 / sampleSeconds;
+}
@@ -0,0 +1,72 @@
+#ifndef __EXCURSIONFORECASTER_H
+#define __EXCURSIONFORECASTER_H
+
+#include <stdint.h>
+
+/**
+ * @brief Holt's double exponential smoothing (level plus trend) for one reading
+ *
+ * Used to estimate how long it will be until a reading crosses one of its alert limits, so we can
+ * warn ahead of time instead of after the product is already out of range.
+ *
+ * The state is kept in fixed point: values are hundredths (of a degree or a percent RH) scaled by
+ * a further 256, and the smoothing factors are fractions of 256. Each sample is a few multiplies.
+ */
+class ExcursionForecaster {
+public:
+	/**
+	 * @brief Construct a forecaster
+	 *
+	 * @param sampleSeconds Time between samples passed to addSample()
+	 *
+	 * @param alpha Level smoothing factor in 256ths (default 77, about 0.3)
+	 *
+	 * @param beta Trend smoothing factor in 256ths (default 26, about 0.1)
+	 */
+	ExcursionForecaster(uint16_t sampleSeconds, uint8_t alpha = 77, uint8_t beta = 26);
+
+	/**
+	 * @brief Add a sample and update the level and trend
+	 */
+	void addSample(float value);
+
+	/**
+	 * @brief Forget all samples, for example after a long gap
+	 */
+	void reset();
+
+	/**
+	 * @brief True once there have been enough samples for the trend to mean something
+	 */
+	bool isReady() const { return count >= WARMUP_SAMPLES; };
+
+	/**
+	 * @brief Estimate the time until the forecast leaves the range between lower and upper
+	 *
+	 * @return Seconds until the forecast crosses a limit, 0 if the level is already outside,
+	 * or -1 if the trend is not heading towards either limit (or the forecaster is not ready).
+	 */
+	int32_t secondsToCross(float lower, float upper) const;
+
+	/**
+	 * @brief The smoothed value
+	 */
+	float getLevel() const;
+
+	/**
+	 * @brief The smoothed trend per hour
+	 */
+	float getTrendPerHour() const;
+
+	static const uint8_t WARMUP_SAMPLES = 8;	//!< Samples before secondsToCross() gives an answer
+
+protected:
+	int32_t level = 0;			//!< Smoothed value (hundredths x 256)
+	int32_t trend = 0;			//!< Smoothed change per sample (hundredths x 256)
+	uint16_t sampleSeconds;		//!< Time between samples
+	uint8_t alpha;				//!< Level smoothing factor (256ths)
+	uint8_t beta;				//!< Trend smoothing factor (256ths)
+	uint8_t count = 0;			//!< Samples so far, up to WARMUP_SAMPLES
+};
+
+#endif /* __EXCURSIONFORECASTER_H */
@@ -0,0 +1,1732 @@
+#include "FacilityMonitor.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+const char FacilityMonitor::stateNames[8][26] = {"Initialize", "Error", "Idle", "Measuring","Reporting", "Response Wait", "Connecting"};
+const char * const FacilityMonitor::connectionPolicyNames[4] = {"Always On", "Per Report", "Scheduled Windows", "On Alert"};
+const char * const FacilityMonitor::historyTierNames[3] = {"raw", "hourly", "daily"};
+
+const FacilityMonitor::Function FacilityMonitor::functions[] = {                            // Same names as the Particle functions have always had
+  {"Measure-Now", &FacilityMonitor::measureNow},
+  {"Verbose-Mode", &FacilityMonitor::setVerboseMode},
+  {"Temp-Upper-Limit", &FacilityMonitor::setUpperTempLimit},
+  {"Temp-Lower-Limit", &FacilityMonitor::setLowerTempLimit},
+  {"Humidity-Lower-Limit", &FacilityMonitor::setLowerHumidityLimit},
+  {"Humidty-upper-Limit", &FacilityMonitor::setUpperHumidityLimit},
+  {"Keep Alive", &FacilityMonitor::setKeepAlive},
+  {"3rd Party Sim", &FacilityMonitor::setThirdPartySim},
+  {"Adaptive Keep Alive", &FacilityMonitor::setAdaptiveKeepAlive},
+  {"Connection-Policy", &FacilityMonitor::setConnectionPolicy},
+  {"Connect-Window", &FacilityMonitor::setConnectWindow},
+  {"Connection-Stats", &FacilityMonitor::connectionStatsCommand},
+  {"Signal-Deferral", &FacilityMonitor::setSignalDeferral},
+  {"Forecast-Lead", &FacilityMonitor::setForecastLead},
+  {"Threshold-Profiles", &FacilityMonitor::setThresholdProfiles},
+  {"History-Query", &FacilityMonitor::historyQueryCommand},
+  {"Resend-Reports", &FacilityMonitor::resendReportsCommand},
+  {"Trace", &FacilityMonitor::traceCommand}
+};
+const int FacilityMonitor::functionCount = sizeof(functions) / sizeof(functions[0]);
+
+const char * const FacilityMonitor::coalescedEvents[] = {                                   // Short messages that come in bursts - never the reports, which each get a webhook response
+  "Alerts", "State Transition", "Mode",
+  "Upper Temperature Threshold Set", "Lower Temperature Threshold Set", "Upper Humidity Threshold Set", "Lower Humidity Threshold Set"
+};
+const int FacilityMonitor::coalescedEventCount = sizeof(coalescedEvents) / sizeof(coalescedEvents[0]);
+
+FacilityMonitor::FacilityMonitor(const Hal &hal, StallMonitor::Record &stallRecord, TraceBuffer::Ring &traceRing, const char *releaseNumber) :
+  clock(hal.clock), sensor(hal.sensor), store(hal.store), cloud(hal.cloud), gpio(hal.gpio), system(hal.system), releaseNumber(releaseNumber),
+  stallMonitor(stallRecord, stallLimit), traceBuffer(traceRing), bulkDump(store, system, clock), historyQueryDecoder(&historyQuery.block[0]),
+  excursionDetector(sampleInterval), temperatureForecaster(sampleInterval), humidityForecaster(sampleInterval)
+{
+  bulkDump.addStore(BulkDump::SECTION_STATUS, 0, FRAM::historyAddr);                        // Settings, thresholds and the ring heads - the reader needs them to make sense of the rest
+  bulkDump.addStore(BulkDump::SECTION_HISTORY, FRAM::historyAddr, historyBlocks * HistoryBlock::SIZE);
+  bulkDump.addStore(BulkDump::SECTION_HOURLY, FRAM::hourlyAddr, hourlyRecords * sizeof(RollupRecord));
+  bulkDump.addStore(BulkDump::SECTION_DAILY, FRAM::dailyAddr, dailyRecords * sizeof(RollupRecord));
+  bulkDump.addStore(BulkDump::SECTION_REPORTS, FRAM::reportsAddr, reportRecords * sizeof(reportRecord_structure));
+  bulkDump.addMemory(BulkDump::SECTION_TRACE, &traceRing, sizeof(traceRing));
+  bulkDump.addMemory(BulkDump::SECTION_STALL, &stallRecord, sizeof(stallRecord));
+}
+
+int FacilityMonitor::callFunction(int index, const char *argument)                          // Calls a cloud function - -1 if there is no such function
+{
+  if (index < 0 || index >= functionCount) return -1;
+  return (this->*functions[index].handler)((argument) ? argument : "");
+}
+
+int FacilityMonitor::callFunction(const char *name, const char *argument)
+{
+  for (int ii = 0; ii < functionCount; ii++) {
+    if (!strcmp(name, functions[ii].name)) return callFunction(ii, argument);
+  }
+  return -1;
+}
+
+void FacilityMonitor::setup()                                                               // Note: Disconnected Setup()
+{
+  publishPostMortem();                                                                      // Before the stall record is cleared for this run
+  stallMonitor.clear(clock.millis());
+  traceBuffer.begin();                                                                      // Carries on from the trace before the reset
+  traceBuffer.add(clock.millis(), TRACE_BOOT, system.resetReason(), atoi(releaseNumber));
+  gpio.pinMode(HalGpio::WAKE_PIN, false);                                                   // This pin is active HIGH,
+  gpio.pinMode(HalGpio::DONE_PIN, true);                                                    // Allows us to pet the watchdog
+  gpio.pinMode(HalGpio::LED_PIN, true);                                                     // declare the Blue LED Pin as an output
+
+  petWatchdog();                                                                            // Pet the watchdog - This will reset the watchdog time period AND
+  gpio.attachWakeInterrupt();                                                               // The watchdog timer will signal us and we have to respond
+
+  char StartupMessage[64] = "Startup Successful";                                           // Messages from Initialization
+  state = INITIALIZATION_STATE;
+
+  clock.begin();                                                                            // Start the real time clock - and clear any alarm from the last cycle
+
+  if (!sensor.begin()) {                                                                    // Start the i2c connected SHT-31 sensor
+    snprintf(StartupMessage,sizeof(StartupMessage),"Error - SHT31 Initialization");
+    state = ERROR_STATE;
+    resetTimeStamp = clock.millis();
+  }
+
+  // Load FRAM and reset variables to their correct values
+  store.begin();                                                                            // Initialize the FRAM module
+
+  uint8_t tempVersion;
+  store.get(FRAM::versionAddr, tempVersion);
+  if (tempVersion != FRAMversionNumber) {                                                   // Check to see if the memory map in the sketch matches the data on the chip
+    store.erase();                                                                          // Reset the FRAM to correct the issue
+    store.put(FRAM::versionAddr, FRAMversionNumber);                                        // Put the right value in
+    store.get(FRAM::versionAddr, tempVersion);                                              // See if this worked
+    if (tempVersion != FRAMversionNumber) state = ERROR_STATE;                              // Device will not work without FRAM
+    else {
+      loadSystemDefaults();                                                                 // Out of the box, we need the device to be awake and connected
+      loadAlertDefaults();
+      loadKeepAliveDefaults();
+      loadConnectionStatsDefaults();
+      loadThresholdScheduleDefaults();
+      loadHistoryDefaults();
+      loadReportLogDefaults();
+    }
+  }
+  else {
+    store.get(FRAM::sysStatusAddr,sysStatus);                                               // Loads the System Status array from FRAM
+    store.get(FRAM::alertStatusAddr,alertsStatus);                                          // Load the current values array from FRAM
+    store.get(FRAM::keepAliveAddr,keepAliveStatus);                                         // Load what we have learned about each SIM's keep alive
+    store.get(FRAM::connectionStatsAddr,connectionStats);                                   // Load the stats for each connection policy
+    ThresholdSchedule::Stored savedSchedule;
+    store.get(FRAM::thresholdScheduleAddr,savedSchedule);                                   // Load the threshold profiles - the lookup table is rebuilt from them
+    if (!thresholdSchedule.load(savedSchedule)) thresholdScheduleWriteNeeded = true;        // Corrupted - we are back to the base thresholds
+    store.get(FRAM::historyStatusAddr,historyStatus);                                       // Where we were in the history
+    store.get(FRAM::reportLogAddr,reportLog);                                               // Sequence numbers carry on from where they were
+    store.get(FRAM::rollupAddr,hourlyRollup.state);                                     // The hour and the day so far
+    store.get(FRAM::rollupAddr + sizeof(RollupAccumulator::State),dailyRollup.state);
+  }
+
+  startHistory();                                                                           // Pick up the head block so new readings carry on from it
+
+  checkSystemValues();                                                                      // Make sure System values are all in valid range
+  checkAlertsValues();                                                                      // Make sure that Alerts values are all in a valid range
+  checkKeepAliveValues();                                                                   // Make sure the learned keep alive values are in a valid range
+  checkReportLogValues();                                                                   // Make sure the report ring is in a valid range
+  sentSeqSkip = cloud.queuedEvents();                                                       // Anything queued before the reset was not noted - its bare status codes are skipped
+
+  snprintf(connectionPolicyStr, sizeof(connectionPolicyStr), "%s", connectionPolicyNames[sysStatus.connectionPolicy]);
+  if (sysStatus.connectionPolicy == ALWAYS_ON || !clock.isValid()) {                       // Always on - or we need the time before we can schedule anything
+    connectStart = clock.millis();
+    cloud.connect();
+  }
+
+  if (sysStatus.thirdPartySim) {
+    if (connectStart) {
+      StallMonitor::Scope stallOp(stallMonitor, StallMonitor::OP_CELLULAR);
+      cloud.waitConnected(30 * 1000);
+    }
+    keepAliveCurrent = sysStatus.keepAlive;
+    if (cloud.connected()) startKeepAlive();                                                // Picks the learned value for this SIM and sets the keep alive
+    else cloud.keepAlive(sysStatus.keepAlive);                                              // Set the keep alive value - we will look up the SIM once connected
+    // keepAliveTimer.changePeriod(sysStatus.keepAlive*1000);                                  // Will start the repeating timer
+  }
+
+  takeMeasurements();                                                                       // For the benefit of monitoring the device
+  updateThresholdValue();                                                                   // For checking values of each device
+
+  if(sysStatus.verboseMode) cloud.publish("Startup",StartupMessage,HalCloud::PRIORITY_LOW); // Let Particle know how the startup process went
+
+  if (state == INITIALIZATION_STATE) state = (connectStart) ? CONNECTING_STATE : IDLE_STATE; // We made it throughgo let's go to idle
+
+  checkHeap(true);                                                                          // Everything is allocated by now - any growth from here on is a leak
+  stallMonitor.loopRan(clock.millis(), (clock.isValid()) ? clock.now() : 0, state);        // The stall timer starts once this returns - only loop passes are timed
+}
+
+void FacilityMonitor::loop()
+{
+  stallMonitor.loopRan(clock.millis(), (clock.isValid()) ? clock.now() : 0, state);        // Tells the stall monitor we are still going and notes state changes
+
+  switch(state) {
+  case IDLE_STATE:                                                                          // Idle state - brackets only needed if a variable is defined in a state    
+    if (state != oldState) recordStateTransition();
+
+    if (clock.now() - lastSampleTime >= sampleInterval) sampleSensors();                    // Feed the detector between reports
+
+    if (reportDue()) state = MEASURING_STATE;
+    else if (sysStatus.connectionPolicy != ALWAYS_ON) {
+      if (connectionWanted() && !cloud.connected()) startConnection(IDLE_STATE);            // Scheduled window is open
+      else if (!connectionWanted() && cloud.connected() && !dataInFlight && (cloud.queuedEvents() == 0 || deferralStart)) stopConnection(); // All sent or waiting for signal - radio off
+    }
+    break;
+
+  case MEASURING_STATE:                                                                     // Take measurements prior to sending
+    if (state != oldState) recordStateTransition();
+    lastBoundary = clock.now();
+
+    if (takeMeasurements()) alertsStatus.thresholdCrossedFlag = true;                       // A return of a "true" value indicates that one of the thresholds have been crossed
+    else {
+      alertsStatus.thresholdCrossedFlag = false;
+      gpio.digitalWrite(HalGpio::LED_PIN, false);                                           // Just in case it was on an on-flash
+    }
+    alertsStatusWriteNeeded = true;
+
+    state = REPORTING_STATE;
+    break;
+
+  case REPORTING_STATE:
+    if (oldState == MEASURING_STATE) sendEvent();                                           // Queued first, so it goes out on the next session whatever becomes of the connect
+    if (state != oldState) recordStateTransition();                                       // Reporting - hourly or on command
+    if (cloud.connected()) {
+      if (HalClock::hourOf(clock.now()) == 12) {
+        cloud.syncTime();                                                                   // Set the clock each day at noon
+        publishConnectionStats(false);                                                      // and let the backend know how the connection policy is doing
+        if (heapLowWater < heapAfterSetup) cloud.publish("Heap", heapString, HalCloud::PRIORITY_LOW); // Something is allocating after setup
+        if (system.loopStackHeadroom() < stackWarning || cloud.publishStackHeadroom() < stackWarning) cloud.publish("Stacks", stackString, HalCloud::PRIORITY_LOW);
+      }
+      webhookTimeStamp = clock.millis();                                                    // The wait for a response starts once it can go out
+      state = RESP_WAIT_STATE;                                                              // Wait for Response
+    }
+    else if (sysStatus.connectionPolicy == ALWAYS_ON || sysStatus.connectionPolicy == PER_REPORT || (sysStatus.connectionPolicy == ON_ALERT && urgentReport())) {
+      startConnection(REPORTING_STATE);                                                     // Connect and come back here for the noon jobs and the response
+    }
+    else {
+      dataInFlight = false;                                                                 // Nothing to wait for - the response comes when we connect
+      inFlightSeq = 0;                                                                      // Its bare status code is matched up by noteReportSent()
+      state = IDLE_STATE;
+    }
+    break;
+
+  case CONNECTING_STATE:
+    if (state != oldState) recordStateTransition();
+    if (cloud.connected()) state = connectReturnState;
+    else if (reportDue()) state = MEASURING_STATE;                                          // Another report is due - make it and carry on connecting
+    else if (clock.millis() - connectStart > connectMaxTime) {                              // Could not connect - the reports stay queued for next time
+      connectionStats.policy[sysStatus.connectionPolicy].failures++;
+      connectionStatsWriteNeeded = true;
+      connectStart = 0;
+      dataInFlight = false;                                                                 // Its bare status code is matched up by noteReportSent()
+      inFlightSeq = 0;
+      if (sysStatus.connectionPolicy != ALWAYS_ON) stopConnection();                        // Always On leaves the radio trying - a reset would not bring the network back
+      state = IDLE_STATE;
+    }
+    break;
+
+  case RESP_WAIT_STATE:
+    if (state != oldState) recordStateTransition();
+
+    if (!dataInFlight && (clock.now() % reportBoundary()))                                  // Response received back to IDLE state - make sure we don't allow repetivie reporting events
+    {
+     state = IDLE_STATE;
+    }
+    else if (clock.millis() - webhookTimeStamp > webhookWait && webhookTimedOut()) {        // If it takes too long and the link looks broken - will need to reset
+      resetTimeStamp = clock.millis();
+      cloud.publish("spark/device/session/end", "");                                        // If the device times out on the Webhook response, it will ensure a new session is started on next connect
+      state = ERROR_STATE;                                                                  // Response timed out
+      resetTimeStamp = clock.millis();
+    }
+    break;
+
+
+  case ERROR_STATE:                                                                         // To be enhanced - where we deal with errors
+    if (state != oldState) recordStateTransition();
+    if (clock.millis() > resetTimeStamp + resetWait)
+    {
+      if (cloud.connected()) cloud.publish("State","Error State - Reset");                // Brodcast Reset Action
+      StallMonitor::Scope stallOp(stallMonitor, StallMonitor::OP_SLEEP);
+      clock.delay(2000);
+      system.reset();
+    }
+    break;
+  }
+
+  clock.loop();                                                                             // keeps the clock up to date
+
+  trackConnection();                                                                        // Connect time and connected time for the connection policy stats
+
+  checkSignalDeferral();                                                                    // Hold a backlog until the signal is good enough to send it cheaply
+
+  if (sysStatus.thirdPartySim && sysStatus.adaptiveKeepAlive) manageKeepAlive();            // Learn how long the carrier will hold the session open
+  cloudDisconnectRequested = false;                                                         // Both of the above have seen any disconnect we asked for
+
+  if (system.watchdogRequested(watchdogFlag)) petWatchdog();                                // Watchdog flag is raised - time to pet the watchdog
+
+  if (alertsStatus.thresholdCrossedFlag) blinkLED(HalGpio::LED_PIN);
+
+  if (historyQuery.active) pumpHistoryQuery();                                              // Sends the next page of a History-Query answer
+  if (resendMask) pumpResends();                                                            // Sends the next report the backend asked for again
+  publishStall();                                                                           // Lets the backend know if the loop was stuck for a while
+  if (clock.millis() - lastHeapCheck >= heapCheckInterval) checkHeap(false);
+  if (system.consoleAvailable()) pumpBulkDump();                                            // Answers tools/dump-reader.cpp on the USB serial port
+
+  StallMonitor::Scope stallOp(stallMonitor, StallMonitor::OP_I2C);                          // FRAM writes from here on
+  if (sysStatusWriteNeeded) {
+    store.put(FRAM::sysStatusAddr,sysStatus);
+    sysStatusWriteNeeded = false;
+  }
+  if (alertsStatusWriteNeeded) {
+    store.put(FRAM::alertStatusAddr,alertsStatus);
+    alertsStatusWriteNeeded = false;
+  }
+  if (sensorDataWriteNeeded) {
+    store.put(FRAM::sensorDataAddr,sensorData);
+    sensorDataWriteNeeded = false;
+  }
+  if (keepAliveWriteNeeded) {
+    store.put(FRAM::keepAliveAddr,keepAliveStatus);
+    keepAliveWriteNeeded = false;
+  }
+  if (connectionStatsWriteNeeded) {
+    store.put(FRAM::connectionStatsAddr,connectionStats);
+    connectionStatsWriteNeeded = false;
+  }
+  if (thresholdScheduleWriteNeeded) {
+    store.put(FRAM::thresholdScheduleAddr,thresholdSchedule.getStored());
+    thresholdScheduleWriteNeeded = false;
+  }
+  if (historyStatusWriteNeeded) {
+    store.put(FRAM::historyStatusAddr,historyStatus);
+    historyStatusWriteNeeded = false;
+  }
+  if (rollupWriteNeeded) {
+    store.put(FRAM::rollupAddr,hourlyRollup.state);
+    store.put(FRAM::rollupAddr + sizeof(RollupAccumulator::State),dailyRollup.state);
+    rollupWriteNeeded = false;
+  }
+
+}
+
+
+void FacilityMonitor::loadSystemDefaults() {                                                // Default settings for the device - connected, not-low power and always on
+  if (cloud.connected()) cloud.publish("Mode","Loading System Defaults");
+  sysStatus.thirdPartySim = 1;
+  sysStatus.keepAlive = 120;
+  sysStatus.adaptiveKeepAlive = true;
+  sysStatus.connectionPolicy = ALWAYS_ON;
+  sysStatus.connectWindowHours = 24;
+  sysStatus.minSignalStrength = 20;
+  sysStatus.maxDeferralMinutes = 120;
+  sysStatus.forecastLeadMinutes = 30;
+  sysStatus.structuresVersion = 1;
+  sysStatus.verboseMode = false;
+  sysStatus.lowBatteryMode = false;
+  store.put(FRAM::sysStatusAddr,sysStatus);                                                 // Write it now since this is a big deal and I don't want values over written
+}
+
+void FacilityMonitor::loadAlertDefaults() {                                                 // Default settings for the device - connected, not-low power and always on
+  if (cloud.connected()) cloud.publish("Mode","Loading Alert Defaults");
+  alertsStatus.upperTemperatureThreshold = 30;
+  alertsStatus.lowerTemperatureThreshold = 2;
+  alertsStatus.upperHumidityThreshold = 90;
+  alertsStatus.lowerHumidityThreshold= 5;
+  store.put(FRAM::alertStatusAddr,alertsStatus);                                            // Write it now since this is a big deal and I don't want values over written
+}
+
+void FacilityMonitor::loadConnectionStatsDefaults() {                                       // Start the stats for every policy from zero
+  memset(&connectionStats, 0, sizeof(connectionStats));
+  store.put(FRAM::connectionStatsAddr,connectionStats);
+}
+
+void FacilityMonitor::loadKeepAliveDefaults() {                                             // Nothing learned yet - each SIM starts from the Keep Alive value
+  memset(&keepAliveStatus, 0, sizeof(keepAliveStatus));
+  store.put(FRAM::keepAliveAddr,keepAliveStatus);
+}
+
+void FacilityMonitor::loadThresholdScheduleDefaults() {                                     // No windows - the base thresholds apply all day
+  thresholdSchedule.clear();
+  store.put(FRAM::thresholdScheduleAddr,thresholdSchedule.getStored());
+}
+
+void FacilityMonitor::loadHistoryDefaults() {                                               // Empty history - the blocks themselves were cleared by the erase
+  memset(&historyStatus, 0, sizeof(historyStatus));
+  store.put(FRAM::historyStatusAddr,historyStatus);
+  hourlyRollup.begin(0);
+  dailyRollup.begin(0);
+  store.put(FRAM::rollupAddr,hourlyRollup.state);
+  store.put(FRAM::rollupAddr + sizeof(RollupAccumulator::State),dailyRollup.state);
+}
+
+void FacilityMonitor::loadReportLogDefaults() {                                             // Sequence numbers start at 1 - 0 means no report
+  memset(&reportLog, 0, sizeof(reportLog));
+  reportLog.nextSeq = 1;
+  store.put(FRAM::reportLogAddr,reportLog);
+}
+
+void FacilityMonitor::checkReportLogValues() {                                              // A ring we can't trust is emptied - the sequence number is kept so it never goes backwards
+  if (reportLog.nextSeq == 0) reportLog.nextSeq = 1;
+  if (reportLog.head >= reportRecords || reportLog.used > reportRecords || reportLog.used >= reportLog.nextSeq) {
+    reportLog.head = reportLog.used = 0;
+    store.put(FRAM::reportLogAddr,reportLog);
+  }
+  countUnackedReports();
+}
+
+void FacilityMonitor::checkSystemValues() {                                                 // Checks to ensure that all system values are in reasonable range 
+  if (sysStatus.connectedStatus < 0 || sysStatus.connectedStatus > 1) {
+    if (cloud.connected()) sysStatus.connectedStatus = true;
+    else sysStatus.connectedStatus = false;
+  }
+  if (sysStatus.keepAlive < 0 || sysStatus.keepAlive > 1200) sysStatus.keepAlive = 600;
+  if (sysStatus.adaptiveKeepAlive > 1) sysStatus.adaptiveKeepAlive = true;
+  if (sysStatus.connectionPolicy > ON_ALERT) sysStatus.connectionPolicy = ALWAYS_ON;
+  if (sysStatus.connectWindowHours < 1 || sysStatus.connectWindowHours > 24) sysStatus.connectWindowHours = 24;
+  if (sysStatus.minSignalStrength > 100) sysStatus.minSignalStrength = 20;
+  if (sysStatus.maxDeferralMinutes > 1440) sysStatus.maxDeferralMinutes = 120;
+  if (sysStatus.forecastLeadMinutes > 720) sysStatus.forecastLeadMinutes = 30;
+  if (sysStatus.verboseMode < 0 || sysStatus.verboseMode > 1) sysStatus.verboseMode = false;
+  if (sysStatus.lowBatteryMode < 0 || sysStatus.lowBatteryMode > 1) sysStatus.lowBatteryMode = 0;
+  if (sysStatus.resetCount < 0 || sysStatus.resetCount > 255) sysStatus.resetCount = 0;
+  sysStatusWriteNeeded = true;
+}
+
+void FacilityMonitor::checkAlertsValues() {                                                 // Checks to ensure that all system values are in reasonable range 
+  if (alertsStatus.lowerTemperatureThreshold < 0.0  || alertsStatus.lowerTemperatureThreshold > 20.0) alertsStatus.lowerTemperatureThreshold = 3.0;
+  if (alertsStatus.upperTemperatureThreshold < 20.0 || alertsStatus.upperTemperatureThreshold > 90.0) alertsStatus.upperTemperatureThreshold = 33.0;
+  if (alertsStatus.lowerHumidityThreshold < 0.0     || alertsStatus.lowerHumidityThreshold > 50.0)    alertsStatus.lowerHumidityThreshold = 13.0;
+  if (alertsStatus.upperHumidityThreshold < 20.0    || alertsStatus.upperHumidityThreshold > 90.0)    alertsStatus.upperHumidityThreshold = 63.0;
+  alertsStatusWriteNeeded = true;
+}
+
+void FacilityMonitor::checkKeepAliveValues() {                                              // Throw away any entry that can't be right
+  for (keepAliveSim_structure &sim : keepAliveStatus.sims) {
+    sim.iccid[sizeof(sim.iccid) - 1] = '\0';
+    if (sim.knownGood < keepAliveMin || sim.knownGood > keepAliveMax || sim.knownBad > keepAliveMax || (sim.knownBad && sim.knownBad <= sim.knownGood)) {
+      memset(&sim, 0, sizeof(sim));
+      keepAliveWriteNeeded = true;
+    }
+  }
+}
+
+void FacilityMonitor::watchdogInterrupt(uint32_t nowMillis)                                 // From the wake pin interrupt - nowMillis is millis() there and then
+{
+  watchdogFlag = true;
+  stallMonitor.watchdogRequested(nowMillis);                                                // The pet should follow on the next loop pass
+}
+
+void FacilityMonitor::petWatchdog()
+{
+  gpio.digitalWrite(HalGpio::DONE_PIN, true);                                               // Pet the watchdog
+  gpio.digitalWrite(HalGpio::DONE_PIN, false);
+  watchdogFlag = false;
+  uint32_t petWait = stallMonitor.watchdogPetted(clock.millis());                           // Anything over stallLimit was already counted as a stall
+  traceBuffer.add(clock.millis(), TRACE_WATCHDOG_PET, 0, (petWait > UINT16_MAX) ? UINT16_MAX : petWait);
+}
+
+// These functions record what the loop is doing so a stall - and the watchdog reset that follows - can be explained
+
+void FacilityMonitor::checkStall(uint32_t nowMillis)                                        // Timer callback - only touches the retained record
+{
+  stallMonitor.check(nowMillis);
+}
+
+void FacilityMonitor::publishStall()                                                        // Once the loop is going again after a stall
+{
+  uint32_t duration = 0;
+  uint8_t stalledState = 0, stalledOperation = 0;
+  bool recovered = stallMonitor.takeRecovery(duration, stalledState, stalledOperation);     // Set by the stall timer
+  if (!system.stallRecovered(recovered, duration, stalledState, stalledOperation)) return;  // Logged for a replay, which has no timer
+  traceBuffer.add(clock.millis(), TRACE_STALL, stalledState, (duration / 1000 > UINT16_MAX) ? UINT16_MAX : duration / 1000);
+  char data[64];
+  snprintf(data, sizeof(data), "%4.1f sec in %s during %s", duration / 1000.0,
+    (stalledState <= CONNECTING_STATE) ? stateNames[stalledState] : "?", StallMonitor::operationName(stalledOperation));
+  cloud.publish("Stall", data);
+}
+
+void FacilityMonitor::publishPostMortem()                                                   // On the first boot after a watchdog reset, what the loop was last doing
+{
+  const StallMonitor::Record &record = stallMonitor.getRecord();
+  int reason = system.resetReason();
+  if (!stallMonitor.isValid()) return;                                                      // Power up - retained RAM is random
+  if (reason != HalSystem::RESET_PIN && reason != HalSystem::RESET_WATCHDOG && !stallMonitor.isStalled()) return; // The external watchdog pulls the reset pin
+
+  unsigned long stalledFor = (record.stallMillis) ? record.checkMillis - record.stallMillis : 0;
+  unsigned long petWait = (record.requestMillis) ? record.checkMillis - record.requestMillis : 0;
+  unsigned long resetTime = 0;                                                              // Roughly - the last state change plus the time since
+  if (record.loopTime && stallMonitor.getCount()) {
+    resetTime = record.loopTime + (record.checkMillis - stallMonitor.getEntry(stallMonitor.getCount() - 1).millis) / 1000;
+  }
+
+  char data[400];
+  int len = snprintf(data, sizeof(data), "{\"Reason\":%i,\"State\":\"%s\",\"Op\":\"%s\",\"StalledMs\":%lu,\"PetWaitMs\":%lu,\"LongestPetMs\":%lu,\"Stalls\":%u,\"Time\":%lu,\"Trail\":\"",
+    reason, (record.state <= CONNECTING_STATE) ? stateNames[record.state] : "?", StallMonitor::operationName(record.operation),
+    stalledFor, petWait, (unsigned long)record.longestPetGap, (unsigned)record.stalls, resetTime);
+  const int trailEntries = 8;                                                               // The last few state changes, in seconds before the reset
+  int first = (stallMonitor.getCount() > trailEntries) ? stallMonitor.getCount() - trailEntries : 0;
+  for (int ii = first; ii < stallMonitor.getCount() && len > 0 && len < (int)sizeof(data); ii++) {
+    const StallMonitor::Entry &entry = stallMonitor.getEntry(ii);
+    len += snprintf(&data[len], sizeof(data) - len, "%s%s/%s -%lu", (ii == first) ? "" : ",",
+      (entry.state <= CONNECTING_STATE) ? stateNames[entry.state] : "?", StallMonitor::operationName(entry.operation), (unsigned long)(record.checkMillis - entry.millis) / 1000);
+  }
+  if (len > 0 && len < (int)sizeof(data)) snprintf(&data[len], sizeof(data) - len, "\"}");
+  cloud.publish("Post Mortem", data);                                                      // Queued - goes out once we connect
+}
+
+// void keepAliveMessage() {
+//   Particle.publish("*", PRIVATE,NO_ACK);
+// }
+
+// These functions learn the carrier's NAT timeout for third party SIMs. We lengthen the keep alive while the
+// session survives, back off to the last good value when it drops and stop once the two are a step apart.
+
+void FacilityMonitor::startKeepAlive()                                                      // Call once connected - finds this SIM's entry and sets the keep alive
+{
+  if (!sysStatus.adaptiveKeepAlive) {
+    keepAliveCurrent = sysStatus.keepAlive;
+    cloud.keepAlive(keepAliveCurrent);
+    return;
+  }
+
+  if (!keepAliveSim) {
+    char iccid[21];
+    StallMonitor::Scope stallOp(stallMonitor, StallMonitor::OP_CELLULAR);
+    cloud.simId(iccid, sizeof(iccid));                                                      // The ICCID tells us which SIM is in the device
+
+    keepAliveSim_structure *oldest = &keepAliveStatus.sims[0];
+    for (keepAliveSim_structure &sim : keepAliveStatus.sims) {
+      if (!strncmp(sim.iccid, iccid, sizeof(sim.iccid) - 1) && sim.knownGood) {
+        keepAliveSim = &sim;
+        break;
+      }
+      if (sim.lastUsed < oldest->lastUsed) oldest = &sim;
+    }
+    if (!keepAliveSim) {                                                                    // New SIM - start learning from the Keep Alive value
+      keepAliveSim = oldest;
+      memset(keepAliveSim, 0, sizeof(keepAliveSim_structure));
+      strncpy(keepAliveSim->iccid, iccid, sizeof(keepAliveSim->iccid) - 1);
+      keepAliveSim->knownGood = std::min(std::max(sysStatus.keepAlive, keepAliveMin), keepAliveMax);
+    }
+    keepAliveSim->lastUsed = clock.now();
+    keepAliveWriteNeeded = true;
+  }
+
+  setKeepAliveProbe(nextKeepAliveProbe());
+}
+
+int FacilityMonitor::nextKeepAliveProbe()                                                   // Longer while we have no upper bound, then split the difference
+{
+  if (keepAliveSim->converged) return keepAliveSim->knownGood;
+
+  int probe;
+  if (!keepAliveSim->knownBad) probe = std::min(keepAliveSim->knownGood * 3 / 2, keepAliveMax);
+  else probe = (keepAliveSim->knownGood + keepAliveSim->knownBad) / 2;
+
+  if (probe - keepAliveSim->knownGood < keepAliveStep) {                                    // Close enough - this is the carrier's limit
+    keepAliveSim->converged = true;
+    keepAliveWriteNeeded = true;
+    char data[32];
+    snprintf(data, sizeof(data), "Learned %i sec", keepAliveSim->knownGood);
+    cloud.publish("Keep Alive", data);
+    return keepAliveSim->knownGood;
+  }
+  return probe;
+}
+
+void FacilityMonitor::setKeepAliveProbe(int seconds)
+{
+  keepAliveCurrent = seconds;
+  keepAliveProbeStart = clock.millis();
+  cloud.keepAlive(keepAliveCurrent);
+  if (sysStatus.verboseMode) {
+    char data[32];
+    snprintf(data, sizeof(data), "Probing %i sec", keepAliveCurrent);
+    cloud.publish("Keep Alive", data);
+  }
+}
+
+void FacilityMonitor::manageKeepAlive()                                                     // Called from the main loop - watches the session and moves the keep alive
+{
+  bool connected = cloud.connected();
+
+  if (connected && !keepAliveWasConnected) startKeepAlive();                                         // New session - pick up where we left off
+  else if (!connected && keepAliveWasConnected && keepAliveSim && !cloudDisconnectRequested) {       // We lost the session
+    if (keepAliveCurrent > keepAliveSim->knownGood) {                                       // The probe was too long - back off to the last good value
+      keepAliveSim->knownBad = keepAliveCurrent;
+      keepAliveWriteNeeded = true;
+    }
+    else if (cloud.registered()) {                                                          // Even the good value failed with the network still there - the carrier may have changed
+      keepAliveSim->knownBad = keepAliveSim->knownGood;
+      keepAliveSim->knownGood = std::max(keepAliveSim->knownGood / 2, keepAliveMin);
+      keepAliveSim->converged = false;
+      keepAliveWriteNeeded = true;
+    }                                                                                       // Otherwise the network went away - that says nothing about the carrier's timeout
+  }
+  else if (connected && keepAliveSim && !keepAliveSim->converged && keepAliveCurrent > keepAliveSim->knownGood
+           && clock.millis() - keepAliveProbeStart > (unsigned long)keepAliveCurrent * keepAliveSurviveIntervals * 1000) {
+    keepAliveSim->knownGood = keepAliveCurrent;                                             // The session survived - this value is good
+    keepAliveWriteNeeded = true;
+    setKeepAliveProbe(nextKeepAliveProbe());
+  }
+
+  keepAliveWasConnected = connected;
+}
+
+// These functions carry out the connection policy and keep the stats we use to pick one for each site
+
+bool FacilityMonitor::connectionWanted()                                                    // Should we be connected right now, report or not?
+{
+  switch (sysStatus.connectionPolicy) {
+    case ALWAYS_ON: return true;
+    case SCHEDULED_WINDOWS: return (HalClock::hourOf(clock.now()) % sysStatus.connectWindowHours == 0 && HalClock::minuteOf(clock.now()) < connectWindowMinutes);
+    default: return false;                                                                  // Per report and on alert connect from REPORTING_STATE
+  }
+}
+
+void FacilityMonitor::startConnection(State returnState)                                    // Turns on the radio and connects - CONNECTING_STATE waits for it
+{
+  connectReturnState = returnState;
+  if (!connectStart) connectStart = clock.millis();
+  cloud.connect();                                                                          // Turns on the cellular modem as well
+  state = CONNECTING_STATE;
+}
+
+void FacilityMonitor::stopConnection()                                                      // Disconnect and turn the radio off
+{
+  updateConnectionStats();
+  cloudDisconnectRequested = true;
+  cloud.disconnect();                                                                       // Turns the radio off as well
+}
+
+void FacilityMonitor::trackConnection()                                                     // Called from the main loop - notes when we connect and disconnect
+{
+  bool connected = cloud.connected();
+
+  if (connected && !trackWasConnected) {
+    if (connectStart) {
+      connectionStats.policy[sysStatus.connectionPolicy].connects++;
+      connectionStats.policy[sysStatus.connectionPolicy].connectMillis += clock.millis() - connectStart;
+      connectStart = 0;
+    }
+    connectedSince = clock.millis();
+    lastSentBytes = cloud.sentBytes();
+    connectionStatsWriteNeeded = true;
+    traceBuffer.add(clock.millis(), TRACE_CONNECTED, sysStatus.connectionPolicy);
+  }
+  else if (!connected && trackWasConnected) {
+    traceBuffer.add(clock.millis(), TRACE_DISCONNECTED, cloudDisconnectRequested);
+    if (!cloudDisconnectRequested) {
+      updateConnectionStats();                                                              // We lost it - stopConnection() did this already if it was us
+      if (sysStatus.connectionPolicy == ALWAYS_ON) connectStart = clock.millis();           // Device OS will reconnect - time it
+    }
+    connectedSince = 0;
+  }
+
+  trackWasConnected = connected;
+}
+
+void FacilityMonitor::updateConnectionStats()                                               // Adds connected time and data since the last call to the current policy
+{
+  if (!connectedSince) return;
+  connectionStats.policy[sysStatus.connectionPolicy].connectedSeconds += (clock.millis() - connectedSince) / 1000;
+  connectedSince = clock.millis();
+  uint32_t sentBytes = cloud.sentBytes();
+  connectionStats.policy[sysStatus.connectionPolicy].bytesSent += sentBytes - lastSentBytes;
+  lastSentBytes = sentBytes;
+  connectionStatsWriteNeeded = true;
+}
+
+void FacilityMonitor::publishConnectionStats(bool force)                                    // Once a day, or when asked for
+{
+  if (!force && HalClock::dayOf(clock.now()) == lastStatsDay) return;
+  lastStatsDay = HalClock::dayOf(clock.now());
+
+  updateConnectionStats();
+  const auto &stats = connectionStats.policy[sysStatus.connectionPolicy];
+  float connectSec = (stats.connects) ? stats.connectMillis / 1000.0 / stats.connects : 0.0;
+  float radiomAh = (stats.connectMillis / 1000.0 * connectingCurrentmA + stats.connectedSeconds * connectedCurrentmA) / 3600.0;
+  char data[160];
+  snprintf(data, sizeof(data), "{\"Policy\":\"%s\",\"Connects\":%u,\"Failures\":%u,\"ConnectSec\":%4.1f,\"ConnectedMin\":%lu,\"kB\":%4.1f,\"mAh\":%4.1f}",
+    connectionPolicyNames[sysStatus.connectionPolicy], stats.connects, stats.failures, connectSec, (unsigned long)(stats.connectedSeconds / 60), stats.bytesSent / 1024.0, radiomAh);
+  cloud.publish("Connection Stats", data, HalCloud::PRIORITY_LOW);
+}
+
+// These functions hold a backlog of queued events while the signal is poor - sending at -110 dBm costs far more energy and retries
+
+int FacilityMonitor::readSignal()                                                           // Samples the signal and updates the console - returns strength in %
+{
+  StallMonitor::Scope stallOp(stallMonitor, StallMonitor::OP_CELLULAR);                     // An AT command - can take seconds
+  float strengthPercent, dBm;
+  cloud.signal(strengthPercent, dBm);
+  int strength = (int)strengthPercent;
+  snprintf(signalString, sizeof(signalString), "%i%% (%4.0f dBm)", strength, dBm);
+  return strength;
+}
+
+void FacilityMonitor::checkSignalDeferral()                                                 // Called from the main loop - pauses and resumes the publish queue
+{
+  if (!deferralStart) {
+    if (!sysStatus.minSignalStrength || urgentReport() || !cloud.connected()) return;
+    if (cloud.queuedEvents() <= 1 || clock.millis() - lastSignalCheck < signalCheckInterval) return; // A single report is never held - only backlogs
+    lastSignalCheck = clock.millis();
+    if (readSignal() >= sysStatus.minSignalStrength) return;
+    deferralStart = clock.millis();                                                         // Poor signal - hold the backlog
+    cloud.pausePublishing(true);
+    if (sysStatus.verboseMode) cloud.publish("Signal", "Deferring Backlog", HalCloud::PRIORITY_LOW); // Queued behind the backlog like everything else
+    return;
+  }
+
+  bool release = urgentReport();                                                            // Alerts go out now whatever the signal
+  release = release || (clock.millis() - deferralStart > (unsigned long)sysStatus.maxDeferralMinutes * 60 * 1000);
+  if (!release && cloud.connected() && clock.millis() - lastSignalCheck > signalCheckInterval) {
+    lastSignalCheck = clock.millis();
+    release = (readSignal() >= sysStatus.minSignalStrength);
+  }
+  if (release) {
+    deferralStart = 0;
+    cloud.pausePublishing(false);
+  }
+}
+
+void FacilityMonitor::sendEvent()
+{
+  StallMonitor::Scope stallOp(stallMonitor, StallMonitor::OP_PUBLISH);
+  sensorData.signalStrength = (cloud.connected()) ? readSignal() : -1;                      // -1 for a report queued while disconnected
+
+  reportRecord_structure report;                                                            // Kept until it is acked so it can be sent again exactly as it was
+  memset(&report, 0, sizeof(report));
+  report.seq = reportLog.nextSeq++;
+  report.timeStamp = sensorData.timeStamp;
+  report.temperature = (int16_t)lroundf(sensorData.temperatureInC * 10);
+  report.humidity = (int16_t)lroundf(sensorData.relativeHumidity * 10);
+  report.battery = sensorData.stateOfCharge;
+  report.signal = sensorData.signalStrength;
+  if (reportLog.used == reportRecords) {                                                    // The oldest report leaves the ring - it is no longer waiting if it was
+    uint8_t acked;
+    store.get(FRAM::reportsAddr + reportLog.head * sizeof(reportRecord_structure) + offsetof(reportRecord_structure, acked), acked);
+    if (!acked) unackedReports--;
+  }
+  store.put(FRAM::reportsAddr + reportLog.head * sizeof(reportRecord_structure), report);
+  resendMask &= ~(1UL << reportLog.head);                                                   // That slot holds a new report now
+  reportLog.head = (reportLog.head + 1) % reportRecords;
+  if (reportLog.used < reportRecords) reportLog.used++;
+  store.put(FRAM::reportLogAddr,reportLog);                                                 // Written now so a reset can never reuse the sequence number
+  unackedReports++;
+  traceBuffer.add(clock.millis(), TRACE_REPORT, (uint8_t)report.signal, (uint16_t)report.seq);
+
+  formatReport(report, reportData, sizeof(reportData));
+  cloud.publish(reportEventName, reportData, HalCloud::PRIORITY_HIGH);
+  noteReportSent(report.seq);
+  inFlightSeq = report.seq;
+  dataInFlight = true;                                                                      // set the data inflight flag
+  webhookRetries = 0;
+  webhookTimeStamp = clock.millis();
+}
+
+void FacilityMonitor::formatReport(const reportRecord_structure &report, char *buf, size_t bufSize) // The webhook payload - built the same way for a resend
+{
+  snprintf(buf, bufSize, "{\"Temperature\":%4.1f, \"Humidity\":%4.1f,\"Battery\":%i,\"Signal\":%i,\"Timestamp\":%lu,\"Seq\":%lu}", report.temperature / 10.0,
+    report.humidity / 10.0, report.battery, report.signal, (unsigned long)report.timeStamp, (unsigned long)report.seq);
+}
+
+int FacilityMonitor::reportSlot(uint32_t seq)                                               // Ring slot holding a sequence number, or -1 if it is not in the ring any more
+{
+  if (seq == 0 || seq >= reportLog.nextSeq || reportLog.nextSeq - seq > reportLog.used) return -1;
+  return (reportLog.head + reportRecords - (reportLog.nextSeq - seq)) % reportRecords;     // Sequence numbers are consecutive in the ring, so no search
+}
+
+void FacilityMonitor::countUnackedReports()                                                 // Once at setup - after that sendEvent() and ackReports() keep the count
+{
+  unackedReports = 0;
+  for (int ii = 0; ii < reportLog.used; ii++) {
+    uint8_t acked;
+    store.get(FRAM::reportsAddr + ((reportLog.head + reportRecords - 1 - ii) % reportRecords) * sizeof(reportRecord_structure) + offsetof(reportRecord_structure, acked), acked);
+    if (!acked) unackedReports++;
+  }
+}
+
+bool FacilityMonitor::forEachSeqRange(const char *list, void (FacilityMonitor::*action)(uint32_t first, uint32_t last)) // "5,9-11" - calls action for each range, false if the list is not valid
+{
+  const char *cp = list;
+  while (*cp) {
+    char * pEND;
+    uint32_t first = strtoul(cp,&pEND,10);
+    if (pEND == cp) return false;
+    uint32_t last = first;
+    if (*pEND == '-') {
+      cp = pEND + 1;
+      last = strtoul(cp,&pEND,10);
+      if (pEND == cp || last < first) return false;
+    }
+    if (last - first >= (uint32_t)reportRecords) first = last - reportRecords + 1;         // Anything older has left the ring anyway
+    (this->*action)(first, last);
+    if (*pEND == ',') pEND++;
+    else if (*pEND) return false;
+    cp = pEND;
+  }
+  return true;
+}
+
+void FacilityMonitor::ackReports(uint32_t first, uint32_t last)                             // The backend has these - they won't be sent again
+{
+  for (uint32_t seq = first; seq <= last && seq >= first; seq++) {
+    int slot = reportSlot(seq);
+    if (slot < 0) continue;
+    uint8_t acked;
+    store.get(FRAM::reportsAddr + slot * sizeof(reportRecord_structure) + offsetof(reportRecord_structure, acked), acked);
+    resendMask &= ~(1UL << slot);
+    if (acked) continue;                                                                    // A duplicate ack - nothing to write
+    acked = true;
+    store.put(FRAM::reportsAddr + slot * sizeof(reportRecord_structure) + offsetof(reportRecord_structure, acked), acked);
+    unackedReports--;
+  }
+  if (inFlightSeq >= first && inFlightSeq <= last) {
+    dataInFlight = false;
+    inFlightSeq = 0;
+  }
+  if (reportLog.nextSeq - 1 >= first && reportLog.nextSeq - 1 <= last) {                  // The latest report is in - alerts up to now have been delivered
+    alertsStatus.upperHumidityThresholdCrossed = false;
+    alertsStatus.lowerHumidityThresholdCrossed = false;
+    alertsStatus.upperTemperatureThresholdCrossed = false;
+    alertsStatus.lowerTemperatureThresholdCrossed = false;
+    alertsStatusWriteNeeded = true;
+  }
+  webhookRetries = 0;
+  linkFailures = 0;
+}
+
+void FacilityMonitor::markResends(uint32_t first, uint32_t last)                            // The backend is missing these - queue them up again
+{
+  for (uint32_t seq = first; seq <= last && seq >= first; seq++) {
+    int slot = reportSlot(seq);
+    if (slot >= 0) resendMask |= (1UL << slot);
+  }
+}
+
+void FacilityMonitor::pumpResends()                                                         // Sends the oldest report asked for - one at a time so the queue has room for new reports
+{
+  if (!cloud.connected() || cloud.queuedEvents() > 1) return;
+
+  for (int ii = reportLog.used; ii > 0; ii--) {                                             // Oldest first
+    int slot = (reportLog.head + reportRecords - ii) % reportRecords;
+    if (!(resendMask & (1UL << slot))) continue;
+    resendMask &= ~(1UL << slot);
+    reportRecord_structure report;
+    store.get(FRAM::reportsAddr + slot * sizeof(reportRecord_structure), report);
+    if (report.acked) continue;                                                             // Acked while it waited
+    char data[sizeof(reportData)];
+    formatReport(report, data, sizeof(data));
+    cloud.publish(reportEventName, data, HalCloud::PRIORITY_HIGH);
+    noteReportSent(report.seq);
+    return;
+  }
+  resendMask = 0;                                                                           // Whatever was left has gone from the ring
+}
+
+void FacilityMonitor::pumpBulkDump()                                                        // Sends what the USB serial port will take - about a frame a pass while a dump is going
+{
+  StallMonitor::Scope stallOp(stallMonitor, StallMonitor::OP_SERIAL);
+  uint8_t section = bulkDump.poll(releaseNumber);
+  if (section) traceBuffer.add(clock.millis(), TRACE_BULK_DUMP, section, bulkDump.getBytesSent() / 1024);
+}
+
+int FacilityMonitor::resendReportsCommand(const char *command)                              // "5,9-11" - send these reports again, or "unacked" for every one the backend has not confirmed
+{
+  if (!strcmp(command, "unacked")) {
+    for (int ii = 0; ii < reportLog.used; ii++) {
+      int slot = (reportLog.head + reportRecords - 1 - ii) % reportRecords;
+      uint8_t acked;
+      store.get(FRAM::reportsAddr + slot * sizeof(reportRecord_structure) + offsetof(reportRecord_structure, acked), acked);
+      if (!acked) resendMask |= (1UL << slot);
+    }
+    return 1;
+  }
+  return (forEachSeqRange(command, &FacilityMonitor::markResends)) ? 1 : 0;
+}
+
+bool FacilityMonitor::webhookTimedOut()                                                     // No response in time - returns true only if the session looks broken
+{
+  if (deferralStart) {                                                                      // The report is waiting behind a backlog for a better signal - not a broken link
+    dataInFlight = false;
+    return false;
+  }
+
+  bool reportSent = (cloud.queuedEvents() == 0);                                            // The cloud took the report so the webhook is just slow
+  if (reportSent && cloud.connected()) linkFailures = 0;
+  else linkFailures++;                                                                      // Report is stuck on the device - evidence of a broken link
+
+  if (linkFailures >= linkFailureLimit) return true;                                        // Repeated evidence - a new session is worth the handshake
+
+  if (webhookRetries >= webhookRetryLimit) {                                                // The backend is not answering - give up on this report but keep the session
+    if (sysStatus.verboseMode) cloud.publish("Ubidots Hook", "No Response", HalCloud::PRIORITY_LOW);
+    forgetReportSends(inFlightSeq, false);
+    dataInFlight = false;
+    return false;
+  }
+
+  webhookRetries++;
+  if (reportSent) {                                                                         // Same report, same sequence number - the backend can drop a duplicate
+    cloud.publish(reportEventName, reportData, HalCloud::PRIORITY_HIGH);
+    noteReportSent(inFlightSeq);
+  }
+  webhookTimeStamp = clock.millis();                                                        // If it is still queued, give it more time rather than queue it twice
+  return false;
+}
+
+void FacilityMonitor::UbidotsHandler(const char *event, const char *data)                   // Looks at the response from Ubidots - Will reset Photon if no successful response
+{                                                                                           // Response Template: "{{hourly.0.status_code}}" so, I should only get a 3 digit number back
+  // Responses: "200:17" acks report 17, "200" the oldest send with no response yet, "ack:12-17,19" acks those and "resend:5,9-11" asks for those again
+  if (!data) {                                                                    // First check to see if there is any data
+    if (sysStatus.verboseMode) {
+      cloud.publish("Ubidots Hook", "No Data");
+    }
+    return;
+  }
+  if (!strncmp(data, "ack:", 4)) {
+    forEachSeqRange(data + 4, &FacilityMonitor::ackReports);
+    return;
+  }
+  if (!strncmp(data, "resend:", 7)) {
+    forEachSeqRange(data + 7, &FacilityMonitor::markResends);
+    return;
+  }
+  int responseCode = atoi(data);                                                  // Response is only a single number thanks to Template
+  if ((responseCode == 200) || (responseCode == 201))
+  {
+    traceBuffer.add(clock.millis(), TRACE_RESPONSE, 1, responseCode);
+    const char *seqStr = strchr(data, ':');
+    uint32_t seq = 0;
+    if (seqStr) {                                                                           // The report it names - the only certain ack
+      seq = strtoul(seqStr + 1, NULL, 10);
+      forgetReportSends(seq, true);
+    }
+    else if (sentSeqSkip) sentSeqSkip--;                                                    // A bare status code for a send we can't name
+    else if (sentSeqCount) {                                                                // or for the oldest send still waiting - responses come back in the order the reports went
+      seq = sentSeqs[sentSeqFirst];
+      sentSeqFirst = (sentSeqFirst + 1) % sentSeqSlots;
+      sentSeqCount--;
+    }
+    if (!seq) return;                                                                       // A bare code with no send waiting - a late duplicate, so it acks nothing
+    ackReports(seq, seq);
+  }
+  else {
+    traceBuffer.add(clock.millis(), TRACE_RESPONSE, 0, (uint16_t)responseCode);
+    if (sysStatus.verboseMode) cloud.publish("Ubidots Hook", data, HalCloud::PRIORITY_LOW); // Publish the response code
+  }
+
+
+}
+
+void FacilityMonitor::noteReportSent(uint32_t seq)                                          // Every publish of a report - resends too - so each bare status code has one send to answer
+{
+  if (sentSeqCount == sentSeqSlots) {                                                       // No room to note it - the oldest goes and its code, if it comes, is skipped
+    sentSeqFirst = (sentSeqFirst + 1) % sentSeqSlots;
+    sentSeqCount--;
+    sentSeqSkip++;
+  }
+  sentSeqs[(sentSeqFirst + sentSeqCount) % sentSeqSlots] = seq;
+  sentSeqCount++;
+}
+
+void FacilityMonitor::forgetReportSends(uint32_t seq, bool answered)                        // Stops matching bare codes to this report - any still to come are skipped unless it was answered
+{
+  int kept = 0;
+  for (int ii = 0; ii < sentSeqCount; ii++) {
+    uint32_t sent = sentSeqs[(sentSeqFirst + ii) % sentSeqSlots];
+    if (sent == seq) {
+      if (!answered) sentSeqSkip++;
+      continue;
+    }
+    sentSeqs[(sentSeqFirst + kept++) % sentSeqSlots] = sent;
+  }
+  sentSeqCount = kept;
+}
+
+// These are the functions that are part of the takeMeasurements call
+
+bool FacilityMonitor::takeMeasurements() {
+  char thresholdMessage[64] = "All within thresholds";
+  bool haveAnyAlertsBeenSet = false;
+  sensorData.validData = false;
+  updateActiveThresholds();
+  bool alertsAllowed = !(activeThresholds.flags & ThresholdSchedule::SUPPRESS_ALERTS);
+  StallMonitor::Scope stallOp(stallMonitor, StallMonitor::OP_I2C);                          // Sensor reads
+
+  if (sensor.readTemperature()){
+    sensorData.temperatureInC = sensor.readTemperature();
+    snprintf(temperatureString,sizeof(temperatureString),"%4.1f*C", sensorData.temperatureInC);
+
+    sensorData.relativeHumidity = sensor.readHumidity();
+    snprintf(humidityString,sizeof(humidityString),"%4.1f%%", sensorData.relativeHumidity);
+
+    sensorData.stateOfCharge = int(sensor.batteryCharge());
+    snprintf(batteryString, sizeof(batteryString), "%i %%", sensorData.stateOfCharge);
+
+    // If lower temperature threshold is crossed, Set the flag true. 
+    if (alertsAllowed && sensorData.temperatureInC < activeThresholds.lowerTemperatureThreshold) {
+      alertsStatus.lowerTemperatureThresholdCrossed = true;
+      snprintf(thresholdMessage, sizeof(thresholdMessage), "Low Temp Alert %4.2f < %4.2f", sensorData.temperatureInC, activeThresholds.lowerTemperatureThreshold);
+      haveAnyAlertsBeenSet = true;
+    }
+
+    // If upper temperature threshold is crossed, Set the flag true. 
+    if (alertsAllowed && !(activeThresholds.flags & ThresholdSchedule::SUPPRESS_HIGH_TEMP) && sensorData.temperatureInC > activeThresholds.upperTemperatureThreshold) {
+      alertsStatus.upperTemperatureThresholdCrossed = true;
+      snprintf(thresholdMessage, sizeof(thresholdMessage), "High Temp Alert %4.2f > %4.2f", sensorData.temperatureInC, activeThresholds.upperTemperatureThreshold);
+      haveAnyAlertsBeenSet = true;
+    }
+
+    // If lower humidity threshold is crossed, Set the flag true. 
+    if (alertsAllowed && sensorData.relativeHumidity < activeThresholds.lowerHumidityThreshold) {
+      alertsStatus.lowerHumidityThresholdCrossed = true;
+      snprintf(thresholdMessage, sizeof(thresholdMessage), "Low Humidity Alert %4.2f < %4.2f", sensorData.relativeHumidity, activeThresholds.lowerHumidityThreshold);
+      haveAnyAlertsBeenSet = true;
+    }
+
+    // If upper humidity threshold is crossed, Set the flag true. 
+    if (alertsAllowed && sensorData.relativeHumidity > activeThresholds.upperHumidityThreshold) {
+      alertsStatus.upperHumidityThresholdCrossed = true;
+      snprintf(thresholdMessage, sizeof(thresholdMessage), "High Humidity Alert %4.2f < %4.2f", sensorData.relativeHumidity, activeThresholds.upperHumidityThreshold);
+      haveAnyAlertsBeenSet = true;
+    }
+  }
+
+    getBatteryContext();                                                                    // Check what the battery is doing.
+
+    // Indicate that this is a valid data array and store it
+    sensorData.validData = true;
+    sensorData.timeStamp = clock.now();
+    sensorDataWriteNeeded = true;
+    alertsStatusWriteNeeded = true;
+
+    if (haveAnyAlertsBeenSet) cloud.publish("Alerts", thresholdMessage, HalCloud::PRIORITY_URGENT);
+
+    return haveAnyAlertsBeenSet;
+}
+
+// These functions keep the history of readings in FRAM. Each tier is a ring: one minute readings in compressed blocks for
+// about the last day, then hourly rollups for weeks and daily rollups for months. The rollups are built as readings arrive,
+// so by the time a raw block is overwritten its readings are already summarised in the hour and the day.
+
+void FacilityMonitor::startHistory()                                                        // Loads the head block and carries on where it left off
+{
+  if (historyStatus.head >= historyBlocks || historyStatus.used > historyBlocks ||
+      historyStatus.hourlyHead >= hourlyRecords || historyStatus.hourlyUsed > hourlyRecords ||
+      historyStatus.dailyHead >= dailyRecords || historyStatus.dailyUsed > dailyRecords) {
+    memset(&historyStatus, 0, sizeof(historyStatus));                                      // Lost track - start again rather than trust any block
+    historyStatusWriteNeeded = true;
+  }
+  store.readData(FRAM::historyAddr + historyStatus.head * HistoryBlock::SIZE, historyBlock, sizeof(historyBlock));
+  if (!historyEncoder.resume(historyBlock)) {                                               // A corrupt head block is started again empty
+    store.writeData(FRAM::historyAddr + historyStatus.head * HistoryBlock::SIZE, historyBlock, sizeof(historyBlock));
+  }
+
+  for (int block = 0; block < historyBlocks; block++) {                                     // Rebuild the time index from the block headers - 4 bytes each
+    uint8_t header[4];
+    store.readData(FRAM::historyAddr + block * HistoryBlock::SIZE, header, sizeof(header));
+    historyBlockStart[block] = HistoryBlock::getStartTime(header);
+  }
+}
+
+void FacilityMonitor::logReading(float temperature, float humidity)                         // Adds a reading to the history
+{
+  if (!clock.isValid()) return;                                                             // A reading without a time is no use later
+
+  HistoryReading reading;
+  reading.time = clock.now();
+  reading.temperature = (int16_t)lroundf(temperature * 10);
+  reading.humidity = (int16_t)lroundf(humidity * 10);
+
+  if (!historyEncoder.add(reading)) {                                                       // Head block is full - move on, overwriting the oldest once the ring is full
+    historyStatus.head = (historyStatus.head + 1) % historyBlocks;
+    historyEncoder.begin(historyBlock);
+    historyEncoder.add(reading);
+  }
+  if (historyEncoder.getCount() == 1) historyBlockStart[historyStatus.head] = reading.time;
+  if (historyStatus.used == 0 || historyEncoder.getCount() == 1) {
+    if (historyStatus.used < historyBlocks) historyStatus.used++;
+    historyStatusWriteNeeded = true;
+  }
+  store.writeData(FRAM::historyAddr + historyStatus.head * HistoryBlock::SIZE, historyBlock, sizeof(historyBlock)); // All of it, so a reused block has nothing left from before
+
+  addToRollup(hourlyRollup, reading, 3600, FRAM::hourlyAddr, historyStatus.hourlyHead, historyStatus.hourlyUsed, hourlyRecords);
+  addToRollup(dailyRollup, reading, 86400, FRAM::dailyAddr, historyStatus.dailyHead, historyStatus.dailyUsed, dailyRecords);
+  rollupWriteNeeded = true;
+}
+
+void FacilityMonitor::addToRollup(RollupAccumulator &rollup, const HistoryReading &reading, uint32_t period, int addr, uint8_t &head, uint8_t &used, int records)
+{
+  uint32_t periodStart = reading.time - reading.time % period;
+  if (!rollup.isEmpty() && rollup.getStartTime() != periodStart) {                          // First reading of a new period - the last one is done
+    RollupRecord record;
+    rollup.finish(record);
+    store.put(addr + head * sizeof(RollupRecord), record);
+    head = (head + 1) % records;
+    if (used < records) used++;
+    historyStatusWriteNeeded = true;
+  }
+  if (rollup.isEmpty() || rollup.getStartTime() != periodStart) rollup.begin(periodStart);
+  rollup.add(reading);
+}
+
+// These functions answer History-Query from the local history. The answer comes from the finest tier that goes back far
+// enough, and a binary search on time finds where to start, so only the part of the tier that was asked for is read.
+
+uint16_t FacilityMonitor::historyOldest(int tier)                                           // Ring position of the oldest block or record in a tier
+{
+  switch (tier) {
+    case TIER_RAW:    return (historyStatus.head + historyBlocks - historyStatus.used + 1) % historyBlocks;
+    case TIER_HOURLY: return (historyStatus.hourlyHead + hourlyRecords - historyStatus.hourlyUsed) % hourlyRecords;
+    default:          return (historyStatus.dailyHead + dailyRecords - historyStatus.dailyUsed) % dailyRecords;
+  }
+}
+
+uint16_t FacilityMonitor::historyStored(int tier)                                           // Blocks or records in a tier
+{
+  switch (tier) {
+    case TIER_RAW:    return historyStatus.used;
+    case TIER_HOURLY: return historyStatus.hourlyUsed;
+    default:          return historyStatus.dailyUsed;
+  }
+}
+
+uint32_t FacilityMonitor::historyPeriod(int tier)                                           // How long each block or record covers - raw blocks are open ended
+{
+  return (tier == TIER_HOURLY) ? 3600 : ((tier == TIER_DAILY) ? 86400 : 0);
+}
+
+bool FacilityMonitor::historyRecordAt(int tier, uint16_t index, RollupRecord &record)       // The index'th oldest rollup - one past the last stored is the period so far
+{
+  uint16_t stored = historyStored(tier);
+  RollupAccumulator &current = (tier == TIER_HOURLY) ? hourlyRollup : dailyRollup;
+  if (index == stored && !current.isEmpty()) {
+    current.finish(record);
+    return true;
+  }
+  if (index >= stored) return false;
+  int records = (tier == TIER_HOURLY) ? hourlyRecords : dailyRecords;
+  int addr = (tier == TIER_HOURLY) ? FRAM::hourlyAddr : FRAM::dailyAddr;
+  store.get(addr + ((historyOldest(tier) + index) % records) * sizeof(RollupRecord), record);
+  return true;
+}
+
+uint32_t FacilityMonitor::historyTimeAt(int tier, uint16_t index)                           // Start time of the index'th oldest block or record
+{
+  if (tier == TIER_RAW) return historyBlockStart[(historyOldest(TIER_RAW) + index) % historyBlocks];
+  RollupRecord record;
+  return (historyRecordAt(tier, index, record)) ? record.startTime : UINT32_MAX;
+}
+
+uint32_t FacilityMonitor::historyTimeAt(uint16_t index, void *context)                      // For HistoryIndex - context is a HistoryLookup
+{
+  const HistoryLookup *lookup = (const HistoryLookup *)context;
+  return lookup->monitor->historyTimeAt(lookup->tier, index);
+}
+
+uint16_t FacilityMonitor::historyEntries(int tier)                                          // Blocks or records to search, including the period so far for the rollups
+{
+  if (tier == TIER_RAW) return historyStatus.used;
+  RollupAccumulator &current = (tier == TIER_HOURLY) ? hourlyRollup : dailyRollup;
+  return historyStored(tier) + ((current.isEmpty()) ? 0 : 1);
+}
+
+int FacilityMonitor::historyQueryCommand(const char *command)                               // "start,end,readings|summary|excursions" - times are Unix times, or seconds before now if 0 or less
+{
+  if (!strcmp(command, "cancel")) {
+    historyQuery.active = false;
+    return 1;
+  }
+  if (historyQuery.active || !clock.isValid()) return 0;                                    // One at a time
+
+  char * pEND;
+  long start = strtol(command,&pEND,10);
+  if (*pEND != ',') return 0;
+  long end = strtol(pEND + 1,&pEND,10);
+  if (*pEND != ',') return 0;
+  const char *aggregation = pEND + 1;
+  if (start <= 0) start += clock.now();
+  if (end <= 0) end += clock.now();
+  if (start < 0 || end < start) return 0;
+
+  if (!strcmp(aggregation, "readings")) historyQuery.aggregation = QUERY_READINGS;
+  else if (!strcmp(aggregation, "summary")) historyQuery.aggregation = QUERY_SUMMARY;
+  else if (!strcmp(aggregation, "excursions")) historyQuery.aggregation = QUERY_EXCURSIONS;
+  else return 0;
+
+  int tier;                                                                                 // Finest tier that reaches back to the start, or that has never wrapped and so holds everything there is
+  for (tier = TIER_RAW; tier < TIER_DAILY; tier++) {
+    uint16_t capacity = (tier == TIER_RAW) ? historyBlocks : hourlyRecords;
+    if (historyStored(tier) > 0 && (historyStored(tier) < capacity || historyTimeAt(tier, 0) <= (uint32_t)start)) break;
+  }
+
+  historyQuery.tier = tier;
+  historyQuery.start = start;
+  historyQuery.end = end;
+  historyQuery.count = historyEntries(tier);
+  uint32_t period = historyPeriod(tier);                                                    // First block that can hold the start, or first record that ends after it
+  HistoryLookup lookup = {this, tier};
+  if (tier == TIER_RAW) historyQuery.next = HistoryIndex::entryFor(historyQuery.count, start, historyTimeAt, &lookup);
+  else historyQuery.next = HistoryIndex::lowerBound(historyQuery.count, ((uint32_t)start >= period) ? start - period + 1 : 0, historyTimeAt, &lookup);
+  historyQuery.page = 0;
+  historyQuery.blockLoaded = false;
+  historyQuery.inExcursion = false;
+  historyQuery.pendingRow[0] = 0;
+  historyQuery.data[0] = 0;
+  historyQuery.active = true;
+  return 1;
+}
+
+bool FacilityMonitor::nextHistoryReading(HistoryReading &reading)                           // Raw tier - the next reading in the range
+{
+  while (true) {
+    if (!historyQuery.blockLoaded) {
+      if (historyQuery.next >= historyQuery.count) return false;
+      uint16_t block = (historyOldest(TIER_RAW) + historyQuery.next++) % historyBlocks;
+      store.readData(FRAM::historyAddr + block * HistoryBlock::SIZE, historyQuery.block, sizeof(historyQuery.block));
+      historyQueryDecoder = HistoryBlockDecoder(historyQuery.block);
+      historyQuery.blockLoaded = true;
+    }
+    if (!historyQueryDecoder.next(reading)) {
+      historyQuery.blockLoaded = false;
+      continue;
+    }
+    if (reading.time < historyQuery.start) continue;
+    if (reading.time > historyQuery.end) {
+      historyQuery.next = historyQuery.count;
+      historyQuery.blockLoaded = false;
+      return false;
+    }
+    return true;
+  }
+}
+
+bool FacilityMonitor::nextHistoryRecord(RollupRecord &record)                               // Rollup tiers - the next record that overlaps the range
+{
+  while (historyQuery.next < historyQuery.count) {
+    if (!historyRecordAt(historyQuery.tier, historyQuery.next++, record)) break;
+    if (record.startTime + historyPeriod(historyQuery.tier) <= historyQuery.start) continue;
+    if (record.startTime > historyQuery.end) break;
+    return true;
+  }
+  historyQuery.next = historyQuery.count;
+  return false;
+}
+
+bool FacilityMonitor::nextHistoryRow(char *row, size_t size)                                // The next row of the answer - false when there are no more
+{
+  HistoryReading reading;
+  RollupRecord record;
+  bool raw = (historyQuery.tier == TIER_RAW);
+
+  switch (historyQuery.aggregation) {
+    case QUERY_READINGS:
+      if (raw && nextHistoryReading(reading)) {
+        snprintf(row, size, "%lu,%.1f,%.1f", (unsigned long)reading.time, reading.temperature / 10.0, reading.humidity / 10.0);
+        return true;
+      }
+      if (!raw && nextHistoryRecord(record)) {
+        snprintf(row, size, "%lu,%.1f,%.1f,%.1f,%.1f,%u", (unsigned long)record.startTime, record.minTemperature / 10.0, record.maxTemperature / 10.0,
+          record.meanTemperature / 10.0, record.mktTemperature / 10.0, record.meanHumidity);
+        return true;
+      }
+      return false;
+
+    case QUERY_SUMMARY: {
+      if (historyQuery.next >= historyQuery.count && !historyQuery.blockLoaded) return false;
+      RollupAccumulator summary;                                                            // The same running totals as the rollups, so MKT comes out the same way
+      summary.begin(historyQuery.start);
+      if (raw) while (nextHistoryReading(reading)) summary.add(reading);
+      else while (nextHistoryRecord(record)) summary.add(record);
+      summary.finish(record);
+      snprintf(row, size, "n=%u,%.1f,%.1f,%.1f,mkt=%.1f,%u-%u%%", summary.state.count, record.minTemperature / 10.0, record.maxTemperature / 10.0,
+        record.meanTemperature / 10.0, record.mktTemperature / 10.0, record.minHumidity, record.maxHumidity);
+      return true;
+    }
+
+    default: {                                                                              // Temperature excursions, against the thresholds in force at the time
+      activeThresholds_structure thresholds;
+      while (true) {
+        bool more = (raw) ? nextHistoryReading(reading) : nextHistoryRecord(record);
+        if (more && !raw) {                                                                 // A record is out if any reading in it was
+          reading.time = record.startTime;
+          reading.temperature = record.maxTemperature;
+        }
+        bool out = false;
+        int16_t low = 0, high = 0;
+        if (more) {
+          thresholdsAt(reading.time, thresholds);
+          low = (raw) ? reading.temperature : record.minTemperature;
+          high = reading.temperature;
+          out = (low < thresholds.lowerTemperatureThreshold * 10 || high > thresholds.upperTemperatureThreshold * 10);
+        }
+        if (out) {
+          if (!historyQuery.inExcursion) {
+            historyQuery.inExcursion = true;
+            historyQuery.excursionStart = reading.time;
+            historyQuery.excursionMin = low;
+            historyQuery.excursionMax = high;
+          }
+          historyQuery.excursionEnd = reading.time + historyPeriod(historyQuery.tier);
+          if (low < historyQuery.excursionMin) historyQuery.excursionMin = low;
+          if (high > historyQuery.excursionMax) historyQuery.excursionMax = high;
+        }
+        else if (historyQuery.inExcursion) {                                                // Back in range (or out of history) - that excursion is done
+          historyQuery.inExcursion = false;
+          snprintf(row, size, "%lu-%lu%s,%.1f,%.1f", (unsigned long)historyQuery.excursionStart, (unsigned long)historyQuery.excursionEnd,
+            (more) ? "" : "+", historyQuery.excursionMin / 10.0, historyQuery.excursionMax / 10.0);
+          return true;
+        }
+        if (!more) return false;
+      }
+    }
+  }
+}
+
+void FacilityMonitor::pumpHistoryQuery()                                                    // Fills and publishes the next page - one page in the queue at a time as the retained buffer is small
+{
+  if (!cloud.connected() || cloud.queuedEvents() > 0) return;
+
+  char row[sizeof(historyQuery.pendingRow)];
+  bool done = false;
+  historyQuery.page++;
+  snprintf(historyQuery.data, sizeof(historyQuery.data), "%u %s %s:", historyQuery.page, historyTierNames[historyQuery.tier],
+    (historyQuery.aggregation == QUERY_READINGS) ? "readings" : ((historyQuery.aggregation == QUERY_SUMMARY) ? "summary" : "excursions"));
+  size_t headerLen = strlen(historyQuery.data);
+
+  while (true) {
+    if (historyQuery.pendingRow[0]) {
+      strcpy(row, historyQuery.pendingRow);
+      historyQuery.pendingRow[0] = 0;
+    }
+    else if (!nextHistoryRow(row, sizeof(row))) {
+      done = true;
+      break;
+    }
+    size_t len = strlen(historyQuery.data);
+    if (len + strlen(row) + 8 >= sizeof(historyQuery.data)) {                               // Leave room for the end marker
+      strcpy(historyQuery.pendingRow, row);
+      break;
+    }
+    snprintf(historyQuery.data + len, sizeof(historyQuery.data) - len, "%s%s", (len > headerLen) ? ";" : "", row);
+  }
+
+  if (done) {
+    size_t len = strlen(historyQuery.data);
+    snprintf(historyQuery.data + len, sizeof(historyQuery.data) - len, "%s", (len > headerLen) ? ";end" : "end");
+    historyQuery.active = false;
+  }
+  cloud.publish("History", historyQuery.data);
+}
+
+// These functions watch the rate of change between reports so we can warn before the thresholds are crossed
+
+void FacilityMonitor::sampleSensors()                                                       // A quick reading for the detector - nothing is published unless it finds something
+{
+  lastSampleTime = clock.now();
+  StallMonitor::Scope stallOp(stallMonitor, StallMonitor::OP_I2C);                          // Sensor reads and the history in FRAM
+  float temperature = sensor.readTemperature();
+  float humidity = sensor.readHumidity();
+  if (isnan(temperature) || isnan(humidity)) return;
+  traceBuffer.add(clock.millis(), TRACE_SAMPLE, 0, (uint16_t)(int16_t)lroundf(temperature * 10));
+
+  logReading(temperature, humidity);                                                        // Every reading goes in the history
+  updateActiveThresholds();
+  checkForecast(temperature, humidity);
+
+  ExcursionDetector::Event event = excursionDetector.addSample(temperature, humidity);
+  if (!excursionDetector.eventChanged()) return;
+
+  detectorWarning = (event == ExcursionDetector::DOOR_OPEN || event == ExcursionDetector::COMPRESSOR_FAILURE);
+  if (activeThresholds.flags & ThresholdSchedule::SUPPRESS_WARNINGS) detectorWarning = false; // Scheduled defrost or loading - this rise is expected
+  char data[64];
+  snprintf(data, sizeof(data), "%s %4.1f*C %+4.2f*C/min", ExcursionDetector::eventName(event), temperature, excursionDetector.getSlope() / 100.0);
+  if (detectorWarning) cloud.publish("Early Warning", data, HalCloud::PRIORITY_URGENT);     // Defrost cycles are normal - only worth a message in verbose mode
+  else if (sysStatus.verboseMode) cloud.publish("Excursion", data, HalCloud::PRIORITY_LOW);
+}
+
+void FacilityMonitor::checkForecast(float temperature, float humidity)                      // Sends one early warning when a limit is forecast to be crossed within the lead time
+{
+  temperatureForecaster.addSample(temperature);
+  humidityForecaster.addSample(humidity);
+  if (!temperatureForecaster.isReady()) return;
+
+  long tempSeconds = temperatureForecaster.secondsToCross(activeThresholds.lowerTemperatureThreshold, activeThresholds.upperTemperatureThreshold);
+  long humiditySeconds = humidityForecaster.secondsToCross(activeThresholds.lowerHumidityThreshold, activeThresholds.upperHumidityThreshold);
+  bool tempFirst = (tempSeconds >= 0 && (humiditySeconds < 0 || tempSeconds <= humiditySeconds));
+  long seconds = (tempFirst) ? tempSeconds : humiditySeconds;
+
+  if (seconds < 0) {
+    snprintf(forecastString, sizeof(forecastString), "Steady");
+    forecastWarning = false;
+    return;
+  }
+
+  ExcursionForecaster &forecaster = (tempFirst) ? temperatureForecaster : humidityForecaster;
+  float upper = (tempFirst) ? activeThresholds.upperTemperatureThreshold : activeThresholds.upperHumidityThreshold;
+  bool high = (forecaster.getLevel() >= upper || forecaster.getTrendPerHour() > 0);
+  const char *units = (tempFirst) ? "*C" : "%";
+  snprintf(forecastString, sizeof(forecastString), "%s %s in %li min", (high) ? "High" : "Low", (tempFirst) ? "Temp" : "Humidity", seconds / 60);
+
+  long leadSeconds = (long)sysStatus.forecastLeadMinutes * 60;
+  if (activeThresholds.flags & ThresholdSchedule::SUPPRESS_WARNINGS) forecastWarning = false; // Expected during this window - the forecast is still shown
+  else if (seconds <= leadSeconds && leadSeconds > 0) {
+    if (forecastWarning) return;                                                            // Only one warning until the forecast clears
+    forecastWarning = true;
+    char data[96];
+    snprintf(data, sizeof(data), "Forecast %s - %4.1f%s %+4.1f%s/hr", forecastString, forecaster.getLevel(), units, forecaster.getTrendPerHour(), units);
+    cloud.publish("Early Warning", data, HalCloud::PRIORITY_URGENT);
+  }
+  else if (seconds > 2 * leadSeconds) forecastWarning = false;                              // Some hysteresis so a wobbling forecast does not send a stream of warnings
+}
+
+void FacilityMonitor::updateActiveThresholds()                                              // Picks the thresholds for the time of day - a table lookup, so cheap enough for every reading
+{
+  const ThresholdSchedule::Window *window = thresholdsAt((clock.isValid()) ? clock.now() : 0, activeThresholds);
+  if (window) ThresholdSchedule::describe(*window, thresholdProfileStr, sizeof(thresholdProfileStr));
+  else snprintf(thresholdProfileStr, sizeof(thresholdProfileStr), "Base");
+}
+
+const ThresholdSchedule::Window *FacilityMonitor::thresholdsAt(uint32_t time, activeThresholds_structure &thresholds) // The thresholds in force at a time - 0 for the base thresholds
+{
+  const ThresholdSchedule::Window *window = (time) ? thresholdSchedule.windowAt((time % 86400) / 60) : NULL;
+
+  thresholds.upperTemperatureThreshold = alertsStatus.upperTemperatureThreshold;
+  thresholds.lowerTemperatureThreshold = alertsStatus.lowerTemperatureThreshold;
+  thresholds.upperHumidityThreshold = alertsStatus.upperHumidityThreshold;
+  thresholds.lowerHumidityThreshold = alertsStatus.lowerHumidityThreshold;
+  thresholds.flags = 0;
+
+  if (!window) return NULL;
+  if (window->upperTemperature != ThresholdSchedule::USE_BASE) thresholds.upperTemperatureThreshold = window->upperTemperature / 10.0;
+  if (window->lowerTemperature != ThresholdSchedule::USE_BASE) thresholds.lowerTemperatureThreshold = window->lowerTemperature / 10.0;
+  if (window->upperHumidity != ThresholdSchedule::USE_BASE) thresholds.upperHumidityThreshold = window->upperHumidity / 10.0;
+  if (window->lowerHumidity != ThresholdSchedule::USE_BASE) thresholds.lowerHumidityThreshold = window->lowerHumidity / 10.0;
+  thresholds.flags = window->flags;
+  return window;
+}
+
+bool FacilityMonitor::urgentReport()                                                        // Alerts and early warnings skip signal deferral and connect on alert
+{
+  return alertsStatus.thresholdCrossedFlag || detectorWarning || forecastWarning;
+}
+
+int FacilityMonitor::reportBoundary()                                                       // Seconds between reports - shorter while something is wrong
+{
+  return (urgentReport()) ? fastWakeBoundary : wakeBoundary;
+}
+
+bool FacilityMonitor::reportDue()                                                           // On a report boundary we haven't measured for yet
+{
+  return !(clock.now() % reportBoundary()) && clock.now() != lastBoundary;
+}
+
+void FacilityMonitor::checkHeap(bool afterSetup)                                            // Watches for heap growth and fragmentation
+{
+  lastHeapCheck = clock.millis();
+  uint32_t freeHeap, largestBlock;
+  system.heapInfo(freeHeap, largestBlock);
+
+  if (afterSetup || !heapAfterSetup) heapAfterSetup = heapLowWater = freeHeap;
+  if (freeHeap < heapLowWater) heapLowWater = freeHeap;
+  int fragmentation = (freeHeap) ? 100 - (int)((uint64_t)largestBlock * 100 / freeHeap) : 0;
+  snprintf(heapString, sizeof(heapString), "%lu free, %li since setup, %lu largest, %i%% frag", (unsigned long)freeHeap,
+    (long)heapLowWater - (long)heapAfterSetup, (unsigned long)largestBlock, fragmentation);
+
+  snprintf(stackString, sizeof(stackString), "loop %u of %u free, publish %u of %u free", (unsigned)system.loopStackHeadroom(), (unsigned)loopStackSize,
+    (unsigned)cloud.publishStackHeadroom(), (unsigned)publishStackSize);                    // The headroom never goes up, so once a minute catches the worst
+
+  const StallMonitor::Record &stallRecord = stallMonitor.getRecord();
+  snprintf(stallString, sizeof(stallString), "longest pet wait %lu ms, %u stalls, longest %lu ms", (unsigned long)stallRecord.longestPetGap,
+    (unsigned)stallRecord.stalls, (unsigned long)stallRecord.longestStall);
+}
+
+// Function to Blink the LED for alerting. 
+void FacilityMonitor::blinkLED(HalGpio::Pin LED)                                            // Non-blocking LED flashing routine
+{
+  const int flashingFrequency = 1000;
+
+  if (clock.millis() - lastStateChange > flashingFrequency) {
+    gpio.digitalWrite(LED,!gpio.digitalRead(LED));
+    lastStateChange = clock.millis();
+  }
+}
+
+// These are the particle functions that allow you to configure and run the device
+// They are intended to allow for customization and control during installations
+// and to allow for management.
+
+
+int FacilityMonitor::measureNow(const char *command) // Function to force sending data in current hour
+{
+  if (!strcmp(command, "1")) {
+    state = MEASURING_STATE;
+    return 1;
+  }
+  else return 0;
+}
+
+int FacilityMonitor::setVerboseMode(const char *command) // Function to force sending data in current hour
+{
+  if (!strcmp(command, "1"))
+  {
+    sysStatus.verboseMode = true;
+    cloud.publish("Mode","Set Verbose Mode");
+    sysStatusWriteNeeded = true;
+    return 1;
+  }
+  else if (!strcmp(command, "0"))
+  {
+    sysStatus.verboseMode = false;
+    cloud.publish("Mode","Cleared Verbose Mode");
+    sysStatusWriteNeeded = true;
+    return 1;
+  }
+  else return 0;
+}
+
+
+void FacilityMonitor::recordStateTransition(void)                                           // A trace record for every change - only the error state is worth a publish
+{
+  traceBuffer.add(clock.millis(), TRACE_STATE, oldState, state);
+  if (state == ERROR_STATE && cloud.connected()) {
+    char stateTransitionString[40];
+    snprintf(stateTransitionString, sizeof(stateTransitionString), "From %s to %s", stateNames[oldState],stateNames[state]);
+    cloud.publish("State Transition",stateTransitionString);
+  }
+  oldState = state;
+}
+
+int FacilityMonitor::traceCommand(const char *command)                                      // "publish" or "serial" dumps the trace, "clear" empties it
+{
+  if (!strcasecmp(command, "publish")) dumpTrace(false);
+  else if (!strcasecmp(command, "serial") && system.consoleAvailable()) dumpTrace(true);    // Not while serial is carrying the input log
+  else if (!strcasecmp(command, "clear")) traceBuffer.clear();
+  else return 0;
+  return 1;
+}
+
+void FacilityMonitor::dumpTrace(bool toSerial)                                              // The whole ring as one line of base64 - tools/trace-decode.cpp turns it back into text
+{
+  traceBuffer.add(clock.millis(), TRACE_DUMP, toSerial);
+  size_t len = traceBuffer.pack(tracePacked, (toSerial) ? sizeof(tracePacked) : tracePublishBytes, clock.millis(), (clock.isValid()) ? clock.now() : 0);
+  TraceBuffer::base64Encode(tracePacked, len, traceText, sizeof(traceText));
+  if (toSerial) system.writeConsole("TRACE ", traceText);
+  else cloud.publish("Trace", traceText, HalCloud::PRIORITY_LOW);
+}
+
+// These function will allow to change the upper and lower limits for alerting the customer. 
+
+int FacilityMonitor::setUpperTempLimit(const char *value)
+{
+  alertsStatus.upperTemperatureThreshold = atof(value);
+  cloud.publish("Upper Temperature Threshold Set",value);
+  updateThresholdValue();
+  return 1;
+}
+
+int FacilityMonitor::setLowerTempLimit(const char *value)
+{
+  alertsStatus.lowerTemperatureThreshold = atof(value);
+  cloud.publish("Lower Temperature Threshold Set",value);
+  updateThresholdValue();
+  return 1;
+
+}
+
+int FacilityMonitor::setUpperHumidityLimit(const char *value)
+{
+  alertsStatus.upperHumidityThreshold = atof(value);
+  cloud.publish("Upper Humidity Threshold Set",value);
+  updateThresholdValue();
+  return 1;
+}
+
+int FacilityMonitor::setLowerHumidityLimit(const char *value)
+{
+  alertsStatus.lowerHumidityThreshold = atof(value);
+  cloud.publish("Lower Humidity Threshold Set",value);
+  updateThresholdValue();
+  return 1;
+}
+
+int FacilityMonitor::setThirdPartySim(const char *command) // Function to force sending data in current hour
+{
+  if (!strcmp(command, "1"))
+  {
+    sysStatus.thirdPartySim = true;
+    if (cloud.connected()) startKeepAlive();                                                // Set the keep alive value
+    else cloud.keepAlive(sysStatus.keepAlive);
+    // keepAliveTimer.changePeriod(sysStatus.keepAlive*1000);                                  // Will start the repeating timer
+    if (cloud.connected()) cloud.publish("Mode","Set to 3rd Party Sim");
+    sysStatusWriteNeeded = true;
+    return 1;
+  }
+  else if (!strcmp(command, "0"))
+  {
+    sysStatus.thirdPartySim = false;
+    if (cloud.connected()) cloud.publish("Mode","Set to Particle Sim");
+    sysStatusWriteNeeded = true;
+    return 1;
+  }
+  else return 0;
+}
+
+
+int FacilityMonitor::setKeepAlive(const char *command)
+{
+  char * pEND;
+  char data[256];
+  int tempTime = strtol(command,&pEND,10);                                                  // Looks for the first integer and interprets it
+  if ((tempTime < 0) || (tempTime > 1200)) return 0;                                        // Make sure it falls in a valid range or send a "fail" result
+  sysStatus.keepAlive = tempTime;
+  if (keepAliveSim) {                                                                       // Start learning again from the new value
+    keepAliveSim->knownGood = std::min(std::max(sysStatus.keepAlive, keepAliveMin), keepAliveMax);
+    keepAliveSim->knownBad = 0;
+    keepAliveSim->converged = false;
+    keepAliveWriteNeeded = true;
+  }
+  if (sysStatus.thirdPartySim && cloud.connected()) startKeepAlive();                      // Set the keep alive value
+  else cloud.keepAlive(sysStatus.keepAlive);
+  // keepAliveTimer.changePeriod(sysStatus.keepAlive*1000);                                  // Will start the repeating timer
+  snprintf(data, sizeof(data), "Keep Alive set to %i sec",sysStatus.keepAlive);
+  cloud.publish("Keep Alive",data);
+  sysStatusWriteNeeded = true;                                                           // Need to store to FRAM back in the main loop
+  return 1;
+}
+
+int FacilityMonitor::setAdaptiveKeepAlive(const char *command)                              // Function to turn keep alive probing on or off
+{
+  if (!strcmp(command, "1"))
+  {
+    sysStatus.adaptiveKeepAlive = true;
+    if (sysStatus.thirdPartySim && cloud.connected()) startKeepAlive();
+    if (cloud.connected()) cloud.publish("Mode","Set Adaptive Keep Alive");
+    sysStatusWriteNeeded = true;
+    return 1;
+  }
+  else if (!strcmp(command, "0"))
+  {
+    sysStatus.adaptiveKeepAlive = false;
+    keepAliveCurrent = sysStatus.keepAlive;
+    cloud.keepAlive(sysStatus.keepAlive);                                                   // Back to the fixed value
+    if (cloud.connected()) cloud.publish("Mode","Cleared Adaptive Keep Alive");
+    sysStatusWriteNeeded = true;
+    return 1;
+  }
+  else return 0;
+}
+
+int FacilityMonitor::setConnectionPolicy(const char *command)                               // Always on, per report, scheduled windows or on alert - by number or name
+{
+  int policy = -1;
+  for (int i = 0; i < 4; i++) {
+    if (!strcasecmp(command, connectionPolicyNames[i]) || (strlen(command) == 1 && command[0] == '0' + i)) policy = i;
+  }
+  if (policy < 0) return 0;
+
+  updateConnectionStats();                                                                  // Time and data so far belong to the old policy
+  sysStatus.connectionPolicy = policy;
+  snprintf(connectionPolicyStr, sizeof(connectionPolicyStr), "%s", connectionPolicyNames[sysStatus.connectionPolicy]);
+  char data[48];
+  snprintf(data, sizeof(data), "Connection Policy %s", connectionPolicyStr);
+  cloud.publish("Mode", data);                                                              // Goes out before we drop the connection
+  sysStatusWriteNeeded = true;
+  if (sysStatus.connectionPolicy == ALWAYS_ON && !cloud.connected() && state == IDLE_STATE) startConnection(IDLE_STATE); // Nothing else brings the radio back under Always On
+  return 1;
+}
+
+int FacilityMonitor::setConnectWindow(const char *command)                                  // Scheduled windows open at the top of every this many hours
+{
+  char * pEND;
+  int tempHours = strtol(command,&pEND,10);
+  if ((tempHours < 1) || (tempHours > 24)) return 0;
+  sysStatus.connectWindowHours = tempHours;
+  char data[48];
+  snprintf(data, sizeof(data), "Connect Window every %i hours", sysStatus.connectWindowHours);
+  cloud.publish("Mode", data);
+  sysStatusWriteNeeded = true;
+  return 1;
+}
+
+int FacilityMonitor::connectionStatsCommand(const char *command)                            // 1 publishes the stats for the current policy, reset clears them all
+{
+  if (!strcmp(command, "1")) {
+    publishConnectionStats(true);
+    return 1;
+  }
+  else if (!strcmp(command, "reset")) {
+    memset(&connectionStats, 0, sizeof(connectionStats));
+    connectedSince = (cloud.connected()) ? clock.millis() : 0;
+    lastSentBytes = cloud.sentBytes();
+    connectionStatsWriteNeeded = true;
+    return 1;
+  }
+  else return 0;
+}
+
+int FacilityMonitor::setSignalDeferral(const char *command)                                 // "strength,minutes" - hold backlogs until the signal is at least strength %, for up to minutes
+{
+  char * pEND;
+  int tempStrength = strtol(command,&pEND,10);
+  int tempMinutes = (*pEND == ',') ? strtol(pEND + 1,&pEND,10) : sysStatus.maxDeferralMinutes;
+  if ((tempStrength < 0) || (tempStrength > 100) || (tempMinutes < 0) || (tempMinutes > 1440)) return 0;
+  sysStatus.minSignalStrength = tempStrength;
+  sysStatus.maxDeferralMinutes = tempMinutes;
+  char data[64];
+  snprintf(data, sizeof(data), "Signal Deferral %i%% for up to %i min", sysStatus.minSignalStrength, sysStatus.maxDeferralMinutes);
+  cloud.publish("Mode", data);
+  sysStatusWriteNeeded = true;
+  return 1;
+}
+
+int FacilityMonitor::setForecastLead(const char *command)                                   // Minutes of warning we want before a limit is crossed - 0 turns forecasting off
+{
+  char * pEND;
+  int tempMinutes = strtol(command,&pEND,10);
+  if ((tempMinutes < 0) || (tempMinutes > 720) || (pEND == command)) return 0;
+  sysStatus.forecastLeadMinutes = tempMinutes;
+  if (!tempMinutes) forecastWarning = false;
+  char data[64];
+  snprintf(data, sizeof(data), "Forecast Lead %i min", sysStatus.forecastLeadMinutes);
+  cloud.publish("Mode", data);
+  sysStatusWriteNeeded = true;
+  return 1;
+}
+
+int FacilityMonitor::setThresholdProfiles(const char *command)                              // "HHMM-HHMM,lowTemp,highTemp,lowHumidity,highHumidity,flags;..." in UTC - "clear" for none
+{
+  if (!thresholdSchedule.parse(command)) return 0;                                          // Nothing changes unless the whole schedule is valid
+  thresholdScheduleWriteNeeded = true;
+  updateActiveThresholds();
+  char data[64];
+  snprintf(data, sizeof(data), "Threshold Profiles: %i windows, now %s", thresholdSchedule.getStored().count, thresholdProfileStr);
+  cloud.publish("Mode", data);
+  return 1;
+}
+
+// This function updates the threshold value string in the console. 
+void FacilityMonitor::updateThresholdValue()
+{
+    snprintf(upperTemperatureThresholdString,sizeof(upperTemperatureThresholdString),"Temp_Max : %3.1f", alertsStatus.upperTemperatureThreshold);
+    snprintf(lowerTemperatureThresholdString,sizeof(lowerTemperatureThresholdString),"Temp_Min : %3.1f",alertsStatus.lowerTemperatureThreshold);
+    snprintf(upperHumidityThresholdString,sizeof(upperHumidityThresholdString),"Humidity_Max: %3.1f",alertsStatus.upperHumidityThreshold);
+    snprintf(lowerHumidityThresholdString,sizeof(lowerHumidityThresholdString),"Humidity_Min : %3.1f",alertsStatus.lowerHumidityThreshold);
+    alertsStatusWriteNeeded = true;                                                         // This function is called when there is a change so, we need to update the FRAM
+}
+
+
+void FacilityMonitor::getBatteryContext()
+{
+  const char* batteryContext[7] ={"Unknown","Not Charging","Charging","Charged","Discharging","Fault","Diconnected"};
+  // Battery conect information - https://docs.particle.io/reference/device-os/firmware/boron/#batterystate-
+  sysStatus.batteryState = sensor.batteryState();
+  snprintf(batteryContextStr, sizeof(batteryContextStr),"%s", batteryContext[sysStatus.batteryState]);
+  sysStatusWriteNeeded = true;
+}
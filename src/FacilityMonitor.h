@@ -0,0 +1,474 @@
+#ifndef __FACILITYMONITOR_H
+#define __FACILITYMONITOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Hal.h"                                                                            // Clock, sensor, FRAM, cloud and GPIO interfaces
+#include "ExcursionDetector.h"                                                              // Door open, defrost and compressor failure from the rate of change
+#include "ExcursionForecaster.h"                                                            // Level and trend smoothing to forecast when a limit will be crossed
+#include "ThresholdSchedule.h"                                                              // Time of day windows with their own thresholds
+#include "HistoryCodec.h"                                                                   // Delta of delta compression for the reading history
+#include "Rollup.h"                                                                         // Hourly and daily min, max, mean and mean kinetic temperature
+#include "HistoryIndex.h"                                                                   // Binary search by time in the history rings
+#include "StallMonitor.h"                                                                   // What the loop was doing when it stopped - kept across a reset
+#include "TraceBuffer.h"                                                                    // Binary trace records in a retained ring
+#include "TraceEvents.h"                                                                    // Trace event ids - shared with tools/trace-decode.cpp
+#include "BulkDump.h"                                                                       // Framed dump of the FRAM and the trace over the USB serial port
+
+// Define the memory map - note can be EEPROM or FRAM - moving to FRAM for speed and to avoid memory wear
+namespace FRAM {                                                                         // MPoved to namespace instead of #define to limit scope
+  enum Addresses {
+    versionAddr           = 0x00,                                                           // Where we store the memory map version number - 8 Bits
+    sysStatusAddr         = 0x01,                                                           // This is the status of the device
+    alertStatusAddr       = 0x50,                                                           // Where we store the status of the alerts in the system
+    sensorDataAddr        = 0xA0,                                                           // Where we store the latest sensor data readings
+    keepAliveAddr         = 0x100,                                                          // Where we store the learned keep alive values for each SIM
+    connectionStatsAddr   = 0x180,                                                          // Where we store the connect time, data and radio time for each connection policy
+    thresholdScheduleAddr = 0x200,                                                          // Where we store the time of day threshold profiles
+    historyStatusAddr     = 0x280,                                                          // Where we store the head of each history tier
+    rollupAddr            = 0x2C0,                                                          // Where we store the running totals for the hour and the day so far
+    reportLogAddr         = 0x300,                                                          // Where we store the next sequence number and the head of the report ring
+    historyAddr           = 0x400,                                                          // Start of the compressed raw readings (historyBlocks x 64 bytes)
+    hourlyAddr            = 0xC00,                                                          // Start of the hourly rollups (hourlyRecords x 16 bytes)
+    reportsAddr           = 0x1800,                                                         // Start of the reports waiting for an ack (reportRecords x 16 bytes)
+    dailyAddr             = 0x1A00                                                          // Start of the daily rollups (dailyRecords x 16 bytes)
+   };
+};
+
+const int FRAMversionNumber = 13;                                                           // Increment this number each time the memory map is changed
+
+struct systemStatus_structure {                     
+  uint8_t structuresVersion;                                                                // Version of the data structures (system and data)
+  bool thirdPartySim;                                                                       // If this is set to "true" then the keep alive code will be executed
+  int keepAlive;                                                                            // Keep alive value for use with 3rd part SIMs
+  uint8_t adaptiveKeepAlive;                                                                // If set, we probe for the longest keep alive the carrier will allow, starting from keepAlive
+  uint8_t connectionPolicy;                                                                 // When we bring up the cellular connection - see ConnectionPolicy
+  uint8_t connectWindowHours;                                                               // For scheduled windows - connect at the top of every this many hours
+  uint8_t minSignalStrength;                                                                // Backlogs wait for at least this signal strength (%) - 0 sends them regardless
+  uint16_t maxDeferralMinutes;                                                              // The longest a backlog will wait for a better signal
+  uint16_t forecastLeadMinutes;                                                             // Warn when a limit is forecast to be crossed within this many minutes - 0 turns forecasting off
+  uint8_t connectedStatus;
+  uint8_t verboseMode;
+  uint8_t lowBatteryMode;
+  int stateOfCharge;                                                                        // Battery charge level
+  uint8_t batteryState;                                                                     // Stores the current battery state
+  int resetCount;                                                                           // reset count of device (0-256)
+  uint32_t lastHookResponse;                                                                // Last time we got a valid Webhook response
+};
+
+struct alertsStatus_structure {
+  bool upperTemperatureThresholdCrossed;                                                    // Set this to true if the upper temp threshold is crossed
+  bool lowerTemperatureThresholdCrossed;                                                    // Set this to true if the lower temp threshold is crossed
+  bool upperHumidityThresholdCrossed;                                                       // Set this to true if the upper humidty threshold is crossed
+  bool lowerHumidityThresholdCrossed;                                                       // Set this to true if the lower humidty threshold is crossed
+  bool thresholdCrossedFlag;                                                                // If any of the thresholds have been crossed
+  float upperTemperatureThreshold;                                                          // Values set below that trigger alerts
+  float lowerTemperatureThreshold;
+  float upperHumidityThreshold;
+  float lowerHumidityThreshold;
+};
+
+struct sensor_data_struct {                                                               // Here we define the structure for collecting and storing data from the sensors
+  bool validData;
+  uint32_t timeStamp;
+  float temperatureInC;
+  float relativeHumidity; 
+  int stateOfCharge;
+  int signalStrength;                                                                       // Signal strength (%) when the reading was reported
+};
+
+struct keepAliveSim_structure {                                                             // What we have learned about the carrier's NAT timeout for one SIM
+  char iccid[21];                                                                           // SIM this entry belongs to
+  uint8_t converged;                                                                        // Set once knownGood and knownBad are within a probe step of each other
+  uint16_t knownGood;                                                                       // Longest keep alive (sec) the session has survived
+  uint16_t knownBad;                                                                        // Shortest keep alive (sec) that lost the session - 0 if we have not found one yet
+  uint32_t lastUsed;                                                                        // Time.now() when this SIM was last seen - the oldest entry is replaced on a new SIM
+};
+
+struct connectionStats_structure {                                                          // Kept for each connection policy so we can compare them for a site
+  struct {
+    uint16_t connects;                                                                      // Connections made
+    uint16_t failures;                                                                      // Connection attempts that timed out
+    uint32_t connectMillis;                                                                 // Total time spent connecting
+    uint32_t connectedSeconds;                                                              // Total time connected to the cloud
+    uint32_t bytesSent;                                                                     // Event name and data bytes published
+  } policy[4];
+};
+
+struct historyStatus_structure {                                                            // Each tier of the history is a ring - raw readings are compressed blocks, see HistoryCodec.h
+  uint8_t head;                                                                             // Block readings are being added to
+  uint8_t used;                                                                             // Blocks holding readings, up to historyBlocks
+  uint8_t hourlyHead;                                                                       // Where the next hourly rollup goes
+  uint8_t hourlyUsed;                                                                       // Hourly rollups stored, up to hourlyRecords
+  uint8_t dailyHead;                                                                        // Where the next daily rollup goes
+  uint8_t dailyUsed;                                                                        // Daily rollups stored, up to dailyRecords
+};
+
+struct reportLog_structure {                                                                // Reports are numbered and kept in a ring until the backend acks them
+  uint32_t nextSeq;                                                                         // Sequence number for the next report - never reused, even after a reset
+  uint8_t head;                                                                             // Where the next report goes
+  uint8_t used;                                                                             // Reports in the ring, acked or not, up to reportRecords
+};
+
+struct reportRecord_structure {                                                             // Everything needed to send a report again exactly as it was - 16 bytes
+  uint32_t seq;
+  uint32_t timeStamp;
+  int16_t temperature;                                                                      // Tenths of a degree C
+  int16_t humidity;                                                                         // Tenths of a percent RH
+  int8_t battery;
+  int8_t signal;
+  uint8_t acked;                                                                            // Set once the backend has confirmed it
+  uint8_t reserved;
+};
+
+struct keepAliveStatus_structure {
+  keepAliveSim_structure sims[4];                                                           // One entry per SIM so swapping SIMs does not throw away what we learned
+};
+
+struct activeThresholds_structure {                                                         // The thresholds that apply at a time - alertsStatus unless a window is active
+  float upperTemperatureThreshold;
+  float lowerTemperatureThreshold;
+  float upperHumidityThreshold;
+  float lowerHumidityThreshold;
+  uint8_t flags;                                                                            // ThresholdSchedule::Flags for the active window
+};
+
+/**
+ * @brief The firmware logic - the state machine, alerts, reports, connection policy, history and what they keep in FRAM
+ *
+ * It only reaches the hardware through the interfaces in Hal.h, so the same code runs on the device
+ * (VaccineFacilityMonitor.ino wires it to Device OS with ParticleHal.h) and on a Linux host (host/).
+ * setup() and loop() are the firmware's own. The watchdog interrupt, the stall timer, cloud function
+ * calls and webhook responses come in through the public methods below.
+ */
+class FacilityMonitor {
+public:
+  // State Machine Variables
+  enum State { INITIALIZATION_STATE, ERROR_STATE, IDLE_STATE, MEASURING_STATE, REPORTING_STATE, RESP_WAIT_STATE, CONNECTING_STATE};
+  static const char stateNames[8][26];
+
+  // Connection Policies
+  enum ConnectionPolicy { ALWAYS_ON, PER_REPORT, SCHEDULED_WINDOWS, ON_ALERT };
+  static const char * const connectionPolicyNames[4];
+
+  // Stack Monitor Variables - the stacks themselves are set up before setup() is called
+  static constexpr size_t loopStackSize = 6144;                                             // Device OS application thread stack on Gen3
+  static constexpr size_t loopStackReserve = 1536;                                          // Generous allowance for what is in use when setup() starts
+  static constexpr size_t publishStackSize = 2048;                                          // Publish queue worker - check "Stacks" on a few devices before making this smaller
+
+  /**
+   * @brief A cloud function - the handler takes the argument and returns the function's result
+   */
+  struct Function {
+    const char *name;
+    int (FacilityMonitor::*handler)(const char *command);
+  };
+  static const Function functions[];                                                        // Every cloud function, for the caller to register
+  static const int functionCount;
+
+  static constexpr const char *reportEventName = "storage-facility-hook-stealth";           // The webhook that takes the reports to Ubidots
+  static const char * const coalescedEvents[];                                              // Waiting together, these go out as one event, a line each
+  static const int coalescedEventCount;
+
+  // History ring sizes - tools/query-bench.cpp times lookups in rings of these sizes
+  static constexpr int historyBlocks = 32;                                                  // 2kB of FRAM - about 40 one minute readings a block, so the last day or so
+  static constexpr int hourlyRecords = 192;                                                 // 3kB of FRAM - 8 weeks of hourly rollups
+  static constexpr int dailyRecords = 96;                                                   // 1.5kB of FRAM - over 3 months of daily rollups
+
+  /**
+   * @brief Construct the firmware
+   *
+   * @param hal The hardware - kept by reference
+   *
+   * @param stallRecord Where the stall monitor keeps its record - retained RAM on the device
+   *
+   * @param traceRing Where the trace is kept - retained RAM on the device
+   *
+   * @param releaseNumber For the boot trace record
+   */
+  FacilityMonitor(const Hal &hal, StallMonitor::Record &stallRecord, TraceBuffer::Ring &traceRing, const char *releaseNumber);
+
+  void setup();
+  void loop();
+
+  int callFunction(int index, const char *argument);                                        // A cloud function by its place in functions[] - -1 if there is no such function
+  int callFunction(const char *name, const char *argument);                                 // A cloud function by name
+  void UbidotsHandler(const char *event, const char *data);                                 // The webhook response - data is NULL if there was none
+  void watchdogInterrupt(uint32_t nowMillis);                                               // The watchdog has asked for a pet - safe from an interrupt
+  void checkStall(uint32_t nowMillis);                                                      // From a timer - only touches the stall record
+
+  State getState() const { return state; };
+  int reportBoundary();                                                                     // Seconds between reports right now - the simulators count the reports due with it
+
+  // Kept in FRAM - public so the console can show some of them
+  systemStatus_structure sysStatus;
+  alertsStatus_structure alertsStatus;
+  sensor_data_struct sensorData;
+  keepAliveStatus_structure keepAliveStatus;
+  connectionStats_structure connectionStats;
+  historyStatus_structure historyStatus;
+  reportLog_structure reportLog;
+
+  // Variables Related To Particle Mobile Application Reporting
+  // Simplifies reading values in the Particle Mobile Application
+  char temperatureString[16];
+  char humidityString[16];
+  char batteryContextStr[16];                                                               // One word that describes whether the device is getting power, charging, discharging or too cold to charge
+  char batteryString[16];
+  char upperTemperatureThresholdString[24];                                                 // String to show the current threshold readings.
+  char lowerTemperatureThresholdString[24];                                                 // String to show the current threshold readings.
+  char upperHumidityThresholdString[24];                                                    // String to show the current threshold readings.
+  char lowerHumidityThresholdString[24];                                                    // String to show the current threshold readings.
+  char connectionPolicyStr[24];                                                             // Connection policy name for the console
+  char signalString[24];                                                                    // Signal strength and quality for the console
+  char forecastString[48] = "Not enough data";                                              // What the forecast looks like right now
+  char thresholdProfileStr[32] = "Base";                                                    // Active window for the console
+  char heapString[64];                                                                      // Free, low water, largest block and fragmentation for the console
+  char stackString[64];                                                                     // Headroom of each thread for the console
+  char stallString[64];                                                                     // Longest pet wait and stalls for the console
+  int keepAliveCurrent = 0;                                                                 // Keep alive value in use right now (sec)
+  int unackedReports = 0;                                                                   // For the console
+
+protected:
+  void loadSystemDefaults();
+  void loadAlertDefaults();
+  void loadConnectionStatsDefaults();
+  void loadKeepAliveDefaults();
+  void loadThresholdScheduleDefaults();
+  void loadHistoryDefaults();
+  void loadReportLogDefaults();
+  void checkReportLogValues();
+  void checkSystemValues();
+  void checkAlertsValues();
+  void checkKeepAliveValues();
+  void petWatchdog();
+  void publishStall();
+  void publishPostMortem();
+  void startKeepAlive();
+  int nextKeepAliveProbe();
+  void setKeepAliveProbe(int seconds);
+  void manageKeepAlive();
+  bool connectionWanted();
+  void startConnection(State returnState);
+  void stopConnection();
+  void trackConnection();
+  void updateConnectionStats();
+  void publishConnectionStats(bool force);
+  int readSignal();
+  void checkSignalDeferral();
+  void sendEvent();
+  void formatReport(const reportRecord_structure &report, char *buf, size_t bufSize);
+  int reportSlot(uint32_t seq);
+  void countUnackedReports();
+  bool forEachSeqRange(const char *list, void (FacilityMonitor::*action)(uint32_t first, uint32_t last));
+  void ackReports(uint32_t first, uint32_t last);
+  void markResends(uint32_t first, uint32_t last);
+  void pumpResends();
+  void pumpBulkDump();
+  bool webhookTimedOut();
+  void noteReportSent(uint32_t seq);
+  void forgetReportSends(uint32_t seq, bool answered);
+  bool takeMeasurements();
+  void startHistory();
+  void logReading(float temperature, float humidity);
+  void addToRollup(RollupAccumulator &rollup, const HistoryReading &reading, uint32_t period, int addr, uint8_t &head, uint8_t &used, int records);
+  uint16_t historyOldest(int tier);
+  uint16_t historyStored(int tier);
+  uint32_t historyPeriod(int tier);
+  bool historyRecordAt(int tier, uint16_t index, RollupRecord &record);
+  uint32_t historyTimeAt(int tier, uint16_t index);
+  static uint32_t historyTimeAt(uint16_t index, void *context);
+  uint16_t historyEntries(int tier);
+  bool nextHistoryReading(HistoryReading &reading);
+  bool nextHistoryRecord(RollupRecord &record);
+  bool nextHistoryRow(char *row, size_t size);
+  void pumpHistoryQuery();
+  void sampleSensors();
+  void checkForecast(float temperature, float humidity);
+  void updateActiveThresholds();
+  const ThresholdSchedule::Window *thresholdsAt(uint32_t time, activeThresholds_structure &thresholds);
+  bool urgentReport();
+  bool reportDue();
+  void checkHeap(bool afterSetup);
+  void blinkLED(HalGpio::Pin LED);
+  void recordStateTransition(void);
+  void dumpTrace(bool toSerial);
+  void updateThresholdValue();
+  void getBatteryContext();
+
+  // Cloud functions
+  int measureNow(const char *command);
+  int setVerboseMode(const char *command);
+  int setUpperTempLimit(const char *value);
+  int setLowerTempLimit(const char *value);
+  int setUpperHumidityLimit(const char *value);
+  int setLowerHumidityLimit(const char *value);
+  int setThirdPartySim(const char *command);
+  int setKeepAlive(const char *command);
+  int setAdaptiveKeepAlive(const char *command);
+  int setConnectionPolicy(const char *command);
+  int setConnectWindow(const char *command);
+  int connectionStatsCommand(const char *command);
+  int setSignalDeferral(const char *command);
+  int setForecastLead(const char *command);
+  int setThresholdProfiles(const char *command);
+  int historyQueryCommand(const char *command);
+  int resendReportsCommand(const char *command);
+  int traceCommand(const char *command);
+
+  // The hardware
+  HalClock &clock;
+  HalSensor &sensor;
+  HalStore &store;
+  HalCloud &cloud;
+  HalGpio &gpio;
+  HalSystem &system;
+  const char *releaseNumber;
+
+  State state = INITIALIZATION_STATE;
+  State oldState = INITIALIZATION_STATE;
+  State connectReturnState = IDLE_STATE;                                                    // Where we go once CONNECTING_STATE is done
+
+  volatile bool watchdogFlag=false;                                                         // Flag to let us know we need to pet the dog
+
+  // Timing Variables
+  static constexpr uint32_t webhookWait = 45000;                                            // How long will we wair for a WebHook response
+  static constexpr uint32_t resetWait   = 300000;                                           // How long will we wait in ERROR_STATE until reset
+  static constexpr uint32_t connectMaxTime = 600000;                                        // How long we will try to connect before giving up until the next report
+  static constexpr int connectWindowMinutes = 10;                                           // How long a scheduled window stays open
+
+  uint32_t webhookTimeStamp  = 0;                                                           // Webhooks...
+  uint32_t resetTimeStamp    = 0;                                                           // Resets - this keeps you from falling into a reset loop
+  uint32_t lastBoundary      = 0;                                                           // The report boundary last measured for - each is reported once
+  bool dataInFlight = false;
+
+  // Webhook Retry Variables
+  static constexpr int webhookRetryLimit = 2;                                               // Resend a report this many times before giving up on it
+  static constexpr int linkFailureLimit = 3;                                                // End the session only after this many timeouts that point to a broken link
+  char reportData[128];                                                                     // The report in flight - resent as is so a retry is the same report to the backend
+  int webhookRetries = 0;                                                                   // Resends of the report in flight
+  int linkFailures = 0;                                                                     // Timeouts in a row where the report never left the device
+
+  // Report Sequence Variables
+  static constexpr int reportRecords = 32;                                                  // Reports kept for a resend - over 10 hours at the normal interval
+  uint32_t inFlightSeq = 0;                                                                 // Sequence number of the report we are waiting on
+  uint32_t resendMask = 0;                                                                  // One bit per ring slot - reports the backend asked for again
+  static constexpr int sentSeqSlots = reportRecords;                                        // Report sends a bare status code can still answer - "200" with no ":seq"
+  uint32_t sentSeqs[sentSeqSlots];                                                          // Sequence number of each of those sends, oldest first
+  uint8_t sentSeqFirst = 0;
+  uint8_t sentSeqCount = 0;
+  uint16_t sentSeqSkip = 0;                                                                 // Bare codes still to come for sends we could not note - they ack nothing
+
+  // Heap Monitor Variables - nothing should be allocated after setup, this shows if something is
+  static constexpr uint32_t heapCheckInterval = 60000;
+  uint32_t lastHeapCheck = 0;
+  uint32_t heapAfterSetup = 0;                                                              // Free heap at the end of setup
+  uint32_t heapLowWater = 0;                                                                // Least free heap seen since then
+
+  static constexpr size_t stackWarning = 256;                                               // Less headroom than this gets a mention in the daily stats
+
+  // Stall Monitor Variables - the external watchdog resets us if the loop stops, this says why afterwards
+  static constexpr uint32_t stallLimit = 20000;                                             // A loop pass or a pet this late is a stall - the slowest modem command is a few seconds
+  StallMonitor stallMonitor;
+
+  // Trace Variables - state changes and the like as 8 byte records, dumped on demand with the Trace function
+  TraceBuffer traceBuffer;
+  static constexpr size_t tracePublishBytes = 465;                                          // Packed bytes that fit the 622 character publish limit once base64 encoded
+  uint8_t tracePacked[TraceBuffer::HEADER_SIZE + TraceBuffer::CAPACITY * TraceBuffer::RECORD_SIZE];
+  char traceText[4 * ((sizeof(tracePacked) + 2) / 3) + 1];                                  // Members - too big for the loop stack
+
+  // Bulk Dump Variables - tools/dump-reader.cpp pulls the history, reports and trace over the USB serial port
+  BulkDumpServer bulkDump;
+
+  bool sysStatusWriteNeeded = false;                                                        // Keep track of when we need to write
+  bool alertsStatusWriteNeeded = false;
+  bool sensorDataWriteNeeded = false;
+  bool keepAliveWriteNeeded = false;
+  bool connectionStatsWriteNeeded = false;
+  bool thresholdScheduleWriteNeeded = false;
+  bool historyStatusWriteNeeded = false;
+
+  // Connection Policy Variables
+  uint32_t connectStart = 0;                                                                // When we started connecting - 0 if we are not
+  uint32_t connectedSince = 0;                                                              // When we last added connected time to the stats
+  uint32_t lastSentBytes = 0;                                                               // cloud.sentBytes() when we last updated the stats
+  bool cloudDisconnectRequested = false;                                                    // We took the connection down - not the carrier
+  bool trackWasConnected = false;                                                           // Connected on the last trackConnection()
+  int lastStatsDay = -1;                                                                    // Day of the month the stats were last published
+  static constexpr float connectingCurrentmA = 100.0;                                       // Rough radio current while connecting - for the energy estimate
+  static constexpr float connectedCurrentmA = 20.0;                                         // Rough radio current while connected and mostly idle
+
+  // Signal Deferral Variables
+  static constexpr uint32_t signalCheckInterval = 60000;                                    // How often we look at the signal while a backlog is waiting
+  uint32_t deferralStart = 0;                                                               // When we started holding the backlog - 0 if we are not
+  uint32_t lastSignalCheck = 0;
+
+  // Threshold Profile Variables
+  ThresholdSchedule thresholdSchedule;                                                      // Windows of the day with their own thresholds - base thresholds outside them
+  activeThresholds_structure activeThresholds;                                              // The thresholds that apply right now
+
+  // History Variables
+  uint8_t historyBlock[HistoryBlock::SIZE];                                                 // Copy of the head block - written through to FRAM with each reading
+  HistoryBlockEncoder historyEncoder;
+  RollupAccumulator hourlyRollup;                                                           // The hour so far
+  RollupAccumulator dailyRollup;                                                            // The day so far (UTC)
+  bool rollupWriteNeeded = false;
+  uint32_t historyBlockStart[historyBlocks];                                                // Time index for the raw tier - the first reading in each block
+
+  // History Query Variables
+  enum HistoryTier { TIER_RAW, TIER_HOURLY, TIER_DAILY };
+  static const char * const historyTierNames[3];
+  enum HistoryAggregation { QUERY_READINGS, QUERY_SUMMARY, QUERY_EXCURSIONS };
+  static constexpr size_t historyPageSize = 240;                                            // Keeps each page well inside the publish limit and the retained queue
+  struct historyQuery_structure {                                                           // The query being answered - pages go out one at a time from loop()
+    bool active;
+    uint8_t aggregation;                                                                    // HistoryAggregation
+    uint8_t tier;                                                                           // HistoryTier the answer comes from
+    uint32_t start;                                                                         // Time range asked for
+    uint32_t end;
+    uint16_t next;                                                                          // Next block or record to read, counting from the oldest
+    uint16_t count;                                                                         // Blocks or records in the tier
+    uint16_t page;                                                                          // Pages published so far
+    bool blockLoaded;                                                                       // Raw tier - block holds the block being decoded
+    bool inExcursion;                                                                       // Excursions - we are in one
+    uint32_t excursionStart;
+    uint32_t excursionEnd;
+    int16_t excursionMin;
+    int16_t excursionMax;
+    uint8_t block[HistoryBlock::SIZE];
+    char pendingRow[48];                                                                    // A row that did not fit on the last page
+    char data[historyPageSize];
+  } historyQuery;
+  HistoryBlockDecoder historyQueryDecoder;
+  struct HistoryLookup {                                                                    // Context for HistoryIndex
+    FacilityMonitor *monitor;
+    int tier;
+  };
+
+  // Adaptive Keep Alive Variables
+  static constexpr int keepAliveMin = 30;                                                   // Never probe below this (sec)
+  static constexpr int keepAliveMax = 1200;                                                 // Same upper limit as the Keep Alive function
+  static constexpr int keepAliveStep = 30;                                                  // Stop probing once the good and bad values are this close (sec)
+  static constexpr int keepAliveSurviveIntervals = 3;                                       // The session has to survive this many intervals before we call a value good
+  keepAliveSim_structure *keepAliveSim = NULL;                                              // Entry for the SIM we are using - found once we are connected
+  uint32_t keepAliveProbeStart = 0;                                                         // When we started running at keepAliveCurrent
+  bool keepAliveWasConnected = false;                                                       // Connected on the last manageKeepAlive()
+
+  // Time Period Related Variables
+  static constexpr int wakeBoundary = 0*3600 + 20*60 + 0;                                   // 0 hour 20 minutes 0 seconds
+  static constexpr int fastWakeBoundary = 0*3600 + 5*60 + 0;                                // Report this often while an alert or early warning is active
+  static constexpr int sampleInterval = 60;                                                 // Seconds between readings for the detector - these are not published
+
+  // Early Warning Variables
+  ExcursionDetector excursionDetector;
+  uint32_t lastSampleTime = 0;                                                              // Time.now() of the last detector reading
+  bool detectorWarning = false;                                                             // The detector expects an excursion - report fast and treat reports as urgent
+  ExcursionForecaster temperatureForecaster;
+  ExcursionForecaster humidityForecaster;
+  bool forecastWarning = false;                                                             // A limit is forecast to be crossed within the lead time - latched until the forecast clears
+
+  uint32_t lastStateChange = 0;                                                             // blinkLED() - when the LED last changed
+};
+
+#endif /* __FACILITYMONITOR_H */
@@ -0,0 +1,184 @@
+#ifndef __HAL_H
+#define __HAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @brief Thin interfaces between the firmware logic (FacilityMonitor) and the hardware
+ *
+ * FacilityMonitor only talks to the outside world through these, so it builds and runs anywhere.
+ * ParticleHal.h implements them with Device OS, the SHT31, the FRAM and the RTC - each call does
+ * exactly what the firmware used to do inline. The host build (host/) implements them with stubs
+ * and a virtual clock, and with a replay of a log from the Input-Record function.
+ *
+ * None of the device implementations may block for longer than the Device OS call it stands for,
+ * or allocate after setup.
+ */
+
+/**
+ * @brief millis(), the time of day and the real time clock
+ */
+class HalClock {
+public:
+	virtual ~HalClock() {};
+
+	virtual uint32_t millis() = 0;					//!< Since boot - wraps after 49.7 days
+	virtual uint32_t now() = 0;						//!< Unix time, UTC
+	virtual bool isValid() = 0;						//!< now() has been set from the cloud or the RTC
+	virtual void delay(uint32_t ms) = 0;
+	virtual void begin() = 0;						//!< Start the real time clock and clear any alarm
+	virtual void loop() = 0;						//!< Keep the real time clock and now() in step - call every loop pass
+
+	/**
+	 * @brief Parts of a Unix time, UTC - the same as Time.hour(t), Time.minute(t) and Time.day(t) with no zone set
+	 */
+	static int hourOf(uint32_t time) { return (time % 86400) / 3600; };
+	static int minuteOf(uint32_t time) { return (time % 3600) / 60; };
+	static int dayOf(uint32_t time) {
+		time_t t = time;
+		struct tm parts;
+		gmtime_r(&t, &parts);
+		return parts.tm_mday;
+	};
+};
+
+/**
+ * @brief The temperature and humidity sensor, and the fuel gauge
+ */
+class HalSensor {
+public:
+	virtual ~HalSensor() {};
+
+	virtual bool begin() = 0;
+	virtual float readTemperature() = 0;			//!< Degrees C - NAN if the read failed
+	virtual float readHumidity() = 0;				//!< % RH - NAN if the read failed
+	virtual float batteryCharge() = 0;				//!< State of charge (%)
+	virtual int batteryState() = 0;					//!< 0-6, the same as System.batteryState()
+};
+
+/**
+ * @brief Nonvolatile storage - the FRAM
+ */
+class HalStore {
+public:
+	virtual ~HalStore() {};
+
+	virtual void begin() = 0;
+	virtual size_t length() = 0;
+	virtual bool erase() = 0;						//!< All of it, to zeros
+	virtual bool readData(size_t addr, uint8_t *data, size_t len) = 0;
+	virtual bool writeData(size_t addr, const uint8_t *data, size_t len) = 0;
+
+	template <typename T> T &get(size_t addr, T &t) {
+		readData(addr, (uint8_t *)&t, sizeof(T));
+		return t;
+	}
+
+	template <typename T> const T &put(size_t addr, const T &t) {
+		writeData(addr, (const uint8_t *)&t, sizeof(T));
+		return t;
+	}
+};
+
+/**
+ * @brief The cloud connection, the cellular modem and the publish queue
+ */
+class HalCloud {
+public:
+	enum Priority : uint8_t {
+		PRIORITY_LOW = 0,			//!< Diagnostics - dropped first when the queue is full
+		PRIORITY_NORMAL,
+		PRIORITY_HIGH,
+		PRIORITY_URGENT				//!< Sent before anything else queued
+	};
+
+	virtual ~HalCloud() {};
+
+	virtual bool connected() = 0;
+	virtual bool registered() = 0;					//!< The modem is on the cellular network, session or not
+	virtual void connect() = 0;						//!< Turns the modem on as well - returns straight away
+	virtual void waitConnected(uint32_t timeout) = 0;	//!< Waits up to timeout ms for connected()
+	virtual void disconnect() = 0;					//!< Ends the session and turns the modem off
+	virtual void keepAlive(int seconds) = 0;
+	virtual void syncTime() = 0;					//!< Asks the cloud for the time
+
+	virtual bool publish(const char *name, const char *data, Priority priority = PRIORITY_NORMAL) = 0;	//!< Adds a private event to the publish queue
+	virtual uint16_t queuedEvents() = 0;			//!< Events in the publish queue, including one being sent
+	virtual uint32_t sentBytes() = 0;				//!< Name and data bytes the queue has published
+	virtual void pausePublishing(bool pause) = 0;	//!< Events are still queued while paused
+	virtual size_t publishStackHeadroom() = 0;		//!< Publish thread stack never used
+
+	virtual void signal(float &strength, float &dBm) = 0;	//!< Strength in % and in dBm
+	virtual void simId(char *iccid, size_t size) = 0;		//!< The SIM's ICCID
+};
+
+/**
+ * @brief The pins the firmware drives or reads
+ */
+class HalGpio {
+public:
+	enum Pin : uint8_t {
+		LED_PIN = 0,				//!< Flashes while a threshold is crossed
+		WAKE_PIN,					//!< The watchdog asks for a pet on this - see attachWakeInterrupt()
+		DONE_PIN					//!< Pulsed to pet the watchdog
+	};
+
+	virtual ~HalGpio() {};
+
+	virtual void pinMode(Pin pin, bool output) = 0;
+	virtual void digitalWrite(Pin pin, bool high) = 0;
+	virtual bool digitalRead(Pin pin) = 0;
+
+	/**
+	 * @brief Start sending rising edges on WAKE_PIN to the handler the implementation was given
+	 *
+	 * The handler runs in interrupt context and calls FacilityMonitor::watchdogInterrupt().
+	 */
+	virtual void attachWakeInterrupt() = 0;
+};
+
+/**
+ * @brief Resets, memory, the USB console, and what the loop sees of the watchdog interrupt and the stall timer
+ */
+class HalSystem {
+public:
+	static const int RESET_PIN = 20;				//!< Same as RESET_REASON_PIN_RESET - the external watchdog pulls the reset pin
+	static const int RESET_WATCHDOG = 60;			//!< Same as RESET_REASON_WATCHDOG
+
+	virtual ~HalSystem() {};
+
+	virtual int resetReason() = 0;					//!< The same numbers as System.resetReason()
+	virtual void reset() = 0;
+	virtual void heapInfo(uint32_t &freeHeap, uint32_t &largestBlock) = 0;
+	virtual size_t loopStackHeadroom() = 0;			//!< Loop thread stack never used
+
+	virtual bool consoleAvailable() = 0;			//!< False while something else is using the USB serial port
+	virtual void writeConsole(const char *prefix, const char *text) = 0;	//!< One line
+	virtual size_t consoleRead(uint8_t *buf, size_t len) { return 0; };			//!< Bytes waiting, without blocking
+	virtual size_t consoleWrite(const uint8_t *buf, size_t len) { return 0; };	//!< Bytes the port takes now, without blocking
+
+	/**
+	 * @brief What the loop sees of the watchdog interrupt and the stall timer
+	 *
+	 * Both run outside the loop, so the loop passes what it finds through here - the device can log
+	 * it for a replay, and a replay hands back what was logged. Otherwise they return what they are given.
+	 */
+	virtual bool watchdogRequested(bool requested) { return requested; };
+	virtual bool stallRecovered(bool recovered, uint32_t &duration, uint8_t &state, uint8_t &operation) { return recovered; };
+};
+
+/**
+ * @brief One of each, as FacilityMonitor takes them
+ */
+struct Hal {
+	HalClock &clock;
+	HalSensor &sensor;
+	HalStore &store;
+	HalCloud &cloud;
+	HalGpio &gpio;
+	HalSystem &system;
+};
+
+#endif /* __HAL_H */
@@ -0,0 +1,206 @@
+#include "HistoryCodec.h"
+
+#include <string.h>
+
+static const size_t STREAM_BITS = (HistoryBlock::SIZE - HistoryBlock::HEADER_SIZE) * 8;
+
+// Folds the sign into the low bit so small negative values are small too
+static uint32_t zigzag(int32_t value) {
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+	return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+// Variable length codes. Each row is a prefix (ones then a zero, except the last) and a payload size.
+// Times:  0 | 10 + 7 bits | 110 + 12 bits | 1110 + 20 bits | 1111 + 32 bits
+// Values: 0 | 10 + 3 bits | 110 + 7 bits  | 111 + 17 bits
+static const uint8_t timeBits[] = {0, 7, 12, 20, 32};
+static const uint8_t valueBits[] = {0, 3, 7, 17};
+
+// Index of the shortest code that holds value
+static uint8_t codeFor(uint32_t value, const uint8_t *payloadBits, uint8_t codes) {
+	for(uint8_t ii = 0; ii < codes - 1; ii++) {
+		if (payloadBits[ii] == 32 || value < ((uint32_t)1 << payloadBits[ii])) {
+			return ii;
+		}
+	}
+	return codes - 1;
+}
+
+// Prefix length for a code: ii ones followed by a zero, except the last which has no zero
+static uint8_t prefixBits(uint8_t code, uint8_t codes) {
+	return (code == codes - 1) ? code : code + 1;
+}
+
+
+// [static]
+uint32_t HistoryBlock::getStartTime(const uint8_t *block) {
+	return (uint32_t)block[0] | ((uint32_t)block[1] << 8) | ((uint32_t)block[2] << 16) | ((uint32_t)block[3] << 24);
+}
+
+
+void HistoryBlockEncoder::begin(uint8_t *block) {
+	this->block = block;
+	memset(block, 0, HistoryBlock::SIZE);
+	bitPos = 0;
+	lastDelta = 0;
+}
+
+bool HistoryBlockEncoder::resume(uint8_t *block) {
+	this->block = block;
+
+	HistoryBlockDecoder decoder(block);
+	HistoryReading reading;
+	uint8_t decoded = 0;
+	uint32_t prevTime = 0;
+	while(decoder.next(reading)) {
+		if (decoded) {
+			lastDelta = (int32_t)(reading.time - prevTime);
+		}
+		prevTime = reading.time;
+		last = reading;
+		decoded++;
+	}
+	if (decoded != HistoryBlock::getCount(block)) {
+		begin(block);
+		return false;
+	}
+	if (decoded < 2) {
+		lastDelta = 0;
+	}
+	bitPos = decoder.getBitPos();
+	return true;
+}
+
+bool HistoryBlockEncoder::add(const HistoryReading &reading) {
+	uint8_t count = HistoryBlock::getCount(block);
+	if (count == HistoryBlock::MAX_COUNT) {
+		return false;
+	}
+
+	if (count == 0) {
+		block[0] = (uint8_t)reading.time;
+		block[1] = (uint8_t)(reading.time >> 8);
+		block[2] = (uint8_t)(reading.time >> 16);
+		block[3] = (uint8_t)(reading.time >> 24);
+		block[4] = (uint8_t)reading.temperature;
+		block[5] = (uint8_t)((uint16_t)reading.temperature >> 8);
+		block[6] = (uint8_t)reading.humidity;
+		block[7] = (uint8_t)((uint16_t)reading.humidity >> 8);
+		block[8] = 1;
+		last = reading;
+		lastDelta = 0;
+		return true;
+	}
+
+	int32_t delta = (int32_t)(reading.time - last.time);
+	uint32_t values[3] = {
+		zigzag(delta - lastDelta),
+		zigzag((int32_t)reading.temperature - last.temperature),
+		zigzag((int32_t)reading.humidity - last.humidity)
+	};
+	uint8_t codes[3] = {
+		codeFor(values[0], timeBits, sizeof(timeBits)),
+		codeFor(values[1], valueBits, sizeof(valueBits)),
+		codeFor(values[2], valueBits, sizeof(valueBits))
+	};
+
+	// Work out the size first so a reading is either all in the block or not at all
+	size_t bits = prefixBits(codes[0], sizeof(timeBits)) + timeBits[codes[0]];
+	for(size_t ii = 1; ii < 3; ii++) {
+		bits += prefixBits(codes[ii], sizeof(valueBits)) + valueBits[codes[ii]];
+	}
+	if (bitPos + bits > STREAM_BITS) {
+		return false;
+	}
+
+	for(size_t ii = 0; ii < 3; ii++) {
+		const uint8_t *payloadBits = (ii == 0) ? timeBits : valueBits;
+		uint8_t numCodes = (ii == 0) ? sizeof(timeBits) : sizeof(valueBits);
+		uint8_t prefixLen = prefixBits(codes[ii], numCodes);
+		// codes[ii] ones, then a zero unless it is the last code
+		uint32_t prefix = ((1u << codes[ii]) - 1) << (prefixLen - codes[ii]);
+		writeBits(prefix, prefixLen);
+		writeBits(values[ii], payloadBits[codes[ii]]);
+	}
+
+	block[8] = count + 1;
+	last = reading;
+	lastDelta = delta;
+	return true;
+}
+
+void HistoryBlockEncoder::writeBits(uint32_t value, uint8_t bits) {
+	while(bits > 0) {
+		bits--;
+		if ((value >> bits) & 1) {
+			block[HistoryBlock::HEADER_SIZE + bitPos / 8] |= (0x80 >> (bitPos % 8));
+		}
+		bitPos++;
+	}
+}
+
+
+HistoryBlockDecoder::HistoryBlockDecoder(const uint8_t *block) : block(block) {
+}
+
+bool HistoryBlockDecoder::readBits(uint8_t bits, uint32_t &value) {
+	if (bitPos + bits > STREAM_BITS) {
+		return false;
+	}
+	value = 0;
+	while(bits > 0) {
+		bits--;
+		value = (value << 1) | ((block[HistoryBlock::HEADER_SIZE + bitPos / 8] >> (7 - bitPos % 8)) & 1);
+		bitPos++;
+	}
+	return true;
+}
+
+bool HistoryBlockDecoder::next(HistoryReading &reading) {
+	uint8_t count = HistoryBlock::getCount(block);
+	if (index >= count) {
+		return false;
+	}
+
+	if (index == 0) {
+		last.time = HistoryBlock::getStartTime(block);
+		last.temperature = (int16_t)(block[4] | (block[5] << 8));
+		last.humidity = (int16_t)(block[6] | (block[7] << 8));
+		lastDelta = 0;
+	}
+	else {
+		int32_t decoded[3];
+		for(size_t ii = 0; ii < 3; ii++) {
+			const uint8_t *payloadBits = (ii == 0) ? timeBits : valueBits;
+			uint8_t numCodes = (ii == 0) ? sizeof(timeBits) : sizeof(valueBits);
+
+			uint8_t code = 0;
+			uint32_t bit;
+			while(code < numCodes - 1) {
+				if (!readBits(1, bit)) {
+					return false;
+				}
+				if (!bit) {
+					break;
+				}
+				code++;
+			}
+			uint32_t value = 0;
+			if (!readBits(payloadBits[code], value)) {
+				return false;
+			}
+			decoded[ii] = unzigzag(value);
+		}
+		lastDelta += decoded[0];
+		last.time += lastDelta;
+		last.temperature += decoded[1];
+		last.humidity += decoded[2];
+	}
+
+	index++;
+	reading = last;
+	return true;
+}
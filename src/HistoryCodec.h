@@ -0,0 +1,126 @@
+#ifndef __HISTORYCODEC_H
+#define __HISTORYCODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief One reading in the history
+ *
+ * Temperature and humidity are in tenths, which is finer than the SHT31 is accurate to.
+ */
+struct HistoryReading {
+	uint32_t time;					//!< Time.now() of the reading
+	int16_t temperature;			//!< Tenths of a degree C
+	int16_t humidity;				//!< Tenths of a percent RH
+};
+
+/**
+ * @brief Compressed blocks of readings
+ *
+ * Readings change slowly and arrive at a steady interval, so most of each full width record is
+ * repeated information. A block stores the first reading in full, then for each following reading:
+ *
+ * - The change in the time between readings (delta of delta), which is almost always 0 - one bit
+ * - The change in temperature and in humidity, each in a variable length code - one bit if unchanged
+ *
+ * This is the scheme from Facebook's Gorilla paper, using quantized deltas instead of the XOR of
+ * floats since the readings are already fixed point. A steady reading costs about 3 bits instead of
+ * 12 bytes. Blocks are a fixed size and decode on their own, with no state carried from one to the
+ * next, so a block can be written to FRAM or to a flash page as is and read back without the rest.
+ *
+ * Block layout: first time (4 bytes, little endian), first temperature (2), first humidity (2),
+ * count (1), reserved (1), then the bit stream, most significant bit first.
+ */
+class HistoryBlock {
+public:
+	static const size_t SIZE = 64;				//!< Bytes in a block
+	static const size_t HEADER_SIZE = 10;		//!< Bytes before the bit stream
+	static const uint8_t MAX_COUNT = 255;		//!< Readings in a block are limited by the count byte
+
+	/**
+	 * @brief Readings in a block - 0 for an empty (erased) block
+	 */
+	static uint8_t getCount(const uint8_t *block) { return block[8]; };
+
+	/**
+	 * @brief Time of the first reading in a block
+	 */
+	static uint32_t getStartTime(const uint8_t *block);
+};
+
+/**
+ * @brief Adds readings to a block
+ */
+class HistoryBlockEncoder {
+public:
+	/**
+	 * @brief Start a new, empty block
+	 *
+	 * @param block HistoryBlock::SIZE bytes. The encoder writes to it directly.
+	 */
+	void begin(uint8_t *block);
+
+	/**
+	 * @brief Carry on adding to a block that already has readings, for example after a reset
+	 *
+	 * @return false if the block could not be decoded, in which case it has been started again empty
+	 */
+	bool resume(uint8_t *block);
+
+	/**
+	 * @brief Add a reading
+	 *
+	 * @return false if the block is full. The reading was not added - start a new block and add it there.
+	 */
+	bool add(const HistoryReading &reading);
+
+	/**
+	 * @brief Readings in the block
+	 */
+	uint8_t getCount() const { return HistoryBlock::getCount(block); };
+
+	/**
+	 * @brief Bytes of the block used so far, including the header
+	 */
+	size_t getBytesUsed() const { return HistoryBlock::HEADER_SIZE + (bitPos + 7) / 8; };
+
+protected:
+	void writeBits(uint32_t value, uint8_t bits);
+
+	uint8_t *block = NULL;			//!< The block being written
+	size_t bitPos = 0;				//!< Bits written after the header
+	HistoryReading last;			//!< Last reading added
+	int32_t lastDelta = 0;			//!< Time between the last two readings
+};
+
+/**
+ * @brief Reads the readings back out of a block
+ */
+class HistoryBlockDecoder {
+public:
+	HistoryBlockDecoder(const uint8_t *block);
+
+	/**
+	 * @brief Get the next reading
+	 *
+	 * @return false when there are no more readings (or the block is corrupt)
+	 */
+	bool next(HistoryReading &reading);
+
+	/**
+	 * @brief Bits read from the stream so far
+	 */
+	size_t getBitPos() const { return bitPos; };
+
+protected:
+	bool readBits(uint8_t bits, uint32_t &value);
+
+	const uint8_t *block;			//!< The block being read
+	size_t bitPos = 0;				//!< Bits read after the header
+	uint8_t index = 0;				//!< Readings returned so far
+	HistoryReading last;			//!< Last reading returned
+	int32_t lastDelta = 0;			//!< Time between the last two readings
+};
+
+#endif /* __HISTORYCODEC_H */
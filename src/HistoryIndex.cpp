@@ -0,0 +1,27 @@
+#include "HistoryIndex.h"
+
+// [static]
+uint16_t HistoryIndex::lowerBound(uint16_t count, uint32_t time, TimeAt timeAt, void *context) {
+	uint16_t low = 0;
+	uint16_t high = count;
+
+	while(low < high) {
+		uint16_t mid = low + (high - low) / 2;
+		if (timeAt(mid, context) < time) {
+			low = mid + 1;
+		}
+		else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+// [static]
+uint16_t HistoryIndex::entryFor(uint16_t count, uint32_t time, TimeAt timeAt, void *context) {
+	if (time == UINT32_MAX) {
+		return (count > 0) ? count - 1 : 0;
+	}
+	uint16_t after = lowerBound(count, time + 1, timeAt, context);
+	return (after > 0) ? after - 1 : 0;
+}
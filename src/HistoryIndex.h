@@ -0,0 +1,44 @@
+#ifndef __HISTORYINDEX_H
+#define __HISTORYINDEX_H
+
+#include <stdint.h>
+
+/**
+ * @brief Time lookups in the history rings
+ *
+ * Every tier of the history is a ring in time order, so the entry for a time can be found with a
+ * binary search instead of a scan. For the raw tier the times come from a small index in RAM (the
+ * start time of each compressed block); for the rollups they are read from the records themselves,
+ * so a lookup is a handful of FRAM reads.
+ */
+class HistoryIndex {
+public:
+	/**
+	 * @brief Returns the time of an entry
+	 *
+	 * @param index Entry, counting from the oldest (0) to the newest
+	 *
+	 * @param context Whatever was passed to lowerBound()
+	 */
+	typedef uint32_t (*TimeAt)(uint16_t index, void *context);
+
+	/**
+	 * @brief Find the first entry at or after a time
+	 *
+	 * @param count Entries in the ring
+	 *
+	 * @param time Time to look for
+	 *
+	 * @return The index (counting from the oldest) of the first entry whose time is >= time, or count if there is none
+	 */
+	static uint16_t lowerBound(uint16_t count, uint32_t time, TimeAt timeAt, void *context);
+
+	/**
+	 * @brief Find the entry that holds a time, where each entry starts at its time and runs until the next one
+	 *
+	 * @return The index of the last entry whose time is <= time, or 0 if time is before them all
+	 */
+	static uint16_t entryFor(uint16_t count, uint32_t time, TimeAt timeAt, void *context);
+};
+
+#endif /* __HISTORYINDEX_H */
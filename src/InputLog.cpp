@@ -0,0 +1,255 @@
+#include "InputLog.h"
+
+#include <string.h>
+
+static const uint8_t INLINE_MAX = 31;					// Low 5 bits all set means a varint follows
+
+static uint32_t zigzag(int32_t value) {
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+	return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static const char * const typeNames[] = {"millis", "time", "flag", "number", "real", "text", "mark"};
+static const char * const flagNames[] = {"connected", "time valid", "watchdog", "sensor begin", "registered"};
+static const char * const numberNames[] = {"queued", "sent bytes", "battery state", "reset reason", "free heap", "largest block",
+	"loop headroom", "publish headroom", "stall", "stall state", "stall operation"};
+static const char * const realNames[] = {"temperature", "humidity", "battery", "signal strength", "signal dBm"};
+static const char * const textNames[] = {"webhook", "function", "argument", "iccid"};
+static const char * const markNames[] = {"setup", "loop", "end", "overflow"};
+
+// [static]
+const char *InputLog::typeName(uint8_t type) {
+	return (type < sizeof(typeNames) / sizeof(typeNames[0])) ? typeNames[type] : "?";
+}
+
+// [static]
+const char *InputLog::kindName(uint8_t type, uint8_t kind) {
+	switch (type) {
+	case FLAG:
+		return (kind < FLAG_KIND_COUNT) ? flagNames[kind] : "?";
+	case NUMBER:
+		return (kind < NUMBER_KIND_COUNT) ? numberNames[kind] : "?";
+	case REAL:
+		return (kind < REAL_KIND_COUNT) ? realNames[kind] : "?";
+	case TEXT:
+		return (kind < TEXT_KIND_COUNT) ? textNames[kind] : "?";
+	case MARK:
+		return (kind < MARK_KIND_COUNT) ? markNames[kind] : "?";
+	default:
+		return "";
+	}
+}
+
+void InputLogWriter::begin() {
+	head = count = 0;
+	recorded = lastMillis = lastTime = 0;
+	overflowed = false;
+	recording = true;
+}
+
+void InputLogWriter::end() {
+	if (!recording) return;
+	addMark(InputLog::MARK_END);
+	recording = false;
+}
+
+bool InputLogWriter::reserve(size_t len) {
+	if (!recording) return false;
+	if (count + len + 1 <= size) return true;					// Always leave room for the overflow mark
+
+	recording = false;
+	overflowed = true;
+	put((uint8_t)(InputLog::MARK << 5 | InputLog::MARK_OVERFLOW));
+	return false;
+}
+
+void InputLogWriter::put(uint8_t value) {
+	buf[head] = value;
+	head = (head + 1 == size) ? 0 : head + 1;
+	count++;
+	recorded++;
+}
+
+void InputLogWriter::putVarint(uint32_t value) {
+	while (value >= 0x80) {
+		put((uint8_t)(value | 0x80));
+		value >>= 7;
+	}
+	put((uint8_t)value);
+}
+
+void InputLogWriter::addMillis(uint32_t value) {
+	if (!reserve(6)) return;
+	uint32_t delta = value - lastMillis;
+	lastMillis = value;
+	if (delta < INLINE_MAX) {
+		put((uint8_t)(InputLog::MILLIS << 5 | delta));
+	}
+	else {
+		put((uint8_t)(InputLog::MILLIS << 5 | INLINE_MAX));
+		putVarint(delta);
+	}
+}
+
+void InputLogWriter::addTime(uint32_t value) {
+	if (!reserve(6)) return;
+	uint32_t delta = zigzag((int32_t)(value - lastTime));
+	lastTime = value;
+	if (delta < INLINE_MAX) {
+		put((uint8_t)(InputLog::TIME << 5 | delta));
+	}
+	else {
+		put((uint8_t)(InputLog::TIME << 5 | INLINE_MAX));
+		putVarint(delta);
+	}
+}
+
+void InputLogWriter::addFlag(uint8_t kind, bool value) {
+	if (!reserve(1)) return;
+	put((uint8_t)(InputLog::FLAG << 5 | (kind & 0x0f) << 1 | (value ? 1 : 0)));
+}
+
+void InputLogWriter::addNumber(uint8_t kind, int32_t value) {
+	if (!reserve(6)) return;
+	put((uint8_t)(InputLog::NUMBER << 5 | kind));
+	putVarint(zigzag(value));
+}
+
+void InputLogWriter::addReal(uint8_t kind, float value) {
+	if (!reserve(5)) return;
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	put((uint8_t)(InputLog::REAL << 5 | kind));
+	for (int ii = 0; ii < 4; ii++) put((uint8_t)(bits >> (8 * ii)));
+}
+
+void InputLogWriter::addText(uint8_t kind, const char *text, size_t len) {
+	if (!reserve(len + 6)) return;
+	put((uint8_t)(InputLog::TEXT << 5 | kind));
+	putVarint((uint32_t)len);
+	for (size_t ii = 0; ii < len; ii++) put((uint8_t)text[ii]);
+}
+
+void InputLogWriter::addMark(uint8_t kind) {
+	if (!reserve(1)) return;
+	put((uint8_t)(InputLog::MARK << 5 | kind));
+}
+
+const uint8_t *InputLogWriter::peek(size_t &len) const {
+	size_t tail = (head + size - count) % size;
+	len = (tail + count <= size) ? count : size - tail;		// Up to the end of the ring, the rest comes next time
+	return &buf[tail];
+}
+
+void InputLogWriter::consume(size_t len) {
+	count = (len < count) ? count - len : 0;
+}
+
+// [static]
+size_t InputLogWriter::putMagic(uint8_t *buf) {
+	for (size_t ii = 0; ii < MAGIC_SIZE; ii++) buf[ii] = (uint8_t)(InputLog::MAGIC >> (8 * ii));
+	return MAGIC_SIZE;
+}
+
+// [static]
+size_t InputLogWriter::putSection(uint8_t *buf, uint8_t section, uint32_t len) {
+	size_t used = 0;
+	buf[used++] = section;
+	if (section == InputLog::SECTION_END) return used;
+	while (len >= 0x80) {
+		buf[used++] = (uint8_t)(len | 0x80);
+		len >>= 7;
+	}
+	buf[used++] = (uint8_t)len;
+	return used;
+}
+
+bool InputLogReader::getVarint(uint32_t &value) {
+	value = 0;
+	for (int shift = 0; shift < 35; shift += 7) {
+		if (offset >= len) return false;
+		uint8_t byte = data[offset++];
+		value |= (uint32_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) return true;
+	}
+	return false;
+}
+
+bool InputLogReader::readHeader(void (*section)(uint8_t id, const uint8_t *data, size_t len, void *context), void *context) {
+	offset = 0;
+	if (len < 5) return false;
+	uint32_t magic = (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+	if (magic != InputLog::MAGIC) return false;
+	offset = 4;
+
+	while (offset < len) {
+		uint8_t id = data[offset++];
+		if (id == InputLog::SECTION_END) return true;
+		uint32_t sectionLen;
+		if (!getVarint(sectionLen) || sectionLen > len - offset) return false;
+		if (section) section(id, &data[offset], sectionLen, context);
+		offset += sectionLen;
+	}
+	return false;
+}
+
+bool InputLogReader::next(Record &record) {
+	if (offset >= len) return false;
+	uint8_t tag = data[offset++];
+	uint32_t value = tag & INLINE_MAX;
+
+	memset(&record, 0, sizeof(record));
+	record.type = tag >> 5;
+
+	switch (record.type) {
+	case InputLog::MILLIS:
+		if (value == INLINE_MAX && !getVarint(value)) return false;
+		lastMillis += value;
+		record.value = lastMillis;
+		return true;
+
+	case InputLog::TIME:
+		if (value == INLINE_MAX && !getVarint(value)) return false;
+		lastTime += (uint32_t)unzigzag(value);
+		record.value = lastTime;
+		return true;
+
+	case InputLog::FLAG:
+		record.kind = (uint8_t)(value >> 1);
+		record.value = value & 1;
+		return true;
+
+	case InputLog::NUMBER:
+		record.kind = (uint8_t)value;
+		if (!getVarint(value)) return false;
+		record.number = unzigzag(value);
+		return true;
+
+	case InputLog::REAL: {
+		record.kind = (uint8_t)value;
+		if (len - offset < 4) return false;
+		uint32_t bits = (uint32_t)data[offset] | ((uint32_t)data[offset + 1] << 8) | ((uint32_t)data[offset + 2] << 16) | ((uint32_t)data[offset + 3] << 24);
+		offset += 4;
+		memcpy(&record.real, &bits, sizeof(bits));
+		return true;
+	}
+
+	case InputLog::TEXT:
+		record.kind = (uint8_t)value;
+		if (!getVarint(value) || value > len - offset) return false;
+		record.text = (const char *)&data[offset];
+		record.textLen = value;
+		offset += value;
+		return true;
+
+	case InputLog::MARK:
+		record.kind = (uint8_t)value;
+		return true;
+
+	default:
+		return false;
+	}
+}
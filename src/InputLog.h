@@ -0,0 +1,280 @@
+#ifndef __INPUTLOG_H
+#define __INPUTLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Compact binary log of everything the firmware reads that its own code doesn't decide
+ *
+ * Given the same FRAM and retained RAM to start from and the same inputs in the same order - every
+ * millis() and Time.now(), every sensor reading, every Particle.connected(), what the publish queue
+ * reports back and every cloud function or webhook response - the firmware does exactly the same
+ * thing. Recording those is enough to replay a field problem on a desk.
+ *
+ * The log starts with a header holding the snapshots to start from - the magic number, then each
+ * Section as its id, a varint length and the bytes, ending with SECTION_END - then one
+ * record per input. Each record starts with a byte: the top 3 bits are the Type and the low 5 bits
+ * are the Kind, or for small values the value itself, so most records are a single byte:
+ *
+ * - MILLIS: the change since the last MILLIS, in the low 5 bits if under 31, otherwise a varint follows
+ * - TIME: the change since the last TIME, zigzag - in the low 5 bits if it fits, otherwise a varint follows
+ * - FLAG: low bit is the value, the other 4 bits the FlagKind
+ * - NUMBER: NumberKind, then a zigzag varint
+ * - REAL: RealKind, then the 4 bytes of the float, little endian
+ * - TEXT: TextKind, then a varint length and that many bytes
+ * - MARK: MarkKind
+ *
+ * A varint is 7 bits a byte, least significant first, with the top bit set on all but the last.
+ * The writer buffers into a ring the caller drains (to USB serial on the device) and stops with an
+ * OVERFLOW mark if the ring fills, since a log with a hole in it can't be replayed.
+ */
+class InputLog {
+public:
+	static const uint32_t MAGIC = 0x31524656;			//!< "VFR1" - first 4 bytes of a log, little endian
+
+	enum Type : uint8_t {
+		MILLIS = 0,
+		TIME,
+		FLAG,
+		NUMBER,
+		REAL,
+		TEXT,
+		MARK
+	};
+
+	enum FlagKind : uint8_t {
+		FLAG_CONNECTED = 0,			//!< Particle.connected()
+		FLAG_TIME_VALID,			//!< Time.isValid()
+		FLAG_WATCHDOG,				//!< The watchdog interrupt has asked for a pet
+		FLAG_SENSOR_BEGIN,			//!< The sensor started
+		FLAG_REGISTERED,			//!< Cellular.ready()
+		FLAG_KIND_COUNT
+	};
+
+	enum NumberKind : uint8_t {
+		NUMBER_QUEUED = 0,			//!< Events in the publish queue
+		NUMBER_SENT_BYTES,			//!< Bytes the publish queue has sent
+		NUMBER_BATTERY_STATE,		//!< System.batteryState()
+		NUMBER_RESET_REASON,		//!< System.resetReason()
+		NUMBER_FREE_HEAP,			//!< Free heap
+		NUMBER_LARGEST_BLOCK,		//!< Largest free block of heap
+		NUMBER_LOOP_HEADROOM,		//!< Loop thread stack never used
+		NUMBER_PUBLISH_HEADROOM,	//!< Publish thread stack never used
+		NUMBER_STALL,				//!< A stall the loop recovered from (ms) - 0 for none, then its state and operation
+		NUMBER_STALL_STATE,
+		NUMBER_STALL_OPERATION,
+		NUMBER_KIND_COUNT
+	};
+
+	enum RealKind : uint8_t {
+		REAL_TEMPERATURE = 0,		//!< Sensor temperature (C)
+		REAL_HUMIDITY,				//!< Sensor humidity (%)
+		REAL_BATTERY,				//!< System.batteryCharge()
+		REAL_SIGNAL_STRENGTH,		//!< Signal strength (%)
+		REAL_SIGNAL_DBM,			//!< Signal strength (dBm)
+		REAL_KIND_COUNT
+	};
+
+	enum TextKind : uint8_t {
+		TEXT_WEBHOOK = 0,			//!< A webhook response - the data
+		TEXT_FUNCTION,				//!< A cloud function was called - its name, with the argument in the TEXT_ARGUMENT that follows
+		TEXT_ARGUMENT,
+		TEXT_ICCID,					//!< The SIM's ICCID
+		TEXT_KIND_COUNT
+	};
+
+	enum MarkKind : uint8_t {
+		MARK_SETUP = 0,				//!< setup() is starting
+		MARK_LOOP,					//!< loop() is starting
+		MARK_END,					//!< Recording was stopped
+		MARK_OVERFLOW,				//!< The ring filled - nothing after this was recorded
+		MARK_KIND_COUNT
+	};
+
+	/**
+	 * @brief Sections of the header - each is a snapshot of something the firmware starts from
+	 */
+	enum Section : uint8_t {
+		SECTION_END = 0,			//!< No more sections - the records follow
+		SECTION_FRAM,				//!< The whole FRAM
+		SECTION_PUBLISH_QUEUE,		//!< The retained publish queue buffer
+		SECTION_STALL_RECORD,		//!< The retained stall monitor record
+		SECTION_TRACE_RING			//!< The retained trace ring
+	};
+
+	/**
+	 * @brief Printable names, for a dump of the log
+	 */
+	static const char *typeName(uint8_t type);
+	static const char *kindName(uint8_t type, uint8_t kind);
+};
+
+/**
+ * @brief Encodes inputs into a ring the caller drains
+ *
+ * Only safe from one thread - on the device, everything that is recorded happens on the application thread.
+ */
+class InputLogWriter {
+public:
+	/**
+	 * @brief Construct a writer
+	 *
+	 * @param buf The ring
+	 *
+	 * @param size Size of the ring - it needs to hold everything recorded between two calls to drain it
+	 */
+	InputLogWriter(uint8_t *buf, size_t size) : buf(buf), size(size) {};
+
+	/**
+	 * @brief Empty the ring and start recording
+	 */
+	void begin();
+
+	/**
+	 * @brief Add a MARK_END and stop recording - drain what is left after this
+	 */
+	void end();
+
+	/**
+	 * @brief True while recording - false before begin(), after end() or once the ring overflowed
+	 */
+	bool isRecording() const { return recording; };
+
+	/**
+	 * @brief True if recording stopped because the ring filled
+	 */
+	bool hasOverflowed() const { return overflowed; };
+
+	void addMillis(uint32_t value);
+	void addTime(uint32_t value);
+	void addFlag(uint8_t kind, bool value);
+	void addNumber(uint8_t kind, int32_t value);
+	void addReal(uint8_t kind, float value);
+	void addText(uint8_t kind, const char *text, size_t len);
+	void addMark(uint8_t kind);
+
+	/**
+	 * @brief The oldest bytes waiting to be drained, in one piece
+	 *
+	 * @param len Set to how many there are - there may be more after calling consume()
+	 */
+	const uint8_t *peek(size_t &len) const;
+
+	/**
+	 * @brief Drop bytes that have been sent
+	 */
+	void consume(size_t len);
+
+	/**
+	 * @brief Bytes waiting to be drained
+	 */
+	size_t getPending() const { return count; };
+
+	/**
+	 * @brief Bytes recorded since begin()
+	 */
+	uint32_t getRecorded() const { return recorded; };
+
+	static const size_t MAGIC_SIZE = 4;
+	static const size_t SECTION_SIZE_MAX = 6;		//!< Most putSection() will write
+
+	/**
+	 * @brief Encode the magic number that starts a log
+	 *
+	 * @param buf At least MAGIC_SIZE bytes
+	 *
+	 * @return Bytes written
+	 */
+	static size_t putMagic(uint8_t *buf);
+
+	/**
+	 * @brief Encode the start of a header section - its len bytes follow
+	 *
+	 * @param buf At least SECTION_SIZE_MAX bytes
+	 *
+	 * @param section InputLog::Section - SECTION_END ends the header and has no length
+	 *
+	 * @param len Bytes in the section
+	 *
+	 * @return Bytes written
+	 */
+	static size_t putSection(uint8_t *buf, uint8_t section, uint32_t len);
+
+protected:
+	bool reserve(size_t len);
+	void put(uint8_t value);
+	void putVarint(uint32_t value);
+
+	uint8_t *buf;
+	size_t size;
+	size_t head = 0;				//!< Where the next byte goes
+	size_t count = 0;				//!< Bytes waiting
+	uint32_t recorded = 0;
+	uint32_t lastMillis = 0;
+	uint32_t lastTime = 0;
+	bool recording = false;
+	bool overflowed = false;
+};
+
+/**
+ * @brief Decodes a log, one record at a time
+ */
+class InputLogReader {
+public:
+	/**
+	 * @brief One input
+	 */
+	struct Record {
+		uint8_t type;				//!< InputLog::Type
+		uint8_t kind;				//!< Kind for the type - 0 for MILLIS and TIME
+		uint32_t value;				//!< MILLIS and TIME - the value itself, not the change. FLAG - 0 or 1.
+		int32_t number;				//!< NUMBER
+		float real;					//!< REAL
+		const char *text;			//!< TEXT - not null terminated
+		size_t textLen;
+	};
+
+	/**
+	 * @brief Construct a reader
+	 *
+	 * @param data The whole log, header included
+	 *
+	 * @param len Its length
+	 */
+	InputLogReader(const uint8_t *data, size_t len) : data(data), len(len) {};
+
+	/**
+	 * @brief Check the magic number and read the header sections
+	 *
+	 * @param section Called for each section with its id, data and length
+	 *
+	 * @param context Passed to section
+	 *
+	 * @return false if this isn't a log or the header is cut short
+	 */
+	bool readHeader(void (*section)(uint8_t id, const uint8_t *data, size_t len, void *context), void *context);
+
+	/**
+	 * @brief The next record
+	 *
+	 * @return false at the end of the log or if it is cut short
+	 */
+	bool next(Record &record);
+
+	/**
+	 * @brief Bytes read so far
+	 */
+	size_t getOffset() const { return offset; };
+
+protected:
+	bool getVarint(uint32_t &value);
+
+	const uint8_t *data;
+	size_t len;
+	size_t offset = 0;
+	uint32_t lastMillis = 0;
+	uint32_t lastTime = 0;
+};
+
+#endif /* __INPUTLOG_H */
@@ -0,0 +1,250 @@
+#include "ParticleHal.h"
+
+#include "adafruit-sht31.h"
+#include "MB85RC256V-FRAM-RK.h"
+#include "MCP79410RK.h"
+#include "PublishQueueAsyncRK.h"
+
+static_assert(HalSystem::RESET_PIN == RESET_REASON_PIN_RESET, "HalSystem reset reasons are System.resetReason() values");
+static_assert(HalSystem::RESET_WATCHDOG == RESET_REASON_WATCHDOG, "HalSystem reset reasons are System.resetReason() values");
+
+uint32_t ParticleClock::millis() {
+	uint32_t value = ::millis();
+	inputLog.addMillis(value);
+	return value;
+}
+
+uint32_t ParticleClock::now() {
+	uint32_t value = Time.now();
+	inputLog.addTime(value);
+	return value;
+}
+
+bool ParticleClock::isValid() {
+	bool value = Time.isValid();
+	inputLog.addFlag(InputLog::FLAG_TIME_VALID, value);
+	return value;
+}
+
+void ParticleClock::delay(uint32_t ms) {
+	::delay(ms);
+}
+
+void ParticleClock::begin() {
+	rtc.setup();													// Start the real time clock
+	rtc.clearAlarm();												// Ensures alarm is still not set from last cycle
+}
+
+void ParticleClock::loop() {
+	rtc.loop();
+}
+
+bool ParticleSensor::begin() {
+	bool value = sht31.begin(SHT31_ADDR);
+	inputLog.addFlag(InputLog::FLAG_SENSOR_BEGIN, value);
+	return value;
+}
+
+float ParticleSensor::readTemperature() {
+	float value = sht31.readTemperature();
+	inputLog.addReal(InputLog::REAL_TEMPERATURE, value);
+	return value;
+}
+
+float ParticleSensor::readHumidity() {
+	float value = sht31.readHumidity();
+	inputLog.addReal(InputLog::REAL_HUMIDITY, value);
+	return value;
+}
+
+float ParticleSensor::batteryCharge() {
+	float value = System.batteryCharge();
+	inputLog.addReal(InputLog::REAL_BATTERY, value);
+	return value;
+}
+
+int ParticleSensor::batteryState() {
+	int value = System.batteryState();
+	inputLog.addNumber(InputLog::NUMBER_BATTERY_STATE, value);
+	return value;
+}
+
+void ParticleStore::begin() {
+	fram.begin();
+}
+
+size_t ParticleStore::length() {
+	return fram.length();
+}
+
+bool ParticleStore::erase() {
+	return fram.erase();
+}
+
+bool ParticleStore::readData(size_t addr, uint8_t *data, size_t len) {
+	return fram.readData(addr, data, len);
+}
+
+bool ParticleStore::writeData(size_t addr, const uint8_t *data, size_t len) {
+	return fram.writeData(addr, data, len);
+}
+
+bool ParticleCloud::connected() {
+	bool value = Particle.connected();
+	inputLog.addFlag(InputLog::FLAG_CONNECTED, value);
+	return value;
+}
+
+bool ParticleCloud::registered() {
+	bool value = Cellular.ready();
+	inputLog.addFlag(InputLog::FLAG_REGISTERED, value);
+	return value;
+}
+
+void ParticleCloud::connect() {
+	Particle.connect();
+}
+
+void ParticleCloud::waitConnected(uint32_t timeout) {
+	waitFor(Particle.connected, timeout);
+}
+
+void ParticleCloud::disconnect() {
+	Particle.disconnect();
+	Cellular.off();
+}
+
+void ParticleCloud::keepAlive(int seconds) {
+	Particle.keepAlive(seconds);
+}
+
+void ParticleCloud::syncTime() {
+	Particle.syncTime();
+}
+
+bool ParticleCloud::publish(const char *name, const char *data, Priority priority) {
+	return publishQueue.publish(name, data, (PublishQueuePriority)priority, PRIVATE);	// The lanes are numbered the same
+}
+
+uint16_t ParticleCloud::queuedEvents() {
+	uint16_t value = publishQueue.getNumEvents();					// The publish thread changes this - it is an input to the loop
+	inputLog.addNumber(InputLog::NUMBER_QUEUED, value);
+	return value;
+}
+
+uint32_t ParticleCloud::sentBytes() {
+	uint32_t value = publishQueue.getSentBytes();
+	inputLog.addNumber(InputLog::NUMBER_SENT_BYTES, (int32_t)value);
+	return value;
+}
+
+void ParticleCloud::pausePublishing(bool pause) {
+	publishQueue.setPausePublishing(pause);
+}
+
+size_t ParticleCloud::publishStackHeadroom() {
+	size_t value = publishQueue.getThreadStackHeadroom();
+	inputLog.addNumber(InputLog::NUMBER_PUBLISH_HEADROOM, value);
+	return value;
+}
+
+void ParticleCloud::signal(float &strength, float &dBm) {
+	CellularSignal sig = Cellular.RSSI();
+	strength = sig.getStrength();
+	dBm = sig.getStrengthValue();
+	inputLog.addReal(InputLog::REAL_SIGNAL_STRENGTH, strength);
+	inputLog.addReal(InputLog::REAL_SIGNAL_DBM, dBm);
+}
+
+void ParticleCloud::simId(char *iccid, size_t size) {
+	CellularDevice device;
+	memset(&device, 0, sizeof(device));
+	device.size = sizeof(device);
+	cellular_device_info(&device, NULL);
+	size_t len = strnlen(device.iccid, sizeof(device.iccid));
+	if (size) {
+		if (len >= size) len = size - 1;
+		memcpy(iccid, device.iccid, len);
+		iccid[len] = 0;
+	}
+	inputLog.addText(InputLog::TEXT_ICCID, iccid, len);
+}
+
+const pin_t ParticleGpio::pins[3] = {D7, D8, D5};
+
+void ParticleGpio::pinMode(Pin pin, bool output) {
+	::pinMode(pins[pin], (output) ? OUTPUT : INPUT);
+}
+
+void ParticleGpio::digitalWrite(Pin pin, bool high) {
+	::digitalWrite(pins[pin], (high) ? HIGH : LOW);
+}
+
+bool ParticleGpio::digitalRead(Pin pin) {
+	return ::digitalRead(pins[pin]) == HIGH;
+}
+
+void ParticleGpio::attachWakeInterrupt() {
+	attachInterrupt(pins[WAKE_PIN], wakeHandler, RISING);
+}
+
+int ParticleSystem::resetReason() {
+	int value = System.resetReason();
+	inputLog.addNumber(InputLog::NUMBER_RESET_REASON, value);
+	return value;
+}
+
+void ParticleSystem::reset() {
+	System.reset();
+}
+
+void ParticleSystem::heapInfo(uint32_t &freeHeap, uint32_t &largestBlock) {
+	runtime_info_t info;
+	memset(&info, 0, sizeof(info));
+	info.size = sizeof(info);
+	HAL_Core_Runtime_Info(&info, NULL);
+	freeHeap = info.freeheap;
+	largestBlock = info.largest_free_block_heap;
+	inputLog.addNumber(InputLog::NUMBER_FREE_HEAP, freeHeap);
+	inputLog.addNumber(InputLog::NUMBER_LARGEST_BLOCK, largestBlock);
+}
+
+size_t ParticleSystem::loopStackHeadroom() {
+	size_t value = loopStack.getHeadroom();
+	inputLog.addNumber(InputLog::NUMBER_LOOP_HEADROOM, value);
+	return value;
+}
+
+bool ParticleSystem::consoleAvailable() {
+	return !inputLog.isRecording();
+}
+
+void ParticleSystem::writeConsole(const char *prefix, const char *text) {
+	Serial.print(prefix);
+	Serial.println(text);
+}
+
+size_t ParticleSystem::consoleRead(uint8_t *buf, size_t len) {
+	size_t count = 0;
+	while (count < len && Serial.available() > 0) buf[count++] = (uint8_t)Serial.read();
+	return count;
+}
+
+size_t ParticleSystem::consoleWrite(const uint8_t *buf, size_t len) {
+	int room = Serial.availableForWrite();
+	if (room <= 0) return 0;
+	return Serial.write(buf, ((size_t)room < len) ? (size_t)room : len);
+}
+
+bool ParticleSystem::watchdogRequested(bool requested) {
+	inputLog.addFlag(InputLog::FLAG_WATCHDOG, requested);
+	return requested;
+}
+
+bool ParticleSystem::stallRecovered(bool recovered, uint32_t &duration, uint8_t &state, uint8_t &operation) {
+	inputLog.addNumber(InputLog::NUMBER_STALL, (recovered) ? duration : 0);
+	if (!recovered) return false;
+	inputLog.addNumber(InputLog::NUMBER_STALL_STATE, state);
+	inputLog.addNumber(InputLog::NUMBER_STALL_OPERATION, operation);
+	return true;
+}
@@ -0,0 +1,157 @@
+#ifndef __PARTICLEHAL_H
+#define __PARTICLEHAL_H
+
+#include "Particle.h"
+
+#include "Hal.h"
+#include "InputLog.h"
+#include "StackMonitor.h"
+
+class Adafruit_SHT31;										// The libraries are only needed in ParticleHal.cpp - adafruit-sht31.h has no include guard
+class MB85RC;
+class MCP79410;
+class PublishQueueAsync;
+
+/**
+ * @brief The interfaces in Hal.h on Device OS
+ *
+ * Each call does what the firmware used to do inline. Everything the firmware reads that its own code
+ * doesn't decide is also added to the input log (InputLog.h) - the writer ignores it unless the Input-Record
+ * function has it recording - so a replay on a desk (host/replay.cpp) gets the same values in the same order.
+ * The FRAM isn't logged: the log starts with a copy of it.
+ */
+
+/**
+ * @brief millis(), Time and the MCP79410
+ */
+class ParticleClock : public HalClock {
+public:
+	ParticleClock(MCP79410 &rtc, InputLogWriter &inputLog) : rtc(rtc), inputLog(inputLog) {};
+
+	virtual uint32_t millis();
+	virtual uint32_t now();
+	virtual bool isValid();
+	virtual void delay(uint32_t ms);
+	virtual void begin();
+	virtual void loop();
+
+protected:
+	MCP79410 &rtc;
+	InputLogWriter &inputLog;
+};
+
+/**
+ * @brief The SHT31 and the fuel gauge
+ */
+class ParticleSensor : public HalSensor {
+public:
+	ParticleSensor(Adafruit_SHT31 &sht31, InputLogWriter &inputLog) : sht31(sht31), inputLog(inputLog) {};
+
+	virtual bool begin();
+	virtual float readTemperature();
+	virtual float readHumidity();
+	virtual float batteryCharge();
+	virtual int batteryState();
+
+	static const uint8_t SHT31_ADDR = 0x44;
+
+protected:
+	Adafruit_SHT31 &sht31;
+	InputLogWriter &inputLog;
+};
+
+/**
+ * @brief The FRAM
+ */
+class ParticleStore : public HalStore {
+public:
+	ParticleStore(MB85RC &fram) : fram(fram) {};
+
+	virtual void begin();
+	virtual size_t length();
+	virtual bool erase();
+	virtual bool readData(size_t addr, uint8_t *data, size_t len);
+	virtual bool writeData(size_t addr, const uint8_t *data, size_t len);
+
+protected:
+	MB85RC &fram;
+};
+
+/**
+ * @brief The Particle cloud, the cellular modem and the publish queue
+ */
+class ParticleCloud : public HalCloud {
+public:
+	ParticleCloud(PublishQueueAsync &publishQueue, InputLogWriter &inputLog) : publishQueue(publishQueue), inputLog(inputLog) {};
+
+	virtual bool connected();
+	virtual bool registered();
+	virtual void connect();
+	virtual void waitConnected(uint32_t timeout);
+	virtual void disconnect();
+	virtual void keepAlive(int seconds);
+	virtual void syncTime();
+
+	virtual bool publish(const char *name, const char *data, Priority priority = PRIORITY_NORMAL);
+	virtual uint16_t queuedEvents();
+	virtual uint32_t sentBytes();
+	virtual void pausePublishing(bool pause);
+	virtual size_t publishStackHeadroom();
+
+	virtual void signal(float &strength, float &dBm);
+	virtual void simId(char *iccid, size_t size);
+
+protected:
+	PublishQueueAsync &publishQueue;
+	InputLogWriter &inputLog;
+};
+
+/**
+ * @brief The pins on the carrier board
+ */
+class ParticleGpio : public HalGpio {
+public:
+	/**
+	 * @brief Construct the pins
+	 *
+	 * @param wakeHandler Called from the interrupt on a rising edge of WAKE_PIN, once attachWakeInterrupt() is called
+	 */
+	ParticleGpio(void (*wakeHandler)()) : wakeHandler(wakeHandler) {};
+
+	virtual void pinMode(Pin pin, bool output);
+	virtual void digitalWrite(Pin pin, bool high);
+	virtual bool digitalRead(Pin pin);
+	virtual void attachWakeInterrupt();
+
+	static const pin_t pins[3];				//!< By Pin - the blue LED (D7), the watchdog wake (D8) and done (D5)
+
+protected:
+	void (*wakeHandler)();
+};
+
+/**
+ * @brief System, heap and stack, and the USB serial port
+ */
+class ParticleSystem : public HalSystem {
+public:
+	ParticleSystem(StackMonitor &loopStack, InputLogWriter &inputLog) : loopStack(loopStack), inputLog(inputLog) {};
+
+	virtual int resetReason();
+	virtual void reset();
+	virtual void heapInfo(uint32_t &freeHeap, uint32_t &largestBlock);
+	virtual size_t loopStackHeadroom();
+
+	virtual bool consoleAvailable();						//!< Not while the input log is being streamed out of it
+	virtual void writeConsole(const char *prefix, const char *text);
+	virtual size_t consoleRead(uint8_t *buf, size_t len);	//!< Not logged - only used while the input log isn't recording
+	virtual size_t consoleWrite(const uint8_t *buf, size_t len);
+
+	virtual bool watchdogRequested(bool requested);
+	virtual bool stallRecovered(bool recovered, uint32_t &duration, uint8_t &state, uint8_t &operation);
+
+protected:
+	StackMonitor &loopStack;
+	InputLogWriter &inputLog;
+};
+
+#endif /* __PARTICLEHAL_H */
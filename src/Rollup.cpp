@@ -0,0 +1,86 @@
+#include "Rollup.h"
+
+#include <math.h>
+#include <string.h>
+
+static const float activationOverR = 10000.0;		// dH/R in kelvin - 83.144 kJ/mol / 8.3144 J/mol/K
+static const float zeroC = 273.15;
+
+static uint8_t toPercent(int32_t tenths) {
+	if (tenths < 0) return 0;
+	if (tenths > 1000) return 100;
+	return (uint8_t)((tenths + 5) / 10);
+}
+
+void RollupAccumulator::begin(uint32_t startTime) {
+	memset(&state, 0, sizeof(state));
+	state.startTime = startTime;
+}
+
+void RollupAccumulator::add(const HistoryReading &reading) {
+	if (state.count == 0 || reading.temperature < state.minTemperature) {
+		state.minTemperature = reading.temperature;
+	}
+	if (state.count == 0 || reading.temperature > state.maxTemperature) {
+		state.maxTemperature = reading.temperature;
+	}
+	if (state.count == 0 || reading.humidity < state.minHumidity) {
+		state.minHumidity = reading.humidity;
+	}
+	if (state.count == 0 || reading.humidity > state.maxHumidity) {
+		state.maxHumidity = reading.humidity;
+	}
+	state.sumTemperature += reading.temperature;
+	state.sumHumidity += reading.humidity;
+
+	float kelvin = reading.temperature / 10.0f + zeroC;
+	state.sumArrhenius += expf(activationOverR * (1.0f / zeroC - 1.0f / kelvin));
+
+	if (state.count < UINT16_MAX) {
+		state.count++;
+	}
+}
+
+void RollupAccumulator::add(const RollupRecord &record) {
+	if (record.count == 0) {
+		return;
+	}
+	if (state.count == 0 || record.minTemperature < state.minTemperature) {
+		state.minTemperature = record.minTemperature;
+	}
+	if (state.count == 0 || record.maxTemperature > state.maxTemperature) {
+		state.maxTemperature = record.maxTemperature;
+	}
+	if (state.count == 0 || record.minHumidity * 10 < state.minHumidity) {
+		state.minHumidity = record.minHumidity * 10;
+	}
+	if (state.count == 0 || record.maxHumidity * 10 > state.maxHumidity) {
+		state.maxHumidity = record.maxHumidity * 10;
+	}
+	state.sumTemperature += (int32_t)record.meanTemperature * record.count;
+	state.sumHumidity += (int32_t)record.meanHumidity * 10 * record.count;
+
+	float kelvin = record.mktTemperature / 10.0f + zeroC;
+	state.sumArrhenius += record.count * expf(activationOverR * (1.0f / zeroC - 1.0f / kelvin));
+
+	state.count = (state.count > UINT16_MAX - record.count) ? UINT16_MAX : state.count + record.count;
+}
+
+void RollupAccumulator::finish(RollupRecord &record) const {
+	memset(&record, 0, sizeof(record));
+	record.startTime = state.startTime;
+	if (state.count == 0) {
+		return;
+	}
+	record.minTemperature = state.minTemperature;
+	record.maxTemperature = state.maxTemperature;
+	record.meanTemperature = (int16_t)lroundf((float)state.sumTemperature / state.count);
+
+	float kelvin = activationOverR / (activationOverR / zeroC - logf(state.sumArrhenius / state.count));
+	record.mktTemperature = (int16_t)lroundf((kelvin - zeroC) * 10);
+
+	record.minHumidity = toPercent(state.minHumidity);
+	record.maxHumidity = toPercent(state.maxHumidity);
+	record.meanHumidity = toPercent(lroundf((float)state.sumHumidity / state.count));
+	record.count = (state.count > 255) ? 255 : state.count;
+}
@@ -0,0 +1,90 @@
+#ifndef __ROLLUP_H
+#define __ROLLUP_H
+
+#include <stdint.h>
+
+#include "HistoryCodec.h"
+
+/**
+ * @brief Summary of the readings over an hour or a day
+ *
+ * 16 bytes so a long run of them fits in FRAM. Temperatures are in tenths of a degree C and
+ * humidity in whole percent RH.
+ */
+struct RollupRecord {
+	uint32_t startTime;				//!< Start of the period
+	int16_t minTemperature;
+	int16_t maxTemperature;
+	int16_t meanTemperature;
+	int16_t mktTemperature;			//!< Mean kinetic temperature - what cold chain audits ask for
+	uint8_t minHumidity;
+	uint8_t maxHumidity;
+	uint8_t meanHumidity;
+	uint8_t count;					//!< Readings in the period (stops at 255)
+};
+
+/**
+ * @brief Builds a RollupRecord one reading at a time
+ *
+ * Only running totals are kept, so adding a reading never looks back at earlier ones and the raw
+ * readings can be thrown away as soon as they are added. The mean kinetic temperature uses the
+ * usual activation energy of 83.144 kJ/mol; each reading adds its Arrhenius factor relative to
+ * 0 C, which keeps the sum in a comfortable range for a float.
+ */
+class RollupAccumulator {
+public:
+	/**
+	 * @brief Running totals - a plain structure so it can be saved as is
+	 */
+	struct State {
+		uint32_t startTime;			//!< Start of the period
+		int32_t sumTemperature;		//!< Tenths of a degree C
+		int32_t sumHumidity;		//!< Tenths of a percent RH
+		float sumArrhenius;			//!< Sum of exp(dH/R * (1/273.15 - 1/T))
+		int16_t minTemperature;
+		int16_t maxTemperature;
+		int16_t minHumidity;
+		int16_t maxHumidity;
+		uint16_t count;				//!< 0 if nothing has been added
+		uint16_t reserved;
+	};
+
+	/**
+	 * @brief Start a new period with no readings
+	 */
+	void begin(uint32_t startTime);
+
+	/**
+	 * @brief Add a reading to the period
+	 */
+	void add(const HistoryReading &reading);
+
+	/**
+	 * @brief Add a whole period that has already been summarised, for example to summarise several hours
+	 *
+	 * The mean kinetic temperature stays exact as each record's MKT stands for the Arrhenius factors of its readings.
+	 */
+	void add(const RollupRecord &record);
+
+	/**
+	 * @brief True if no readings have been added since begin()
+	 */
+	bool isEmpty() const { return state.count == 0; };
+
+	/**
+	 * @brief Start of the current period
+	 */
+	uint32_t getStartTime() const { return state.startTime; };
+
+	/**
+	 * @brief Summarise the period so far
+	 */
+	void finish(RollupRecord &record) const;
+
+	/**
+	 * @brief The running totals, to save and restore across a reset
+	 */
+	State state;
+};
+
+#endif /* __ROLLUP_H */
@@ -0,0 +1,29 @@
+#include "StackMonitor.h"
+
+void StackMonitor::paint(size_t stackSize, size_t reserve) {
+	this->stackSize = stackSize;
+	if (stackSize <= reserve + GUARD) {
+		return;
+	}
+
+	uint32_t marker = 0;
+	uintptr_t paintTop = ((uintptr_t)&marker - GUARD) & ~(uintptr_t)3;
+	uintptr_t paintBottom = ((uintptr_t)&marker - (stackSize - reserve) + 3) & ~(uintptr_t)3;
+
+	// A plain loop rather than memset, which would put its own frame in the middle of what we're painting
+	for(volatile uint32_t *p = (volatile uint32_t *)paintBottom; p < (volatile uint32_t *)paintTop; p++) {
+		*p = PAINT;
+	}
+	top = (volatile uint32_t *)paintTop;
+	bottom = (volatile uint32_t *)paintBottom;
+}
+
+size_t StackMonitor::getHeadroom() const {
+	size_t headroom = 0;
+	if (bottom) {
+		for(volatile uint32_t *p = bottom; p < top && *p == PAINT; p++) {
+			headroom += sizeof(uint32_t);
+		}
+	}
+	return headroom;
+}
@@ -0,0 +1,52 @@
+#ifndef __STACKMONITOR_H
+#define __STACKMONITOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Stack high water measurement for a thread
+ *
+ * paint() fills the unused part of the calling thread's stack with a known pattern. Later,
+ * getHeadroom() counts how much of the pattern is left at the bottom of the stack - the part
+ * that has never been used. A stack overflow on Device OS shows up as a random hard fault, so
+ * watching the headroom is the way to size a stack without guessing.
+ *
+ * The stack grows down and its base address isn't available to the application, so paint()
+ * works from the current stack pointer: it assumes no more than reserve bytes are in use when it
+ * is called and paints the rest. Call it as early in the thread as you can.
+ */
+class StackMonitor {
+public:
+	/**
+	 * @brief Paint the unused part of the calling thread's stack
+	 *
+	 * @param stackSize Size of the thread's stack in bytes
+	 *
+	 * @param reserve The most the thread can have used when this is called. Too small and the paint
+	 * runs off the bottom of the stack, so be generous.
+	 */
+	void paint(size_t stackSize, size_t reserve);
+
+	/**
+	 * @brief Bytes at the bottom of the stack that have never been used (0 if not painted)
+	 *
+	 * This is a lower bound, since the reserve at the top isn't painted.
+	 */
+	size_t getHeadroom() const;
+
+	/**
+	 * @brief Size passed to paint()
+	 */
+	size_t getStackSize() const { return stackSize; };
+
+	static const uint32_t PAINT = 0xa5a5a5a5;		//!< Pattern painted on the unused stack
+	static const size_t GUARD = 64;					//!< Left unpainted below paint()'s own frame
+
+protected:
+	volatile uint32_t *bottom = NULL;				//!< Lowest painted word
+	volatile uint32_t *top = NULL;					//!< Word after the highest painted word
+	size_t stackSize = 0;
+};
+
+#endif /* __STACKMONITOR_H */
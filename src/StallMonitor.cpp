@@ -0,0 +1,86 @@
+#include "StallMonitor.h"
+
+#include <string.h>
+
+void StallMonitor::clear(uint32_t nowMillis) {
+	memset(&record, 0, sizeof(record));
+	record.loopMillis = record.checkMillis = nowMillis;
+	record.magic = MAGIC;
+	recoveredDuration = 0;
+}
+
+void StallMonitor::loopRan(uint32_t nowMillis, uint32_t nowTime, uint8_t state) {
+	record.loopMillis = nowMillis;
+
+	if (record.stallMillis) {
+		// Back from a stall - it is only reported once the loop can publish again
+		uint32_t duration = nowMillis - record.stallMillis;
+		if (duration > record.longestStall) record.longestStall = duration;
+		recoveredDuration = (duration) ? duration : 1;
+		recoveredState = record.stallState;
+		recoveredOperation = record.stallOperation;
+		record.stallMillis = 0;
+	}
+
+	if (record.count && state == record.state) return;
+
+	Entry &entry = record.entries[record.next];
+	entry.millis = nowMillis;
+	entry.state = state;
+	entry.operation = record.operation;
+	entry.reserved = 0;
+	record.next = (record.next + 1) % HISTORY;
+	if (record.count < HISTORY) record.count++;
+	record.state = state;
+	record.loopTime = nowTime;
+}
+
+void StallMonitor::watchdogRequested(uint32_t nowMillis) {
+	if (!record.requestMillis) record.requestMillis = (nowMillis) ? nowMillis : 1;
+}
+
+uint32_t StallMonitor::watchdogPetted(uint32_t nowMillis) {
+	if (!record.requestMillis) return 0;
+	uint32_t gap = nowMillis - record.requestMillis;
+	if (gap > record.longestPetGap) record.longestPetGap = gap;
+	record.requestMillis = 0;
+	return gap;
+}
+
+void StallMonitor::check(uint32_t nowMillis) {
+	record.checkMillis = nowMillis;
+	if (record.stallMillis) return;
+
+	// Whichever is older - the last loop pass or an unanswered watchdog - is when the stall began
+	uint32_t since = 0;
+	if (nowMillis - record.loopMillis > stallLimit) since = record.loopMillis;
+	if (record.requestMillis && nowMillis - record.requestMillis > stallLimit) {
+		if (!since || (int32_t)(record.requestMillis - since) < 0) since = record.requestMillis;
+	}
+	if (!since) return;
+
+	record.stallState = record.state;
+	record.stallOperation = record.operation;
+	if (record.stalls < UINT16_MAX) record.stalls++;
+	record.stallMillis = since;
+}
+
+bool StallMonitor::takeRecovery(uint32_t &duration, uint8_t &state, uint8_t &operation) {
+	if (!recoveredDuration) return false;
+	duration = recoveredDuration;
+	state = recoveredState;
+	operation = recoveredOperation;
+	recoveredDuration = 0;
+	return true;
+}
+
+const StallMonitor::Entry &StallMonitor::getEntry(uint8_t n) const {
+	uint8_t oldest = (record.count < HISTORY) ? 0 : record.next;
+	return record.entries[(oldest + n) % HISTORY];
+}
+
+// [static]
+const char *StallMonitor::operationName(uint8_t operation) {
+	static const char *names[OP_COUNT] = {"loop", "i2c", "publish", "cellular", "sleep", "serial"};
+	return (operation < OP_COUNT) ? names[operation] : "?";
+}
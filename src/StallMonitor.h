@@ -0,0 +1,198 @@
+#ifndef __STALLMONITOR_H
+#define __STALLMONITOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Records what the loop was doing so a watchdog reset can be explained afterwards
+ *
+ * The external watchdog resets the device when the loop stops petting it, and the reset wipes
+ * everything that would say why. This keeps a small record in retained RAM, which survives a
+ * reset (but not a power cycle):
+ *
+ * - The last HISTORY state changes of the loop, with the millis() of each
+ * - The operation that might block (I2C, publish, cellular, sleep) the loop is in right now
+ * - When the watchdog last asked to be petted and the longest it has waited for it
+ * - Any stall - a loop pass or a pet that is overdue - seen by check(), which is meant to be
+ *   called from a software timer so it keeps running while the loop is stuck
+ *
+ * The record is owned by the caller so it can be declared retained. Nothing here depends on the
+ * platform - the caller passes in millis().
+ */
+class StallMonitor {
+public:
+	/**
+	 * @brief Operations the loop can block in
+	 */
+	enum Operation : uint8_t {
+		OP_LOOP = 0,			//!< Nothing in particular
+		OP_I2C,					//!< Sensor, FRAM or clock
+		OP_PUBLISH,				//!< Adding to the publish queue
+		OP_CELLULAR,			//!< Modem commands - signal strength, SIM details, waiting to connect
+		OP_SLEEP,				//!< Delay or sleep
+		OP_SERIAL,				//!< Bulk dump over the USB serial port
+		OP_COUNT
+	};
+
+	static const uint8_t HISTORY = 16;					//!< State changes kept in the record
+	static const uint32_t MAGIC = 0x53544c31;			//!< "STL1" - a valid record (retained RAM is random after power up)
+
+	/**
+	 * @brief One state change
+	 */
+	struct Entry {
+		uint32_t millis;			//!< When the loop changed to this state
+		uint8_t state;				//!< The application's state number
+		uint8_t operation;			//!< Operation at the time
+		uint16_t reserved;
+	};
+
+	/**
+	 * @brief Everything that is kept across a reset - 168 bytes
+	 */
+	struct Record {
+		uint32_t magic;				//!< MAGIC if the rest is valid
+		uint32_t loopMillis;		//!< Last loop pass
+		uint32_t checkMillis;		//!< Last check() - within a timer period of the reset
+		uint32_t loopTime;			//!< Wall clock (Unix time) of the last state change - 0 if not known
+		uint32_t requestMillis;		//!< When the watchdog asked to be petted - 0 once it is
+		uint32_t longestPetGap;		//!< Longest wait between the watchdog asking and being petted (ms)
+		uint32_t stallMillis;		//!< When the stall in progress began - 0 if there isn't one
+		uint32_t longestStall;		//!< Longest stall the loop has recovered from (ms)
+		uint16_t stalls;			//!< Stalls since the record was cleared
+		uint8_t state;				//!< State of the last loop pass
+		uint8_t operation;			//!< Operation in progress
+		uint8_t stallState;			//!< State and operation when the stall in progress began
+		uint8_t stallOperation;
+		uint8_t next;				//!< Where the next entry goes
+		uint8_t count;				//!< Entries in use
+		Entry entries[HISTORY];		//!< Ring of state changes
+	};
+
+	/**
+	 * @brief Construct a monitor
+	 *
+	 * @param record Where to keep the record - normally a retained variable
+	 *
+	 * @param stallLimit A loop pass or a pet this late (ms) counts as a stall
+	 */
+	StallMonitor(Record &record, uint32_t stallLimit) : record(record), stallLimit(stallLimit) {};
+
+	/**
+	 * @brief True if the record survived the last reset
+	 *
+	 * Check this (and format the record) before calling clear().
+	 */
+	bool isValid() const { return record.magic == MAGIC; };
+
+	/**
+	 * @brief Start a new record
+	 *
+	 * @param nowMillis millis()
+	 */
+	void clear(uint32_t nowMillis);
+
+	/**
+	 * @brief Call on every loop pass
+	 *
+	 * @param nowMillis millis()
+	 *
+	 * @param nowTime Unix time, or 0 if the clock isn't set
+	 *
+	 * @param state The application's state - a change adds an entry to the ring
+	 */
+	void loopRan(uint32_t nowMillis, uint32_t nowTime, uint8_t state);
+
+	/**
+	 * @brief Note the operation the loop is starting - see Scope
+	 */
+	void setOperation(uint8_t operation) { record.operation = operation; };
+
+	/**
+	 * @brief The operation in progress
+	 */
+	uint8_t getOperation() const { return record.operation; };
+
+	/**
+	 * @brief Call from the watchdog interrupt
+	 */
+	void watchdogRequested(uint32_t nowMillis);
+
+	/**
+	 * @brief Call when the watchdog is petted
+	 *
+	 * @return How long the watchdog waited (ms), 0 if it hadn't asked
+	 */
+	uint32_t watchdogPetted(uint32_t nowMillis);
+
+	/**
+	 * @brief Look for a stall - call from a timer, so it runs while the loop is stuck
+	 *
+	 * Only the record is touched. The stall is reported by takeRecovery() once the loop runs again
+	 * or from the record after a reset.
+	 */
+	void check(uint32_t nowMillis);
+
+	/**
+	 * @brief True if a stall is in progress
+	 */
+	bool isStalled() const { return record.stallMillis != 0; };
+
+	/**
+	 * @brief A stall the loop has recovered from, once
+	 *
+	 * @param duration Set to how long it lasted (ms)
+	 *
+	 * @param state Set to the state it started in
+	 *
+	 * @param operation Set to the operation it started in
+	 *
+	 * @return true if there was one since the last call
+	 */
+	bool takeRecovery(uint32_t &duration, uint8_t &state, uint8_t &operation);
+
+	/**
+	 * @brief Entry n of the ring, oldest first (n < getCount())
+	 */
+	const Entry &getEntry(uint8_t n) const;
+
+	/**
+	 * @brief Entries in the ring
+	 */
+	uint8_t getCount() const { return record.count; };
+
+	/**
+	 * @brief The record, for a post mortem
+	 */
+	const Record &getRecord() const { return record; };
+
+	/**
+	 * @brief Short printable name of an operation
+	 */
+	static const char *operationName(uint8_t operation);
+
+	/**
+	 * @brief Marks an operation for as long as it is in scope, then puts back the one before
+	 */
+	class Scope {
+	public:
+		Scope(StallMonitor &monitor, uint8_t operation) : monitor(monitor), previous(monitor.getOperation()) {
+			monitor.setOperation(operation);
+		};
+		~Scope() { monitor.setOperation(previous); };
+
+	protected:
+		StallMonitor &monitor;
+		uint8_t previous;
+	};
+
+protected:
+	Record &record;
+	uint32_t stallLimit;
+	uint32_t recoveredDuration = 0;	//!< Set by loopRan() when a stall ends - cleared by takeRecovery()
+	uint8_t recoveredState = 0;
+	uint8_t recoveredOperation = 0;
+};
+
+#endif /* __STALLMONITOR_H */
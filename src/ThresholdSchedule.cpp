@@ -0,0 +1,186 @@
+#include "ThresholdSchedule.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// "HHMM" to minutes since midnight, or -1
+static int parseTime(const char *&cp) {
+	if (!isdigit(cp[0]) || !isdigit(cp[1]) || !isdigit(cp[2]) || !isdigit(cp[3])) {
+		return -1;
+	}
+	int hours = (cp[0] - '0') * 10 + (cp[1] - '0');
+	int minutes = (cp[2] - '0') * 10 + (cp[3] - '0');
+	cp += 4;
+	if (hours > 24 || minutes > 59 || (hours == 24 && minutes != 0)) {
+		return -1;
+	}
+	return hours * 60 + minutes;
+}
+
+// An optional bound in tenths. Empty means USE_BASE.
+static bool parseBound(const char *&cp, int16_t &bound) {
+	if (*cp != ',') {
+		bound = ThresholdSchedule::USE_BASE;
+		return true;
+	}
+	cp++;
+	if (*cp == ',' || *cp == ';' || *cp == 0) {
+		bound = ThresholdSchedule::USE_BASE;
+		return true;
+	}
+	char *end;
+	double value = strtod(cp, &end);
+	if (end == cp || value < -100 || value > 200) {
+		return false;
+	}
+	cp = end;
+	bound = (int16_t)lround(value * 10);
+	return true;
+}
+
+ThresholdSchedule::ThresholdSchedule() {
+	clear();
+}
+
+void ThresholdSchedule::clear() {
+	memset(&stored, 0, sizeof(stored));
+	buildTable();
+}
+
+bool ThresholdSchedule::load(const Stored &saved) {
+	bool ok = (saved.count <= MAX_WINDOWS);
+	for(uint8_t ii = 0; ok && ii < saved.count; ii++) {
+		ok = valid(saved.windows[ii]);
+	}
+	if (!ok) {
+		clear();
+		return false;
+	}
+	stored = saved;
+	buildTable();
+	return true;
+}
+
+bool ThresholdSchedule::parse(const char *config) {
+	Stored parsed;
+	memset(&parsed, 0, sizeof(parsed));
+
+	const char *cp = config;
+	while(isspace(*cp)) {
+		cp++;
+	}
+	if (strcmp(cp, "clear") != 0) {
+		while(*cp) {
+			if (parsed.count >= MAX_WINDOWS) {
+				return false;
+			}
+			Window &window = parsed.windows[parsed.count];
+
+			int start = parseTime(cp);
+			if (start < 0 || *cp++ != '-') {
+				return false;
+			}
+			int end = parseTime(cp);
+			if (end < 0 || start == end) {
+				return false;
+			}
+			// Widen to whole slots
+			window.startSlot = (start / SLOT_MINUTES) % SLOTS;
+			window.endSlot = ((end + SLOT_MINUTES - 1) / SLOT_MINUTES) % SLOTS;
+			if (window.startSlot == window.endSlot) {
+				// All the way round - kept as the whole day, so it isn't read as an empty window
+				window.startSlot = 0;
+				window.endSlot = SLOTS;
+			}
+
+			if (!parseBound(cp, window.lowerTemperature) || !parseBound(cp, window.upperTemperature) ||
+				!parseBound(cp, window.lowerHumidity) || !parseBound(cp, window.upperHumidity)) {
+				return false;
+			}
+
+			if (*cp == ',') {
+				for(cp++; *cp && *cp != ';'; cp++) {
+					switch(*cp) {
+					case 'a':
+						window.flags |= SUPPRESS_ALERTS;
+						break;
+					case 'w':
+						window.flags |= SUPPRESS_WARNINGS;
+						break;
+					case 'd':
+						window.flags |= SUPPRESS_WARNINGS | SUPPRESS_HIGH_TEMP;
+						break;
+					default:
+						return false;
+					}
+				}
+			}
+
+			if (!valid(window)) {
+				return false;
+			}
+			parsed.count++;
+
+			if (*cp == ';') {
+				cp++;
+			}
+			else if (*cp) {
+				return false;
+			}
+		}
+	}
+
+	stored = parsed;
+	buildTable();
+	return true;
+}
+
+bool ThresholdSchedule::valid(const Window &window) const {
+	if (window.startSlot >= SLOTS || window.endSlot > SLOTS || window.startSlot == window.endSlot) {
+		return false;
+	}
+	if (window.endSlot == SLOTS && window.startSlot != 0) {
+		// Only the whole day ends on SLOTS - any other window that runs to midnight ends on slot 0
+		return false;
+	}
+	if (window.flags & ~(SUPPRESS_ALERTS | SUPPRESS_WARNINGS | SUPPRESS_HIGH_TEMP)) {
+		return false;
+	}
+	if (window.lowerTemperature != USE_BASE && window.upperTemperature != USE_BASE && window.lowerTemperature >= window.upperTemperature) {
+		return false;
+	}
+	if (window.lowerHumidity != USE_BASE && window.upperHumidity != USE_BASE && window.lowerHumidity >= window.upperHumidity) {
+		return false;
+	}
+	return true;
+}
+
+void ThresholdSchedule::buildTable() {
+	memset(table, NO_WINDOW, sizeof(table));
+
+	// Later windows overwrite earlier ones where they overlap
+	for(uint8_t ii = 0; ii < stored.count; ii++) {
+		const Window &window = stored.windows[ii];
+		uint8_t slots = (window.endSlot == SLOTS) ? SLOTS : (window.endSlot + SLOTS - window.startSlot) % SLOTS;
+		for(uint8_t slot = window.startSlot; slots > 0; slot = (slot + 1) % SLOTS, slots--) {
+			table[slot] = ii;
+		}
+	}
+}
+
+const ThresholdSchedule::Window *ThresholdSchedule::windowAt(uint16_t minuteOfDay) const {
+	uint8_t index = windowIndexAt(minuteOfDay);
+	return (index == NO_WINDOW) ? NULL : &stored.windows[index];
+}
+
+// [static]
+void ThresholdSchedule::describe(const Window &window, char *buf, size_t bufSize) {
+	int start = window.startSlot * SLOT_MINUTES;
+	int end = window.endSlot * SLOT_MINUTES;
+	snprintf(buf, bufSize, "%02d%02d-%02d%02d%s%s", start / 60, start % 60, end / 60, end % 60,
+		(window.flags & SUPPRESS_ALERTS) ? " a" : "",
+		(window.flags & SUPPRESS_HIGH_TEMP) ? " d" : ((window.flags & SUPPRESS_WARNINGS) ? " w" : ""));
+}
@@ -0,0 +1,119 @@
+#ifndef __THRESHOLDSCHEDULE_H
+#define __THRESHOLDSCHEDULE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Time of day threshold profiles
+ *
+ * A cold room does not look the same all day - scheduled defrost cycles and loading at the start of
+ * a shift produce the same excursions every day. A schedule is a short list of windows, each with
+ * its own bounds and suppression rules. Outside every window the base thresholds (alertsStatus) apply.
+ *
+ * The day is split into 15 minute slots and a table maps each slot to its window, so finding the
+ * active window is a single array lookup. The table is rebuilt from the windows whenever they change
+ * and only the windows themselves (the Stored structure) need to be saved.
+ */
+class ThresholdSchedule {
+public:
+	/**
+	 * @brief Suppression rules for a window
+	 */
+	enum Flags : uint8_t {
+		SUPPRESS_ALERTS = 0x01,			//!< No threshold alerts at all
+		SUPPRESS_WARNINGS = 0x02,		//!< No early warnings from the detector or the forecast
+		SUPPRESS_HIGH_TEMP = 0x04		//!< No high temperature alerts (a defrost cycle sets this and SUPPRESS_WARNINGS)
+	};
+
+	/**
+	 * @brief One window of the schedule
+	 *
+	 * Bounds are in tenths of a degree C or a percent RH. USE_BASE means use the base threshold.
+	 */
+	struct Window {
+		uint8_t startSlot;				//!< First 15 minute slot (0 is 00:00 UTC)
+		uint8_t endSlot;				//!< Slot after the last one - less than startSlot if the window runs past midnight, SLOTS with a startSlot of 0 for the whole day
+		uint8_t flags;					//!< Flags
+		uint8_t reserved;
+		int16_t lowerTemperature;
+		int16_t upperTemperature;
+		int16_t lowerHumidity;
+		int16_t upperHumidity;
+	};
+
+	static const uint8_t MAX_WINDOWS = 8;			//!< Windows in a schedule
+	static const uint8_t SLOT_MINUTES = 15;			//!< Resolution of the schedule
+	static const uint8_t SLOTS = 24 * 60 / SLOT_MINUTES;
+	static const uint8_t NO_WINDOW = 0xff;			//!< Table entry for slots covered by no window
+	static const int16_t USE_BASE = INT16_MIN;		//!< Bound that falls back to the base threshold
+
+	/**
+	 * @brief What gets saved - this is all that is needed to rebuild the schedule
+	 */
+	struct Stored {
+		uint8_t count;					//!< Windows in use
+		uint8_t reserved[3];
+		Window windows[MAX_WINDOWS];
+	};
+
+	ThresholdSchedule();
+
+	/**
+	 * @brief Replace the schedule from a configuration string
+	 *
+	 * @param config Windows separated by semicolons, each "HHMM-HHMM,lowTemp,highTemp,lowHumidity,highHumidity,flags".
+	 * Times are UTC and are widened to 15 minute slots - a window that comes round to its own start, such as
+	 * "0000-2400", covers the whole day. Empty bounds use the base thresholds. Flags are any of
+	 * a (no alerts), w (no early warnings) and d (defrost - no early warnings or high temperature alerts).
+	 * Where windows overlap the later one wins. An empty string or "clear" removes all windows.
+	 *
+	 * @return true if the whole string was valid. If not, the schedule is left as it was.
+	 */
+	bool parse(const char *config);
+
+	/**
+	 * @brief Load a saved schedule
+	 *
+	 * @return true if it was valid. If not, the schedule is cleared.
+	 */
+	bool load(const Stored &saved);
+
+	/**
+	 * @brief Remove all windows
+	 */
+	void clear();
+
+	/**
+	 * @brief The schedule as it should be saved
+	 */
+	const Stored &getStored() const { return stored; };
+
+	/**
+	 * @brief Index of the window active at a time of day
+	 *
+	 * @param minuteOfDay Minutes since midnight UTC
+	 *
+	 * @return The index into getStored().windows, or NO_WINDOW if the base thresholds apply
+	 */
+	uint8_t windowIndexAt(uint16_t minuteOfDay) const { return table[(minuteOfDay % (24 * 60)) / SLOT_MINUTES]; };
+
+	/**
+	 * @brief The window active at a time of day, or NULL if the base thresholds apply
+	 */
+	const Window *windowAt(uint16_t minuteOfDay) const;
+
+	/**
+	 * @brief Describe a window, for example "0200-0245 d"
+	 */
+	static void describe(const Window &window, char *buf, size_t bufSize);
+
+protected:
+	bool valid(const Window &window) const;
+	void buildTable();
+
+	Stored stored;					//!< The windows
+	uint8_t table[SLOTS];			//!< Window index for every slot of the day
+};
+
+#endif /* __THRESHOLDSCHEDULE_H */
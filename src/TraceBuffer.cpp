@@ -0,0 +1,82 @@
+#include "TraceBuffer.h"
+
+#include <string.h>
+
+static const char base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void putLittle32(uint8_t *buf, uint32_t value) {
+	buf[0] = (uint8_t)value;
+	buf[1] = (uint8_t)(value >> 8);
+	buf[2] = (uint8_t)(value >> 16);
+	buf[3] = (uint8_t)(value >> 24);
+}
+
+void TraceBuffer::begin() {
+	if (ring.magic != MAGIC) clear();
+}
+
+void TraceBuffer::clear() {
+	memset(&ring, 0, sizeof(ring));
+	ring.magic = MAGIC;
+}
+
+size_t TraceBuffer::pack(uint8_t *buf, size_t size, uint32_t nowMillis, uint32_t nowTime) const {
+	if (size < HEADER_SIZE) return 0;
+	putLittle32(&buf[0], ring.written);
+	putLittle32(&buf[4], nowMillis);
+	putLittle32(&buf[8], nowTime);
+
+	uint16_t count = getCount();
+	uint16_t fit = (uint16_t)((size - HEADER_SIZE) / RECORD_SIZE);
+	uint16_t first = (count > fit) ? count - fit : 0;		// Drop the oldest if there isn't room
+
+	uint8_t *p = &buf[HEADER_SIZE];
+	for (uint16_t n = first; n < count; n++) {
+		const Entry &entry = getEntry(n);
+		putLittle32(p, entry.millis);
+		p[4] = entry.id;
+		p[5] = entry.a;
+		p[6] = (uint8_t)entry.b;
+		p[7] = (uint8_t)(entry.b >> 8);
+		p += RECORD_SIZE;
+	}
+	return p - buf;
+}
+
+// [static]
+size_t TraceBuffer::base64Encode(const uint8_t *in, size_t len, char *out, size_t outSize) {
+	if (outSize < 4 * ((len + 2) / 3) + 1) return 0;
+
+	char *p = out;
+	for (size_t ii = 0; ii < len; ii += 3) {
+		uint32_t group = (uint32_t)in[ii] << 16;
+		if (ii + 1 < len) group |= (uint32_t)in[ii + 1] << 8;
+		if (ii + 2 < len) group |= in[ii + 2];
+		*p++ = base64Chars[(group >> 18) & 0x3f];
+		*p++ = base64Chars[(group >> 12) & 0x3f];
+		*p++ = (ii + 1 < len) ? base64Chars[(group >> 6) & 0x3f] : '=';
+		*p++ = (ii + 2 < len) ? base64Chars[group & 0x3f] : '=';
+	}
+	*p = 0;
+	return p - out;
+}
+
+// [static]
+size_t TraceBuffer::base64Decode(const char *in, uint8_t *out, size_t outSize) {
+	uint32_t group = 0;
+	int bits = 0;
+	size_t len = 0;
+
+	for (; *in; in++) {
+		const char *found = (*in != '=') ? strchr(base64Chars, *in) : NULL;
+		if (!found) break;
+		group = (group << 6) | (uint32_t)(found - base64Chars);
+		bits += 6;
+		if (bits >= 8) {
+			bits -= 8;
+			if (len == outSize) break;
+			out[len++] = (uint8_t)(group >> bits);
+		}
+	}
+	return len;
+}
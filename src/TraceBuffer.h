@@ -0,0 +1,127 @@
+#ifndef __TRACEBUFFER_H
+#define __TRACEBUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Ring of small binary trace records
+ *
+ * Each record is an event id, two arguments and the millis() it happened at - 8 bytes, stored with
+ * a handful of instructions and no formatting, so tracing doesn't change the timing it is meant to
+ * show. The ring is owned by the caller so it can be declared retained, which keeps the trace from
+ * before a reset.
+ *
+ * pack() writes the ring out oldest first, little endian, behind a 12 byte header:
+ *
+ * - uint32_t written - records added since the ring was cleared (the ones that are gone are the difference)
+ * - uint32_t millis - millis() when it was packed
+ * - uint32_t time - Unix time when it was packed, 0 if not known
+ *
+ * base64Encode() turns that into text for a publish or a serial line, and tools/trace-decode.cpp
+ * turns it back into one line per record. add() is only safe from one thread.
+ */
+class TraceBuffer {
+public:
+	static const uint16_t CAPACITY = 64;				//!< Records kept - a power of 2
+	static const uint32_t MAGIC = 0x54524331;			//!< "TRC1" - a valid ring (retained RAM is random after power up)
+	static const size_t HEADER_SIZE = 12;				//!< Bytes before the records in pack()
+	static const size_t RECORD_SIZE = 8;				//!< Bytes per record in pack()
+
+	/**
+	 * @brief One record
+	 */
+	struct Entry {
+		uint32_t millis;			//!< When it happened
+		uint8_t id;					//!< What happened - the caller's numbering
+		uint8_t a;					//!< Arguments - meaning depends on id
+		uint16_t b;
+	};
+
+	/**
+	 * @brief The ring - 520 bytes
+	 */
+	struct Ring {
+		uint32_t magic;				//!< MAGIC if the rest is valid
+		uint32_t written;			//!< Records added - the next goes at written % CAPACITY
+		Entry entries[CAPACITY];
+	};
+
+	/**
+	 * @brief Construct a trace buffer
+	 *
+	 * @param ring Where to keep the records - normally a retained variable
+	 */
+	TraceBuffer(Ring &ring) : ring(ring) {};
+
+	/**
+	 * @brief Keep the ring if it survived a reset, otherwise clear it
+	 */
+	void begin();
+
+	/**
+	 * @brief Empty the ring
+	 */
+	void clear();
+
+	/**
+	 * @brief Add a record, overwriting the oldest once the ring is full
+	 */
+	inline void add(uint32_t millis, uint8_t id, uint8_t a = 0, uint16_t b = 0) {
+		Entry &entry = ring.entries[ring.written & (CAPACITY - 1)];
+		entry.millis = millis;
+		entry.id = id;
+		entry.a = a;
+		entry.b = b;
+		ring.written++;
+	};
+
+	/**
+	 * @brief Records in the ring
+	 */
+	uint16_t getCount() const { return (ring.written < CAPACITY) ? ring.written : CAPACITY; };
+
+	/**
+	 * @brief Record n, oldest first (n < getCount())
+	 */
+	const Entry &getEntry(uint16_t n) const { return ring.entries[(ring.written - getCount() + n) & (CAPACITY - 1)]; };
+
+	/**
+	 * @brief Records added since the ring was cleared
+	 */
+	uint32_t getWritten() const { return ring.written; };
+
+	/**
+	 * @brief Write the header and records, oldest first
+	 *
+	 * @param buf Where to write them - HEADER_SIZE + CAPACITY * RECORD_SIZE bytes is always enough
+	 *
+	 * @param size Size of buf. Only the newest records that fit are written.
+	 *
+	 * @param nowMillis millis()
+	 *
+	 * @param nowTime Unix time, 0 if not known
+	 *
+	 * @return Bytes written, 0 if the header doesn't fit
+	 */
+	size_t pack(uint8_t *buf, size_t size, uint32_t nowMillis, uint32_t nowTime) const;
+
+	/**
+	 * @brief Base64 encode, null terminated
+	 *
+	 * @return Length of the text, or 0 if out is too small (4 * ((len + 2) / 3) + 1 bytes is needed)
+	 */
+	static size_t base64Encode(const uint8_t *in, size_t len, char *out, size_t outSize);
+
+	/**
+	 * @brief Base64 decode - stops at the first character that isn't base64
+	 *
+	 * @return Bytes decoded
+	 */
+	static size_t base64Decode(const char *in, uint8_t *out, size_t outSize);
+
+protected:
+	Ring &ring;
+};
+
+#endif /* __TRACEBUFFER_H */
@@ -0,0 +1,33 @@
+#ifndef __TRACEEVENTS_H
+#define __TRACEEVENTS_H
+
+#include <stdint.h>
+
+/**
+ * @brief Event ids for the firmware's TraceBuffer records, shared with tools/trace-decode.cpp
+ *
+ * Only ever add to the end - the decoder has to read traces from older firmware.
+ */
+enum TraceEvent : uint8_t {
+	TRACE_BOOT = 1,				//!< a: reset reason, b: release major number
+	TRACE_STATE,				//!< a: old state, b: new state
+	TRACE_WATCHDOG_PET,			//!< b: ms the watchdog waited for its pet (65535 if longer)
+	TRACE_SAMPLE,				//!< b: temperature in tenths of a degree (int16_t)
+	TRACE_REPORT,				//!< a: signal strength %, b: low 16 bits of the sequence number
+	TRACE_RESPONSE,				//!< a: 1 if it acked a report, b: status code
+	TRACE_CONNECTED,			//!< a: connection policy
+	TRACE_DISCONNECTED,			//!< a: 1 if we asked for it
+	TRACE_STALL,				//!< a: state, b: seconds it lasted
+	TRACE_DUMP,					//!< a: 0 publish, 1 serial
+	TRACE_BULK_DUMP,			//!< a: section sent over the USB serial port, b: kB sent since boot
+	TRACE_EVENT_COUNT
+};
+
+/**
+ * @brief Printable names, indexed by TraceEvent
+ */
+static const char * const traceEventNames[TRACE_EVENT_COUNT] = {
+	"?", "boot", "state", "watchdog pet", "sample", "report", "response", "connected", "disconnected", "stall", "dump", "bulk dump"
+};
+
+#endif /* __TRACEEVENTS_H */
@@ -42,65 +42,46 @@
 // v19.00 - Changed to deviceOS@5.3.1 for KiPharma Devices.  (Product version 18)
 // v20.00 - Removed the keepAlive message, as it was using too much data operations.
 // v21.00 - Same version as 20, only the webhook name is changed to stealth. Use this for SVH Devices. (Product Version 19)
-
-PRODUCT_VERSION(19); 
-const char releaseNumber[8] = "21.00";                                                      // Displays the release on the menu
-
-// Define the memory map - note can be EEPROM or FRAM - moving to FRAM for speed and to avoid memory wear
-namespace FRAM {                                                                         // MPoved to namespace instead of #define to limit scope
-  enum Addresses {
-    versionAddr           = 0x00,                                                           // Where we store the memory map version number - 8 Bits
-    sysStatusAddr         = 0x01,                                                           // This is the status of the device
-    alertStatusAddr       = 0x50,                                                           // Where we store the status of the alerts in the system
-    sensorDataAddr        = 0xA0                                                            // Where we store the latest sensor data readings
-   };
-};
-
-const int FRAMversionNumber = 5;                                                            // Increment this number each time the memory map is changed
-
-struct systemStatus_structure {                     
-  uint8_t structuresVersion;                                                                // Version of the data structures (system and data)
-  bool thirdPartySim;                                                                       // If this is set to "true" then the keep alive code will be executed
-  int keepAlive;                                                                            // Keep alive value for use with 3rd part SIMs
-  uint8_t connectedStatus;
-  uint8_t verboseMode;
-  uint8_t lowBatteryMode;
-  int stateOfCharge;                                                                        // Battery charge level
-  uint8_t batteryState;                                                                     // Stores the current battery state
-  int resetCount;                                                                           // reset count of device (0-256)
-  unsigned long lastHookResponse;                                                           // Last time we got a valid Webhook response
-} sysStatus;
-
-struct alertsStatus_structure {
-  bool upperTemperatureThresholdCrossed;                                                    // Set this to true if the upper temp threshold is crossed
-  bool lowerTemperatureThresholdCrossed;                                                    // Set this to true if the lower temp threshold is crossed
-  bool upperHumidityThresholdCrossed;                                                       // Set this to true if the upper humidty threshold is crossed
-  bool lowerHumidityThresholdCrossed;                                                       // Set this to true if the lower humidty threshold is crossed
-  bool thresholdCrossedFlag;                                                                // If any of the thresholds have been crossed
-  float upperTemperatureThreshold;                                                          // Values set below that trigger alerts
-  float lowerTemperatureThreshold;
-  float upperHumidityThreshold;
-  float lowerHumidityThreshold;
-} alertsStatus;
-
-struct sensor_data_struct {                                                               // Here we define the structure for collecting and storing data from the sensors
-  bool validData;
-  unsigned long timeStamp;
-  float temperatureInC;
-  float relativeHumidity; 
-  int stateOfCharge;
-} sensorData;
-
+// v22.00 - Adaptive keep alive - probes for the carrier's NAT timeout and remembers it for each SIM (Product Version 20)
+// v23.00 - Webhook timeouts resend the report and only end the session after repeated signs of a broken link (Product Version 21)
+// v24.00 - Moved to semi automatic with a selectable connection policy - always on, per report, scheduled windows or on alert (Product Version 22)
+// v25.00 - Backlogs wait for a usable signal (up to a limit) and each report carries the signal strength (Product Version 23)
+// v26.00 - Samples every minute to spot door openings, defrost cycles and compressor failures from the rate of change (Product Version 24)
+// v27.00 - Forecasts the time until each limit is crossed and sends one early warning when it is inside the lead time (Product Version 25)
+// v28.00 - Time of day threshold profiles so scheduled defrost cycles and loading do not raise alerts (Product Version 26)
+// v29.00 - Keeps a compressed history of readings in FRAM (Product Version 27)
+// v30.00 - History is one minute readings for the last day, then hourly and daily rollups with mean kinetic temperature (Product Version 28)
+// v31.00 - History-Query function answers readings, summaries or excursions for a time range from the local history (Product Version 29)
+// v32.00 - Reports carry a sequence number and are kept until acknowledged so the backend can ask for the ones it missed (Product Version 30)
+// v33.00 - No heap allocation after setup, with a heap monitor to prove it (Product Version 31)
+// v34.00 - Measures how much of the loop and publish thread stacks is ever used (Product Version 32)
+// v35.00 - Loop stall monitor in retained RAM with a post mortem after a watchdog reset (Product Version 33)
+// v36.00 - Binary trace ring in retained RAM in place of the verbose state transition publishes (Product Version 34)
+// v37.00 - Input recorder - logs every input to USB serial from boot so a field run can be replayed on a desk (Product Version 35)
+// v38.00 - Firmware logic moved behind a hardware abstraction layer so it also builds and runs on a Linux host (Product Version 36)
+// v39.00 - Framed, CRC checked bulk dump of the history, reports and trace over USB serial for sites with no coverage (Product Version 37)
+// v40.00 - Publish queue kept in a circular log in retained RAM so queueing, sending and dropping an event cost the same at any size (Product Version 38)
+// v41.00 - Bursts of alerts, state transitions, mode and threshold messages coalesced into one publish, a line each (Product Version 39)
+// v42.00 - Priority lanes in the publish queue - alerts sent first, then reports, and diagnostics dropped first when it is full (Product Version 40)
+
+PRODUCT_VERSION(40); 
+const char releaseNumber[8] = "42.00";                                                      // Displays the release on the menu
+
+// The firmware itself is FacilityMonitor (FacilityMonitor.h) - this file wires it to Device OS with the classes in ParticleHal.h
+// and owns what only the device has: the retained RAM, the thread stacks, the cloud registrations and the input recorder.
 
 // Included Libraries
-#include "math.h"
 #include "adafruit-sht31.h"
 #include "PublishQueueAsyncRK.h"                                                            // Async Particle Publish
 #include "MB85RC256V-FRAM-RK.h"                                                             // Rickkas Particle based FRAM Library
 #include "MCP79410RK.h"                                                                     // Real Time Clock
+#include "StackMonitor.h"                                                                   // Stack painting to find the high water mark
+#include "InputLog.h"                                                                       // Compact log of every input for a replay
+#include "FacilityMonitor.h"                                                                // The state machine, the history, the reports and the cloud functions
+#include "ParticleHal.h"                                                                    // Hal.h on Device OS
 
 // Prototypes and System Mode calls
-SYSTEM_MODE(AUTOMATIC);                                                                     // This will enable user code to start executing automatically.
+SYSTEM_MODE(SEMI_AUTOMATIC);                                                                // We connect and disconnect as the connection policy tells us to
 SYSTEM_THREAD(ENABLED);                                                                     // Means my code will not be held up by Particle processes.
 STARTUP(System.enableFeature(FEATURE_RESET_INFO));
 Adafruit_SHT31 sht31 = Adafruit_SHT31();
@@ -108,514 +89,172 @@ MB85RC64 fram(Wire, 0);
 MCP79410 rtc;                                                                               // Rickkas MCP79410 libarary
 retained uint8_t publishQueueRetainedBuffer[2048];                                          // Create a buffer in FRAM for cached publishes
 PublishQueueAsync publishQueue(publishQueueRetainedBuffer, sizeof(publishQueueRetainedBuffer));
-// Timer keepAliveTimer(1000, keepAliveMessage);
-
-// State Machine Variables
-enum State { INITIALIZATION_STATE, ERROR_STATE, IDLE_STATE, MEASURING_STATE, REPORTING_STATE, RESP_WAIT_STATE};
-char stateNames[8][26] = {"Initialize", "Error", "Idle", "Measuring","Reporting", "Response Wait"};
-State state = INITIALIZATION_STATE;
-State oldState = INITIALIZATION_STATE;
-
-// Pin Constants
-const int blueLED =   D7;                                                               // This LED is on the Electron itself
-const int wakeUpPin = D8;  
-const int donePin = D5;
-
-volatile bool watchdogFlag=false;                                                           // Flag to let us know we need to pet the dog
-
-// Timing Variables
-const unsigned long webhookWait = 45000;                                                    // How long will we wair for a WebHook response
-const unsigned long resetWait   = 300000;                                                   // How long will we wait in ERROR_STATE until reset
-
-unsigned long webhookTimeStamp  = 0;                                                        // Webhooks...
-unsigned long resetTimeStamp    = 0;                                                        // Resets - this keeps you from falling into a reset loop
-bool dataInFlight = false;
-
-// Variables Related To Particle Mobile Application Reporting
-// Simplifies reading values in the Particle Mobile Application
-char temperatureString[16];
-char humidityString[16];
-char batteryContextStr[16];                                                                 // One word that describes whether the device is getting power, charging, discharging or too cold to charge
-char batteryString[16];
-char upperTemperatureThresholdString[24];                                                   // String to show the current threshold readings.                         
-char lowerTemperatureThresholdString[24];                                                   // String to show the current threshold readings.                         
-char upperHumidityThresholdString[24];                                                      // String to show the current threshold readings.                         
-char lowerHumidityThresholdString[24];                                                      // String to show the current threshold readings.       
-bool sysStatusWriteNeeded = false;                                                       // Keep track of when we need to write
-bool alertsStatusWriteNeeded = false;         
-bool sensorDataWriteNeeded = false; 
-
-
-// Time Period Related Variables
-const int wakeBoundary = 0*3600 + 20*60 + 0;                                                // 0 hour 20 minutes 0 seconds
+StackMonitor loopStack;
+retained StallMonitor::Record stallRecord;                                                  // Survives the watchdog reset - 168 bytes of the retained RAM
+retained TraceBuffer::Ring traceRing;                                                       // 520 bytes of the retained RAM - the trace from before a reset is kept
+
+// Input Recorder Variables - every input from boot on, streamed out of USB serial so the run can be replayed exactly
+const uint32_t inputRecordArmed = 0x41524d31;                                               // "ARM1" - anything else in retained RAM means do not record
+retained uint32_t inputRecordArm;                                                           // Set by the Input-Record function - recording starts on the next boot
+const unsigned long inputRecordHostWait = 10000;                                            // How long the boot waits for a serial terminal before it gives up on recording
+uint8_t inputLogRing[4096];                                                                 // A loop pass logs a few dozen bytes - this covers USB falling behind for a while
+InputLogWriter inputLog(inputLogRing, sizeof(inputLogRing));
+unsigned long inputRecordResetAt = 0;                                                       // Input-Record "boot" resets once the function has returned
+
+// The Hardware - each logs what it reads to the input log
+void watchdogISR();                                                                         // Declared here as the pins are created before the preprocessor's prototypes
+ParticleClock halClock(rtc, inputLog);
+ParticleSensor halSensor(sht31, inputLog);
+ParticleStore halStore(fram);
+ParticleCloud halCloud(publishQueue, inputLog);
+ParticleGpio halGpio(watchdogISR);
+ParticleSystem halSystem(loopStack, inputLog);
+
+FacilityMonitor monitor({halClock, halSensor, halStore, halCloud, halGpio, halSystem}, stallRecord, traceRing, releaseNumber);
+void checkStall();                                                                          // Declared here as the timer is created before the preprocessor's prototypes
+Timer stallTimer(1000, checkStall);                                                         // Keeps looking while the loop is stuck
 
 void setup()                                                                                // Note: Disconnected Setup()
 {
-  pinMode(wakeUpPin,INPUT);                                                                 // This pin is active HIGH, 
-  pinMode(donePin,OUTPUT);                                                                  // Allows us to pet the watchdog
-  pinMode(blueLED, OUTPUT);                                                                 // declare the Blue LED Pin as an output
-
-  petWatchdog();                                                                            // Pet the watchdog - This will reset the watchdog time period AND 
-  attachInterrupt(wakeUpPin, watchdogISR, RISING);                                          // The watchdog timer will signal us and we have to respond
-
-  char StartupMessage[64] = "Startup Successful";                                           // Messages from Initialization
-  state = INITIALIZATION_STATE;
+  loopStack.paint(FacilityMonitor::loopStackSize, FacilityMonitor::loopStackReserve);       // First, while the loop thread has used as little of its stack as it ever will
+  Serial.begin(9600);                                                                       // Only used for a trace dump or the input recorder
+  if (inputRecordArm == inputRecordArmed) startInputRecording();                            // Before anything reads an input or changes FRAM or retained RAM
+  for (int ii = 0; ii < FacilityMonitor::coalescedEventCount; ii++) {                       // A burst of these takes one publish, not one a second each
+    publishQueue.withCoalescing(FacilityMonitor::coalescedEvents[ii]);
+  }
+  publishQueue.withThreadStackSize(FacilityMonitor::publishStackSize).setup();              // Start the publish thread - it paints its own stack
 
-  char responseTopic[125];
-  String deviceID = System.deviceID();                                                      // Multiple Electrons share the same hook - keeps things straight
-  deviceID.toCharArray(responseTopic,125);
+  char responseTopic[25];                                                                   // Multiple Electrons share the same hook - keeps things straight
+  uint8_t deviceID[12];
+  unsigned idLen = hal_get_device_id(deviceID, sizeof(deviceID));                           // Straight from the HAL - System.deviceID() builds a String
+  for (unsigned i = 0; i < idLen && i < sizeof(deviceID); i++) snprintf(&responseTopic[i * 2], 3, "%02x", deviceID[i]);
   Particle.subscribe(responseTopic, UbidotsHandler, MY_DEVICES);                            // Subscribe to the integration response event
   
   Particle.variable("Release",releaseNumber);
-  Particle.variable("temperature", temperatureString);
-  Particle.variable("humidity", humidityString);
-  Particle.variable("temperature-Upper",upperTemperatureThresholdString);
-  Particle.variable("temperature-lower",lowerTemperatureThresholdString);
-  Particle.variable("humidity-upper",upperHumidityThresholdString);
-  Particle.variable("humidity-lower",lowerHumidityThresholdString);
-  Particle.variable("Battery", batteryString);                                              // Battery level in V as the Argon does not have a fuel cell
-  Particle.variable("BatteryContext",batteryContextStr);
-  Particle.variable("Keep Alive Sec",sysStatus.keepAlive);
-  Particle.variable("3rd Party Sim", sysStatus.thirdPartySim);
-
-  
-  Particle.function("Measure-Now",measureNow);
-  Particle.function("Verbose-Mode",setVerboseMode);
-  Particle.function("Temp-Upper-Limit",setUpperTempLimit);
-  Particle.function("Temp-Lower-Limit",setLowerTempLimit);
-  Particle.function("Humidity-Lower-Limit",setLowerHumidityLimit);
-  Particle.function("Humidty-upper-Limit",setUpperHumidityLimit);
-  Particle.function("Keep Alive",setKeepAlive);
-  Particle.function("3rd Party Sim", setThirdPartySim);
-
-  rtc.setup();                                                        // Start the real time clock
-  rtc.clearAlarm();                                                   // Ensures alarm is still not set from last cycle
-
-  if (!sht31.begin(0x44)) {                                                                 // Start the i2c connected SHT-31 sensor
-    snprintf(StartupMessage,sizeof(StartupMessage),"Error - SHT31 Initialization");
-    state = ERROR_STATE;
-    resetTimeStamp = millis();
+  Particle.variable("temperature", monitor.temperatureString);
+  Particle.variable("humidity", monitor.humidityString);
+  Particle.variable("temperature-Upper",monitor.upperTemperatureThresholdString);
+  Particle.variable("temperature-lower",monitor.lowerTemperatureThresholdString);
+  Particle.variable("humidity-upper",monitor.upperHumidityThresholdString);
+  Particle.variable("humidity-lower",monitor.lowerHumidityThresholdString);
+  Particle.variable("Battery", monitor.batteryString);                                      // Battery level in V as the Argon does not have a fuel cell
+  Particle.variable("BatteryContext",monitor.batteryContextStr);
+  Particle.variable("Keep Alive Sec",monitor.sysStatus.keepAlive);
+  Particle.variable("Keep Alive Now",monitor.keepAliveCurrent);
+  Particle.variable("3rd Party Sim", monitor.sysStatus.thirdPartySim);
+  Particle.variable("Connection Policy", monitor.connectionPolicyStr);
+  Particle.variable("Signal", monitor.signalString);
+  Particle.variable("Forecast", monitor.forecastString);
+  Particle.variable("Threshold Profile", monitor.thresholdProfileStr);
+  Particle.variable("Unacked Reports", monitor.unackedReports);
+  Particle.variable("Heap", monitor.heapString);
+  Particle.variable("Stacks", monitor.stackString);
+  Particle.variable("Stalls", monitor.stallString);
+
+  for (int ii = 0; ii < FacilityMonitor::functionCount; ii++) {                             // Measure-Now, Verbose-Mode, the limits and the rest - see FacilityMonitor::functions
+    Particle.function(FacilityMonitor::functions[ii].name, [ii](String command) { return cloudFunction(ii, command); });
   }
+  Particle.function("Input-Record", inputRecordCommand);
 
-  // Load FRAM and reset variables to their correct values
-  fram.begin();                                                                             // Initialize the FRAM module
-
-  byte tempVersion;
-  fram.get(FRAM::versionAddr, tempVersion);
-  if (tempVersion != FRAMversionNumber) {                                                   // Check to see if the memory map in the sketch matches the data on the chip
-    fram.erase();                                                                           // Reset the FRAM to correct the issue
-    fram.put(FRAM::versionAddr, FRAMversionNumber);                                         // Put the right value in
-    fram.get(FRAM::versionAddr, tempVersion);                                               // See if this worked
-    if (tempVersion != FRAMversionNumber) state = ERROR_STATE;                              // Device will not work without FRAM
-    else {
-      loadSystemDefaults();                                                                 // Out of the box, we need the device to be awake and connected
-      loadAlertDefaults();
-    }
-  }
-  else {
-    fram.get(FRAM::sysStatusAddr,sysStatus);                                                // Loads the System Status array from FRAM
-    fram.get(FRAM::alertStatusAddr,alertsStatus);                                           // Load the current values array from FRAM
-  }
-
-  checkSystemValues();                                                                      // Make sure System values are all in valid range
-  checkAlertsValues();                                                                      // Make sure that Alerts values are all in a valid range
-
-  if (sysStatus.thirdPartySim) {
-    waitFor(Particle.connected,30 * 1000); 
-    Particle.keepAlive(sysStatus.keepAlive);                                              // Set the keep alive value
-    // keepAliveTimer.changePeriod(sysStatus.keepAlive*1000);                                  // Will start the repeating timer
-  }
-
-  takeMeasurements();                                                                       // For the benefit of monitoring the device
-  updateThresholdValue();                                                                   // For checking values of each device
-
-  if(sysStatus.verboseMode) publishQueue.publish("Startup",StartupMessage,PRIVATE);                       // Let Particle know how the startup process went
-
-  if (state == INITIALIZATION_STATE) state = IDLE_STATE;                                    // We made it throughgo let's go to idle
+  monitor.setup();
+  stallTimer.start();                                                                       // Setup can take a while connecting - only loop passes are timed
 }
 
 void loop()
 {
-  switch(state) {
-  case IDLE_STATE:                                                                          // Idle state - brackets only needed if a variable is defined in a state    
-    if (sysStatus.verboseMode && state != oldState) publishStateTransition();
-
-    if (!(Time.now() % wakeBoundary)) state = MEASURING_STATE;                                                     
-    
-    break;
-
-  case MEASURING_STATE:                                                                     // Take measurements prior to sending
-    if (sysStatus.verboseMode && state != oldState) publishStateTransition();
-
-    if (takeMeasurements()) alertsStatus.thresholdCrossedFlag = true;                       // A return of a "true" value indicates that one of the thresholds have been crossed
-    else {
-      alertsStatus.thresholdCrossedFlag = false;
-      digitalWrite(blueLED,LOW);                                                            // Just in case it was on an on-flash
-    }
-    alertsStatusWriteNeeded = true;
-
-    state = REPORTING_STATE;
-    break;
-
-  case REPORTING_STATE: 
-    if (sysStatus.verboseMode && state != oldState) publishStateTransition();               // Reporting - hourly or on command
-    if (Particle.connected()) {
-      if (Time.hour() == 12) Particle.syncTime();                                           // Set the clock each day at noon
-      sendEvent();                                                                          // Send data to Ubidots
-      state = RESP_WAIT_STATE;                                                              // Wait for Response
-    }
-    else {
-      state = ERROR_STATE;
-      resetTimeStamp = millis();
-    }
-    break;
-
-  case RESP_WAIT_STATE:
-    if (sysStatus.verboseMode && state != oldState) publishStateTransition();
-
-    if (!dataInFlight && (Time.now() % wakeBoundary))                                       // Response received back to IDLE state - make sure we don't allow repetivie reporting events
-    {
-     state = IDLE_STATE;
-    }
-    else if (millis() - webhookTimeStamp > webhookWait) {                                   // If it takes too long - will need to reset
-      resetTimeStamp = millis();
-      publishQueue.publish("spark/device/session/end", "", PRIVATE);                        // If the device times out on the Webhook response, it will ensure a new session is started on next connect
-      state = ERROR_STATE;                                                                  // Response timed out
-      resetTimeStamp = millis();
-    }
-    break;
-
-  
-  case ERROR_STATE:                                                                         // To be enhanced - where we deal with errors
-    if (state != oldState) publishStateTransition();
-    if (millis() > resetTimeStamp + resetWait)
-    {
-      if (Particle.connected()) publishQueue.publish("State","Error State - Reset", PRIVATE); // Brodcast Reset Action
-      delay(2000);
-      System.reset();
-    }
-    break;
-  }
-
-  rtc.loop();                                                                               // keeps the clock up to date
-
-  if (watchdogFlag) petWatchdog();                                                          // Watchdog flag is raised - time to pet the watchdog
-
-  if (alertsStatus.thresholdCrossedFlag) blinkLED(blueLED);
-
-  if (sysStatusWriteNeeded) {
-    fram.put(FRAM::sysStatusAddr,sysStatus);
-    sysStatusWriteNeeded = false;
-  }
-  if (alertsStatusWriteNeeded) {
-    fram.put(FRAM::alertStatusAddr,alertsStatus);
-    alertsStatusWriteNeeded = false;
-  }
-  if (sensorDataWriteNeeded) {
-    fram.put(FRAM::sensorDataAddr,sensorData);
-    sensorDataWriteNeeded = false;
-  }
-
-}
-
-
-void loadSystemDefaults() {                                                                 // Default settings for the device - connected, not-low power and always on
-  if (Particle.connected()) publishQueue.publish("Mode","Loading System Defaults", PRIVATE);
-  sysStatus.thirdPartySim = 1;
-  sysStatus.keepAlive = 120;
-  sysStatus.structuresVersion = 1;
-  sysStatus.verboseMode = false;
-  sysStatus.lowBatteryMode = false;
-  fram.put(FRAM::sysStatusAddr,sysStatus);                                                  // Write it now since this is a big deal and I don't want values over written
-}
-
-void loadAlertDefaults() {                                                                  // Default settings for the device - connected, not-low power and always on
-  if (Particle.connected()) publishQueue.publish("Mode","Loading Alert Defaults", PRIVATE);
-  alertsStatus.upperTemperatureThreshold = 30;
-  alertsStatus.lowerTemperatureThreshold = 2;
-  alertsStatus.upperHumidityThreshold = 90;
-  alertsStatus.lowerHumidityThreshold= 5;
-  fram.put(FRAM::alertStatusAddr,alertsStatus);                                             // Write it now since this is a big deal and I don't want values over written
-}
-
-void checkSystemValues() {                                                                  // Checks to ensure that all system values are in reasonable range 
-  if (sysStatus.connectedStatus < 0 || sysStatus.connectedStatus > 1) {
-    if (Particle.connected()) sysStatus.connectedStatus = true;
-    else sysStatus.connectedStatus = false;
-  }
-  if (sysStatus.keepAlive < 0 || sysStatus.keepAlive > 1200) sysStatus.keepAlive = 600;
-  if (sysStatus.verboseMode < 0 || sysStatus.verboseMode > 1) sysStatus.verboseMode = false;
-  if (sysStatus.lowBatteryMode < 0 || sysStatus.lowBatteryMode > 1) sysStatus.lowBatteryMode = 0;
-  if (sysStatus.resetCount < 0 || sysStatus.resetCount > 255) sysStatus.resetCount = 0;
-  sysStatusWriteNeeded = true;
-}
-
-void checkAlertsValues() {                                                                  // Checks to ensure that all system values are in reasonable range 
-  if (alertsStatus.lowerTemperatureThreshold < 0.0  || alertsStatus.lowerTemperatureThreshold > 20.0) alertsStatus.lowerTemperatureThreshold = 3.0;
-  if (alertsStatus.upperTemperatureThreshold < 20.0 || alertsStatus.upperTemperatureThreshold > 90.0) alertsStatus.upperTemperatureThreshold = 33.0;
-  if (alertsStatus.lowerHumidityThreshold < 0.0     || alertsStatus.lowerHumidityThreshold > 50.0)    alertsStatus.lowerHumidityThreshold = 13.0;
-  if (alertsStatus.upperHumidityThreshold < 20.0    || alertsStatus.upperHumidityThreshold > 90.0)    alertsStatus.upperHumidityThreshold = 63.0;
-  alertsStatusWriteNeeded = true;
+  inputLog.addMark(InputLog::MARK_LOOP);                                                    // A replay runs loop() once for each of these
+  monitor.loop();
+  pumpInputLog();                                                                           // Sends what this pass recorded out of USB serial
 }
 
 void watchdogISR()
 {
-  watchdogFlag = true;
+  monitor.watchdogInterrupt(millis());                                                      // The pet follows on the next loop pass
 }
 
-void petWatchdog()
+void checkStall()                                                                           // Timer callback - only touches the retained record
 {
-  digitalWrite(donePin, HIGH);                                                              // Pet the watchdog
-  digitalWrite(donePin, LOW);
-  watchdogFlag = false;
-  if (Particle.connected && sysStatus.verboseMode) publishQueue.publish("Watchdog","Petted",PRIVATE);
+  monitor.checkStall(millis());
 }
 
-// void keepAliveMessage() {
-//   Particle.publish("*", PRIVATE,NO_ACK);
-// }
-
-void sendEvent()
+int cloudFunction(int index, const String &command)                                         // A cloud function call - a replay makes the same call at the same point
 {
-  char data[100];                 
-  snprintf(data, sizeof(data), "{\"Temperature\":%4.1f, \"Humidity\":%4.1f,\"Battery\":%i}", sensorData.temperatureInC, sensorData.relativeHumidity,sensorData.stateOfCharge);
-  publishQueue.publish("storage-facility-hook-stealth", data, PRIVATE);
-  dataInFlight = true;                                                                      // set the data inflight flag
-  webhookTimeStamp = millis();
-}
-
-void UbidotsHandler(const char *event, const char *data)                                    // Looks at the response from Ubidots - Will reset Photon if no successful response
-{                                                                                           // Response Template: "{{hourly.0.status_code}}" so, I should only get a 3 digit number back
-  // Response Template: "{{hourly.0.status_code}}"
-  if (!data) {                                                                    // First check to see if there is any data
-    if (sysStatus.verboseMode) {
-      publishQueue.publish("Ubidots Hook", "No Data", PRIVATE);
-    }
-    return;
-  }
-  int responseCode = atoi(data);                                                  // Response is only a single number thanks to Template
-  if ((responseCode == 200) || (responseCode == 201))
-  {
-    if (sysStatus.verboseMode) {
-      publishQueue.publish("State", "Response Received", PRIVATE);
-    }
-    alertsStatus.upperHumidityThresholdCrossed = false;
-    alertsStatus.lowerHumidityThresholdCrossed = false;
-    alertsStatus.upperTemperatureThresholdCrossed = false;
-    alertsStatus.lowerTemperatureThresholdCrossed = false;
-    alertsStatusWriteNeeded = true;
-    dataInFlight = false;    
-
-  }
-  else if (sysStatus.verboseMode) {  
-    publishQueue.publish("Ubidots Hook", data, PRIVATE);                              // Publish the response code
-  }
-
-
+  const char *name = FacilityMonitor::functions[index].name;
+  inputLog.addText(InputLog::TEXT_FUNCTION, name, strlen(name));
+  inputLog.addText(InputLog::TEXT_ARGUMENT, command.c_str(), command.length());
+  return monitor.callFunction(index, command.c_str());
 }
 
-// These are the functions that are part of the takeMeasurements call
-
-bool takeMeasurements() {
-  char thresholdMessage[64] = "All within thresholds";
-  bool haveAnyAlertsBeenSet = false;
-  sensorData.validData = false;
-
-  if (sht31.readTemperature()){
-    sensorData.temperatureInC = sht31.readTemperature();
-    snprintf(temperatureString,sizeof(temperatureString),"%4.1f*C", sensorData.temperatureInC);
-
-    sensorData.relativeHumidity = sht31.readHumidity();
-    snprintf(humidityString,sizeof(humidityString),"%4.1f%%", sensorData.relativeHumidity);
-
-    sensorData.stateOfCharge = int(System.batteryCharge());
-    snprintf(batteryString, sizeof(batteryString), "%i %%", sensorData.stateOfCharge);
-
-    // If lower temperature threshold is crossed, Set the flag true. 
-    if (sensorData.temperatureInC < alertsStatus.lowerTemperatureThreshold) {
-      alertsStatus.lowerTemperatureThresholdCrossed = true;
-      snprintf(thresholdMessage, sizeof(thresholdMessage), "Low Temp Alert %4.2f < %4.2f", sensorData.temperatureInC, alertsStatus.lowerTemperatureThreshold);
-      haveAnyAlertsBeenSet = true;
-    }
-
-    // If upper temperature threshold is crossed, Set the flag true. 
-    if (sensorData.temperatureInC > alertsStatus.upperTemperatureThreshold) {
-      alertsStatus.upperTemperatureThresholdCrossed = true;
-      snprintf(thresholdMessage, sizeof(thresholdMessage), "High Temp Alert %4.2f > %4.2f", sensorData.temperatureInC, alertsStatus.upperTemperatureThreshold);
-      haveAnyAlertsBeenSet = true;
-    }
-
-    // If lower humidity threshold is crossed, Set the flag true. 
-    if (sensorData.relativeHumidity < alertsStatus.lowerHumidityThreshold) {
-      alertsStatus.lowerHumidityThresholdCrossed = true;
-      snprintf(thresholdMessage, sizeof(thresholdMessage), "Low Humidity Alert %4.2f < %4.2f", sensorData.relativeHumidity, alertsStatus.lowerHumidityThreshold);
-      haveAnyAlertsBeenSet = true;
-    }
-
-    // If upper humidity threshold is crossed, Set the flag true. 
-    if (sensorData.relativeHumidity > alertsStatus.upperHumidityThreshold) {
-      alertsStatus.upperHumidityThresholdCrossed = true;
-      snprintf(thresholdMessage, sizeof(thresholdMessage), "High Humidity Alert %4.2f < %4.2f", sensorData.relativeHumidity, alertsStatus.upperHumidityThreshold);
-      haveAnyAlertsBeenSet = true;
-    }
-  }
-
-    getBatteryContext();                                                                    // Check what the battery is doing.
-
-    // Indicate that this is a valid data array and store it
-    sensorData.validData = true;
-    sensorData.timeStamp = Time.now();
-    sensorDataWriteNeeded = true;
-    alertsStatusWriteNeeded = true;  
-
-    if (haveAnyAlertsBeenSet) publishQueue.publish("Alerts", thresholdMessage,PRIVATE);
-
-    return haveAnyAlertsBeenSet;
-}
-
-// Function to Blink the LED for alerting. 
-void blinkLED(int LED)                                                                      // Non-blocking LED flashing routine
+void UbidotsHandler(const char *event, const char *data)                                    // The integration response - logged, as a replay has no cloud
 {
-  const int flashingFrequency = 1000;
-  static unsigned long lastStateChange = 0;
-
-  if (millis() - lastStateChange > flashingFrequency) {
-    digitalWrite(LED,!digitalRead(LED));
-    lastStateChange = millis();
-  }
+  inputLog.addText(InputLog::TEXT_WEBHOOK, (data) ? data : "", (data) ? strlen(data) : 0);
+  monitor.UbidotsHandler(event, data);
 }
 
-// These are the particle functions that allow you to configure and run the device
-// They are intended to allow for customization and control during installations
-// and to allow for management.
+// The input recorder. Everything the firmware reads that its own code does not decide goes through ParticleHal.h, which logs it
+// while the recorder is on (see InputLog.h) so host/replay.cpp can hand the same values back to FacilityMonitor in the same order.
 
-
-int measureNow(String command) // Function to force sending data in current hour
+int inputRecordCommand(String command)                                                      // "boot" resets and records from the boot, "stop" ends the recording
 {
-  if (command == "1") {
-    state = MEASURING_STATE;
-    return 1;
+  if (command.equalsIgnoreCase("boot")) {
+    inputRecordArm = inputRecordArmed;
+    inputRecordResetAt = millis();
+    publishQueue.publish("Mode","Recording inputs from the next boot - connect to USB serial", PRIVATE);
   }
-  else return 0;
-}
-
-int setVerboseMode(String command) // Function to force sending data in current hour
-{
-  if (command == "1")
-  {
-    sysStatus.verboseMode = true;
-    publishQueue.publish("Mode","Set Verbose Mode",PRIVATE);
-    sysStatusWriteNeeded = true;
-    return 1;
-  }
-  else if (command == "0")
-  {
-    sysStatus.verboseMode = false;
-    publishQueue.publish("Mode","Cleared Verbose Mode",PRIVATE);
-    sysStatusWriteNeeded = true;
-    return 1;
+  else if (command.equalsIgnoreCase("stop") && inputLog.isRecording()) {
+    inputLog.end();
+    publishQueue.publish("Mode","Stopped recording inputs", PRIVATE);
   }
   else return 0;
-}
-
-
-void publishStateTransition(void)
-{
-  char stateTransitionString[40];
-  snprintf(stateTransitionString, sizeof(stateTransitionString), "From %s to %s", stateNames[oldState],stateNames[state]);
-  oldState = state;
-  if(Particle.connected()) publishQueue.publish("State Transition",stateTransitionString, PRIVATE);
-}
-
-// These function will allow to change the upper and lower limits for alerting the customer. 
-
-int setUpperTempLimit(String value)
-{
-  alertsStatus.upperTemperatureThreshold = value.toFloat();
-  publishQueue.publish("Upper Temperature Threshold Set",String(value),PRIVATE);
-  updateThresholdValue();
-  return 1;
-}
-
-int setLowerTempLimit(String value)
-{
-  alertsStatus.lowerTemperatureThreshold = value.toFloat();
-  publishQueue.publish("Lower Temperature Threshold Set",String(value),PRIVATE);
-  updateThresholdValue();
-  return 1;
-
-}
-
-int setUpperHumidityLimit(String value)
-{
-  alertsStatus.upperHumidityThreshold = value.toFloat();
-  publishQueue.publish("Upper Humidity Threshold Set",String(value),PRIVATE);
-  updateThresholdValue();
-  return 1;
-}
-
-int setLowerHumidityLimit(String value)
-{
-  alertsStatus.lowerHumidityThreshold = value.toFloat();
-  publishQueue.publish("Lower Humidity Threshold Set",String(value),PRIVATE);
-  updateThresholdValue();
   return 1;
 }
 
-int setThirdPartySim(String command) // Function to force sending data in current hour
+void inputRecordWrite(const uint8_t *data, size_t len)                                      // Blocking - only used for the header, before the loop starts
 {
-  if (command == "1")
-  {
-    sysStatus.thirdPartySim = true;
-    Particle.keepAlive(sysStatus.keepAlive);                                                // Set the keep alive value
-    // keepAliveTimer.changePeriod(sysStatus.keepAlive*1000);                                  // Will start the repeating timer
-    if (Particle.connected()) publishQueue.publish("Mode","Set to 3rd Party Sim", PRIVATE);
-    sysStatusWriteNeeded = true;
-    return 1;
-  }
-  else if (command == "0")
-  {
-    sysStatus.thirdPartySim = false;
-    if (Particle.connected()) publishQueue.publish("Mode","Set to Particle Sim", PRIVATE);
-    sysStatusWriteNeeded = true;
-    return 1;
+  while (len) {
+    size_t sent = Serial.write(data, len);
+    if (!sent && !Serial.isConnected()) return;                                             // Terminal closed - the log is no use without all of its header
+    data += sent;
+    len -= sent;
   }
-  else return 0;
 }
 
-
-int setKeepAlive(String command)
+void startInputRecording()                                                                  // The header holds everything the run starts from - FRAM and retained RAM
 {
-  char * pEND;
-  char data[256];
-  int tempTime = strtol(command,&pEND,10);                                                  // Looks for the first integer and interprets it
-  if ((tempTime < 0) || (tempTime > 1200)) return 0;                                        // Make sure it falls in a valid range or send a "fail" result
-  sysStatus.keepAlive = tempTime;
-  Particle.keepAlive(sysStatus.keepAlive);                                                // Set the keep alive value
-  // keepAliveTimer.changePeriod(sysStatus.keepAlive*1000);                                  // Will start the repeating timer
-  snprintf(data, sizeof(data), "Keep Alive set to %i sec",sysStatus.keepAlive);
-  publishQueue.publish("Keep Alive",data, PRIVATE);
-  sysStatusWriteNeeded = true;                                                           // Need to store to FRAM back in the main loop
-  return 1;
+  inputRecordArm = 0;                                                                       // One recording per request - a reset during it does not start another
+  waitFor(Serial.isConnected, inputRecordHostWait);
+  if (!Serial.isConnected()) return;
+
+  uint8_t buf[64];
+  inputRecordWrite(buf, InputLogWriter::putMagic(buf));
+
+  fram.begin();
+  inputRecordWrite(buf, InputLogWriter::putSection(buf, InputLog::SECTION_FRAM, fram.length()));
+  for (size_t addr = 0; addr < fram.length(); addr += sizeof(buf)) {
+    fram.readData(addr, buf, sizeof(buf));
+    inputRecordWrite(buf, sizeof(buf));
+  }
+  inputRecordWrite(buf, InputLogWriter::putSection(buf, InputLog::SECTION_PUBLISH_QUEUE, sizeof(publishQueueRetainedBuffer)));
+  inputRecordWrite(publishQueueRetainedBuffer, sizeof(publishQueueRetainedBuffer));
+  inputRecordWrite(buf, InputLogWriter::putSection(buf, InputLog::SECTION_STALL_RECORD, sizeof(stallRecord)));
+  inputRecordWrite((const uint8_t *)&stallRecord, sizeof(stallRecord));
+  inputRecordWrite(buf, InputLogWriter::putSection(buf, InputLog::SECTION_TRACE_RING, sizeof(traceRing)));
+  inputRecordWrite((const uint8_t *)&traceRing, sizeof(traceRing));
+  inputRecordWrite(buf, InputLogWriter::putSection(buf, InputLog::SECTION_END, 0));
+
+  inputLog.begin();
+  inputLog.addMark(InputLog::MARK_SETUP);
 }
 
-// This function updates the threshold value string in the console. 
-void updateThresholdValue()
+void pumpInputLog()                                                                         // Called from the main loop - never blocks, the ring holds what USB cannot take yet
 {
-    snprintf(upperTemperatureThresholdString,sizeof(upperTemperatureThresholdString),"Temp_Max : %3.1f", alertsStatus.upperTemperatureThreshold);
-    snprintf(lowerTemperatureThresholdString,sizeof(lowerTemperatureThresholdString),"Temp_Min : %3.1f",alertsStatus.lowerTemperatureThreshold);
-    snprintf(upperHumidityThresholdString,sizeof(upperHumidityThresholdString),"Humidity_Max: %3.1f",alertsStatus.upperHumidityThreshold);
-    snprintf(lowerHumidityThresholdString,sizeof(lowerHumidityThresholdString),"Humidity_Min : %3.1f",alertsStatus.lowerHumidityThreshold);
-    alertsStatusWriteNeeded = true;                                                         // This function is called when there is a change so, we need to update the FRAM
-} 
-
-
-void getBatteryContext() 
-{
-  const char* batteryContext[7] ={"Unknown","Not Charging","Charging","Charged","Discharging","Fault","Diconnected"};
-  // Battery conect information - https://docs.particle.io/reference/device-os/firmware/boron/#batterystate-
-  sysStatus.batteryState = System.batteryState();
-  snprintf(batteryContextStr, sizeof(batteryContextStr),"%s", batteryContext[sysStatus.batteryState]);
-  sysStatusWriteNeeded = true;
+  size_t len;
+  const uint8_t *data = inputLog.peek(len);
+  while (len) {
+    int room = Serial.availableForWrite();
+    if (room <= 0) break;
+    inputLog.consume(Serial.write(data, (len < (size_t)room) ? len : (size_t)room));
+    data = inputLog.peek(len);
+  }
+  if (inputRecordResetAt && millis() - inputRecordResetAt > 2000) System.reset();          // Input-Record "boot" has had its response
 }
-
@@ -0,0 +1,526 @@
+// Host reader for the bulk dump the firmware sends over USB serial (src/BulkDump.h)
+//
+// Build and run from the top of the repository:
+//   g++ -O2 -Isrc tools/dump-reader.cpp src/BulkDump.cpp src/HistoryCodec.cpp src/TraceBuffer.cpp -o dump-reader
+//   ./dump-reader /dev/ttyACM0
+//   ./dump-reader -a site.vfa
+//
+// Pulls every section from the device, then asks for the manifest again and reads once more any
+// section that changed meanwhile, until one manifest matches everything read - so the ring heads in
+// the status section match the rings. A live section (the trace, the stall record) changes all the
+// time, so it is read once and kept as it was. A dropped frame or a timeout is asked for again from the last
+// good byte, and if the port goes away (a cable pulled, the device reset) it is opened again and the
+// section carries on from there. -d <bytes> closes and opens the port again after every so many bytes,
+// to try that out. host/host-firmware -p gives a pseudo terminal to read from without a device.
+//
+// The sections are written to <base>.vfa, a compact archive: "VFA1", then each section as its id, a
+// varint length and the bytes (as the header of an input log, src/InputLog.h), ending with a 0. The
+// rings are written oldest first without their unused slots, each history block only up to its last
+// reading (a length byte, then the bytes) and the trace as TraceBuffer::pack() writes it. Section 0x80
+// is the manifest header. The archive is then turned into <base>-readings.csv, -hourly.csv, -daily.csv,
+// -reports.csv and -trace.csv. -a does only that, for an archive read before.
+
+#include "BulkDump.h"
+#include "FacilityMonitor.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+static const uint32_t ARCHIVE_MAGIC = 0x31414656;				// "VFA1", little endian
+static const uint8_t ARCHIVE_END = 0;
+static const uint8_t ARCHIVE_INFO = 0x80;						// The MANIFEST payload up to the sections
+static const int frameTimeout = 2000;							// ms without a frame before asking again
+static const int retryLimit = 10;								// Requests in a row with nothing back
+static const int roundLimit = 5;								// Manifests before giving up on a still snapshot
+
+struct Section {
+	uint8_t id;
+	uint8_t flags;
+	uint32_t length;
+	uint32_t crc;
+	std::vector<uint8_t> data;
+	uint32_t crcRead;											// CRC of data
+	bool read;
+};
+
+struct Manifest {
+	uint8_t info[BulkDump::MANIFEST_HEADER_SIZE];
+	std::vector<Section> sections;
+};
+
+class Link {
+public:
+	Link(const char *path, uint64_t dropEvery) : path(path), dropEvery(dropEvery), parser(parseBuf, sizeof(parseBuf)) {};
+
+	bool open();
+	void reopen();
+	bool send(uint8_t type, uint8_t section, uint32_t offset);
+	int next(BulkDumpParser::Frame &frame);					// 1 for a frame, 0 for a timeout, -1 if the port went away
+	uint32_t getBadFrames() const { return badFrames + parser.getBadFrames(); };
+
+	uint64_t received = 0;
+	unsigned reopens = 0;
+
+protected:
+	const char *path;
+	uint64_t dropEvery;
+	uint64_t nextDrop = 0;
+	int fd = -1;
+	uint8_t in[4096];
+	size_t inLen = 0;
+	size_t inPos = 0;
+	uint8_t parseBuf[BulkDump::HEADER_SIZE + BulkDump::MAX_PAYLOAD + BulkDump::CRC_SIZE];
+	BulkDumpParser parser;
+	uint32_t badFrames = 0;										// Found by the parsers before the last open()
+};
+
+bool Link::open() {
+	for (int tries = 0; tries < 60; tries++) {					// Half a minute for the device to come back
+		fd = ::open(path, O_RDWR | O_NOCTTY);
+		if (fd >= 0) break;
+		usleep(500000);
+	}
+	if (fd < 0) {
+		perror(path);
+		return false;
+	}
+	struct termios raw;
+	if (!tcgetattr(fd, &raw)) {
+		cfmakeraw(&raw);
+		tcsetattr(fd, TCSANOW, &raw);
+		tcflush(fd, TCIFLUSH);									// Whatever was left from before
+	}
+	inLen = inPos = 0;
+	badFrames += parser.getBadFrames();
+	parser = BulkDumpParser(parseBuf, sizeof(parseBuf));
+	nextDrop = (dropEvery) ? received + dropEvery : 0;
+	return true;
+}
+
+void Link::reopen() {
+	if (fd >= 0) close(fd);
+	fd = -1;
+	reopens++;
+	if (!open()) exit(1);
+}
+
+bool Link::send(uint8_t type, uint8_t section, uint32_t offset) {
+	uint8_t buf[BulkDump::HEADER_SIZE + BulkDump::CRC_SIZE];
+	size_t len = BulkDump::putFrame(buf, type, section, offset, NULL, 0);
+	return write(fd, buf, len) == (ssize_t)len;
+}
+
+int Link::next(BulkDumpParser::Frame &frame) {
+	for (;;) {
+		while (inPos < inLen) {
+			if (parser.put(in[inPos++], frame)) return 1;
+		}
+		if (nextDrop && received >= nextDrop) return -1;		// As if the cable was pulled
+		struct pollfd pfd = {fd, POLLIN, 0};
+		int ready = poll(&pfd, 1, frameTimeout);
+		if (ready == 0) return 0;
+		ssize_t got = (ready > 0) ? read(fd, in, sizeof(in)) : -1;
+		if (got <= 0) return -1;
+		inLen = got;
+		inPos = 0;
+		received += got;
+	}
+}
+
+static bool readManifest(Link &link, Manifest &manifest) {
+	for (int tries = 0; tries < retryLimit; tries++) {
+		if (!link.send(BulkDump::REQ_MANIFEST, 0, 0)) {
+			link.reopen();
+			continue;
+		}
+		BulkDumpParser::Frame frame;
+		int result;
+		while ((result = link.next(frame)) > 0 && frame.type != BulkDump::MANIFEST);	// DATA still coming from before
+		if (result < 0) link.reopen();
+		if (result <= 0) continue;
+		if (frame.length < BulkDump::MANIFEST_HEADER_SIZE || frame.payload[0] != BulkDump::VERSION) {
+			fprintf(stderr, "Manifest version %u not known\n", frame.payload[0]);
+			return false;
+		}
+		memcpy(manifest.info, frame.payload, BulkDump::MANIFEST_HEADER_SIZE);
+		manifest.sections.clear();
+		for (size_t pos = BulkDump::MANIFEST_HEADER_SIZE; pos + BulkDump::MANIFEST_ENTRY_SIZE <= frame.length; pos += BulkDump::MANIFEST_ENTRY_SIZE) {
+			Section section = {};
+			section.id = frame.payload[pos];
+			section.flags = frame.payload[pos + 1];
+			section.length = BulkDump::getLittle32(&frame.payload[pos + 2]);
+			section.crc = BulkDump::getLittle32(&frame.payload[pos + 6]);
+			manifest.sections.push_back(section);
+		}
+		return true;
+	}
+	fprintf(stderr, "No manifest from the device\n");
+	return false;
+}
+
+static bool readSection(Link &link, Section &section) {
+	section.data.assign(section.length, 0);
+	uint32_t offset = 0;
+	int retries = 0;
+	bool asked = false;											// Asked again from offset and waiting for it to start - frames from before are ignored
+	if (!link.send(BulkDump::REQ_READ, section.id, 0)) link.reopen();
+	for (;;) {
+		BulkDumpParser::Frame frame;
+		int result = link.next(frame);
+		if (result <= 0) {
+			if (result < 0) link.reopen();
+			if (++retries > retryLimit) {
+				fprintf(stderr, "Gave up on %s at byte %u\n", BulkDump::sectionName(section.id), offset);
+				return false;
+			}
+			link.send(BulkDump::REQ_READ, section.id, offset);
+			asked = true;
+			continue;
+		}
+		if (frame.type == BulkDump::ERROR) {
+			fprintf(stderr, "Device: %.*s (%s)\n", frame.length, (const char *)frame.payload, BulkDump::sectionName(frame.section));
+			return false;
+		}
+		if (frame.section != section.id) continue;
+		if (frame.type == BulkDump::DATA && frame.offset == offset && offset + frame.length <= section.length) {
+			memcpy(&section.data[offset], frame.payload, frame.length);
+			offset += frame.length;
+			retries = 0;
+			asked = false;
+		}
+		else if (frame.type == BulkDump::SECTION_END && offset == section.length) break;
+		else if (!asked && (frame.type == BulkDump::DATA || frame.type == BulkDump::SECTION_END)) {	// A frame was lost
+			link.send(BulkDump::REQ_READ, section.id, offset);
+			asked = true;
+		}
+	}
+	section.crcRead = BulkDump::crc32(section.data.data(), section.data.size());
+	section.read = true;
+	return true;
+}
+
+static Section *findSection(Manifest &manifest, uint8_t id) {
+	for (Section &section : manifest.sections) {
+		if (section.id == id) return &section;
+	}
+	return NULL;
+}
+
+// Reads until a manifest matches every section held
+static bool readDevice(Link &link, Manifest &manifest) {
+	Manifest latest;
+	if (!readManifest(link, manifest)) return false;
+	for (int round = 0; round < roundLimit; round++) {
+		for (Section &section : manifest.sections) {
+			if (section.read && (section.crcRead == section.crc || (section.flags & BulkDump::FLAG_LIVE))) continue;
+			if (!readSection(link, section)) return false;
+			printf("%-8s %6u bytes%s\n", BulkDump::sectionName(section.id), section.length, (round) ? " (again - it changed)" : "");
+		}
+		if (!readManifest(link, latest)) return false;
+		bool still = true;
+		for (Section &section : manifest.sections) {
+			Section *now = findSection(latest, section.id);
+			if (!now || now->length != section.length) {
+				fprintf(stderr, "The sections changed size - the device was updated?\n");
+				return false;
+			}
+			section.crc = now->crc;
+			if (section.crcRead != section.crc && !(section.flags & BulkDump::FLAG_LIVE)) still = false;
+		}
+		memcpy(manifest.info, latest.info, sizeof(manifest.info));
+		if (still) return true;
+	}
+	fprintf(stderr, "Still changing after %d manifests - the archive may not be a consistent snapshot\n", roundLimit);
+	return true;
+}
+
+static void putVarint(std::vector<uint8_t> &out, uint32_t value) {
+	while (value >= 0x80) {
+		out.push_back((uint8_t)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((uint8_t)value);
+}
+
+static bool getVarint(const std::vector<uint8_t> &in, size_t &pos, uint32_t &value) {
+	value = 0;
+	for (int shift = 0; pos < in.size() && shift < 32; shift += 7) {
+		uint8_t byte = in[pos++];
+		value |= (uint32_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) return true;
+	}
+	return false;
+}
+
+static void putSection(std::vector<uint8_t> &out, uint8_t id, const std::vector<uint8_t> &data) {
+	out.push_back(id);
+	putVarint(out, data.size());
+	out.insert(out.end(), data.begin(), data.end());
+}
+
+// Copies count records of size bytes from a ring, oldest first
+static std::vector<uint8_t> linearize(const std::vector<uint8_t> &ring, size_t size, unsigned oldest, unsigned count) {
+	std::vector<uint8_t> out;
+	unsigned slots = ring.size() / size;
+	for (unsigned ii = 0; ii < count; ii++) {
+		const uint8_t *record = &ring[((oldest + ii) % slots) * size];
+		out.insert(out.end(), record, record + size);
+	}
+	return out;
+}
+
+static std::vector<uint8_t> makeArchive(Manifest &manifest) {
+	std::vector<uint8_t> archive;
+	for (int ii = 0; ii < 4; ii++) archive.push_back((uint8_t)(ARCHIVE_MAGIC >> (8 * ii)));
+	putSection(archive, ARCHIVE_INFO, std::vector<uint8_t>(manifest.info, manifest.info + sizeof(manifest.info)));
+
+	Section *status = findSection(manifest, BulkDump::SECTION_STATUS);
+	if (!status || status->data.size() < FRAM::reportLogAddr + sizeof(reportLog_structure)) return archive;
+	historyStatus_structure history;
+	reportLog_structure reportLog;
+	memcpy(&history, &status->data[FRAM::historyStatusAddr], sizeof(history));
+	memcpy(&reportLog, &status->data[FRAM::reportLogAddr], sizeof(reportLog));
+
+	for (Section &section : manifest.sections) {
+		std::vector<uint8_t> out;
+		const std::vector<uint8_t> &data = section.data;
+		switch (section.id) {
+		case BulkDump::SECTION_HISTORY: {
+			unsigned blocks = data.size() / HistoryBlock::SIZE;
+			unsigned used = (history.used < blocks) ? history.used : blocks;
+			for (unsigned ii = 0; blocks && ii < used; ii++) {		// The raw ring's head is the block being filled - it is the newest
+				const uint8_t *block = &data[((history.head + blocks - used + 1 + ii) % blocks) * HistoryBlock::SIZE];
+				HistoryBlockDecoder decoder(block);
+				HistoryReading reading;
+				while (decoder.next(reading));
+				size_t len = HistoryBlock::HEADER_SIZE + (decoder.getBitPos() + 7) / 8;
+				if (len > HistoryBlock::SIZE) len = HistoryBlock::SIZE;
+				out.push_back((uint8_t)len);
+				out.insert(out.end(), block, block + len);
+			}
+			break;
+		}
+		case BulkDump::SECTION_HOURLY:
+		case BulkDump::SECTION_DAILY: {
+			unsigned slots = data.size() / sizeof(RollupRecord);
+			uint8_t head = (section.id == BulkDump::SECTION_HOURLY) ? history.hourlyHead : history.dailyHead;
+			uint8_t used = (section.id == BulkDump::SECTION_HOURLY) ? history.hourlyUsed : history.dailyUsed;
+			if (used > slots) used = slots;
+			if (slots) out = linearize(data, sizeof(RollupRecord), (head + slots - used) % slots, used);
+			break;
+		}
+		case BulkDump::SECTION_REPORTS: {
+			unsigned slots = data.size() / sizeof(reportRecord_structure);
+			unsigned used = (reportLog.used < slots) ? reportLog.used : slots;
+			if (slots) out = linearize(data, sizeof(reportRecord_structure), (reportLog.head + slots - used) % slots, used);
+			break;
+		}
+		case BulkDump::SECTION_TRACE: {
+			TraceBuffer::Ring ring;
+			if (data.size() != sizeof(ring)) break;
+			memcpy(&ring, data.data(), sizeof(ring));
+			if (ring.magic != TraceBuffer::MAGIC) break;
+			TraceBuffer trace(ring);
+			out.resize(TraceBuffer::HEADER_SIZE + TraceBuffer::CAPACITY * TraceBuffer::RECORD_SIZE);
+			out.resize(trace.pack(out.data(), out.size(), BulkDump::getLittle32(&manifest.info[6]), BulkDump::getLittle32(&manifest.info[2])));
+			break;
+		}
+		default:
+			out = data;												// Status and the stall record as they are
+			break;
+		}
+		putSection(archive, section.id, out);
+	}
+	archive.push_back(ARCHIVE_END);
+	return archive;
+}
+
+static FILE *openCsv(const char *base, const char *name, const char *header) {
+	char path[512];
+	snprintf(path, sizeof(path), "%s-%s.csv", base, name);
+	FILE *fp = fopen(path, "w");
+	if (!fp) {
+		perror(path);
+		exit(1);
+	}
+	fprintf(fp, "%s\n", header);
+	return fp;
+}
+
+static void formatTime(uint32_t time, char *buf, size_t size) {
+	time_t t = time;
+	strftime(buf, size, "%Y-%m-%d %H:%M:%S", gmtime(&t));
+}
+
+static void writeRollups(const char *base, const char *name, const std::vector<uint8_t> &data) {
+	FILE *fp = openCsv(base, name, "start,min C,max C,mean C,mkt C,min %RH,max %RH,mean %RH,readings");
+	for (size_t pos = 0; pos + sizeof(RollupRecord) <= data.size(); pos += sizeof(RollupRecord)) {
+		RollupRecord record;
+		memcpy(&record, &data[pos], sizeof(record));
+		char when[32];
+		formatTime(record.startTime, when, sizeof(when));
+		fprintf(fp, "%s,%.1f,%.1f,%.1f,%.1f,%u,%u,%u,%u\n", when, record.minTemperature / 10.0, record.maxTemperature / 10.0,
+			record.meanTemperature / 10.0, record.mktTemperature / 10.0, record.minHumidity, record.maxHumidity, record.meanHumidity, record.count);
+	}
+	fclose(fp);
+}
+
+// Alerts are judged against the thresholds in the status section - a threshold profile window isn't taken into account
+static const char *alertFor(const reportRecord_structure &report, const alertsStatus_structure &alerts) {
+	if (report.temperature / 10.0 > alerts.upperTemperatureThreshold) return "temperature high";
+	if (report.temperature / 10.0 < alerts.lowerTemperatureThreshold) return "temperature low";
+	if (report.humidity / 10.0 > alerts.upperHumidityThreshold) return "humidity high";
+	if (report.humidity / 10.0 < alerts.lowerHumidityThreshold) return "humidity low";
+	return "";
+}
+
+static bool writeCsv(const std::vector<uint8_t> &archive, const char *base) {
+	if (archive.size() < 4 || BulkDump::getLittle32(archive.data()) != ARCHIVE_MAGIC) {
+		fprintf(stderr, "Not an archive\n");
+		return false;
+	}
+	std::vector<uint8_t> sections[256];
+	size_t pos = 4;
+	uint8_t id;
+	while (pos < archive.size() && (id = archive[pos++]) != ARCHIVE_END) {
+		uint32_t len;
+		if (!getVarint(archive, pos, len) || len > archive.size() - pos) {
+			fprintf(stderr, "Archive cut short\n");
+			return false;
+		}
+		sections[id].assign(archive.begin() + pos, archive.begin() + pos + len);
+		pos += len;
+	}
+
+	const std::vector<uint8_t> &info = sections[ARCHIVE_INFO];
+	if (info.size() >= BulkDump::MANIFEST_HEADER_SIZE) {
+		char when[32] = "time not set";
+		if (BulkDump::getLittle32(&info[2])) formatTime(BulkDump::getLittle32(&info[2]), when, sizeof(when));
+		printf("Release %.8s, read %s UTC, up %u s\n", (const char *)&info[10], when, BulkDump::getLittle32(&info[6]) / 1000);
+	}
+
+	FILE *fp = openCsv(base, "readings", "time,C,%RH");
+	unsigned readings = 0;
+	const std::vector<uint8_t> &history = sections[BulkDump::SECTION_HISTORY];
+	for (pos = 0; pos < history.size() && pos + 1 + history[pos] <= history.size(); pos += 1 + history[pos]) {
+		uint8_t block[HistoryBlock::SIZE] = {};
+		memcpy(block, &history[pos + 1], (history[pos] < sizeof(block)) ? history[pos] : sizeof(block));
+		HistoryBlockDecoder decoder(block);
+		HistoryReading reading;
+		while (decoder.next(reading)) {
+			char when[32];
+			formatTime(reading.time, when, sizeof(when));
+			fprintf(fp, "%s,%.1f,%.1f\n", when, reading.temperature / 10.0, reading.humidity / 10.0);
+			readings++;
+		}
+	}
+	fclose(fp);
+
+	writeRollups(base, "hourly", sections[BulkDump::SECTION_HOURLY]);
+	writeRollups(base, "daily", sections[BulkDump::SECTION_DAILY]);
+
+	alertsStatus_structure alerts = {};
+	const std::vector<uint8_t> &status = sections[BulkDump::SECTION_STATUS];
+	if (status.size() >= FRAM::alertStatusAddr + sizeof(alerts)) memcpy(&alerts, &status[FRAM::alertStatusAddr], sizeof(alerts));
+	fp = openCsv(base, "reports", "seq,time,C,%RH,battery %,signal %,acked,alert");
+	const std::vector<uint8_t> &reports = sections[BulkDump::SECTION_REPORTS];
+	for (pos = 0; pos + sizeof(reportRecord_structure) <= reports.size(); pos += sizeof(reportRecord_structure)) {
+		reportRecord_structure report;
+		memcpy(&report, &reports[pos], sizeof(report));
+		char when[32];
+		formatTime(report.timeStamp, when, sizeof(when));
+		fprintf(fp, "%u,%s,%.1f,%.1f,%d,%d,%u,%s\n", report.seq, when, report.temperature / 10.0, report.humidity / 10.0,
+			report.battery, report.signal, report.acked, alertFor(report, alerts));
+	}
+	fclose(fp);
+
+	fp = openCsv(base, "trace", "millis,time,event,a,b");
+	const std::vector<uint8_t> &trace = sections[BulkDump::SECTION_TRACE];
+	if (trace.size() >= TraceBuffer::HEADER_SIZE) {
+		uint32_t nowMillis = BulkDump::getLittle32(&trace[4]);
+		uint32_t nowTime = BulkDump::getLittle32(&trace[8]);
+		size_t count = (trace.size() - TraceBuffer::HEADER_SIZE) / TraceBuffer::RECORD_SIZE;
+		size_t lastBoot = 0;										// Only records since the last boot can be given a time
+		for (size_t ii = 0; ii < count; ii++) {
+			if (trace[TraceBuffer::HEADER_SIZE + ii * TraceBuffer::RECORD_SIZE + 4] == TRACE_BOOT) lastBoot = ii;
+		}
+		for (size_t ii = 0; ii < count; ii++) {
+			const uint8_t *p = &trace[TraceBuffer::HEADER_SIZE + ii * TraceBuffer::RECORD_SIZE];
+			uint32_t millis = BulkDump::getLittle32(p);
+			char when[32] = "";
+			if (ii >= lastBoot && nowTime) formatTime(nowTime - (nowMillis - millis) / 1000, when, sizeof(when));
+			fprintf(fp, "%u,%s,%s,%u,%u\n", millis, when, (p[4] < TRACE_EVENT_COUNT) ? traceEventNames[p[4]] : "?", p[5], p[6] | (p[7] << 8));
+		}
+	}
+	fclose(fp);
+
+	printf("%u readings, %zu hourly and %zu daily rollups, %zu reports\n", readings, sections[BulkDump::SECTION_HOURLY].size() / sizeof(RollupRecord),
+		sections[BulkDump::SECTION_DAILY].size() / sizeof(RollupRecord), reports.size() / sizeof(reportRecord_structure));
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	const char *base = "dump";
+	const char *archivePath = NULL;
+	uint64_t dropEvery = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "o:d:a:")) != -1) {
+		switch (opt) {
+		case 'o': base = optarg; break;
+		case 'd': dropEvery = strtoull(optarg, NULL, 10); break;
+		case 'a': archivePath = optarg; break;
+		default:
+			fprintf(stderr, "usage: %s [-o base] [-d bytes] port\n       %s -a archive.vfa [-o base]\n", argv[0], argv[0]);
+			return 1;
+		}
+	}
+
+	std::vector<uint8_t> archive;
+	if (archivePath) {
+		FILE *fp = fopen(archivePath, "rb");
+		if (!fp) {
+			perror(archivePath);
+			return 1;
+		}
+		uint8_t buf[4096];
+		size_t got;
+		while ((got = fread(buf, 1, sizeof(buf), fp)) > 0) archive.insert(archive.end(), buf, buf + got);
+		fclose(fp);
+		return (writeCsv(archive, base)) ? 0 : 1;
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "usage: %s [-o base] [-d bytes] port\n", argv[0]);
+		return 1;
+	}
+
+	Link link(argv[optind], dropEvery);
+	if (!link.open()) return 1;
+	auto start = std::chrono::steady_clock::now();
+	Manifest manifest;
+	if (!readDevice(link, manifest)) return 1;
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	size_t raw = 0;
+	for (const Section &section : manifest.sections) raw += section.length;
+	printf("%zu bytes in %.2f s (%.0f kB/s on the wire), %u bad frames, port opened again %u times\n", raw, seconds,
+		link.received / 1024.0 / seconds, link.getBadFrames(), link.reopens);
+
+	archive = makeArchive(manifest);
+	char path[512];
+	snprintf(path, sizeof(path), "%s.vfa", base);
+	FILE *fp = fopen(path, "wb");
+	if (!fp || fwrite(archive.data(), 1, archive.size(), fp) != archive.size()) {
+		perror(path);
+		return 1;
+	}
+	fclose(fp);
+	printf("%s: %zu bytes\n", path, archive.size());
+	return (writeCsv(archive, base)) ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+// Host benchmark for the history compression in src/HistoryCodec.cpp
+//
+// Build and run from the top of the repository:
+//   g++ -O2 -Isrc tools/history-bench.cpp src/HistoryCodec.cpp -o history-bench
+//   ./history-bench trace.csv
+//
+// The trace is a CSV of "time,temperature,humidity" (Unix time, degrees C, %RH), one reading per
+// line - for example the device's readings exported from Ubidots. Lines that don't parse (such as a
+// header) are skipped. With no file, a synthetic week of 20 minute readings is used instead.
+//
+// Reports the compression ratio against the 12 byte records the readings would take uncompressed
+// (a uint32_t time and two floats), the encode and decode speed, and checks every reading decodes
+// back to what went in.
+
+#include "HistoryCodec.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static std::vector<HistoryReading> loadTrace(const char *path) {
+	std::vector<HistoryReading> trace;
+	FILE *fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		exit(1);
+	}
+	char line[256];
+	while(fgets(line, sizeof(line), fp)) {
+		unsigned long time;
+		double temperature, humidity;
+		if (sscanf(line, "%lu,%lf,%lf", &time, &temperature, &humidity) == 3) {
+			trace.push_back({(uint32_t)time, (int16_t)lround(temperature * 10), (int16_t)lround(humidity * 10)});
+		}
+	}
+	fclose(fp);
+	return trace;
+}
+
+// A fridge at about 5 C cycling slowly, with sensor noise, a defrost every 6 hours and the odd missed report
+static std::vector<HistoryReading> syntheticTrace() {
+	std::vector<HistoryReading> trace;
+	srand(1);
+	uint32_t time = 1700000000;
+	for(int ii = 0; ii < 7 * 72; ii++) {
+		double temperature = 5.0 + 0.8 * sin(ii / 9.0) + (rand() % 3 - 1) * 0.1;
+		double humidity = 45.0 + 3.0 * sin(ii / 30.0) + (rand() % 5 - 2) * 0.1;
+		if (ii % 18 == 0) {
+			temperature += 4.0;
+		}
+		trace.push_back({time, (int16_t)lround(temperature * 10), (int16_t)lround(humidity * 10)});
+		time += (rand() % 50 == 0) ? 2400 : 1200;
+	}
+	return trace;
+}
+
+int main(int argc, char *argv[]) {
+	std::vector<HistoryReading> trace = (argc > 1) ? loadTrace(argv[1]) : syntheticTrace();
+	if (trace.empty()) {
+		printf("no readings\n");
+		return 1;
+	}
+
+	const int repeats = 200;
+	std::vector<uint8_t> blocks;
+
+	auto encodeStart = std::chrono::steady_clock::now();
+	for(int rep = 0; rep < repeats; rep++) {
+		blocks.assign(HistoryBlock::SIZE, 0);
+		HistoryBlockEncoder encoder;
+		encoder.begin(&blocks[0]);
+		for(const HistoryReading &reading : trace) {
+			if (!encoder.add(reading)) {
+				blocks.resize(blocks.size() + HistoryBlock::SIZE);
+				encoder.begin(&blocks[blocks.size() - HistoryBlock::SIZE]);
+				encoder.add(reading);
+			}
+		}
+	}
+	auto encodeEnd = std::chrono::steady_clock::now();
+
+	size_t decoded = 0;
+	bool match = true;
+	auto decodeStart = std::chrono::steady_clock::now();
+	for(int rep = 0; rep < repeats; rep++) {
+		decoded = 0;
+		for(size_t offset = 0; offset < blocks.size(); offset += HistoryBlock::SIZE) {
+			HistoryBlockDecoder decoder(&blocks[offset]);
+			HistoryReading reading;
+			while(decoder.next(reading)) {
+				const HistoryReading &expected = trace[decoded++];
+				if (reading.time != expected.time || reading.temperature != expected.temperature || reading.humidity != expected.humidity) {
+					match = false;
+				}
+			}
+		}
+	}
+	auto decodeEnd = std::chrono::steady_clock::now();
+
+	double encodeNs = std::chrono::duration<double, std::nano>(encodeEnd - encodeStart).count() / repeats / trace.size();
+	double decodeNs = std::chrono::duration<double, std::nano>(decodeEnd - decodeStart).count() / repeats / trace.size();
+	size_t rawBytes = trace.size() * 12;
+
+	printf("readings:     %zu\n", trace.size());
+	printf("blocks:       %zu (%zu bytes)\n", blocks.size() / HistoryBlock::SIZE, blocks.size());
+	printf("per block:    %.1f readings\n", (double)trace.size() / (blocks.size() / HistoryBlock::SIZE));
+	printf("ratio:        %.2fx (%zu raw bytes)\n", (double)rawBytes / blocks.size(), rawBytes);
+	printf("encode:       %.1f ns/reading\n", encodeNs);
+	printf("decode:       %.1f ns/reading\n", decodeNs);
+	printf("round trip:   %s\n", (match && decoded == trace.size()) ? "ok" : "MISMATCH");
+	return (match && decoded == trace.size()) ? 0 : 1;
+}
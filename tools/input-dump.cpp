@@ -0,0 +1,103 @@
+// Host dump of an input log recorded by the firmware's Input-Record function (src/InputLog.h)
+//
+// Build and run from the top of the repository:
+//   g++ -O2 -Isrc tools/input-dump.cpp src/InputLog.cpp -o input-dump
+//   ./input-dump run.vfr
+//
+// Capture the log with the serial port in raw mode, for example on Linux:
+//   stty -F /dev/ttyACM0 raw -echo && cat /dev/ttyACM0 > run.vfr
+// then call Input-Record with "boot" and, once the run is long enough, "stop". Anything before the
+// magic number (a terminal's leftovers) is skipped. Prints the header sections, one line per record
+// and then how many bytes each type of record took, so the cost of the recorder can be checked.
+
+#include "InputLog.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static const char *sectionNames[] = {"end", "FRAM", "publish queue", "stall record", "trace ring"};
+
+static void printSection(uint8_t id, const uint8_t *data, size_t len, void *context) {
+	printf("section %-14s %6zu bytes\n", (id < sizeof(sectionNames) / sizeof(sectionNames[0])) ? sectionNames[id] : "?", len);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s run.vfr\n", argv[0]);
+		return 1;
+	}
+	FILE *fp = fopen(argv[1], "rb");
+	if (!fp) {
+		perror(argv[1]);
+		return 1;
+	}
+	std::vector<uint8_t> log;
+	uint8_t buf[4096];
+	size_t got;
+	while ((got = fread(buf, 1, sizeof(buf), fp)) > 0) log.insert(log.end(), buf, buf + got);
+	fclose(fp);
+
+	size_t start = 0;
+	for (; start + 4 <= log.size(); start++) {
+		uint32_t magic = log[start] | (log[start + 1] << 8) | (log[start + 2] << 16) | ((uint32_t)log[start + 3] << 24);
+		if (magic == InputLog::MAGIC) break;
+	}
+	if (start + 4 > log.size()) {
+		fprintf(stderr, "No input log found\n");
+		return 1;
+	}
+
+	InputLogReader reader(&log[start], log.size() - start);
+	if (!reader.readHeader(printSection, NULL)) {
+		fprintf(stderr, "Header is cut short\n");
+		return 1;
+	}
+	size_t headerSize = reader.getOffset();
+
+	size_t typeBytes[8] = {0}, typeCount[8] = {0};
+	unsigned loops = 0;
+	bool ended = false;
+	InputLogReader::Record record;
+	size_t offset = reader.getOffset();
+	while (reader.next(record)) {
+		typeBytes[record.type] += reader.getOffset() - offset;
+		typeCount[record.type]++;
+		offset = reader.getOffset();
+
+		printf("%-7s ", InputLog::typeName(record.type));
+		switch (record.type) {
+		case InputLog::MILLIS:
+		case InputLog::TIME:
+			printf("%u\n", record.value);
+			break;
+		case InputLog::FLAG:
+			printf("%-16s %s\n", InputLog::kindName(record.type, record.kind), (record.value) ? "true" : "false");
+			break;
+		case InputLog::NUMBER:
+			printf("%-16s %d\n", InputLog::kindName(record.type, record.kind), record.number);
+			break;
+		case InputLog::REAL:
+			printf("%-16s %.9g\n", InputLog::kindName(record.type, record.kind), record.real);
+			break;
+		case InputLog::TEXT:
+			printf("%-16s \"%.*s\"\n", InputLog::kindName(record.type, record.kind), (int)record.textLen, record.text);
+			break;
+		case InputLog::MARK:
+			printf("%s\n", InputLog::kindName(record.type, record.kind));
+			if (record.kind == InputLog::MARK_LOOP) loops++;
+			if (record.kind == InputLog::MARK_END || record.kind == InputLog::MARK_OVERFLOW) ended = true;
+			break;
+		}
+		if (ended) break;
+	}
+	if (!ended) printf("(log is cut short at byte %zu)\n", start + reader.getOffset());
+
+	size_t recordBytes = reader.getOffset() - headerSize;
+	printf("\n%zu header bytes, %zu record bytes, %u loop passes (%.1f bytes a pass)\n", headerSize, recordBytes, loops,
+		(loops) ? (double)recordBytes / loops : 0.0);
+	for (int type = InputLog::MILLIS; type <= InputLog::MARK; type++) {
+		if (typeCount[type]) printf("  %-7s %8zu records %8zu bytes\n", InputLog::typeName(type), typeCount[type], typeBytes[type]);
+	}
+	return 0;
+}
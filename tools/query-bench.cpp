@@ -0,0 +1,99 @@
+// Host benchmark for the time lookups in src/HistoryIndex.cpp
+//
+// Build and run from the top of the repository:
+//   g++ -O2 -Isrc tools/query-bench.cpp src/HistoryIndex.cpp -o query-bench
+//   ./query-bench
+//
+// For rings the size of each history tier in FacilityMonitor.h (and a larger one for comparison)
+// this times finding the start of a range with HistoryIndex against a linear scan, and counts how
+// many entries each one looks at. On the device every entry looked at in a rollup tier is an FRAM
+// read, so the count matters more than the time. The rings have gaps in them, as the real history
+// does after an outage.
+
+#include "FacilityMonitor.h"
+#include "HistoryIndex.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+struct Ring {
+	std::vector<uint32_t> times;	// In ring order - the oldest is at oldest
+	uint16_t oldest;
+	unsigned long probes;
+};
+
+static uint32_t timeAt(uint16_t index, void *context) {
+	Ring *ring = (Ring *)context;
+	ring->probes++;
+	return ring->times[(ring->oldest + index) % ring->times.size()];
+}
+
+static uint16_t linearFind(Ring &ring, uint32_t time) {
+	uint16_t count = ring.times.size();
+	for(uint16_t ii = 0; ii < count; ii++) {
+		if (timeAt(ii, &ring) >= time) {
+			return ii;
+		}
+	}
+	return count;
+}
+
+static Ring makeRing(uint16_t count, uint32_t period) {
+	Ring ring;
+	ring.times.resize(count);
+	ring.oldest = count / 3;			// Part way round, as it is once the ring has wrapped
+	ring.probes = 0;
+	uint32_t time = 1700000000;
+	for(uint16_t ii = 0; ii < count; ii++) {
+		ring.times[(ring.oldest + ii) % count] = time;
+		time += (rand() % 20 == 0) ? period * (2 + rand() % 10) : period;
+	}
+	return ring;
+}
+
+static void bench(const char *name, uint16_t count, uint32_t period) {
+	srand(1);
+	Ring ring = makeRing(count, period);
+	uint32_t first = timeAt(0, &ring);
+	uint32_t last = timeAt(count - 1, &ring);
+
+	const int queries = 100000;
+	std::vector<uint32_t> targets(queries);
+	for(int ii = 0; ii < queries; ii++) {
+		targets[ii] = first + (uint32_t)(((uint64_t)rand() * (last - first)) / RAND_MAX);
+	}
+
+	bool match = true;
+	ring.probes = 0;
+	auto start = std::chrono::steady_clock::now();
+	unsigned long sum = 0;
+	for(int ii = 0; ii < queries; ii++) {
+		sum += HistoryIndex::lowerBound(count, targets[ii], timeAt, &ring);
+	}
+	auto mid = std::chrono::steady_clock::now();
+	unsigned long searchProbes = ring.probes;
+
+	ring.probes = 0;
+	unsigned long linearSum = 0;
+	for(int ii = 0; ii < queries; ii++) {
+		linearSum += linearFind(ring, targets[ii]);
+	}
+	auto end = std::chrono::steady_clock::now();
+	unsigned long linearProbes = ring.probes;
+	match = (sum == linearSum);
+
+	printf("%-8s %5u entries  search %6.1f ns %5.1f reads   scan %8.1f ns %7.1f reads   %s\n", name, count,
+		std::chrono::duration<double, std::nano>(mid - start).count() / queries, (double)searchProbes / queries,
+		std::chrono::duration<double, std::nano>(end - mid).count() / queries, (double)linearProbes / queries,
+		match ? "ok" : "MISMATCH");
+}
+
+int main() {
+	bench("raw", FacilityMonitor::historyBlocks, 40 * 60);		// A block holds about 40 one minute readings
+	bench("hourly", FacilityMonitor::hourlyRecords, 3600);
+	bench("daily", FacilityMonitor::dailyRecords, 86400);
+	bench("large", 8192, 3600);
+	return 0;
+}
@@ -0,0 +1,266 @@
+// Host benchmark for the retained publish queue storage in lib/PublishQueueAsyncRK/src/PublishQueueRing.cpp
+//
+// Build and run from the top of the repository:
+//   g++ -O2 -Ilib/PublishQueueAsyncRK/src tools/queue-bench.cpp lib/PublishQueueAsyncRK/src/PublishQueueRing.cpp -o queue-bench
+//   ./queue-bench
+//
+// For a range of buffer sizes this times the three things the queue does - queue an event when the
+// buffer is full (dropping the oldest), the same while the oldest is being sent (dropping the second
+// oldest), and send one (copy out the oldest and drop it) - for PublishQueueRing against the packed
+// layout it replaced, where every drop moved the rest of the buffer down. Every event goes to the normal
+// priority, and the packed layout is given the room the ring's blocks would have, so both are given the
+// same events and must send the same ones in the same order.
+//
+// It then counts the bytes each would move over the I2C bus per event sent with the queue in FRAM
+// (PublishQueueAsyncFRAM): PublishQueueFRAMRing against the packed layout's fram.moveData() of the
+// rest of the queue. The ring reads the event, the links of the blocks it is in and the free list's
+// last one, and writes its header; while more events are queued than PUBLISH_QUEUE_INDEX_SIZE, it
+// also reads 8 bytes for the size of one more.
+
+#include "PublishQueueRing.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// The packed layout PublishQueueAsyncRetained and PublishQueueAsyncFRAM used before - events from the
+// start of the buffer, in order. busBytes counts what the FRAM version read and wrote. It holds what
+// the given number of the ring's blocks would: the events, starting where the oldest would in its block.
+class PackedQueue {
+public:
+	PackedQueue(uint8_t *buf, uint16_t size, uint16_t blocks) : buf(buf), size(size), blocks(blocks) {
+		header = reinterpret_cast<PublishQueueHeader *>(buf);
+		header->numEvents = 0;
+		nextFree = &buf[sizeof(PublishQueueHeader)];
+	}
+
+	bool push(const char *eventName, const char *data, int ttl, uint8_t flags, bool keepOldest) {
+		size_t len = PublishQueueRing::eventSize(eventName, data);
+		if ((len + BLOCK_SIZE - 1) / BLOCK_SIZE > blocks) return false;
+		while(true) {
+			size_t used = headOffset + (nextFree - &buf[sizeof(PublishQueueHeader)]) + len;
+			if ((used + BLOCK_SIZE - 1) / BLOCK_SIZE <= blocks && (size_t)(&buf[size] - nextFree) >= len) {
+				PublishQueueEventData *event = reinterpret_cast<PublishQueueEventData *>(nextFree);
+				event->ttl = ttl;
+				event->flags = flags;
+				char *cp = reinterpret_cast<char *>(nextFree) + sizeof(PublishQueueEventData);
+				strcpy(cp, eventName);
+				strcpy(cp + strlen(eventName) + 1, data);
+				nextFree += len;
+				header->numEvents++;
+				busBytes += len + sizeof(PublishQueueHeader);
+				return true;
+			}
+			if (!discard(keepOldest)) return false;
+		}
+	}
+
+	bool front(uint8_t *out) {
+		if (!header->numEvents) return false;
+		uint8_t *start = &buf[sizeof(PublishQueueHeader)];
+		memcpy(out, start, skipEvent(start) - start);				// The old code handed out a pointer - copied here to compare
+		return true;
+	}
+
+	bool discard(bool secondEvent) {
+		uint8_t *start = &buf[sizeof(PublishQueueHeader)];
+		if (header->numEvents < ((secondEvent) ? 2 : 1)) return false;
+		if (secondEvent) start = skipEvent(start);
+		uint8_t *next = skipEvent(start);
+		memmove(start, next, &buf[size] - next);
+		busBytes += 2 * (nextFree - next) + sizeof(PublishQueueHeader);	// moveData() reads and writes the rest of the queue
+		nextFree -= next - start;
+		header->numEvents--;
+		headOffset = (header->numEvents) ? (headOffset + (next - start)) % BLOCK_SIZE : 0;	// As the ring's oldest event moves on
+		return true;
+	}
+
+	uint16_t getNumEvents() const { return header->numEvents; };
+
+	uint64_t busBytes = 0;
+
+protected:
+	uint8_t *skipEvent(uint8_t *start) {
+		size_t count = &buf[size] - start;
+		busBytes += (count < PublishQueueRing::EVENT_BUF_SIZE) ? count : PublishQueueRing::EVENT_BUF_SIZE;	// Reads as much as an event could be
+		start += sizeof(PublishQueueEventData);
+		start += strlen(reinterpret_cast<char *>(start)) + 1;
+		start += strlen(reinterpret_cast<char *>(start)) + 1;
+		size_t offset = start - buf;
+		if ((offset % 4) != 0) start += 4 - (offset % 4);
+		return start;
+	}
+
+	static const size_t BLOCK_SIZE = PUBLISH_QUEUE_BLOCK_SIZE;
+
+	uint8_t *buf;
+	uint16_t size;
+	uint16_t blocks;
+	size_t headOffset = 0;
+	PublishQueueHeader *header;
+	uint8_t *nextFree;
+};
+
+// The blocks a ring of this size has, each with its link
+static uint16_t ringBlocks(uint16_t size) {
+	return (size - sizeof(PublishQueueRingHeader)) / (PUBLISH_QUEUE_BLOCK_SIZE + sizeof(uint16_t));
+}
+
+// Stands for PublishQueueFRAMRing - the events in a separate store, counting the bytes that go over the bus
+class CountingRing : public PublishQueueRing {
+public:
+	CountingRing(uint16_t size) : PublishQueueRing(&storeHeader, size - sizeof(PublishQueueRingHeader)), store(capacity) {
+		storeHeader.magic = 0;
+		begin(size);
+	}
+
+	mutable uint64_t busBytes = 0;
+
+protected:
+	virtual void write(uint16_t offset, const void *src, size_t len) {
+		memcpy(&store[offset], src, len);
+		busBytes += len;
+	}
+
+	virtual void read(uint16_t offset, void *dst, size_t len) const {
+		memcpy(dst, &store[offset], len);
+		busBytes += len;
+	}
+
+	virtual void saveHeader() {
+		busBytes += sizeof(PublishQueueRingHeader);
+	}
+
+	PublishQueueRingHeader storeHeader;
+	std::vector<uint8_t> store;
+};
+
+struct Event {
+	std::string name;
+	std::string data;
+};
+
+static std::vector<Event> makeEvents(size_t count) {
+	std::vector<Event> events(count);
+	for(size_t ii = 0; ii < count; ii++) {
+		events[ii].name = (ii % 7) ? "Ubidots-Hook-v1" : "Alerts";
+		size_t len = 40 + rand() % 160;								// About the size of a report
+		events[ii].data.assign(len, 'a' + ii % 26);
+	}
+	return events;
+}
+
+struct Timing {
+	double queueNs;
+	double queueSendingNs;
+	double sendNs;
+	unsigned long hash;												// Of the events sent, in order
+};
+
+template<class Queue> static Timing run(Queue &queue, const std::vector<Event> &events, int rounds) {
+	Timing timing = {};
+	uint32_t out[(PublishQueueRing::EVENT_BUF_SIZE + 3) / 4];
+	size_t next = 0;
+	auto push = [&](bool keepOldest) {
+		const Event &event = events[next++ % events.size()];
+		queue.push(event.name.c_str(), event.data.c_str(), 60, 1, keepOldest);
+	};
+	for(int ii = 0; ii < 1000; ii++) push(false);					// Full from here on
+
+	auto start = std::chrono::steady_clock::now();
+	for(int ii = 0; ii < rounds; ii++) push(false);
+	queue.front(reinterpret_cast<uint8_t *>(out));					// The oldest is being sent from here
+	auto mid = std::chrono::steady_clock::now();
+	for(int ii = 0; ii < rounds; ii++) push(true);
+	auto end = std::chrono::steady_clock::now();
+	timing.queueNs = std::chrono::duration<double, std::nano>(mid - start).count() / rounds;
+	timing.queueSendingNs = std::chrono::duration<double, std::nano>(end - mid).count() / rounds;
+
+	// Send one and queue one, so sends are timed with a full buffer
+	std::chrono::duration<double, std::nano> sendTime(0);
+	unsigned sends = 0;
+	for(int ii = 0; ii < rounds; ii++) {
+		auto sendStart = std::chrono::steady_clock::now();
+		if (queue.front(reinterpret_cast<uint8_t *>(out))) {
+			queue.discard(false);
+			sendTime += std::chrono::steady_clock::now() - sendStart;
+			sends++;
+			const char *name = reinterpret_cast<const char *>(out) + sizeof(PublishQueueEventData);
+			for(const char *cp = name; *cp; cp++) timing.hash = timing.hash * 31 + *cp;
+			timing.hash = timing.hash * 31 + strlen(name + strlen(name) + 1);
+		}
+		push(false);
+	}
+	timing.sendNs = (sends) ? sendTime.count() / sends : 0;
+	return timing;
+}
+
+static void bench(uint16_t size) {
+	const int rounds = 20000;
+	srand(size);
+	std::vector<Event> events = makeEvents(997);
+	std::vector<uint32_t> ringBuf(size / 4), packedBuf(size / 4);
+	memset(ringBuf.data(), 0, size);
+
+	PublishQueueRing ring(reinterpret_cast<uint8_t *>(ringBuf.data()), size);
+	PackedQueue packed(reinterpret_cast<uint8_t *>(packedBuf.data()), size, ringBlocks(size));
+	Timing ringTiming = run(ring, events, rounds);
+	Timing packedTiming = run(packed, events, rounds);
+
+	printf("%6u bytes %4u events   ring: queue %6.0f ns  while sending %6.0f ns  send %6.0f ns   packed: queue %7.0f ns  while sending %7.0f ns  send %7.0f ns   %s\n",
+		size, ring.getNumEvents(), ringTiming.queueNs, ringTiming.queueSendingNs, ringTiming.sendNs,
+		packedTiming.queueNs, packedTiming.queueSendingNs, packedTiming.sendNs,
+		(ringTiming.hash == packedTiming.hash) ? "same events" : "DIFFERENT EVENTS");
+}
+
+// Bytes over the bus per event sent (getOldestEvent() then discardOldEvent()) from a full queue in FRAM
+template<class Queue> static double busPerSend(Queue &queue, const std::vector<Event> &events, int rounds) {
+	uint32_t out[(PublishQueueRing::EVENT_BUF_SIZE + 3) / 4];
+	size_t next = 0;
+	uint64_t sendBytes = 0;
+	for(int ii = 0; ii < rounds + 1000; ii++) {
+		if (ii >= 1000) {
+			uint64_t before = queue.busBytes;
+			queue.front(reinterpret_cast<uint8_t *>(out));
+			queue.discard(false);
+			sendBytes += queue.busBytes - before;
+		}
+		const Event &event = events[next++ % events.size()];
+		queue.push(event.name.c_str(), event.data.c_str(), 60, 1, false);
+	}
+	return (double)sendBytes / rounds;
+}
+
+static void busBench(uint16_t size) {
+	const int rounds = 2000;
+	srand(size);
+	std::vector<Event> events = makeEvents(997);
+	std::vector<uint32_t> packedBuf(size / 4);
+
+	CountingRing ring(size);
+	PackedQueue packed(reinterpret_cast<uint8_t *>(packedBuf.data()), size, ringBlocks(size));
+	double ringBytes = busPerSend(ring, events, rounds);
+	double packedBytes = busPerSend(packed, events, rounds);
+
+	// The bus runs at 100kHz, about 9 bits a byte
+	printf("%6u bytes %4u events   ring: %6.0f bytes %5.1f ms   moveData: %7.0f bytes %6.1f ms per event sent\n",
+		size, ring.getNumEvents(), ringBytes, ringBytes * 9 / 100, packedBytes, packedBytes * 9 / 100);
+}
+
+int main() {
+	bench(2048);
+	bench(4096);
+	bench(8192);
+	bench(16384);
+	bench(32768);
+	bench(65532);
+
+	printf("\nWith the queue in FRAM\n");
+	busBench(2048);
+	busBench(8192);
+	busBench(32764);
+	return 0;
+}
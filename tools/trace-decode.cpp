@@ -0,0 +1,146 @@
+// Host decoder for the trace dumped by the firmware's Trace function (src/TraceBuffer.h)
+//
+// Build and run from the top of the repository:
+//   g++ -O2 -Isrc tools/trace-decode.cpp src/TraceBuffer.cpp src/BulkDump.cpp -o trace-decode
+//   ./trace-decode serial.log
+//
+// The input is any text with the base64 trace in it - a serial log with "TRACE ..." lines, the
+// "Trace" event copied from the console, or the JSON from "particle subscribe Trace". With no file,
+// stdin is read. Each trace found is printed one record per line, with the wall clock time for the
+// records since the last boot (earlier ones only have the millis() of the boot they came from).
+
+#include "TraceBuffer.h"
+#include "TraceEvents.h"
+#include "BulkDump.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+// Same order as the State and ConnectionPolicy enums in the firmware
+static const char *stateNames[] = {"Initialize", "Error", "Idle", "Measuring", "Reporting", "Response Wait", "Connecting"};
+static const char *policyNames[] = {"Always On", "Per Report", "Scheduled Windows", "On Alert"};
+
+static uint32_t getLittle32(const uint8_t *buf) {
+	return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+static const char *stateName(unsigned state) {
+	return (state < sizeof(stateNames) / sizeof(stateNames[0])) ? stateNames[state] : "?";
+}
+
+static void describe(const TraceBuffer::Entry &entry, char *buf, size_t size) {
+	switch (entry.id) {
+	case TRACE_BOOT:
+		snprintf(buf, size, "reset reason %u, release %u", entry.a, entry.b);
+		break;
+	case TRACE_STATE:
+		snprintf(buf, size, "%s -> %s", stateName(entry.a), stateName(entry.b));
+		break;
+	case TRACE_WATCHDOG_PET:
+		snprintf(buf, size, "waited %u ms", entry.b);
+		break;
+	case TRACE_SAMPLE:
+		snprintf(buf, size, "%.1f C", (int16_t)entry.b / 10.0);
+		break;
+	case TRACE_REPORT:
+		snprintf(buf, size, "seq ..%u, signal %i%%", entry.b, (int8_t)entry.a);
+		break;
+	case TRACE_RESPONSE:
+		snprintf(buf, size, "status %u%s", entry.b, (entry.a) ? ", acked" : "");
+		break;
+	case TRACE_CONNECTED:
+		snprintf(buf, size, "%s", (entry.a < sizeof(policyNames) / sizeof(policyNames[0])) ? policyNames[entry.a] : "?");
+		break;
+	case TRACE_DISCONNECTED:
+		snprintf(buf, size, "%s", (entry.a) ? "requested" : "lost");
+		break;
+	case TRACE_STALL:
+		snprintf(buf, size, "%u sec in %s", entry.b, stateName(entry.a));
+		break;
+	case TRACE_DUMP:
+		snprintf(buf, size, "%s", (entry.a) ? "serial" : "publish");
+		break;
+	case TRACE_BULK_DUMP:
+		snprintf(buf, size, "%s, %u kB sent", BulkDump::sectionName(entry.a), entry.b);
+		break;
+	default:
+		snprintf(buf, size, "a %u, b %u", entry.a, entry.b);
+		break;
+	}
+}
+
+static void decode(const char *text) {
+	uint8_t packed[TraceBuffer::HEADER_SIZE + TraceBuffer::CAPACITY * TraceBuffer::RECORD_SIZE];
+	size_t len = TraceBuffer::base64Decode(text, packed, sizeof(packed));
+	if (len < TraceBuffer::HEADER_SIZE) return;
+
+	uint32_t written = getLittle32(&packed[0]);
+	uint32_t nowMillis = getLittle32(&packed[4]);
+	uint32_t nowTime = getLittle32(&packed[8]);
+	size_t count = (len - TraceBuffer::HEADER_SIZE) / TraceBuffer::RECORD_SIZE;
+
+	TraceBuffer::Entry entries[TraceBuffer::CAPACITY];
+	size_t lastBoot = count;
+	for (size_t ii = 0; ii < count; ii++) {
+		const uint8_t *p = &packed[TraceBuffer::HEADER_SIZE + ii * TraceBuffer::RECORD_SIZE];
+		entries[ii].millis = getLittle32(p);
+		entries[ii].id = p[4];
+		entries[ii].a = p[5];
+		entries[ii].b = (uint16_t)(p[6] | (p[7] << 8));
+		if (entries[ii].id == TRACE_BOOT) lastBoot = ii;
+	}
+	if (lastBoot == count) lastBoot = 0;						// The boot record was overwritten - all of them are from this boot
+
+	printf("Trace: %zu of %u records, dumped at millis %u", count, written, nowMillis);
+	if (nowTime) {
+		time_t t = nowTime;
+		char when[32];
+		strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", gmtime(&t));
+		printf(" (%s UTC)", when);
+	}
+	printf("\n");
+
+	for (size_t ii = 0; ii < count; ii++) {
+		const TraceBuffer::Entry &entry = entries[ii];
+		char when[32] = "before reset";
+		if (ii >= lastBoot && nowTime) {
+			time_t t = nowTime - (time_t)((nowMillis - entry.millis) / 1000);
+			strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", gmtime(&t));
+		}
+		char text[64];
+		describe(entry, text, sizeof(text));
+		printf("%-20s %10u ms  %-13s %s\n", when, entry.millis, (entry.id < TRACE_EVENT_COUNT) ? traceEventNames[entry.id] : "?", text);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	FILE *fp = stdin;
+	if (argc > 1) {
+		fp = fopen(argv[1], "r");
+		if (!fp) {
+			perror(argv[1]);
+			return 1;
+		}
+	}
+
+	// The trace is the first long run of base64 on a line - the header alone is 16 characters
+	static char line[4096];
+	int found = 0;
+	while (fgets(line, sizeof(line), fp)) {
+		for (char *p = line; *p; ) {
+			size_t run = 0;
+			while (p[run] && (isalnum((unsigned char)p[run]) || p[run] == '+' || p[run] == '/' || p[run] == '=')) run++;
+			if (run >= 16) {
+				decode(p);
+				found++;
+				break;
+			}
+			p += (run) ? run : 1;
+		}
+	}
+	if (fp != stdin) fclose(fp);
+	if (!found) fprintf(stderr, "No trace found\n");
+	return (found) ? 0 : 1;
+}